@@ -0,0 +1,25 @@
+#include "arena.h"
+#include <cstring>
+
+using namespace std;
+
+// The current block is full: start a new one big enough for the request
+void* Arena::refill(size_t bytes, size_t align) {
+    size_t size = nextBlock;
+    while (size < bytes + align)
+        size *= 2;
+    if (nextBlock < ARENA_MAX_BLOCK)
+        nextBlock *= 2;
+
+    blocks.emplace_back(new char[size]);
+    next = blocks.back().get();
+    end = next + size;
+    return allocate(bytes, align);
+}
+
+string_view Arena::copy(string_view s) {
+    char* p = (char*)allocate(s.size(), 1);
+    if (!s.empty())
+        memcpy(p, s.data(), s.size());
+    return string_view(p, s.size());
+}
@@ -0,0 +1,56 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/* ================= Bump Arena ================= */
+/*
+   Hands out memory by bumping a pointer through large blocks and frees
+   it all at once when destroyed. Blocks double in size up to
+   ARENA_MAX_BLOCK, so a small arena stays small and a big one costs one
+   heap allocation per megabyte. Objects
+   placed here are never destroyed: only trivially destructible data
+   (text, plain structs) belongs in an arena.
+*/
+constexpr size_t ARENA_FIRST_BLOCK = 4096;
+constexpr size_t ARENA_MAX_BLOCK = 1 << 20;
+
+class Arena {
+private:
+    vector<unique_ptr<char[]>> blocks;
+    char* next = nullptr;
+    char* end = nullptr;
+    size_t nextBlock = ARENA_FIRST_BLOCK;
+    size_t used = 0;
+
+    void* refill(size_t bytes, size_t align);
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(max_align_t)) {
+        size_t pad = (size_t)-(uintptr_t)next & (align - 1);
+        if (bytes + pad > (size_t)(end - next))
+            return refill(bytes, align);
+        char* p = next + pad;
+        next = p + bytes;
+        used += bytes;
+        return p;
+    }
+
+    // A copy of s that lives as long as the arena
+    string_view copy(string_view s);
+
+    size_t bytesUsed() const { return used; }
+    size_t blockCount() const { return blocks.size(); }
+};
+
+#endif
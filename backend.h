@@ -3,47 +3,131 @@
 
 #include <string>
 #include <vector>
-#include <map>
 #include <cstdint>  
 #include "common.h"
+#include "keywords.h"
+#include "emulator.h"
 
 using namespace std;
 
 /* ================= Operand Typing ================= */
 
-enum OperandType {
-    REG,
-    MEM,
-    IMM,
-    NONE
-};
-
-struct TypedOperand {
-    OperandType type;
-    int value;      // register id | memory address | immediate value
-};
+// OperandType and TypedOperand are shared with the front end (common.h)
 
 struct TypedInstruction {
-    string opcode;
+    Opcode opcode;
     TypedOperand dst;
     TypedOperand src;
+    uint32_t source = NO_SOURCE;    // from IC; rewrites keep the offset of what they replace
 };
 
 /* ================= 8086 Register Encoding ================= */
-/* static prevents multiple-definition linker errors */
-static map<string, int> registerCode = {
-    {"AX", 0}, {"CX", 1}, {"DX", 2}, {"BX", 3},
-    {"SP", 4}, {"BP", 5}, {"SI", 6}, {"DI", 7}
-};
+/* REG operands hold a RegisterId; REG_AX..REG_DI are the 8086 codes 0-7 */
 
 /* ================= Backend API ================= */
 
-extern vector<TypedInstruction> typedInstructions;
-void generateTypedInstructions(const vector<IC>& resolvedIC);
+TypedInstruction typeInstruction(const IC& resolved, const SymbolInterner& names);
+void generateTypedInstructions(const vector<IC>& resolvedIC, const SymbolInterner& names,
+                               vector<TypedInstruction>& out);
 void validateInstructions(const vector<TypedInstruction>& instructions);
-extern vector<uint8_t> machineCode;
-void generateMachineCode(const vector<TypedInstruction>& instructions);
-void runEmulator(const vector<uint8_t>& machineCode);
+
+/* Optional stage between validation and code generation (-O1) */
+struct PeepholeRuleStats {
+    const char* name;
+    int hits;
+};
+
+struct PeepholeStats {
+    vector<PeepholeRuleStats> rules;
+    int bytesSaved = 0;
+};
+
+PeepholeStats optimizePeephole(vector<TypedInstruction>& instructions);
+
+/*
+   -O2, ahead of the peephole optimizer: basic blocks, register and flag
+   liveness and constant propagation over the whole program. Results that
+   are known become MOV r, imm; instructions with no effect beyond dead
+   registers and flags are deleted. Memory is never tracked, so stores
+   always stay. At HLT the general registers are the program's result.
+   Does nothing when a branch target is not a label.
+*/
+struct DataflowStats {
+    int blocks = 0;
+    int folded = 0;         // rewritten as MOV r, imm
+    int removed = 0;        // instructions deleted
+    int bytesSaved = 0;     // net, before branch relaxation
+};
+
+DataflowStats optimizeDataflow(vector<TypedInstruction>& instructions);
+
+// What some path reads before overwriting it, by the same analysis
+struct LiveSet {
+    uint8_t regs;       // bit r: word register r (AX..DI)
+    uint16_t flags;     // FlagBit mask, arithmetic flags only
+};
+
+// after[i] holds once instruction i has run; false when a branch target is not a label
+bool liveAfter(const vector<TypedInstruction>& instructions, vector<LiveSet>& after);
+
+void generateMachineCode(const vector<TypedInstruction>& instructions, vector<uint8_t>& out);
+
+/*
+   generateMachineCode in steps, for callers that keep per-instruction
+   results between builds (incremental.h): size every instruction, relax
+   branches over the whole program (after an edit, relayoutCode revisits
+   only the branches around it), then encode each instruction at its
+   final address. Any split of the work produces the same bytes.
+*/
+enum BranchSize : uint8_t {
+    BR_SHORT,   // rel8
+    BR_NEAR,    // rel16 (JMP, CALL)
+    BR_LONG     // Jcc / LOOP out of rel8 range: hop over a JMP rel16
+};
+
+struct CodeLayout {
+    vector<int> length;             // bytes per instruction
+    vector<uint8_t> branchSize;     // BranchSize, meaningful for branches only
+    vector<int> offset;             // offset[i] = address of instruction i, offset[n] = code size
+};
+
+// Size of a non-branch instruction, -1 for a branch; throws if no form fits
+int instructionLength(const TypedInstruction& instr, size_t index);
+
+/*
+   Relax branches from their shortest encodings. False when a branch
+   that starts short targets a fixed address (JMP 100): code growing
+   before it can bring it back into reach, so the layout depends on the
+   order branches grow in rather than being the least one.
+*/
+bool layoutCode(const vector<TypedInstruction>& instructions, const vector<int>& fixedLength,
+                CodeLayout& layout);
+
+/*
+   The layout after an edit, from the least layout before it. layout
+   holds the old lengths and branch sizes, moved to the new instruction
+   indices; each changed range [first, second) holds instructions that
+   are new or have a new fixedLength (an empty range marks removed
+   ones), and their entries in layout are ignored. Gives the layout
+   layoutCode would, and its result, and appends to moved the branches
+   outside the changed ranges whose size or displacement may differ.
+   With a fixed-address branch it runs layoutCode, and every branch may
+   have moved.
+*/
+bool relayoutCode(const vector<TypedInstruction>& instructions, const vector<int>& fixedLength,
+                  const vector<pair<size_t, size_t>>& changed, CodeLayout& layout, vector<size_t>& moved);
+
+// Address a branch jumps to under layout
+int branchTarget(const vector<TypedInstruction>& instructions, const CodeLayout& layout, size_t i);
+
+void encodeInstruction(const vector<TypedInstruction>& instructions, const CodeLayout& layout,
+                       size_t i, vector<uint8_t>& out);
+/*
+   TIER_PROFILE also prints a hot-spot report and, given a path, writes it
+   as JSON; TIER_TRACE writes the execution trace to the path
+*/
+void runEmulator(const vector<uint8_t>& machineCode, ExecutionTier tier = TIER_INTERPRET,
+                 const string& outputPath = "");
 
 
 #endif
@@ -0,0 +1,36 @@
+#include "batch.h"
+#include "workpool.h"
+#include <exception>
+#include <memory>
+
+using namespace std;
+
+static void runOne(Machine& machine, const vector<uint8_t>& image, ExecutionTier tier,
+                   uint64_t limit, RunResult& result) {
+    try {
+        machine.load(image);
+        result = machine.run(tier, limit);
+    } catch (const exception& e) {
+        result.cpu = machine.cpu();
+        result.error = e.what();
+    }
+}
+
+/* ================================
+   BATCH ENTRY
+================================ */
+vector<RunResult> runBatch(const vector<vector<uint8_t>>& images, ExecutionTier tier,
+                           unsigned threads, uint64_t limit) {
+    vector<RunResult> results(images.size());
+    unsigned workers = poolSize(images.size(), threads);
+
+    // One Machine per worker, created on its first image
+    vector<unique_ptr<Machine>> machines(workers);
+    runPool(images.size(), workers, [&](unsigned w, size_t i) {
+        if (!machines[w])
+            machines[w].reset(new Machine());
+        runOne(*machines[w], images[i], tier, limit, results[i]);
+    });
+
+    return results;
+}
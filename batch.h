@@ -0,0 +1,24 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+#include <vector>
+#include "emulator.h"
+
+using namespace std;
+
+/* ================= Batch Execution ================= */
+/*
+   Runs many independent guest programs on the work-stealing pool
+   (workpool.h). Each worker reuses a single Machine.
+
+   results[i] is the final state of images[i]. A guest fault, or running
+   past limit instructions (0 = no limit, see Machine::run), is reported
+   in that result's error field and does not stop the rest of the batch.
+*/
+// threads = 0: one per hardware thread
+vector<RunResult> runBatch(const vector<vector<uint8_t>>& images,
+                           ExecutionTier tier = TIER_INTERPRET, unsigned threads = 0,
+                           uint64_t limit = 0);
+
+#endif
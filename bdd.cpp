@@ -0,0 +1,106 @@
+#include "bdd.h"
+#include "hash.h"
+#include <algorithm>
+
+using namespace std;
+
+constexpr uint32_t TERMINAL = UINT32_MAX;
+constexpr size_t ITE_CACHE_SIZE = 1 << 16;
+
+BddManager::BddManager(size_t nodeLimit) : nodeLimit(nodeLimit) {
+    clear();
+}
+
+void BddManager::clear() {
+    nodes.clear();
+    nodes.push_back({TERMINAL, BDD_FALSE, BDD_FALSE});
+    nodes.push_back({TERMINAL, BDD_TRUE, BDD_TRUE});
+    unique.assign(1024, 0);
+    cache.assign(ITE_CACHE_SIZE, {0, 0, 0, 0});
+    overflow = false;
+}
+
+static size_t nodeHash(uint32_t var, Bdd lo, Bdd hi) {
+    return (size_t)fmix64((uint64_t)var << 40 ^ (uint64_t)lo << 20 ^ hi);
+}
+
+void BddManager::growUnique() {
+    vector<uint32_t> old;
+    old.swap(unique);
+    unique.assign(old.size() * 2, 0);
+    size_t mask = unique.size() - 1;
+    for (uint32_t id : old) {
+        if (!id)
+            continue;
+        const Node& n = nodes[id];
+        size_t i = nodeHash(n.var, n.lo, n.hi) & mask;
+        while (unique[i])
+            i = (i + 1) & mask;
+        unique[i] = id;
+    }
+}
+
+Bdd BddManager::make(uint32_t var, Bdd lo, Bdd hi) {
+    if (lo == hi)
+        return lo;
+
+    size_t mask = unique.size() - 1;
+    size_t i = nodeHash(var, lo, hi) & mask;
+    for (; unique[i]; i = (i + 1) & mask) {
+        const Node& n = nodes[unique[i]];
+        if (n.var == var && n.lo == lo && n.hi == hi)
+            return unique[i];
+    }
+
+    if (nodes.size() >= nodeLimit) {
+        overflow = true;
+        return BDD_FALSE;
+    }
+    Bdd id = (Bdd)nodes.size();
+    nodes.push_back({var, lo, hi});
+    unique[i] = id;
+    if (nodes.size() * 2 > unique.size())
+        growUnique();
+    return id;
+}
+
+Bdd BddManager::variable(uint32_t var) {
+    return make(var, BDD_FALSE, BDD_TRUE);
+}
+
+bool BddManager::evaluate(Bdd f, const vector<bool>& values) const {
+    while (nodes[f].var != TERMINAL)
+        f = values[nodes[f].var] ? nodes[f].hi : nodes[f].lo;
+    return f == BDD_TRUE;
+}
+
+Bdd BddManager::ite(Bdd f, Bdd g, Bdd h) {
+    if (overflow)
+        return BDD_FALSE;
+    if (f == BDD_TRUE)
+        return g;
+    if (f == BDD_FALSE)
+        return h;
+    if (g == h)
+        return g;
+    if (g == BDD_TRUE && h == BDD_FALSE)
+        return f;
+
+    CacheEntry& slot = cache[(size_t)fmix64((uint64_t)f << 42 ^ (uint64_t)g << 21 ^ h) & (ITE_CACHE_SIZE - 1)];
+    if (slot.f == f && slot.g == g && slot.h == h && slot.result)
+        return slot.result - 1;
+
+    uint32_t top = min(nodes[f].var, min(nodes[g].var, nodes[h].var));
+    auto low = [&](Bdd x) { return nodes[x].var == top ? nodes[x].lo : x; };
+    auto high = [&](Bdd x) { return nodes[x].var == top ? nodes[x].hi : x; };
+
+    Bdd lo = ite(low(f), low(g), low(h));
+    Bdd hi = ite(high(f), high(g), high(h));
+    Bdd r = make(top, lo, hi);
+    if (overflow)
+        return BDD_FALSE;
+
+    // result + 1 so a zeroed entry never matches
+    slot = {f, g, h, r + 1};
+    return r;
+}
@@ -0,0 +1,70 @@
+#ifndef BDD_H
+#define BDD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+/* ================= Binary Decision Diagrams ================= */
+/*
+   Reduced ordered BDDs over numbered boolean variables, lower numbers
+   nearer the root. Nodes are hash-consed, so two functions are equal
+   exactly when their Bdd handles are. Used by the superoptimizer
+   (superopt.h) to prove instruction sequences equal for every input.
+
+   A manager is not thread-safe; give each thread its own. Past
+   nodeLimit nodes every operation returns BDD_FALSE and overflowed()
+   turns true until clear().
+*/
+typedef uint32_t Bdd;
+
+constexpr Bdd BDD_FALSE = 0;
+constexpr Bdd BDD_TRUE = 1;
+
+class BddManager {
+private:
+    struct Node {
+        uint32_t var;       // UINT32_MAX for the two constants
+        Bdd lo, hi;         // var = 0 / var = 1
+    };
+
+    struct CacheEntry {
+        Bdd f, g, h, result;
+    };
+
+    vector<Node> nodes;
+    vector<uint32_t> unique;        // open addressing over nodes; 0 is empty (BDD_FALSE is never stored)
+    vector<CacheEntry> cache;       // direct-mapped ite results
+    size_t nodeLimit;
+    bool overflow;
+
+    Bdd make(uint32_t var, Bdd lo, Bdd hi);
+    void growUnique();
+
+public:
+    explicit BddManager(size_t nodeLimit = 1 << 20);
+
+    BddManager(const BddManager&) = delete;
+    BddManager& operator=(const BddManager&) = delete;
+
+    // Drop every node; earlier handles are invalid afterwards
+    void clear();
+
+    Bdd variable(uint32_t var);
+    Bdd ite(Bdd f, Bdd g, Bdd h);   // if f then g else h
+
+    Bdd negate(Bdd f) { return ite(f, BDD_FALSE, BDD_TRUE); }
+    Bdd both(Bdd f, Bdd g) { return ite(f, g, BDD_FALSE); }
+    Bdd either(Bdd f, Bdd g) { return ite(f, BDD_TRUE, g); }
+    Bdd differ(Bdd f, Bdd g) { return ite(f, negate(g), g); }
+
+    // f with each variable v set to values[v]
+    bool evaluate(Bdd f, const vector<bool>& values) const;
+
+    bool overflowed() const { return overflow; }
+    size_t size() const { return nodes.size(); }
+};
+
+#endif
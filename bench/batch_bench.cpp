@@ -0,0 +1,93 @@
+/*
+   Batch execution scaling: the same set of short guest programs run by
+   runBatch() on 1, 2, ... N worker threads.
+
+   build: g++ -std=c++17 -O2 -pthread -I. bench/batch_bench.cpp batch.cpp workpool.cpp emulator.cpp decoder.cpp jit.cpp timing.cpp profile.cpp trace.cpp -o batch_bench
+   usage: batch_bench [programs] [max threads] [--jit]
+*/
+#include "batch.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+/*
+   A seeded mix of loop kernels, each a few hundred to a few thousand
+   instructions long, like the short test programs a CI job runs:
+
+       MOV CX, n / MOV AX, seed
+   top: ADD AX, CX / XOR BX, AX / MOV [slot], AX / LOOP top
+       HLT
+*/
+static vector<vector<uint8_t>> makePrograms(size_t count)
+{
+    mt19937 rng(12345);
+    vector<vector<uint8_t>> programs;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t n = 100 + rng() % 1900, seed = (uint16_t)rng(), slot = 0x100 + 2 * (rng() % 64);
+        programs.push_back({0xB9, (uint8_t)n, (uint8_t)(n >> 8),
+                            0xB8, (uint8_t)seed, (uint8_t)(seed >> 8),
+                            0x01, 0xC8,
+                            0x31, 0xC3,
+                            0x89, 0x06, (uint8_t)slot, (uint8_t)(slot >> 8),
+                            0xE2, 0xF6,
+                            0xF4});
+    }
+    return programs;
+}
+
+static bool sameResults(const vector<RunResult> &a, const vector<RunResult> &b)
+{
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].executed != b[i].executed || a[i].error != b[i].error ||
+            memcmp(a[i].cpu.regs, b[i].cpu.regs, sizeof(a[i].cpu.regs)) != 0 ||
+            a[i].cpu.flags != b[i].cpu.flags)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+    unsigned maxThreads = argc > 2 ? atoi(argv[2]) : thread::hardware_concurrency();
+    ExecutionTier tier = argc > 3 && strcmp(argv[3], "--jit") == 0 ? TIER_JIT : TIER_INTERPRET;
+    if (maxThreads == 0)
+        maxThreads = 1;
+
+    vector<vector<uint8_t>> programs = makePrograms(count);
+    printf("%zu programs, %s\n", count, tier == TIER_JIT ? "jit" : "interpreter");
+    printf("%8s %12s %12s %10s %8s\n", "threads", "seconds", "programs/s", "MIPS", "speedup");
+
+    vector<RunResult> baseline;
+    double single = 0;
+    for (unsigned t = 1; t <= maxThreads; t++)
+    {
+        auto t0 = chrono::steady_clock::now();
+        vector<RunResult> results = runBatch(programs, tier, t);
+        double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+        uint64_t executed = 0;
+        for (auto &r : results)
+            executed += r.executed;
+
+        if (t == 1)
+        {
+            baseline = move(results);
+            single = s;
+        }
+        else if (!sameResults(baseline, results))
+        {
+            printf("results with %u threads differ from the single-threaded run\n", t);
+            return 1;
+        }
+        printf("%8u %12.3f %12.0f %10.1f %8.2f\n", t, s, count / s, executed / s / 1e6, single / s);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+   Lexer throughput: line-based lexer() vs memory-mapped lexerMapped().
+
+   build: g++ -std=c++17 -O2 -I. bench/lexer_bench.cpp lexer.cpp source_map.cpp -o lexer_bench
+   usage: lexer_bench [megabytes] [repetitions]
+*/
+#include "common.h"
+#include "source_map.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static const char *benchFile = "lexer_bench.asm";
+
+/* Write a synthetic program of roughly the requested size */
+static size_t writeSource(size_t megabytes)
+{
+    static const char *lines[] = {
+        "    MOV AX, 1234          ; load constant\n",
+        "    add bx, ax\n",
+        "    MOV [COUNTER], CX\n",
+        "LOOP_TOP: DEC CX\n",
+        "    JNZ LOOP_TOP\n",
+        "VALUE_TABLE DB 17\n",
+        "    cmp si, di\n",
+        "    XOR DX, DX\n"};
+    const size_t numLines = sizeof(lines) / sizeof(lines[0]);
+
+    ofstream out(benchFile, ios::binary);
+    out << ".DATA\n.CODE\n";
+
+    size_t target = megabytes << 20, written = 0;
+    for (size_t i = 0; written < target; i++)
+    {
+        const char *line = lines[i % numLines];
+        out << line;
+        written += char_traits<char>::length(line);
+    }
+    return written;
+}
+
+template <typename F>
+static double bestSeconds(int reps, F run, size_t &tokenCount)
+{
+    double best = 1e30;
+    for (int r = 0; r < reps; r++)
+    {
+        auto t0 = chrono::steady_clock::now();
+        tokenCount = run();
+        auto t1 = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double>(t1 - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+    int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+    size_t bytes = writeSource(megabytes);
+    double mb = bytes / (1024.0 * 1024.0);
+
+    size_t classicTokens = 0, mappedTokens = 0;
+
+    double classic = bestSeconds(reps, []
+                                 { return lexer(benchFile).size(); }, classicTokens);
+
+    double mapped = bestSeconds(reps, []
+                                {
+                                    SourceMap source;
+                                    source.open(benchFile);
+                                    return lexerMapped(source).size(); }, mappedTokens);
+
+    printf("input: %.1f MB, best of %d\n", mb, reps);
+    printf("lexer()        %10zu tokens  %8.1f MB/s\n", classicTokens, mb / classic);
+    printf("lexerMapped()  %10zu tokens  %8.1f MB/s  (%.1fx)\n", mappedTokens, mb / mapped, classic / mapped);
+
+    remove(benchFile);
+
+    if (classicTokens != mappedTokens)
+    {
+        printf("token count mismatch\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,569 @@
+/*
+   Assembler pipeline throughput, stage by stage, on seeded synthetic
+   programs: Lexer, Parser (which lexes as it goes), SemanticAnalyzer::
+   resolveIC + backpatch, generateTypedInstructions, validateInstructions,
+   generateMachineCode and runEmulator.
+
+   build: g++ -std=c++17 -O2 -pthread -I. bench/pipeline_bench.cpp lexer.cpp parser.cpp semantic.cpp interner.cpp arena.cpp operand_typer.cpp instruction_validator.cpp peephole.cpp dataflow.cpp superopt.cpp bdd.cpp workpool.cpp codegen.cpp compilation.cpp cache.cpp hash.cpp source_map.cpp stats.cpp emulator.cpp decoder.cpp jit.cpp timing.cpp profile.cpp trace.cpp disasm.cpp -o pipeline_bench
+   usage: pipeline_bench [--lines=N,N,...] [--mix=data,branch,arith] [--seed=S]
+                         [--min-time=SECONDS] [--reps=N] [--label=NAME] [--out=results.json]
+          pipeline_bench --generate=LINES [--mix=M] [--seed=S] > program.asm
+          pipeline_bench --compare old.json new.json [--threshold=PERCENT]
+
+   Each benchmark repeats until it has run for --min-time (default 0.5 s)
+   and at least --reps times (default 5); it reports the median, the
+   fastest run and the median absolute deviation. --compare matches two
+   result files by (mix, lines, stage) and exits 1 if any stage slowed
+   down by more than both the threshold (default 10%) and three times
+   the noise of either run. Label runs with the commit they measure,
+   e.g. --label=$(git rev-parse --short HEAD).
+*/
+#include "compilation.h"
+#include "lexer.h"
+#include "parser.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* ================================
+   SOURCE GENERATOR
+   Every program halts when run: loops count CX down, other branches
+   only jump forward, stores go to 0E000H and up (variables share
+   address 0 with the code), and an outer loop on BP repeats the body
+   so the emulator has something to chew on.
+================================ */
+enum Mix
+{
+    MIX_DATA,   // variables, memory operands, big data section
+    MIX_BRANCH, // compares, forward branches, short loops
+    MIX_ARITH   // register and immediate ALU work
+};
+
+static const char *mixNames[] = {"data", "branch", "arith"};
+
+class SourceGenerator
+{
+private:
+    mt19937_64 rng;
+    Mix mix;
+    size_t variables;
+    size_t nextLabel = 0;
+    string out;
+    size_t lines = 0;
+
+    size_t pick(size_t n) { return (size_t)(rng() % n); }
+
+    const char *reg()
+    {
+        static const char *regs[] = {"AX", "BX", "DX", "SI", "DI"};
+        return regs[pick(5)];
+    }
+
+    string imm()
+    {
+        unsigned v = (unsigned)pick(pick(4) ? 256 : 65536);
+        if (pick(3) == 0)
+        {
+            char hex[16];
+            snprintf(hex, sizeof hex, "0%XH", v);
+            return hex;
+        }
+        return to_string(v);
+    }
+
+    string var() { return "V" + to_string(pick(variables)); }
+
+    string store() { return "[" + to_string(0xE000 + 2 * pick(2048)) + "]"; }
+
+    void line(const string &text)
+    {
+        // Some case and layout noise, as hand-written sources have
+        if (pick(8) == 0)
+        {
+            string lower = text;
+            for (char &c : lower)
+                c = (char)tolower((unsigned char)c);
+            out += "    " + lower;
+        }
+        else
+            out += "    " + text;
+        if (pick(10) == 0)
+            out += "    ; note";
+        out += '\n';
+        lines++;
+    }
+
+    void label(size_t id)
+    {
+        out += "L" + to_string(id) + ":\n";
+        lines++;
+    }
+
+    // One instruction with operands that touches neither CX nor BP
+    void operation()
+    {
+        static const char *alu[] = {"ADD", "SUB", "ADC", "SBB", "AND", "OR", "XOR", "CMP", "TEST", "MOV"};
+        size_t kind = pick(10);
+        switch (mix)
+        {
+        case MIX_DATA:
+            if (kind < 4)
+                line(string(alu[pick(10)]) + " " + reg() + ", " + var());
+            else if (kind < 7)
+                line("MOV " + store() + ", " + reg());
+            else if (kind < 8)
+                line("MOV " + string(reg()) + ", [" + to_string(0xE000 + 2 * pick(2048)) + "]");
+            else
+                line(string(alu[pick(10)]) + " " + reg() + ", " + imm());
+            break;
+
+        case MIX_BRANCH:
+            if (kind < 5)
+                line(string(alu[pick(10)]) + " " + reg() + ", " + imm());
+            else
+                line(string(pick(2) ? "INC " : "DEC ") + reg());
+            break;
+
+        case MIX_ARITH:
+            if (kind < 4)
+                line(string(alu[pick(10)]) + " " + reg() + ", " + reg());
+            else if (kind < 7)
+                line(string(alu[pick(10)]) + " " + reg() + ", " + imm());
+            else if (kind < 8)
+                line(string(pick(2) ? "SHL " : "SHR ") + reg() + ", 1");
+            else if (kind < 9)
+                line(string(pick(2) ? "NEG " : "NOT ") + reg());
+            else
+                line("MUL BX");
+            break;
+        }
+    }
+
+    void straight(size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+            operation();
+    }
+
+    // MOV CX, n / top: body / LOOP top
+    void loop()
+    {
+        size_t top = nextLabel++;
+        line("MOV CX, " + to_string(2 + pick(mix == MIX_BRANCH ? 8 : 4)));
+        label(top);
+        straight(2 + pick(6));
+        line("LOOP L" + to_string(top));
+    }
+
+    // CMP / Jcc over a few instructions
+    void forward()
+    {
+        static const char *jcc[] = {"JE", "JNE", "JL", "JGE", "JB", "JAE", "JS", "JNS", "JMP"};
+        size_t skip = nextLabel++;
+        line(string("CMP ") + reg() + ", " + imm());
+        line(string(jcc[pick(9)]) + " L" + to_string(skip));
+        straight(1 + pick(4));
+        label(skip);
+        operation();
+    }
+
+public:
+    SourceGenerator(Mix mix, uint64_t seed) : rng(seed), mix(mix), variables(1) {}
+
+    string generate(size_t target)
+    {
+        out.clear();
+        lines = 0;
+        nextLabel = 0;
+        out.reserve(target * 20);
+
+        variables = max<size_t>(1, target / (mix == MIX_DATA ? 4 : 40));
+        out += ".DATA\n";
+        for (size_t v = 0; v < variables; v++)
+            out += "V" + to_string(v) + (pick(4) ? " DW " : " DB ") + to_string(pick(256)) + "\n";
+        lines = variables + 1;
+
+        out += ".CODE\n    MOV BP, 20\nOUTER:\n";
+        lines += 3;
+        size_t body = target > lines + 4 ? target - lines - 4 : 0;
+        size_t end = lines + body;
+        while (lines < end)
+        {
+            size_t kind = pick(10);
+            if (mix == MIX_BRANCH ? kind < 3 : kind < 1)
+                loop();
+            else if (mix == MIX_BRANCH ? kind < 8 : kind < 3)
+                forward();
+            else
+                straight(1 + pick(6));
+        }
+        out += "    DEC BP\n    JNZ OUTER\n    HLT\nEND\n";
+        lines += 4;
+        return out;
+    }
+};
+
+/* ================================
+   MEASUREMENT
+================================ */
+struct Result
+{
+    string mix;
+    size_t lines = 0;
+    string stage;
+    string unit;
+    uint64_t items = 0; // per run
+    int reps = 0;
+    double medianMs = 0, minMs = 0, madMs = 0;
+
+    double throughput() const { return medianMs > 0 ? items / (medianMs / 1000.0) : 0; }
+};
+
+static double minTime = 0.5;
+static int minReps = 5;
+
+/*
+   prepare() runs untimed before every repetition; only run() is
+   measured. One untimed warm-up run first.
+*/
+template <typename Prepare, typename Run>
+static void measure(Result &r, Prepare prepare, Run run)
+{
+    prepare();
+    run();
+
+    vector<double> ms;
+    double total = 0;
+    while ((total < minTime || (int)ms.size() < minReps) && ms.size() < 100000)
+    {
+        prepare();
+        auto t0 = chrono::steady_clock::now();
+        run();
+        double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        ms.push_back(s * 1000.0);
+        total += s;
+    }
+
+    sort(ms.begin(), ms.end());
+    r.reps = (int)ms.size();
+    r.minMs = ms.front();
+    r.medianMs = ms[ms.size() / 2];
+    vector<double> dev;
+    for (double m : ms)
+        dev.push_back(fabs(m - r.medianMs));
+    sort(dev.begin(), dev.end());
+    r.madMs = dev[dev.size() / 2];
+}
+
+// Discards everything runEmulator prints
+class NullBuffer : public streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+};
+
+static void report(const Result &r)
+{
+    printf("  %-9s %8.3f ms  (min %8.3f, mad %5.1f%%, %6d reps)  %12.0f %s/s\n", r.stage.c_str(),
+           r.medianMs, r.minMs, r.medianMs > 0 ? 100.0 * r.madMs / r.medianMs : 0.0, r.reps,
+           r.throughput(), r.unit.c_str());
+}
+
+static void benchProgram(Mix mix, size_t lines, uint64_t seed, vector<Result> &results)
+{
+    string source = SourceGenerator(mix, seed).generate(lines);
+    printf("\n%s, %zu lines, %.1f MB\n", mixNames[mix], lines, source.size() / (1024.0 * 1024.0));
+
+    auto add = [&](const char *stage, const char *unit, uint64_t items) -> Result &
+    {
+        results.push_back(Result());
+        Result &r = results.back();
+        r.mix = mixNames[mix];
+        r.lines = lines;
+        r.stage = stage;
+        r.unit = unit;
+        r.items = items;
+        return r;
+    };
+
+    // Lexer: the buffer is upper-cased by the first pass; later passes rewrite the same bytes
+    string text = source;
+    uint64_t tokens = 0;
+    {
+        Lexer lex(&text[0], &text[0] + text.size());
+        while (lex.next().type != END_OF_FILE)
+            tokens++;
+    }
+    Result &lexing = add("lex", "tokens", tokens);
+    measure(lexing, [] {}, [&]
+            {
+                Lexer lex(&text[0], &text[0] + text.size());
+                while (lex.next().type != END_OF_FILE)
+                {
+                } });
+    report(lexing);
+
+    // Parser, which also lexes and resolves backward references as it goes
+    unique_ptr<Compilation> parsed;
+    Result &parsing = add("parse", "lines", lines);
+    measure(parsing, [&]
+            { parsed.reset(new Compilation()); }, [&]
+            {
+                Lexer lex(&text[0], &text[0] + text.size());
+                Parser parser(lex, *parsed);
+                parser.parseProgram(); });
+    report(parsing);
+
+    // resolveIC over every instruction, then backpatch, against the full symbol table
+    Compilation deferred;
+    deferred.sem.deferReferences();
+    {
+        Lexer lex(&text[0], &text[0] + text.size());
+        Parser parser(lex, deferred);
+        parser.parseProgram();
+    }
+    SemanticAnalyzer resolver(deferred.names);
+    for (const SymbolEntry &s : deferred.sem.symbols())
+    {
+        if (s.isLabel)
+            resolver.defineLabel(s.name, (size_t)s.address);
+        else
+            resolver.defineVariable(s.name, s.size);
+    }
+    vector<IC> ic;
+    Result &resolving = add("resolve", "instructions", deferred.intermediateCode.size());
+    measure(resolving, [&]
+            { ic = deferred.intermediateCode; }, [&]
+            {
+                for (size_t i = 0; i < ic.size(); i++)
+                    resolver.resolveIC(ic, i);
+                resolver.backpatch(ic); });
+    report(resolving);
+
+    vector<TypedInstruction> typed;
+    Result &typing = add("type", "instructions", ic.size());
+    measure(typing, [&]
+            { typed = vector<TypedInstruction>(); }, [&]
+            { generateTypedInstructions(ic, deferred.names, typed); });
+    report(typing);
+
+    Result &validating = add("validate", "instructions", typed.size());
+    measure(validating, [] {}, [&]
+            { validateInstructions(typed); });
+    report(validating);
+
+    vector<uint8_t> code;
+    generateMachineCode(typed, code);
+    Result &encoding = add("encode", "bytes", code.size());
+    measure(encoding, [&]
+            { code = vector<uint8_t>(); }, [&]
+            { generateMachineCode(typed, code); });
+    report(encoding);
+
+    // Guest memory is 64 KB with stores at 0E000H and up
+    if (code.size() >= 0xE000)
+    {
+        printf("  %-9s skipped: %zu bytes of code do not fit below the stores\n", "emulate", code.size());
+        return;
+    }
+    Machine machine;
+    machine.load(code);
+    uint64_t executed = machine.run().executed;
+
+    NullBuffer discard;
+    streambuf *console = cout.rdbuf(&discard);
+    Result &emulating = add("emulate", "instructions", executed);
+    measure(emulating, [] {}, [&]
+            { runEmulator(code); });
+    cout.rdbuf(console);
+    report(emulating);
+}
+
+/* ================================
+   RESULT FILES
+   One result per line so that --compare can read them back without a
+   JSON library (and so diffs between commits stay line by line).
+================================ */
+static void writeResults(const string &path, const string &label, uint64_t seed, const vector<Result> &results)
+{
+    ofstream out(path);
+    out << "{\n  \"label\": \"" << label << "\",\n  \"seed\": " << seed << ",\n  \"results\": [";
+    char line[512];
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result &r = results[i];
+        snprintf(line, sizeof line,
+                 "%s\n    {\"mix\": \"%s\", \"lines\": %zu, \"stage\": \"%s\", \"unit\": \"%s\", "
+                 "\"items\": %llu, \"reps\": %d, \"medianMs\": %.6f, \"minMs\": %.6f, \"madMs\": %.6f, "
+                 "\"throughput\": %.1f}",
+                 i ? "," : "", r.mix.c_str(), r.lines, r.stage.c_str(), r.unit.c_str(),
+                 (unsigned long long)r.items, r.reps, r.medianMs, r.minMs, r.madMs, r.throughput());
+        out << line;
+    }
+    out << "\n  ]\n}\n";
+    if (!out.flush())
+        printf("cannot write %s\n", path.c_str());
+}
+
+static string field(const string &line, const char *name)
+{
+    string key = string("\"") + name + "\": ";
+    size_t p = line.find(key);
+    if (p == string::npos)
+        return "";
+    p += key.size();
+    if (line[p] == '"')
+        return line.substr(p + 1, line.find('"', p + 1) - p - 1);
+    return line.substr(p, line.find_first_of(",}", p) - p);
+}
+
+static map<string, Result> readResults(const string &path)
+{
+    map<string, Result> results;
+    ifstream in(path);
+    if (!in)
+    {
+        printf("cannot read %s\n", path.c_str());
+        exit(2);
+    }
+    string line;
+    while (getline(in, line))
+    {
+        if (field(line, "stage").empty())
+            continue;
+        Result r;
+        r.mix = field(line, "mix");
+        r.lines = strtoull(field(line, "lines").c_str(), nullptr, 10);
+        r.stage = field(line, "stage");
+        r.unit = field(line, "unit");
+        r.medianMs = atof(field(line, "medianMs").c_str());
+        r.madMs = atof(field(line, "madMs").c_str());
+        results[r.mix + " " + to_string(r.lines) + " " + r.stage] = r;
+    }
+    return results;
+}
+
+static int compareResults(const string &oldPath, const string &newPath, double threshold)
+{
+    map<string, Result> before = readResults(oldPath), after = readResults(newPath);
+    int regressions = 0;
+    printf("%-28s %12s %12s %8s\n", "benchmark", "old ms", "new ms", "change");
+    for (auto &entry : after)
+    {
+        auto it = before.find(entry.first);
+        if (it == before.end())
+            continue;
+        const Result &o = it->second, &n = entry.second;
+        if (o.medianMs <= 0)
+            continue;
+        double change = 100.0 * (n.medianMs - o.medianMs) / o.medianMs;
+        double noise = 300.0 * max(o.madMs / o.medianMs, n.madMs / max(n.medianMs, 1e-9));
+        const char *verdict = "";
+        if (fabs(change) > threshold && fabs(change) > noise)
+            verdict = change > 0 ? "  slower" : "  faster";
+        if (change > 0 && *verdict)
+            regressions++;
+        printf("%-28s %12.3f %12.3f %+7.1f%%%s\n", entry.first.c_str(), o.medianMs, n.medianMs, change, verdict);
+    }
+    printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    return regressions ? 1 : 0;
+}
+
+/* ================================
+   MAIN
+================================ */
+static vector<string> split(const string &list)
+{
+    vector<string> parts;
+    stringstream in(list);
+    string part;
+    while (getline(in, part, ','))
+        parts.push_back(part);
+    return parts;
+}
+
+int main(int argc, char *argv[])
+{
+    vector<size_t> sizes = {1000, 10000, 100000, 1000000};
+    vector<Mix> mixes = {MIX_DATA, MIX_BRANCH, MIX_ARITH};
+    uint64_t seed = 12345;
+    string label = "unlabelled", outPath = "pipeline_bench.json";
+    size_t generate = 0;
+    double threshold = 10;
+    vector<string> compare;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        string value = arg.find('=') == string::npos ? "" : arg.substr(arg.find('=') + 1);
+        if (arg.compare(0, 8, "--lines=") == 0)
+        {
+            sizes.clear();
+            for (const string &s : split(value))
+                sizes.push_back(strtoull(s.c_str(), nullptr, 10));
+        }
+        else if (arg.compare(0, 6, "--mix=") == 0)
+        {
+            mixes.clear();
+            for (const string &s : split(value))
+                for (int m = 0; m < 3; m++)
+                    if (s == mixNames[m])
+                        mixes.push_back((Mix)m);
+        }
+        else if (arg.compare(0, 7, "--seed=") == 0)
+            seed = strtoull(value.c_str(), nullptr, 10);
+        else if (arg.compare(0, 11, "--min-time=") == 0)
+            minTime = atof(value.c_str());
+        else if (arg.compare(0, 7, "--reps=") == 0)
+            minReps = max(1, atoi(value.c_str()));
+        else if (arg.compare(0, 8, "--label=") == 0)
+            label = value;
+        else if (arg.compare(0, 6, "--out=") == 0)
+            outPath = value;
+        else if (arg.compare(0, 11, "--generate=") == 0)
+            generate = strtoull(value.c_str(), nullptr, 10);
+        else if (arg.compare(0, 12, "--threshold=") == 0)
+            threshold = atof(value.c_str());
+        else if (arg == "--compare" && i + 2 < argc)
+        {
+            compare = {argv[i + 1], argv[i + 2]};
+            i += 2;
+        }
+        else
+        {
+            printf("unknown argument %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    if (!compare.empty())
+        return compareResults(compare[0], compare[1], threshold);
+
+    if (generate)
+    {
+        fputs(SourceGenerator(mixes.empty() ? MIX_ARITH : mixes[0], seed).generate(generate).c_str(), stdout);
+        return 0;
+    }
+
+    vector<Result> results;
+    for (Mix mix : mixes)
+        for (size_t lines : sizes)
+            benchProgram(mix, lines, seed, results);
+
+    writeResults(outPath, label, seed, results);
+    printf("\nresults written to %s\n", outPath.c_str());
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+   Reset cost between short runs: reloading the image with load() vs
+   returning to a snapshot with restore(), which copies back only the
+   256-byte pages the run wrote.
+
+   build: g++ -std=c++17 -O2 -pthread -I. bench/snapshot_bench.cpp emulator.cpp decoder.cpp jit.cpp timing.cpp profile.cpp trace.cpp -o snapshot_bench
+   usage: snapshot_bench [runs]
+*/
+#include "emulator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+/* MOV AX, 1, then one word store into each of `pages` distinct pages, then HLT */
+static vector<uint8_t> makeProgram(int pages)
+{
+    vector<uint8_t> code = {0xB8, 0x01, 0x00};
+    for (int k = 0; k < pages; k++)
+    {
+        uint16_t addr = (uint16_t)((2 + k * (250 / pages)) << 8);
+        code.insert(code.end(), {0x89, 0x06, (uint8_t)addr, (uint8_t)(addr >> 8)});
+    }
+    code.push_back(0xF4);
+    return code;
+}
+
+template <typename F>
+static double secondsFor(size_t runs, F reset)
+{
+    auto t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < runs; i++)
+        reset();
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t runs = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    Machine machine;
+
+    printf("%6s %14s %14s %8s\n", "pages", "load ns/run", "restore ns/run", "ratio");
+    for (int pages : {1, 4, 16, 64})
+    {
+        vector<uint8_t> program = makeProgram(pages);
+
+        double loaded = secondsFor(runs, [&] {
+            machine.load(program);
+            machine.run();
+        });
+
+        machine.load(program);
+        machine.snapshot();
+        double restored = secondsFor(runs, [&] {
+            machine.restore();
+            machine.run();
+        });
+
+        printf("%6d %14.1f %14.1f %8.2f\n", pages, loaded / runs * 1e9, restored / runs * 1e9,
+               loaded / restored);
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+   Symbol table throughput at 10^6 symbols: SymbolInterner (open
+   addressing) and SemanticAnalyzer against the node-based containers
+   they replace.
+
+   build: g++ -std=c++17 -O2 -I. bench/symbol_bench.cpp interner.cpp arena.cpp hash.cpp semantic.cpp -o symbol_bench
+   usage: symbol_bench [symbols] [repetitions]
+*/
+#include "common.h"
+#include "semantic.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+template <typename F>
+static double bestSeconds(int reps, F run)
+{
+    double best = 1e30;
+    for (int r = 0; r < reps; r++)
+    {
+        auto t0 = chrono::steady_clock::now();
+        run();
+        auto t1 = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double>(t1 - t0).count());
+    }
+    return best;
+}
+
+static void report(const char *what, size_t n, double seconds)
+{
+    printf("  %-34s %8.1f ms  %7.1f M/s  %6.1f ns each\n", what, seconds * 1e3, n / seconds / 1e6,
+           seconds * 1e9 / n);
+}
+
+// What a data section generator emits: V0, V1, ... plus longer mixed-case-free names
+static vector<string> makeNames(size_t n, const char *prefix, mt19937_64 &rng)
+{
+    static const char *stems[] = {"COUNT", "TABLE", "BUFFER", "RESULT", "INDEX", "TMP"};
+    vector<string> names;
+    names.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (rng() % 4 == 0)
+            names.push_back(string(prefix) + stems[rng() % 6] + "_" + to_string(i));
+        else
+            names.push_back(string(prefix) + to_string(i));
+    }
+    return names;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+    mt19937_64 rng(12345);
+    vector<string> names = makeNames(n, "V", rng);
+    vector<string> missing = makeNames(n, "W", rng);
+    vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = i;
+    shuffle(order.begin(), order.end(), rng);
+
+    printf("%zu symbols, best of %d\n", n, reps);
+
+    /* Interning: the parser's only name lookup */
+    printf("\nSymbolInterner\n");
+    unique_ptr<SymbolInterner> interner;
+    double insert = bestSeconds(reps, [&]
+                                {
+                                    interner.reset(new SymbolInterner());
+                                    for (const string &s : names)
+                                        interner->intern(s); });
+    report("intern, new names", n, insert);
+
+    SymbolId check = 0;
+    double hit = bestSeconds(reps, [&]
+                             {
+                                 for (size_t i : order)
+                                     check ^= interner->intern(names[i]); });
+    report("intern, existing (random order)", n, hit);
+
+    size_t found = 0;
+    double miss = bestSeconds(reps, [&]
+                              {
+                                  for (const string &s : missing)
+                                      found += interner->find(s) != NO_SYMBOL; });
+    report("find, absent", n, miss);
+
+    unordered_map<string, SymbolId> hashed;
+    double hashedInsert = bestSeconds(reps, [&]
+                                      {
+                                          hashed = unordered_map<string, SymbolId>();
+                                          for (const string &s : names)
+                                              hashed.emplace(s, (SymbolId)hashed.size()); });
+    report("unordered_map<string>, insert", n, hashedInsert);
+
+    double hashedHit = bestSeconds(reps, [&]
+                                   {
+                                       for (size_t i : order)
+                                           check ^= hashed.find(names[i])->second; });
+    report("unordered_map<string>, lookup", n, hashedHit);
+
+    /* Definitions and resolution by SymbolId */
+    printf("\nSemanticAnalyzer\n");
+    vector<IC> code(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        code[i].opcode = (Opcode)0;
+        code[i].op1.type = REG;
+        code[i].op2.type = SYM;
+        code[i].op2.value = (int)interner->find(names[order[i]]);
+    }
+
+    unique_ptr<SemanticAnalyzer> sem;
+    double define = bestSeconds(reps, [&]
+                                {
+                                    sem.reset(new SemanticAnalyzer(*interner));
+                                    for (SymbolId id = 0; id < n; id++)
+                                        sem->defineVariable(id, 2); });
+    report("defineVariable", n, define);
+
+    vector<IC> work;
+    double resolve = 1e30;
+    for (int r = 0; r < reps; r++)
+    {
+        work = code;
+        resolve = min(resolve, bestSeconds(1, [&]
+                                           {
+                                               for (size_t i = 0; i < work.size(); i++)
+                                                   sem->resolveIC(work, i); }));
+    }
+    report("resolveIC (random symbols)", n, resolve);
+    for (const IC &ic : work)
+    {
+        if (ic.op2.type != MEM)
+        {
+            printf("unresolved operand\n");
+            return 1;
+        }
+    }
+
+    // The original table: map<string, Symbol>, tested with count() and then fetched with operator[]
+    struct Symbol
+    {
+        bool isLabel;
+        int address;
+        int size;
+    };
+    map<string, Symbol> ordered;
+    double orderedDefine = bestSeconds(reps, [&]
+                                       {
+                                           ordered.clear();
+                                           int offset = 0;
+                                           for (const string &s : names)
+                                           {
+                                               ordered[s] = {false, offset, 2};
+                                               offset += 2;
+                                           } });
+    report("map<string, Symbol>, define", n, orderedDefine);
+
+    double orderedResolve = bestSeconds(reps, [&]
+                                        {
+                                            for (size_t i : order)
+                                            {
+                                                const string &s = names[i];
+                                                if (ordered.count(s))
+                                                    check ^= (SymbolId)ordered[s].address;
+                                            } });
+    report("map<string, Symbol>, resolve", n, orderedResolve);
+
+    printf("\n(checksum %u, %zu false hits)\n", check, found);
+    return found ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+#include "cache.h"
+#include "hash.h"
+#include "source_map.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+/* ================================
+   ENTRY FORMAT
+   CacheHeader, then symbolCount CacheSymbol records, the machine
+   code, and the symbol names back to back. checksum covers
+   everything after the header.
+================================ */
+static const char CACHE_MAGIC[4] = {'T', '8', '6', 'C'};
+constexpr uint32_t CACHE_FORMAT = 1;
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t format;
+    uint64_t keyHi, keyLo;
+    uint32_t codeSize;
+    uint32_t symbolCount;
+    uint32_t namesSize;
+    uint32_t reserved;
+    uint64_t checksum;
+};
+
+struct CacheSymbol {
+    uint32_t nameOffset;        // into the names blob
+    uint32_t nameLength;
+    int32_t address;
+    int32_t size;
+    uint32_t isLabel;
+};
+
+string CacheKey::hex() const {
+    static const char digits[] = "0123456789abcdef";
+    string s(32, '0');
+    for (int i = 0; i < 16; i++) {
+        s[15 - i] = digits[(hi >> (4 * i)) & 15];
+        s[31 - i] = digits[(lo >> (4 * i)) & 15];
+    }
+    return s;
+}
+
+CacheKey cacheKey(const char* text, size_t length, const CompileOptions& options) {
+    // Only the optimization level and superoptimizer goal change the emitted code
+    uint64_t seed = (uint64_t)ASSEMBLER_VERSION << 32 | (uint32_t)options.superopt << 8 | (uint32_t)options.optLevel;
+    Hash128 h = hash128(text, length, fmix64(seed));
+    return {h.hi, h.lo};
+}
+
+/* ================================
+   CACHE
+================================ */
+AssemblyCache::AssemblyCache(const string& dir, uint64_t maxBytes)
+    : dir(dir), maxBytes(maxBytes), stores(0) {
+    // Temporary names must not collide with other processes writing the same entry
+    random_device rd;
+    tempSerial = (uint64_t)rd() << 32 | rd();
+
+    error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir, ec))
+        throw runtime_error("Cannot create cache directory " + dir);
+}
+
+string AssemblyCache::entryPath(const CacheKey& key) const {
+    return (fs::path(dir) / (key.hex() + ".t86c")).string();
+}
+
+bool AssemblyCache::load(const CacheKey& key, Compilation& unit) {
+    string path = entryPath(key);
+    SourceMap entry;
+    if (!entry.open(path) || entry.size() < sizeof(CacheHeader))
+        return false;
+
+    CacheHeader h;
+    memcpy(&h, entry.data(), sizeof(h));
+    if (memcmp(h.magic, CACHE_MAGIC, 4) != 0 || h.format != CACHE_FORMAT ||
+        h.keyHi != key.hi || h.keyLo != key.lo)
+        return false;
+
+    uint64_t payload = (uint64_t)h.symbolCount * sizeof(CacheSymbol) + h.codeSize + h.namesSize;
+    if (entry.size() != sizeof(CacheHeader) + payload)
+        return false;
+    const char* body = entry.data() + sizeof(CacheHeader);
+    if (hash128(body, payload, 0).lo != h.checksum)
+        return false;
+
+    const char* code = body + (size_t)h.symbolCount * sizeof(CacheSymbol);
+    const char* names = code + h.codeSize;
+
+    // Check every symbol before touching unit, so a bad entry leaves it clean
+    vector<CacheSymbol> symbols(h.symbolCount);
+    if (h.symbolCount)
+        memcpy(symbols.data(), body, symbols.size() * sizeof(CacheSymbol));
+    int dataOffset = 0;
+    for (const CacheSymbol& s : symbols) {
+        if ((uint64_t)s.nameOffset + s.nameLength > h.namesSize)
+            return false;
+        if (!s.isLabel) {
+            if (s.address != dataOffset)
+                return false;
+            dataOffset += s.size;
+        }
+    }
+
+    // The analyzer rebuilds the table exactly by replaying the definitions
+    for (const CacheSymbol& s : symbols) {
+        SymbolId name = unit.names.intern(string_view(names + s.nameOffset, s.nameLength));
+        if (s.isLabel)
+            unit.sem.defineLabel(name, (size_t)s.address);
+        else
+            unit.sem.defineVariable(name, s.size);
+    }
+    unit.machineCode.assign((const uint8_t*)code, (const uint8_t*)code + h.codeSize);
+
+    // Most recently used: eviction goes by modification time
+    error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+void AssemblyCache::store(const CacheKey& key, const Compilation& unit) {
+    const vector<SymbolEntry>& table = unit.sem.symbols();
+
+    vector<CacheSymbol> symbols;
+    string names;
+    symbols.reserve(table.size());
+    for (const SymbolEntry& e : table) {
+        string_view name = unit.names.name(e.name);
+        CacheSymbol s = {};
+        s.nameOffset = (uint32_t)names.size();
+        s.nameLength = (uint32_t)name.size();
+        s.isLabel = e.isLabel;
+        s.address = e.address;
+        s.size = e.size;
+        symbols.push_back(s);
+        names += name;
+    }
+
+    string body;
+    body.append((const char*)symbols.data(), symbols.size() * sizeof(CacheSymbol));
+    body.append((const char*)unit.machineCode.data(), unit.machineCode.size());
+    body += names;
+
+    CacheHeader h = {};
+    memcpy(h.magic, CACHE_MAGIC, 4);
+    h.format = CACHE_FORMAT;
+    h.keyHi = key.hi;
+    h.keyLo = key.lo;
+    h.codeSize = (uint32_t)unit.machineCode.size();
+    h.symbolCount = (uint32_t)symbols.size();
+    h.namesSize = (uint32_t)names.size();
+    h.checksum = hash128(body.data(), body.size(), 0).lo;
+
+    // Unique per process and thread; the rename publishes the finished entry
+    string path = entryPath(key);
+    string temp = path + "." + to_string(tempSerial++) + ".tmp";
+    {
+        ofstream out(temp, ios::binary);
+        out.write((const char*)&h, sizeof(h));
+        out.write(body.data(), body.size());
+        if (!out.flush()) {
+            out.close();
+            error_code ec;
+            fs::remove(temp, ec);
+            return;
+        }
+    }
+    error_code ec;
+    fs::rename(temp, path, ec);
+    if (ec)
+        fs::remove(temp, ec);   // e.g. the entry is mapped elsewhere (Windows); it holds the same data
+
+    if (stores++ % CACHE_EVICT_INTERVAL == 0)
+        evict();
+}
+
+void AssemblyCache::evict() {
+    struct Entry {
+        fs::file_time_type used;
+        uint64_t bytes;
+        fs::path path;
+    };
+    vector<Entry> entries;
+    uint64_t total = 0;
+
+    // A temporary file this old belongs to a writer that died
+    auto staleBefore = fs::file_time_type::clock::now() - chrono::minutes(10);
+
+    error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        error_code fec;
+        if (!it->is_regular_file(fec))
+            continue;
+        fs::path p = it->path();
+        uint64_t bytes = it->file_size(fec);
+        if (fec)
+            continue;
+        fs::file_time_type used = it->last_write_time(fec);
+        if (fec)
+            continue;
+
+        if (p.extension() == ".tmp") {
+            if (used < staleBefore)
+                fs::remove(p, fec);
+            continue;
+        }
+        if (p.extension() != ".t86c")
+            continue;
+        entries.push_back({used, bytes, p});
+        total += bytes;
+    }
+    if (total <= maxBytes)
+        return;
+
+    // Oldest first, down to 90% so the next few stores do not evict again
+    sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    uint64_t target = maxBytes / 10 * 9;
+    for (const Entry& e : entries) {
+        if (total <= target)
+            break;
+        // Another process may have evicted or refreshed it already; either is fine
+        error_code rec;
+        if (fs::remove(e.path, rec) || !rec)
+            total -= e.bytes;
+    }
+}
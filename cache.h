@@ -0,0 +1,71 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "compilation.h"
+
+using namespace std;
+
+/* ================= Assembly Cache ================= */
+/*
+   Content-addressed on-disk cache of finished assemblies. The key is a
+   128-bit hash of the source bytes, ASSEMBLER_VERSION and the options
+   that change the output; each entry is one file named by its key,
+   holding the machine code and the symbol table. A hit maps the entry
+   (SourceMap) and fills a Compilation without running any stage.
+
+   Several processes may share a directory. An entry is written to a
+   temporary file and renamed into place, so readers see a whole entry
+   or none; each entry also carries its full key and a checksum, and
+   anything that does not validate is a miss. A hit touches the entry's
+   modification time, and eviction removes the least recently used
+   entries once the directory grows past maxBytes. Eviction runs on the
+   first store of each process and every CACHE_EVICT_INTERVAL stores
+   after that, so the bound is exceeded by at most that many entries
+   per process in between.
+*/
+constexpr uint64_t CACHE_DEFAULT_BYTES = 256ull << 20;
+constexpr unsigned CACHE_EVICT_INTERVAL = 64;
+
+struct CacheKey {
+    uint64_t hi = 0, lo = 0;
+
+    string hex() const;
+};
+
+// Key for source [text, text + length) assembled with options; hash before lexing
+CacheKey cacheKey(const char* text, size_t length, const CompileOptions& options);
+
+class AssemblyCache {
+private:
+    string dir;
+    uint64_t maxBytes;
+    atomic<unsigned> stores;
+    atomic<uint64_t> tempSerial;
+
+    string entryPath(const CacheKey& key) const;
+
+public:
+    // Creates dir if needed; throws runtime_error if it cannot
+    explicit AssemblyCache(const string& dir, uint64_t maxBytes = CACHE_DEFAULT_BYTES);
+
+    AssemblyCache(const AssemblyCache&) = delete;
+    AssemblyCache& operator=(const AssemblyCache&) = delete;
+
+    /*
+       On a hit fill unit.machineCode and unit's symbol table (names and
+       SymbolEntry list, in definition order) and return true. The IC and
+       typed instruction lists stay empty.
+    */
+    bool load(const CacheKey& key, Compilation& unit);
+
+    // Record a finished compilation; failures only cost a future miss
+    void store(const CacheKey& key, const Compilation& unit);
+
+    // Delete least recently used entries until the cache fits in maxBytes
+    void evict();
+};
+
+#endif
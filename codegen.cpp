@@ -1,25 +1,22 @@
 #include "backend.h"
+#include "isa.h"
+#include <algorithm>
 #include <vector>
 #include <cstdint>
 #include <stdexcept>
 
 using namespace std;
 
-/* =========================================
-   Global Machine Code Buffer
-========================================= */
-vector<uint8_t> machineCode;
-
 /* =========================================
    Helper: emit byte / word
 ========================================= */
-static void emit8(uint8_t b) {
-    machineCode.push_back(b);
+static void emit8(vector<uint8_t>& out, uint8_t b) {
+    out.push_back(b);
 }
 
-static void emit16(uint16_t w) {
-    emit8(w & 0xFF);
-    emit8((w >> 8) & 0xFF);
+static void emit16(vector<uint8_t>& out, uint16_t w) {
+    emit8(out, w & 0xFF);
+    emit8(out, (w >> 8) & 0xFF);
 }
 
 /* =========================================
@@ -30,109 +27,594 @@ static uint8_t modRM(uint8_t mod, uint8_t reg, uint8_t rm) {
 }
 
 /* =========================================
-   MOV encoding
+   Operand classification
 ========================================= */
-static void encodeMOV(const TypedInstruction& i) {
-    auto dst = i.dst;
-    auto src = i.src;
-
-    // MOV reg, imm
-    if (dst.type == REG && src.type == IMM) {
-        emit8(0xB8 + dst.value);   // MOV r16, imm16
-        emit16(src.value);
-        return;
+static bool isReg8(const TypedOperand& o) {
+    return o.type == REG && o.value >= REG_AL && o.value <= REG_BH;
+}
+
+static bool isReg16(const TypedOperand& o) {
+    return o.type == REG && o.value <= REG_DI;
+}
+
+static bool isSreg(const TypedOperand& o) {
+    return o.type == REG && o.value >= REG_ES && o.value <= REG_DS;
+}
+
+// 3-bit register number; the RegisterId order makes this (id & 7)
+static uint8_t regNum(const TypedOperand& o) {
+    return o.value & 7;
+}
+
+/*
+   A register operand fixes the operand size, so memory then matches
+   either width; otherwise the symbol's declared size decides (word
+   when unknown).
+*/
+static bool matchOperand(OperandForm f, const TypedOperand& o, bool sizedByReg) {
+    switch (f) {
+    case F_NONE:  return o.type == NONE;
+    case F_R8:    return isReg8(o);
+    case F_R16:   return isReg16(o);
+    case F_RM8:   return isReg8(o) || (o.type == MEM && (sizedByReg || o.size == 1));
+    case F_RM16:  return isReg16(o) || (o.type == MEM && (sizedByReg || o.size != 1));
+    case F_M:     return o.type == MEM;
+    case F_AL:    return o.type == REG && o.value == REG_AL;
+    case F_AX:    return o.type == REG && o.value == REG_AX;
+    case F_CL:    return o.type == REG && o.value == REG_CL;
+    case F_DX:    return o.type == REG && o.value == REG_DX;
+    case F_SREG:  return isSreg(o);
+    case F_IMM8:  return o.type == IMM && o.value <= 0xFF;
+    case F_IMM16: return o.type == IMM;
+    case F_SIMM8: return o.type == IMM && (o.value <= 0x7F || o.value >= 0xFF80);
+    case F_ONE:   return o.type == IMM && o.value == 1;
+    case F_REL8:
+    case F_REL16: return o.type == IMM || o.type == LABEL;
     }
+    return false;
+}
 
-    // MOV reg, reg
-    if (dst.type == REG && src.type == REG) {
-        emit8(0x8B);               // MOV r16, r/m16
-        emit8(modRM(0b11, dst.value, src.value));
-        return;
+static int immSize(OperandForm f) {
+    switch (f) {
+    case F_IMM8:
+    case F_SIMM8: return 1;
+    case F_IMM16: return 2;
+    default:      return 0;
     }
+}
 
-    // MOV reg, mem
-    if (dst.type == REG && src.type == MEM) {
-        emit8(0x8B);               // MOV r16, r/m16
-        emit8(modRM(0b00, dst.value, 0b110));
-        emit16(src.value);
-        return;
+static bool hasModRM(Encoding e) {
+    return e == E_REG_RM || e == E_RM_REG || e == E_RM_EXT;
+}
+
+// Operand placed in the ModR/M r/m field
+static const TypedOperand& rmOperand(const InstrForm& form, const TypedInstruction& instr) {
+    return form.enc == E_REG_RM ? instr.src : instr.dst;
+}
+
+/* =========================================
+   Form selection
+========================================= */
+int formLength(const InstrForm& form, const TypedInstruction& instr) {
+    int len = 1;
+
+    if (form.enc == E_FIXED && form.ext != NO_EXT)
+        len++;
+
+    if (hasModRM(form.enc)) {
+        len++;
+        if (rmOperand(form, instr).type == MEM)
+            len += 2;
     }
 
-    // MOV mem, reg
-    if (dst.type == MEM && src.type == REG) {
-        emit8(0x89);               // MOV r/m16, r16
-        emit8(modRM(0b00, src.value, 0b110));
-        emit16(dst.value);
+    if (form.enc == E_REL)
+        return len + (form.dst == F_REL8 ? 1 : 2);
+
+    return len + immSize(form.dst) + immSize(form.src);
+}
+
+const InstrForm* selectForm(const TypedInstruction& instr, int address) {
+    FormRange r = formIndex.range[instr.opcode];
+
+    for (int i = r.first; i < r.first + r.count; i++) {
+        const InstrForm& form = instrForms[i];
+
+        if (!matchOperand(form.dst, instr.dst, instr.src.type == REG) ||
+            !matchOperand(form.src, instr.src, instr.dst.type == REG))
+            continue;
+
+        if (form.dst == F_REL8 && address >= 0 && instr.dst.type == IMM) {
+            int disp = instr.dst.value - (address + formLength(form, instr));
+            if (disp < -128 || disp > 127)
+                continue;
+        }
+
+        return &form;
+    }
+    return nullptr;
+}
+
+/* =========================================
+   Encoding
+========================================= */
+void encodeForm(const InstrForm& form, const TypedInstruction& instr, int address, vector<uint8_t>& out) {
+    const TypedOperand& dst = instr.dst;
+    const TypedOperand& src = instr.src;
+    uint8_t opcode = form.opcode;
+
+    if (form.enc == E_OPREG)
+        opcode += (form.src == F_R8 || form.src == F_R16) ? regNum(src) : regNum(dst);
+    else if (form.enc == E_SREG_OP)
+        opcode += regNum(dst) << 3;
+
+    emit8(out, opcode);
+
+    if (form.enc == E_FIXED && form.ext != NO_EXT)
+        emit8(out, form.ext);
+
+    if (hasModRM(form.enc)) {
+        uint8_t reg = form.enc == E_REG_RM ? regNum(dst)
+                    : form.enc == E_RM_REG ? regNum(src)
+                    : form.ext;
+        const TypedOperand& rm = rmOperand(form, instr);
+
+        if (rm.type == MEM) {
+            emit8(out, modRM(0b00, reg, 0b110));   // direct address
+            emit16(out, rm.value);
+        } else {
+            emit8(out, modRM(0b11, reg, regNum(rm)));
+        }
+    }
+
+    if (form.enc == E_REL) {
+        int disp = dst.value - (address + formLength(form, instr));
+        if (form.dst == F_REL8)
+            emit8(out, (uint8_t)disp);
+        else
+            emit16(out, (uint16_t)disp);
         return;
     }
 
-    throw runtime_error("Unsupported MOV encoding");
+    // At most one operand is an immediate
+    if (immSize(form.dst))
+        immSize(form.dst) == 1 ? emit8(out, dst.value) : emit16(out, dst.value);
+    if (immSize(form.src))
+        immSize(form.src) == 1 ? emit8(out, src.value) : emit16(out, src.value);
 }
 
 /* =========================================
-   ADD encoding
+   Branch relaxation
+   Every branch starts in its shortest encoding and
+   only ever grows, so growing one branch at a time,
+   whenever it is out of reach, converges. A growth
+   re-checks only the branches it can push out of
+   reach (see layoutCode).
 ========================================= */
-static void encodeADD(const TypedInstruction& i) {
-    auto dst = i.dst;
-    auto src = i.src;
-
-    // ADD reg, reg
-    if (dst.type == REG && src.type == REG) {
-        emit8(0x03);               // ADD r16, r/m16
-        emit8(modRM(0b11, dst.value, src.value));
-        return;
+static const InstrForm* branchForm(Opcode op, OperandForm rel) {
+    FormRange r = formIndex.range[op];
+    for (int i = r.first; i < r.first + r.count; i++)
+        if (instrForms[i].dst == rel)
+            return &instrForms[i];
+    return nullptr;
+}
+
+static bool isBranch(const TypedInstruction& instr) {
+    return (instr.dst.type == LABEL || instr.dst.type == IMM) &&
+           (branchForm(instr.opcode, F_REL8) || branchForm(instr.opcode, F_REL16));
+}
+
+// LOOP, LOOPE, LOOPNE and JCXZ have no inverted form
+static bool isLoopBranch(Opcode op) {
+    return op == OP_LOOP || op == OP_LOOPE || op == OP_LOOPNE || op == OP_JCXZ;
+}
+
+static int branchLength(Opcode op, BranchSize size) {
+    switch (size) {
+    case BR_SHORT: return 2;
+    case BR_NEAR:  return 3;
+    case BR_LONG:  return isLoopBranch(op) ? 7 : 5;
     }
+    return 0;
+}
+
+/*
+   BR_LONG rewrites:
+     Jcc target   ->  J!cc $+5 ; JMP NEAR target
+     LOOP target  ->  LOOP $+4 ; JMP SHORT $+5 ; JMP NEAR target
+*/
+static void encodeBranch(const TypedInstruction& instr, BranchSize size, int address, int target,
+                         vector<uint8_t>& out) {
+    TypedInstruction t = instr;
+    t.dst.type = IMM;
+    t.dst.value = target;
 
-    // ADD reg, mem
-    if (dst.type == REG && src.type == MEM) {
-        emit8(0x03);
-        emit8(modRM(0b00, dst.value, 0b110));
-        emit16(src.value);
+    if (size == BR_SHORT) {
+        encodeForm(*branchForm(instr.opcode, F_REL8), t, address, out);
         return;
     }
-
-    // ADD mem, reg
-    if (dst.type == MEM && src.type == REG) {
-        emit8(0x01);               // ADD r/m16, r16
-        emit8(modRM(0b00, src.value, 0b110));
-        emit16(dst.value);
+    if (size == BR_NEAR) {
+        encodeForm(*branchForm(instr.opcode, F_REL16), t, address, out);
         return;
     }
 
-    // ADD reg, imm
-    if (dst.type == REG && src.type == IMM) {
-        if (dst.value == 0) {
-            emit8(0x05);           // ADD AX, imm16
-            emit16(src.value);
-        } else {
-            emit8(0x81);           // ADD r/m16, imm16
-            emit8(modRM(0b11, 0b000, dst.value));
-            emit16(src.value);
-        }
-        return;
+    uint8_t shortOpcode = branchForm(instr.opcode, F_REL8)->opcode;
+    if (isLoopBranch(instr.opcode)) {
+        emit8(out, shortOpcode);
+        emit8(out, 0x02);
+        emit8(out, 0xEB);          // JMP SHORT past the near jump
+        emit8(out, 0x03);
+    } else {
+        emit8(out, shortOpcode ^ 1); // 70-7F: low bit inverts the condition
+        emit8(out, 0x03);
     }
 
-    throw runtime_error("Unsupported ADD encoding");
+    TypedInstruction jmp;
+    jmp.opcode = OP_JMP;
+    jmp.dst = t.dst;
+    int at = (int)out.size();
+    encodeForm(*branchForm(OP_JMP, F_REL16), jmp, at, out);
 }
 
 /* =========================================
-   Main code generator
+   Code layout
 ========================================= */
-void generateMachineCode(const vector<TypedInstruction>& instructions) {
-    machineCode.clear();
+int instructionLength(const TypedInstruction& instr, size_t index) {
+    if (isBranch(instr))
+        return -1;
+
+    const InstrForm* form = selectForm(instr);
+    if (!form) {
+        throw runtime_error("No encoding for " + string(opcodeName(instr.opcode)) +
+                            " (instruction " + to_string(index) + ")");
+    }
+    return formLength(*form, instr);
+}
+
+static int targetOf(const TypedInstruction& instr, const vector<int>& offset) {
+    return instr.dst.type == LABEL ? offset[instr.dst.value] : instr.dst.value;
+}
 
-    for (const auto& instr : instructions) {
-        if (instr.opcode == "MOV") {
-            encodeMOV(instr);
+int branchTarget(const vector<TypedInstruction>& instructions, const CodeLayout& layout, size_t i) {
+    return targetOf(instructions[i], layout.offset);
+}
+
+/*
+   Offsets while branches grow: a Fenwick tree over the lengths, so
+   growing an instruction and reading an address are both O(log n)
+*/
+class OffsetTree {
+public:
+    explicit OffsetTree(const vector<int>& length) : tree(length.size() + 1, 0) {
+        for (size_t i = 1; i < tree.size(); i++) {
+            tree[i] += length[i - 1];
+            size_t parent = i + (i & -i);
+            if (parent < tree.size())
+                tree[parent] += tree[i];
         }
-        else if (instr.opcode == "ADD") {
-            encodeADD(instr);
+    }
+
+    void add(size_t i, int delta) {
+        for (i++; i < tree.size(); i += i & -i)
+            tree[i] += delta;
+    }
+
+    // Address of instruction i: the lengths of [0, i)
+    int offset(size_t i) const {
+        int sum = 0;
+        for (; i > 0; i -= i & -i)
+            sum += tree[i];
+        return sum;
+    }
+
+private:
+    vector<int> tree;
+};
+
+/*
+   Every instruction is at least a byte, so a short branch to a label
+   spans at most this many instructions, and keeps that span in
+   instructions as others grow
+*/
+constexpr size_t SHORT_SPAN = 128;
+
+static BranchSize initialSize(Opcode op) {
+    return branchForm(op, F_REL8) ? BR_SHORT : BR_NEAR;
+}
+
+// Instructions [first, last) whose lengths add up to branch i's displacement
+static void spanOf(const TypedInstruction& instr, size_t i, size_t& first, size_t& last) {
+    size_t target = (size_t)instr.dst.value;
+    if (instr.dst.type != LABEL) {
+        first = 0;                  // a fixed address: everything up to the branch's end
+        last = i + 1;
+    } else if (i < target) {
+        first = i + 1;
+        last = target;
+    } else {
+        first = target;
+        last = i + 1;
+    }
+}
+
+/*
+   Grow each short branch in pending that is out of reach, then fill in
+   layout.offset. Every branch is checked once, then again each time an
+   instruction it spans grows: a short branch to a label whose span
+   covers the growth, or any short branch to a fixed address after it.
+   Each such re-check that leaves a branch short uses up at least a byte
+   of its 256-byte reach, so the work is linear in the branches, not in
+   the passes over the program it took to converge. branches lists every
+   branch in order; each branch grown is appended to grown, if given.
+*/
+static void relax(const vector<TypedInstruction>& instructions, const vector<size_t>& branches,
+                  vector<size_t>& pending, CodeLayout& layout, vector<size_t>* grown = nullptr) {
+    vector<int>& length = layout.length;
+    vector<uint8_t>& branchSize = layout.branchSize;
+    vector<size_t> absolute;        // branches to a fixed address, still short
+    for (size_t i : branches)
+        if (instructions[i].dst.type != LABEL && branchSize[i] == BR_SHORT)
+            absolute.push_back(i);
+
+    OffsetTree tree(length);
+    auto inReach = [&](size_t i) {
+        const TypedInstruction& instr = instructions[i];
+        int target = instr.dst.type == LABEL ? tree.offset(instr.dst.value) : instr.dst.value;
+        int disp = target - tree.offset(i + 1);
+        return disp >= -128 && disp <= 127;
+    };
+
+    while (!pending.empty()) {
+        size_t i = pending.back();
+        pending.pop_back();
+        if (branchSize[i] != BR_SHORT || inReach(i))
+            continue;
+
+        const TypedInstruction& instr = instructions[i];
+        branchSize[i] = branchForm(instr.opcode, F_REL16) ? BR_NEAR : BR_LONG;
+        int longer = branchLength(instr.opcode, (BranchSize)branchSize[i]);
+        tree.add(i, longer - length[i]);
+        length[i] = longer;
+        if (grown)
+            grown->push_back(i);
+
+        size_t from = i > SHORT_SPAN ? i - SHORT_SPAN : 0;
+        for (auto it = lower_bound(branches.begin(), branches.end(), from);
+             it != branches.end() && *it <= i + SHORT_SPAN; ++it) {
+            size_t k = *it, first, last;
+            if (branchSize[k] != BR_SHORT || instructions[k].dst.type != LABEL)
+                continue;
+            spanOf(instructions[k], k, first, last);
+            if (first <= i && i < last)
+                pending.push_back(k);
         }
-        else if (instr.opcode == "HLT") {
-            emit8(0xF4);           // HLT
+
+        if (instr.dst.type != LABEL)
+            absolute.erase(lower_bound(absolute.begin(), absolute.end(), i));
+        for (auto it = upper_bound(absolute.begin(), absolute.end(), i); it != absolute.end(); ++it)
+            pending.push_back(*it);
+    }
+
+    vector<int>& offset = layout.offset;
+    offset.assign(length.size() + 1, 0);
+    for (size_t i = 0; i < length.size(); i++)
+        offset[i + 1] = offset[i] + length[i];
+}
+
+bool layoutCode(const vector<TypedInstruction>& instructions, const vector<int>& fixedLength,
+                CodeLayout& layout) {
+    size_t n = instructions.size();
+    vector<int>& length = layout.length;
+    vector<uint8_t>& branchSize = layout.branchSize;
+    vector<size_t> branches;
+    bool fixedTargets = false;
+
+    // Fixed-size instructions keep their size; branches start short
+    length.assign(fixedLength.begin(), fixedLength.end());
+    branchSize.assign(n, BR_SHORT);
+    for (size_t i = 0; i < n; i++) {
+        if (length[i] >= 0)
+            continue;
+        const TypedInstruction& instr = instructions[i];
+        branchSize[i] = initialSize(instr.opcode);
+        length[i] = branchLength(instr.opcode, (BranchSize)branchSize[i]);
+        branches.push_back(i);
+        fixedTargets |= instr.dst.type != LABEL && branchSize[i] == BR_SHORT;
+    }
+
+    vector<size_t> pending(branches.rbegin(), branches.rend());
+    relax(instructions, branches, pending, layout);
+    return !fixedTargets;
+}
+
+/*
+   Spans of the branches that are not short, sorted by where they start,
+   with the furthest end below each node: finds one that meets a range
+   in O(log n), and each only once
+*/
+class LongSpans {
+public:
+    struct Span {
+        size_t first, last, branch;
+    };
+
+    explicit LongSpans(vector<Span> all) : spans(move(all)), leaves(1) {
+        sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) { return a.first < b.first; });
+        while (leaves < spans.size())
+            leaves *= 2;
+        end.assign(2 * leaves, 0);
+        for (size_t j = 0; j < spans.size(); j++)
+            end[leaves + j] = spans[j].last + 1;
+        for (size_t node = leaves - 1; node > 0; node--)
+            end[node] = max(end[2 * node], end[2 * node + 1]);
+    }
+
+    // A branch whose span meets [first, last], removed from the set; SIZE_MAX when none is left
+    size_t take(size_t first, size_t last) {
+        size_t limit = upper_bound(spans.begin(), spans.end(), last,
+                                   [](size_t at, const Span& s) { return at < s.first; }) - spans.begin();
+        size_t j = find(1, 0, leaves, limit, first);
+        if (j == SIZE_MAX)
+            return SIZE_MAX;
+        size_t node = leaves + j;
+        end[node] = 0;
+        for (node /= 2; node > 0; node /= 2)
+            end[node] = max(end[2 * node], end[2 * node + 1]);
+        return spans[j].branch;
+    }
+
+private:
+    vector<Span> spans;
+    size_t leaves;
+    vector<size_t> end;         // furthest span last + 1 below each node, 0 when none is left
+
+    // Leftmost leaf below node and before limit whose span reaches from
+    size_t find(size_t node, size_t lo, size_t hi, size_t limit, size_t from) const {
+        if (lo >= limit || end[node] <= from)
+            return SIZE_MAX;
+        if (hi - lo == 1)
+            return lo;
+        size_t mid = (lo + hi) / 2;
+        size_t j = find(2 * node, lo, mid, limit, from);
+        return j != SIZE_MAX ? j : find(2 * node + 1, mid, hi, limit, from);
+    }
+};
+
+bool relayoutCode(const vector<TypedInstruction>& instructions, const vector<int>& fixedLength,
+                  const vector<pair<size_t, size_t>>& changed, CodeLayout& layout, vector<size_t>& moved) {
+    size_t n = instructions.size();
+    vector<int>& length = layout.length;
+    vector<uint8_t>& branchSize = layout.branchSize;
+    vector<size_t> branches;
+    for (size_t i = 0; i < n; i++) {
+        if (fixedLength[i] < 0)
+            branches.push_back(i);
+    }
+    for (size_t k : branches) {
+        const TypedInstruction& instr = instructions[k];
+        if (instr.dst.type != LABEL && initialSize(instr.opcode) == BR_SHORT) {
+            moved.insert(moved.end(), branches.begin(), branches.end());
+            return layoutCode(instructions, fixedLength, layout);
+        }
+    }
+
+    // Changed instructions take their new sizes; their branches start short
+    vector<size_t> pending;
+    for (const auto& range : changed) {
+        for (size_t i = range.first; i < range.second; i++) {
+            if (fixedLength[i] >= 0) {
+                length[i] = fixedLength[i];
+                continue;
+            }
+            branchSize[i] = initialSize(instructions[i].opcode);
+            length[i] = branchLength(instructions[i].opcode, (BranchSize)branchSize[i]);
+            pending.push_back(i);
         }
-        else {
-            throw runtime_error("Unknown instruction: " + instr.opcode);
+    }
+
+    vector<LongSpans::Span> spans;
+    for (size_t k : branches) {
+        if (branchSize[k] == BR_SHORT)
+            continue;
+        LongSpans::Span span;
+        spanOf(instructions[k], k, span.first, span.last);
+        span.branch = k;
+        spans.push_back(span);
+    }
+    LongSpans longSpans(move(spans));
+
+    /*
+       A grown branch that spans a change may now fit in less. It starts
+       over from its initial size, and so, as that shrinks what they span,
+       do the grown branches spanning it. Each grown branch left alone
+       spans only what it spanned before, so it would grow again; the
+       relaxation from here reaches layoutCode's layout.
+    */
+    vector<pair<size_t, int>> reset;            // branch, length before
+    vector<pair<size_t, size_t>> dirty = changed;
+    while (!dirty.empty()) {
+        auto range = dirty.back();
+        dirty.pop_back();
+        for (size_t k; (k = longSpans.take(range.first, range.second)) != SIZE_MAX;) {
+            moved.push_back(k);
+            const TypedInstruction& instr = instructions[k];
+            if (branchSize[k] == initialSize(instr.opcode))
+                continue;               // CALL is never short; only its displacement changes
+            reset.push_back({k, length[k]});
+            branchSize[k] = initialSize(instr.opcode);
+            length[k] = branchLength(instr.opcode, (BranchSize)branchSize[k]);
+            pending.push_back(k);
+            dirty.push_back({k, k + 1});
         }
     }
+
+    // Short branches whose spans meet [first, last]
+    auto shortSpanning = [&](size_t first, size_t last, vector<size_t>& out) {
+        size_t from = first > SHORT_SPAN ? first - SHORT_SPAN : 0;
+        for (auto it = lower_bound(branches.begin(), branches.end(), from);
+             it != branches.end() && *it <= last + SHORT_SPAN; ++it) {
+            size_t k = *it, spanFirst, spanLast;
+            spanOf(instructions[k], k, spanFirst, spanLast);
+            if (branchSize[k] == BR_SHORT && spanFirst <= last && first <= spanLast)
+                out.push_back(k);
+        }
+    };
+    for (const auto& range : changed)
+        shortSpanning(range.first, range.second, pending);
+
+    vector<size_t> grown;
+    relax(instructions, branches, pending, layout, &grown);
+
+    // Every branch whose size or span's length changed is encoded again
+    sort(reset.begin(), reset.end());
+    vector<size_t> resized;
+    for (const auto& entry : reset) {
+        if (length[entry.first] != entry.second)
+            resized.push_back(entry.first);
+    }
+    for (size_t k : grown) {
+        auto it = lower_bound(reset.begin(), reset.end(), make_pair(k, 0));
+        if (it == reset.end() || it->first != k)
+            resized.push_back(k);
+    }
+    moved.insert(moved.end(), resized.begin(), resized.end());
+    vector<pair<size_t, size_t>> lengthened = changed;
+    for (size_t k : resized)
+        lengthened.push_back({k, k + 1});
+    for (const auto& range : lengthened) {
+        shortSpanning(range.first, range.second, moved);
+        for (size_t k; (k = longSpans.take(range.first, range.second)) != SIZE_MAX;)
+            moved.push_back(k);
+    }
+    return true;
+}
+
+void encodeInstruction(const vector<TypedInstruction>& instructions, const CodeLayout& layout,
+                       size_t i, vector<uint8_t>& out) {
+    const TypedInstruction& instr = instructions[i];
+    int address = layout.offset[i];
+
+    if (isBranch(instr)) {
+        encodeBranch(instr, (BranchSize)layout.branchSize[i], address, targetOf(instr, layout.offset), out);
+        return;
+    }
+    encodeForm(*selectForm(instr, address), instr, address, out);
+}
+
+/* =========================================
+   Main code generator
+========================================= */
+void generateMachineCode(const vector<TypedInstruction>& instructions, vector<uint8_t>& out) {
+    out.clear();
+
+    size_t n = instructions.size();
+    vector<int> fixedLength(n);
+    for (size_t i = 0; i < n; i++)
+        fixedLength[i] = instructionLength(instructions[i], i);
+
+    CodeLayout layout;
+    layoutCode(instructions, fixedLength, layout);
+
+    out.reserve(layout.offset[n]);
+    for (size_t i = 0; i < n; i++)
+        encodeInstruction(instructions, layout, i, out);
 }
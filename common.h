@@ -2,9 +2,16 @@
 #define COMMON_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
+#include "arena.h"
 using namespace std;
 
+enum Opcode : uint8_t; // keywords.h
+
+class SourceMap;
+
 enum TokenType
 {
     INSTRUCTION,
@@ -19,29 +26,102 @@ enum TokenType
 
 };
 
+// value points into the lexer's text (mapped file or lexeme pool),
+// it is not an owned copy
 struct Token
 {
     TokenType type;
-    string value;
+    string_view value;
+    uint8_t id = 0; // Opcode / RegisterId / DirectiveId for keyword tokens
 };
 
-struct Operand
+/* ================= Shared IR ================= */
+/*
+   Every stage after the lexer works on these types: opcodes are Opcode
+   IDs, registers are RegisterId values, symbols are interned SymbolId
+   handles, immediates and addresses are plain integers.
+*/
+
+typedef uint32_t SymbolId;
+
+enum OperandType
 {
-    string value;
+    REG,
+    MEM,
+    IMM,
+    NONE,
+    SYM,  // unresolved symbol reference, patched by the semantic analyzer
+    LABEL // code label: value = index of the instruction it precedes
 };
 
+struct TypedOperand
+{
+    OperandType type = NONE;
+    int value = 0;    // RegisterId | memory address | immediate value | SymbolId | instruction index
+    uint8_t size = 0; // MEM: declared width in bytes, 0 if unknown
+};
+
+// Where an instruction came from, unknown for code no source line wrote
+constexpr uint32_t NO_SOURCE = 0xFFFFFFFF;
+
+// What the parser read for one instruction; operands past the second are parsed and dropped
 struct Instruction
 {
-    string opcode;
-    vector<Operand> operands;
+    Opcode opcode;
+    TypedOperand operands[2];
+    int operandCount = 0;
+    uint32_t source = NO_SOURCE; // offset of the mnemonic in the text the parser read
 };
 
 struct IC
 {
-    string opcode;
-    string op1;
-    string op2;
+    Opcode opcode;
+    TypedOperand op1;
+    TypedOperand op2;
+    uint32_t source = NO_SOURCE;
 };
+
 vector<Token> lexer(const string &filename);
+vector<Token> lexerMapped(SourceMap &source);
+
+/*
+   Symbol name interning (interner.cpp). Each distinct name is stored
+   once; its SymbolId is the index into names. Every compilation owns
+   its own interner, so IDs are only meaningful within one compilation.
+
+   Lookup is open addressing with linear probing over a power-of-two
+   array of 16-byte slots, at most half full. A slot carries the name's
+   hash, length and first 7 bytes, so a probe settles most names (every
+   name up to 7 bytes) without leaving the slot array.
+*/
+constexpr SymbolId NO_SYMBOL = UINT32_MAX;
+
+class SymbolInterner
+{
+private:
+    struct Slot
+    {
+        uint32_t hash;   // the name's hash; its low bits pick the home slot
+        SymbolId id;     // NO_SYMBOL: empty
+        uint64_t key;    // first 7 bytes of the name, zero padded, and its length (capped) on top
+    };
+
+    Arena text;                // name storage, freed with the interner
+    vector<string_view> names; // by SymbolId, into text
+    vector<Slot> slots;
+
+    size_t probe(string_view name, uint32_t hash, uint64_t key) const; // slot holding name, or the empty slot for it
+    void grow();
+
+public:
+    SymbolInterner() = default;
+    SymbolInterner(const SymbolInterner &) = delete;
+    SymbolInterner &operator=(const SymbolInterner &) = delete;
+
+    SymbolId intern(string_view name);
+    SymbolId find(string_view name) const; // NO_SYMBOL if never interned
+    string_view name(SymbolId id) const { return names[id]; }
+    size_t count() const { return names.size(); }
+};
 
 #endif
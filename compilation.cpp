@@ -0,0 +1,279 @@
+#include "compilation.h"
+#include "cache.h"
+#include "disasm.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_map.h"
+#include "stats.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+/* ================================
+   Listing helpers
+================================ */
+static string formatOperand(const SymbolInterner& names, const TypedOperand& op) {
+    switch (op.type) {
+    case REG:
+        return registerName((RegisterId)op.value);
+    case MEM:
+        return "[" + to_string(op.value) + "]";
+    case IMM:
+        return to_string(op.value);
+    case SYM:
+        return string(names.name((SymbolId)op.value));
+    case LABEL:
+        return "@" + to_string(op.value);
+    case NONE:
+        break;
+    }
+    return "";
+}
+
+static void printIC(ostream& out, const SymbolInterner& names, const vector<IC>& code) {
+    for (auto& ic : code) {
+        out << "(" << opcodeName(ic.opcode) << ", "
+            << formatOperand(names, ic.op1) << ", "
+            << formatOperand(names, ic.op2) << ")\n";
+    }
+}
+
+// "MOV AX, 1; INC AX", or "(none)"
+static string formatSequence(const SymbolInterner& names, const vector<TypedInstruction>& code) {
+    string s;
+    for (auto& ti : code) {
+        if (!s.empty())
+            s += "; ";
+        s += opcodeName(ti.opcode);
+        if (ti.dst.type != NONE)
+            s += " " + formatOperand(names, ti.dst);
+        if (ti.src.type != NONE)
+            s += ", " + formatOperand(names, ti.src);
+    }
+    return s.empty() ? "(none)" : s;
+}
+
+static void printMachineCode(ostream& out, const vector<uint8_t>& code) {
+    out << "\nMACHINE CODE\n";
+    char hex[4];
+    for (auto b : code) {
+        snprintf(hex, sizeof(hex), "%02X ", b);
+        out << hex;
+    }
+    out << endl;
+}
+
+/* ================================
+   Pipeline
+================================ */
+void assemble(Compilation& unit, char* begin, char* end, const CompileOptions& options, ostream* log) {
+    StageRecorder* stats = options.stats;
+
+    // Lexing streams into the parser; timing it means a separate pass over a copy
+    if (STAGE_STATS_ENABLED && stats) {
+        string copy(begin, end);
+        StageTimer stage(stats, "lex", "tokens");
+        Lexer lex(&copy[0], &copy[0] + copy.size());
+        uint64_t tokens = 0;
+        while (lex.next().type != END_OF_FILE)
+            tokens++;
+        stage.count(tokens);
+    }
+
+    // One pass: tokens stream from the lexer straight into the parser
+    if (log)
+        *log << "Parsing started...\n";
+    {
+        StageTimer stage(stats, "parse", "instructions");
+        Lexer lex(begin, end);
+        Parser parser(lex, unit);
+        parser.parseProgram();
+        stage.count(unit.intermediateCode.size());
+    }
+
+    if (log) {
+        *log << "\nINTERMEDIATE CODE\n";
+        printIC(*log, unit.names, unit.intermediateCode);
+        unit.sem.printSymbolTable(*log);
+    }
+
+    {
+        StageTimer stage(stats, "resolve", "symbols");
+        unit.sem.backpatch(unit.intermediateCode);
+        stage.count(unit.sem.symbols().size());
+    }
+
+    if (log) {
+        *log << "\nRESOLVED INTERMEDIATE CODE\n";
+        printIC(*log, unit.names, unit.intermediateCode);
+    }
+
+    {
+        StageTimer stage(stats, "type", "instructions");
+        generateTypedInstructions(unit.intermediateCode, unit.names, unit.typedInstructions);
+        stage.count(unit.typedInstructions.size());
+    }
+
+    if (log) {
+        *log << "\nTYPED INSTRUCTIONS\n";
+        for (auto& ti : unit.typedInstructions) {
+            *log << opcodeName(ti.opcode)
+                 << " | dst(type=" << ti.dst.type << ", val=" << ti.dst.value << ")"
+                 << " | src(type=" << ti.src.type << ", val=" << ti.src.value << ")\n";
+        }
+    }
+
+    {
+        StageTimer stage(stats, "validate", "instructions");
+        validateInstructions(unit.typedInstructions);
+        stage.count(unit.typedInstructions.size());
+    }
+    if (log)
+        *log << "\nInstruction validation passed.\n";
+
+    if (options.optLevel >= 2) {
+        {
+            StageTimer stage(stats, "dataflow", "instructions");
+            unit.dataflow = optimizeDataflow(unit.typedInstructions);
+            stage.count(unit.typedInstructions.size());
+        }
+
+        if (log) {
+            *log << "\nDATAFLOW OPTIMIZER\n";
+            *log << "basic blocks: " << unit.dataflow.blocks << endl;
+            *log << "folded to constants: " << unit.dataflow.folded << endl;
+            *log << "instructions removed: " << unit.dataflow.removed << endl;
+            *log << "bytes saved: " << unit.dataflow.bytesSaved << endl;
+        }
+    }
+
+    if (options.superopt != SUPEROPT_OFF) {
+        {
+            StageTimer stage(stats, "superopt", "windows");
+            unit.superopt = superoptimize(unit.typedInstructions, options.superopt, options.superoptCache);
+            stage.count(unit.superopt.windows);
+        }
+
+        if (log) {
+            *log << "\nSUPEROPTIMIZER\n";
+            for (auto& r : unit.superopt.replacements)
+                *log << r.index << ": " << formatSequence(unit.names, r.from) << " -> " << formatSequence(unit.names, r.to) << "\n";
+            *log << "windows: " << unit.superopt.windows << " (" << unit.superopt.cacheHits << " cached)\n";
+            *log << "candidates tested: " << unit.superopt.candidates << endl;
+            *log << "proofs: " << unit.superopt.proofs << endl;
+            *log << "bytes saved: " << unit.superopt.bytesSaved << endl;
+            *log << "cycles saved: " << unit.superopt.cyclesSaved << endl;
+        }
+    }
+
+    if (options.optLevel >= 1) {
+        {
+            StageTimer stage(stats, "peephole", "instructions");
+            unit.peephole = optimizePeephole(unit.typedInstructions);
+            stage.count(unit.typedInstructions.size());
+        }
+
+        if (log) {
+            *log << "\nPEEPHOLE OPTIMIZER\n";
+            for (auto& rule : unit.peephole.rules)
+                *log << rule.name << ": " << rule.hits << " hits\n";
+            *log << "bytes saved: " << unit.peephole.bytesSaved << endl;
+        }
+    }
+
+    {
+        StageTimer stage(stats, "encode", "bytes");
+        generateMachineCode(unit.typedInstructions, unit.machineCode);
+        stage.count(unit.machineCode.size());
+    }
+
+    if (log)
+        printMachineCode(*log, unit.machineCode);
+}
+
+// Look up, or assemble and record, the source in [begin, end)
+static void assembleCached(Compilation& unit, char* begin, char* end, const CompileOptions& options,
+                           ostream* log) {
+    if (!options.cache) {
+        assemble(unit, begin, end, options, log);
+        return;
+    }
+
+    // The lexer rewrites the text, so the key must come first
+    CacheKey key;
+    bool hit;
+    {
+        StageTimer stage(options.stats, "cache", "bytes");
+        key = cacheKey(begin, end - begin, options);
+        hit = options.cache->load(key, unit);
+        stage.count(unit.machineCode.size());
+    }
+    if (hit) {
+        unit.cached = true;
+        if (log) {
+            *log << "Loaded from cache (" << key.hex() << ")\n";
+            unit.sem.printSymbolTable(*log);
+            printMachineCode(*log, unit.machineCode);
+        }
+        return;
+    }
+
+    assemble(unit, begin, end, options, log);
+    StageTimer stage(options.stats, "store", "bytes");
+    options.cache->store(key, unit);
+    stage.count(unit.machineCode.size());
+}
+
+void assembleFile(Compilation& unit, const string& filename, const CompileOptions& options, ostream* log) {
+    // Source text must outlive every token: tokens point into it
+    if (options.useMappedLexer) {
+        SourceMap source;
+        {
+            StageTimer stage(options.stats, "read", "bytes");
+            if (!source.open(filename))
+                throw runtime_error("Error opening file " + filename);
+            stage.count(source.size());
+        }
+        assembleCached(unit, source.data(), source.data() + source.size(), options, log);
+        return;
+    }
+
+    string text;
+    {
+        StageTimer stage(options.stats, "read", "bytes");
+        ifstream fin(filename, ios::binary | ios::ate);
+        if (!fin)
+            throw runtime_error("Error opening file " + filename);
+        // One allocation of the right size, rather than growing as it reads
+        text.resize((size_t)fin.tellg());
+        fin.seekg(0);
+        if (!fin.read(&text[0], text.size()))
+            throw runtime_error("Error reading file " + filename);
+        stage.count(text.size());
+    }
+    assembleCached(unit, &text[0], &text[0] + text.size(), options, log);
+}
+
+/* ================================
+   Listing
+================================ */
+void writeListing(ostream& out, const Compilation& unit, string_view source) {
+    const vector<TypedInstruction>& code = unit.typedInstructions;
+    size_t n = code.size();
+    vector<int> fixedLength(n);
+    for (size_t i = 0; i < n; i++)
+        fixedLength[i] = instructionLength(code[i], i);
+
+    // The same layout generateMachineCode used, so every address lands on an instruction
+    CodeLayout layout;
+    layoutCode(code, fixedLength, layout);
+
+    vector<CodeOrigin> origins;
+    origins.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        origins.push_back({(uint32_t)layout.offset[i], code[i].source});
+
+    writeListing(out, unit.machineCode.data(), unit.machineCode.size(), origins, source);
+}
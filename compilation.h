@@ -0,0 +1,79 @@
+#ifndef COMPILATION_H
+#define COMPILATION_H
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "common.h"
+#include "semantic.h"
+#include "backend.h"
+#include "superopt.h"
+
+using namespace std;
+
+class AssemblyCache;
+struct StageRecorder;
+
+/*
+   Part of every cache key (cache.h): bump it whenever a stage changes
+   the code or symbols it produces for the same source.
+*/
+constexpr uint32_t ASSEMBLER_VERSION = 1;
+
+/* ================= Compilation Context ================= */
+/*
+   Everything one assembly produces, stage by stage. Every stage works
+   only on the Compilation it is handed, so independent compilations can
+   run on separate threads.
+*/
+struct Compilation {
+    SymbolInterner names;
+    SemanticAnalyzer sem;                           // owns the symbol table
+    vector<IC> intermediateCode;                    // symbols resolved in place by sem.backpatch()
+    vector<TypedInstruction> typedInstructions;
+    DataflowStats dataflow;                         // -O2 only
+    SuperoptStats superopt;                         // --superopt only
+    PeepholeStats peephole;                         // -O1 and up
+    vector<uint8_t> machineCode;
+    bool cached = false;                            // loaded from the cache: only sem and machineCode are set
+
+    Compilation() : sem(names) {}
+
+    Compilation(const Compilation&) = delete;
+    Compilation& operator=(const Compilation&) = delete;
+};
+
+struct CompileOptions {
+    int optLevel = 0;               // 1: run the peephole optimizer, 2: dataflow first
+    SuperoptGoal superopt = SUPEROPT_OFF;       // after dataflow, before peephole
+    SuperoptCache* superoptCache = nullptr;     // window results; may be shared by threads
+    bool useMappedLexer = false;    // read sources through SourceMap
+    AssemblyCache* cache = nullptr; // look up and record whole files; may be shared by threads
+    StageRecorder* stats = nullptr; // per-stage costs (stats.h); one compilation at a time
+};
+
+/*
+   Run the whole pipeline over [begin, end), which the lexer upper-cases
+   in place. With a log, every stage's output is listed there as it
+   completes. Errors throw runtime_error.
+*/
+void assemble(Compilation& unit, char* begin, char* end, const CompileOptions& options,
+              ostream* log = nullptr);
+
+/*
+   Read filename (mapped or into memory, per options) and assemble it,
+   or load the result from options.cache when the source is unchanged
+*/
+void assembleFile(Compilation& unit, const string& filename, const CompileOptions& options,
+                  ostream* log = nullptr);
+
+/*
+   Source lines interleaved with the code each one assembled to
+   (disasm.h). source is the text unit was assembled from, before the
+   lexer upper-cased it. A unit loaded from the cache has no
+   instructions to trace back, so its code lists ahead of the source.
+*/
+void writeListing(ostream& out, const Compilation& unit, string_view source);
+
+#endif
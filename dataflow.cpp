@@ -0,0 +1,745 @@
+#include "backend.h"
+#include "isa.h"
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+/* =========================================
+   Register and flag units
+   One bit per 16-bit general register and per
+   arithmetic flag; AL..BH belong to their word.
+   Segment registers and memory are not tracked.
+========================================= */
+enum Unit : uint32_t {
+    U_AX = 1 << REG_AX, U_CX = 1 << REG_CX, U_DX = 1 << REG_DX, U_BX = 1 << REG_BX,
+    U_SP = 1 << REG_SP, U_BP = 1 << REG_BP, U_SI = 1 << REG_SI, U_DI = 1 << REG_DI,
+    U_REGS = 0xFF,
+
+    U_CF = 1 << 8,
+    U_PF = 1 << 9,
+    U_AF = 1 << 10,
+    U_ZF = 1 << 11,
+    U_SF = 1 << 12,
+    U_OF = 1 << 13,
+    U_FLAGS = 0x3F00,
+
+    U_ALL = U_REGS | U_FLAGS
+};
+
+static bool isReg16(const TypedOperand& o) {
+    return o.type == REG && o.value <= REG_DI;
+}
+
+static bool isReg8(const TypedOperand& o) {
+    return o.type == REG && o.value >= REG_AL && o.value <= REG_BH;
+}
+
+// Word register an operand lives in, 0 for anything else
+static uint32_t unitOf(const TypedOperand& o) {
+    if (isReg16(o))
+        return 1u << o.value;
+    if (isReg8(o))
+        return 1u << ((o.value - REG_AL) & 3);
+    return 0;
+}
+
+static bool isByteOperation(const TypedOperand& o) {
+    return isReg8(o) || (o.type == MEM && o.size == 1);
+}
+
+/* =========================================
+   Instruction effects
+   Memory operands are direct addresses, so they
+   use no registers; stores are never deleted.
+========================================= */
+struct Effect {
+    uint32_t uses;
+    uint32_t kills;     // overwritten entirely
+    uint32_t writes;    // overwritten in whole or in part (includes kills)
+    bool pure;          // nothing else happens: deletable once writes are dead
+};
+
+static Effect effectOf(const TypedInstruction& in) {
+    const TypedOperand& d = in.dst;
+    const TypedOperand& s = in.src;
+    uint32_t du = unitOf(d), su = unitOf(s);
+    uint32_t dFull = isReg16(d) ? du : 0;
+    bool regDst = du != 0;
+    Effect e = {0, 0, 0, false};
+
+    switch (in.opcode) {
+    case OP_MOV:
+        e.uses = su;
+        e.writes = du;
+        e.kills = dFull;
+        e.pure = regDst;
+        break;
+
+    case OP_ADD: case OP_SUB: case OP_AND: case OP_OR: case OP_XOR:
+    case OP_ADC: case OP_SBB: {
+        // XOR r, r and SUB r, r do not depend on r
+        bool self = (in.opcode == OP_XOR || in.opcode == OP_SUB) && d.type == REG &&
+                    s.type == REG && d.value == s.value;
+        e.uses = (self ? du & ~dFull : du | su) |
+                 (in.opcode == OP_ADC || in.opcode == OP_SBB ? (uint32_t)U_CF : 0u);
+        e.writes = du | U_FLAGS;
+        e.kills = dFull | U_FLAGS;
+        e.pure = regDst;
+        break;
+    }
+    case OP_CMP: case OP_TEST:
+        e.uses = du | su;
+        e.writes = e.kills = U_FLAGS;
+        e.pure = true;
+        break;
+
+    case OP_INC: case OP_DEC:
+        e.uses = du;
+        e.writes = du | (U_FLAGS & ~U_CF);
+        e.kills = dFull | (U_FLAGS & ~U_CF);
+        e.pure = regDst;
+        break;
+    case OP_NEG:
+        e.uses = du;
+        e.writes = du | U_FLAGS;
+        e.kills = dFull | U_FLAGS;
+        e.pure = regDst;
+        break;
+    case OP_NOT:
+        e.uses = du;
+        e.writes = du;
+        e.kills = dFull;
+        e.pure = regDst;
+        break;
+
+    case OP_SHL: case OP_SAL: case OP_SHR: case OP_SAR:
+    case OP_ROL: case OP_ROR: case OP_RCL: case OP_RCR: {
+        bool rotate = in.opcode == OP_ROL || in.opcode == OP_ROR ||
+                      in.opcode == OP_RCL || in.opcode == OP_RCR;
+        uint32_t flags = rotate ? U_CF | U_OF : U_FLAGS;
+        e.uses = du | su | (in.opcode == OP_RCL || in.opcode == OP_RCR ? (uint32_t)U_CF : 0u);
+        e.writes = du | flags;
+        // a CL count of zero changes nothing
+        e.kills = s.type == IMM ? dFull | flags : 0;
+        e.pure = regDst;
+        break;
+    }
+
+    case OP_MUL: case OP_IMUL:
+        e.uses = U_AX | du;
+        e.writes = isByteOperation(d) ? U_AX | U_FLAGS : U_AX | U_DX | U_FLAGS;
+        e.kills = e.writes;
+        break;
+    case OP_DIV: case OP_IDIV:
+        e.uses = (isByteOperation(d) ? U_AX : U_AX | U_DX) | du;
+        e.writes = e.kills = (e.uses & (U_AX | U_DX)) | U_FLAGS;
+        break;
+
+    case OP_DAA: case OP_DAS: case OP_AAA: case OP_AAS:
+        e.uses = U_AX | U_CF | U_AF;
+        e.writes = U_AX | U_FLAGS;
+        e.kills = U_FLAGS;
+        break;
+    case OP_AAM: case OP_AAD:
+        e.uses = U_AX;
+        e.writes = e.kills = U_AX | U_FLAGS;
+        break;
+
+    case OP_XCHG:
+        e.uses = du | su;
+        e.writes = du | su;
+        e.kills = dFull | (isReg16(s) ? su : 0);
+        break;
+    case OP_XLAT:
+        e.uses = U_AX | U_BX;
+        e.writes = U_AX;
+        break;
+    case OP_LEA:
+        e.writes = e.kills = du;
+        e.pure = true;
+        break;
+    case OP_LDS: case OP_LES:
+        e.writes = e.kills = du;
+        break;
+
+    case OP_PUSH:
+        e.uses = du | U_SP;
+        e.writes = e.kills = U_SP;
+        break;
+    case OP_POP:
+        e.uses = U_SP;
+        e.writes = du | U_SP;
+        e.kills = dFull | U_SP;
+        break;
+    case OP_PUSHF:
+        e.uses = U_FLAGS | U_SP;
+        e.writes = e.kills = U_SP;
+        break;
+    case OP_POPF:
+        e.uses = U_SP;
+        e.writes = e.kills = U_FLAGS | U_SP;
+        break;
+    case OP_LAHF:
+        e.uses = U_FLAGS & ~U_OF;
+        e.writes = U_AX;
+        break;
+    case OP_SAHF:
+        e.uses = U_AX;
+        e.writes = e.kills = U_FLAGS & ~U_OF;
+        break;
+    case OP_CLC: case OP_STC:
+        e.writes = e.kills = U_CF;
+        break;
+    case OP_CMC:
+        e.uses = e.writes = e.kills = U_CF;
+        break;
+
+    case OP_IN:
+        e.uses = su;
+        e.writes = du;
+        e.kills = dFull;
+        break;
+    case OP_OUT:
+        e.uses = du | su;
+        break;
+
+    case OP_MOVSB: case OP_MOVSW:
+        e.uses = e.writes = e.kills = U_SI | U_DI;
+        break;
+    case OP_CMPSB: case OP_CMPSW:
+        e.uses = U_SI | U_DI;
+        e.writes = e.kills = U_SI | U_DI | U_FLAGS;
+        break;
+    case OP_SCASB: case OP_SCASW:
+        e.uses = U_AX | U_DI;
+        e.writes = e.kills = U_DI | U_FLAGS;
+        break;
+    case OP_LODSB: case OP_LODSW:
+        e.uses = U_SI;
+        e.writes = U_SI | U_AX;
+        e.kills = in.opcode == OP_LODSW ? U_SI | U_AX : U_SI;
+        break;
+    case OP_STOSB: case OP_STOSW:
+        e.uses = U_AX | U_DI;
+        e.writes = e.kills = U_DI;
+        break;
+
+    case OP_NOP: case OP_WAIT: case OP_LOCK:
+    case OP_CLD: case OP_STD: case OP_CLI: case OP_STI:
+    case OP_JMP:
+        break;
+    case OP_CALL:
+        e.uses = U_SP;
+        e.writes = e.kills = U_SP;
+        break;
+    case OP_LOOP:
+        e.uses = e.writes = e.kills = U_CX;
+        break;
+    case OP_LOOPE: case OP_LOOPNE:
+        e.uses = U_CX | U_ZF;
+        e.writes = e.kills = U_CX;
+        break;
+    case OP_JCXZ:
+        e.uses = U_CX;
+        break;
+    case OP_JE: case OP_JZ: case OP_JNE: case OP_JNZ: case OP_JA: case OP_JAE:
+    case OP_JB: case OP_JBE: case OP_JG: case OP_JGE: case OP_JL: case OP_JLE:
+    case OP_JC: case OP_JNC: case OP_JO: case OP_JNO: case OP_JS: case OP_JNS:
+        e.uses = U_FLAGS;
+        break;
+
+    // The program ends: the registers are its result; flags are not reported
+    case OP_HLT:
+        e.uses = U_REGS;
+        break;
+    // Back to a caller that may read anything
+    case OP_RET:
+        e.uses = U_ALL;
+        break;
+    // The string instruction after a prefix counts CX down and may not run at all
+    case OP_REP: case OP_REPE: case OP_REPZ: case OP_REPNE: case OP_REPNZ:
+        e.uses = e.writes = U_ALL;
+        break;
+
+    default:
+        e.uses = e.writes = U_ALL;
+        break;
+    }
+    return e;
+}
+
+/* =========================================
+   Control flow graph
+========================================= */
+constexpr int NO_BLOCK = -1;
+constexpr int EXIT_BLOCK = -2;   // off the end of the code: everything is observable
+
+struct BasicBlock {
+    size_t first, end;          // instructions [first, end)
+    int succ[2];                // NO_BLOCK when unused
+    bool returnEdge;            // succ[1] is where a CALL returns to
+};
+
+static bool isConditionalBranch(Opcode op) {
+    switch (op) {
+    case OP_JE: case OP_JZ: case OP_JNE: case OP_JNZ: case OP_JA: case OP_JAE:
+    case OP_JB: case OP_JBE: case OP_JG: case OP_JGE: case OP_JL: case OP_JLE:
+    case OP_JC: case OP_JNC: case OP_JO: case OP_JNO: case OP_JS: case OP_JNS:
+    case OP_LOOP: case OP_LOOPE: case OP_LOOPNE: case OP_JCXZ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool endsBlock(Opcode op) {
+    return op == OP_JMP || op == OP_CALL || op == OP_RET || op == OP_HLT ||
+           isConditionalBranch(op);
+}
+
+/*
+   Split code into blocks at labels and after control transfers. Returns
+   false when some branch target is not a label (a numeric address or a
+   register), since its successors are then unknown.
+*/
+static bool buildBlocks(const vector<TypedInstruction>& code, vector<BasicBlock>& blocks) {
+    size_t n = code.size();
+    vector<bool> leader(n + 1, false);
+    leader[0] = true;
+    for (size_t i = 0; i < n; i++) {
+        Opcode op = code[i].opcode;
+        if (!endsBlock(op))
+            continue;
+        if (op != OP_RET && op != OP_HLT) {
+            if (code[i].dst.type != LABEL)
+                return false;
+            leader[code[i].dst.value] = true;
+        }
+        leader[i + 1] = true;
+    }
+
+    vector<int> blockAt(n + 1, EXIT_BLOCK);
+    for (size_t i = 0; i < n; i++) {
+        if (leader[i])
+            blocks.push_back({i, n, {NO_BLOCK, NO_BLOCK}, false});
+        blockAt[i] = (int)blocks.size() - 1;
+    }
+    for (size_t b = 0; b + 1 < blocks.size(); b++)
+        blocks[b].end = blocks[b + 1].first;
+
+    for (BasicBlock& block : blocks) {
+        const TypedInstruction& last = code[block.end - 1];
+        int next = block.end < n ? blockAt[block.end] : EXIT_BLOCK;
+        int target = last.dst.type == LABEL ? blockAt[last.dst.value] : EXIT_BLOCK;
+        switch (last.opcode) {
+        case OP_RET:
+        case OP_HLT:
+            break;
+        case OP_JMP:
+            block.succ[0] = target;
+            break;
+        case OP_CALL:
+            block.succ[0] = target;
+            block.succ[1] = next;
+            block.returnEdge = true;
+            break;
+        default:
+            block.succ[0] = next;
+            if (isConditionalBranch(last.opcode))
+                block.succ[1] = target;
+            break;
+        }
+    }
+    return true;
+}
+
+/* =========================================
+   Liveness (backward)
+   liveAfter[i] = units read before being
+   overwritten on some path from instruction i.
+========================================= */
+struct DataflowContext {
+    vector<TypedInstruction>& code;
+    vector<BasicBlock> blocks;
+    vector<Effect> effect;
+    vector<bool> dead;
+    vector<uint32_t> liveAfter;
+
+    explicit DataflowContext(vector<TypedInstruction>& c)
+        : code(c), effect(c.size()), dead(c.size(), false), liveAfter(c.size(), 0) {
+        for (size_t i = 0; i < code.size(); i++)
+            effect[i] = effectOf(code[i]);
+    }
+};
+
+static uint32_t liveIn(const vector<uint32_t>& blockLive, int succ) {
+    if (succ == NO_BLOCK)
+        return 0;
+    return succ == EXIT_BLOCK ? U_ALL : blockLive[succ];
+}
+
+static void computeLiveness(DataflowContext& ctx) {
+    size_t count = ctx.blocks.size();
+    vector<uint32_t> blockLive(count, 0);
+
+    auto walk = [&](size_t b, bool record) {
+        const BasicBlock& block = ctx.blocks[b];
+        uint32_t live = liveIn(blockLive, block.succ[0]) | liveIn(blockLive, block.succ[1]);
+        for (size_t i = block.end; i-- > block.first;) {
+            if (ctx.dead[i])
+                continue;
+            if (record)
+                ctx.liveAfter[i] = live;
+            live = (live & ~ctx.effect[i].kills) | ctx.effect[i].uses;
+        }
+        return live;
+    };
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = count; b-- > 0;) {
+            uint32_t live = walk(b, false);
+            if (live != blockLive[b]) {
+                blockLive[b] = live;
+                changed = true;
+            }
+        }
+    }
+    for (size_t b = 0; b < count; b++)
+        walk(b, true);
+}
+
+/* =========================================
+   Constant propagation (forward)
+   known holds the bits of each word register
+   whose value is certain: 0, 0x00FF, 0xFF00
+   or 0xFFFF.
+========================================= */
+struct RegisterValues {
+    uint16_t value[8];
+    uint16_t known[8];
+    bool reached;
+
+    void clear() {
+        for (int r = 0; r < 8; r++)
+            value[r] = known[r] = 0;
+    }
+
+    // The meet: only what every predecessor agrees on stays known
+    bool merge(const RegisterValues& other) {
+        if (!reached) {
+            *this = other;
+            reached = true;
+            return true;
+        }
+        bool changed = false;
+        for (int r = 0; r < 8; r++) {
+            uint16_t agree = known[r] & other.known[r] & ~(value[r] ^ other.value[r]);
+            if (agree != known[r]) {
+                known[r] = agree;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    bool read(const TypedOperand& o, uint16_t& v) const {
+        if (o.type == IMM) {
+            v = (uint16_t)o.value;
+            return true;
+        }
+        if (isReg16(o)) {
+            v = value[o.value];
+            return known[o.value] == 0xFFFF;
+        }
+        if (isReg8(o)) {
+            int r = (o.value - REG_AL) & 3;
+            int shift = o.value >= REG_AH ? 8 : 0;
+            v = (value[r] >> shift) & 0xFF;
+            return ((known[r] >> shift) & 0xFF) == 0xFF;
+        }
+        return false;
+    }
+
+    void write(const TypedOperand& o, uint16_t v) {
+        if (isReg16(o)) {
+            value[o.value] = v;
+            known[o.value] = 0xFFFF;
+        } else {
+            int r = (o.value - REG_AL) & 3;
+            int shift = o.value >= REG_AH ? 8 : 0;
+            value[r] = (uint16_t)((value[r] & ~(0xFF << shift)) | ((v & 0xFF) << shift));
+            known[r] |= (uint16_t)(0xFF << shift);
+        }
+    }
+
+    void forget(uint32_t units) {
+        for (int r = 0; r < 8; r++)
+            if (units & (1u << r))
+                known[r] = 0;
+    }
+};
+
+/*
+   Value a register-destination instruction leaves in its destination,
+   if the values it reads are known. Follows the emulator's arithmetic.
+*/
+static bool evaluate(const TypedInstruction& in, const RegisterValues& regs, uint16_t& result) {
+    const TypedOperand& d = in.dst;
+    const TypedOperand& s = in.src;
+    if (!isReg16(d) && !isReg8(d))
+        return false;
+
+    bool byte = isReg8(d);
+    unsigned mask = byte ? 0xFF : 0xFFFF;
+    unsigned bits = byte ? 8 : 16;
+    uint16_t a = 0, b = 0;
+    bool haveA = regs.read(d, a);
+    bool haveB = regs.read(s, b);
+    unsigned r;
+
+    switch (in.opcode) {
+    case OP_MOV:
+        if (!haveB)
+            return false;
+        r = b;
+        break;
+    case OP_ADD: case OP_SUB: case OP_AND: case OP_OR: case OP_XOR:
+        if ((in.opcode == OP_XOR || in.opcode == OP_SUB) && s.type == REG && s.value == d.value) {
+            r = 0;
+            break;
+        }
+        if (!haveA || !haveB)
+            return false;
+        r = in.opcode == OP_ADD ? a + b : in.opcode == OP_SUB ? a - b :
+            in.opcode == OP_AND ? a & b : in.opcode == OP_OR ? a | b : a ^ b;
+        break;
+    case OP_INC: case OP_DEC: case OP_NEG: case OP_NOT:
+        if (!haveA)
+            return false;
+        r = in.opcode == OP_INC ? a + 1u : in.opcode == OP_DEC ? a - 1u :
+            in.opcode == OP_NEG ? 0u - a : ~(unsigned)a;
+        break;
+    case OP_SHL: case OP_SAL: case OP_SHR: case OP_SAR: {
+        if (!haveA || !haveB)
+            return false;
+        unsigned c = b & 0xFF;
+        if (c == 0)
+            return false;           // leaves the flags alone: not a plain write
+        if (in.opcode == OP_SAR) {
+            int v = byte ? (int8_t)a : (int16_t)a;
+            r = (unsigned)(v >> (c >= bits ? bits - 1 : c));
+        } else if (c >= bits) {
+            r = 0;
+        } else {
+            r = in.opcode == OP_SHR ? (a & mask) >> c : (unsigned)a << c;
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+    result = (uint16_t)(r & mask);
+    return true;
+}
+
+static void transfer(const TypedInstruction& in, const Effect& e, RegisterValues& regs) {
+    uint16_t v;
+    if (evaluate(in, regs, v)) {
+        regs.write(in.dst, v);
+        return;
+    }
+    regs.forget(e.writes);
+}
+
+static void propagateConstants(DataflowContext& ctx, vector<RegisterValues>& entry) {
+    size_t count = ctx.blocks.size();
+    entry.assign(count, RegisterValues());
+    for (RegisterValues& regs : entry) {
+        regs.clear();
+        regs.reached = false;
+    }
+    entry[0].reached = true;   // nothing is assumed about the initial registers
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < count; b++) {
+            if (!entry[b].reached)
+                continue;
+            const BasicBlock& block = ctx.blocks[b];
+            RegisterValues regs = entry[b];
+            for (size_t i = block.first; i < block.end; i++)
+                if (!ctx.dead[i])
+                    transfer(ctx.code[i], ctx.effect[i], regs);
+
+            for (int k = 0; k < 2; k++) {
+                int succ = block.succ[k];
+                if (succ < 0)
+                    continue;
+                RegisterValues out = regs;
+                if (k == 1 && block.returnEdge)
+                    out.clear();    // whatever the callee left
+                if (entry[succ].merge(out))
+                    changed = true;
+            }
+        }
+    }
+}
+
+/* =========================================
+   Rewrites
+========================================= */
+static int lengthOf(const TypedInstruction& instr) {
+    const InstrForm* form = selectForm(instr);
+    return form ? formLength(*form, instr) : 0;
+}
+
+static void rewrite(DataflowContext& ctx, size_t i, const TypedInstruction& with, DataflowStats& stats) {
+    stats.bytesSaved += lengthOf(ctx.code[i]) - lengthOf(with);
+    ctx.code[i] = with;
+    ctx.effect[i] = effectOf(with);
+}
+
+static void remove(DataflowContext& ctx, size_t i, DataflowStats& stats) {
+    stats.bytesSaved += lengthOf(ctx.code[i]);
+    stats.removed++;
+    ctx.dead[i] = true;
+}
+
+/*
+   An instruction whose result is known becomes MOV r, imm once none of
+   the flags it sets are read; one that rewrites a register with the
+   value already there is deleted.
+*/
+static bool foldConstants(DataflowContext& ctx, const vector<RegisterValues>& entry, DataflowStats& stats) {
+    bool changed = false;
+    for (size_t b = 0; b < ctx.blocks.size(); b++) {
+        if (!entry[b].reached)
+            continue;
+        const BasicBlock& block = ctx.blocks[b];
+        RegisterValues regs = entry[b];
+        for (size_t i = block.first; i < block.end; i++) {
+            if (ctx.dead[i])
+                continue;
+            const TypedInstruction& in = ctx.code[i];
+            const Effect& e = ctx.effect[i];
+            uint16_t v, current;
+            if (e.pure && !(e.writes & U_FLAGS & ctx.liveAfter[i]) && evaluate(in, regs, v)) {
+                if (regs.read(in.dst, current) && current == v) {
+                    remove(ctx, i, stats);
+                    changed = true;
+                    continue;
+                }
+                // XOR r, r stays: it is already shorter than MOV r, 0
+                bool sameRegister = in.src.type == REG && in.src.value == in.dst.value;
+                if (!(in.opcode == OP_MOV && in.src.type == IMM) && !sameRegister) {
+                    TypedInstruction mov = {OP_MOV, in.dst, TypedOperand(), in.source};
+                    mov.src.type = IMM;
+                    mov.src.value = v;
+                    if (selectForm(mov)) {
+                        rewrite(ctx, i, mov, stats);
+                        stats.folded++;
+                        changed = true;
+                    }
+                }
+            }
+            transfer(ctx.code[i], ctx.effect[i], regs);
+        }
+    }
+    return changed;
+}
+
+// Delete side-effect-free instructions whose every write is dead
+static bool eliminateDeadStores(DataflowContext& ctx, DataflowStats& stats) {
+    bool changed = false;
+    for (size_t i = 0; i < ctx.code.size(); i++) {
+        const Effect& e = ctx.effect[i];
+        if (!ctx.dead[i] && e.pure && e.writes && !(e.writes & ctx.liveAfter[i])) {
+            remove(ctx, i, stats);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/* =========================================
+   Compact live instructions, remap labels
+========================================= */
+static void compact(DataflowContext& ctx) {
+    vector<TypedInstruction>& code = ctx.code;
+    vector<int> newIndex(code.size() + 1);
+
+    size_t out = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        newIndex[i] = (int)out;     // a deleted target falls through to the next live one
+        if (!ctx.dead[i])
+            code[out++] = code[i];
+    }
+    newIndex[code.size()] = (int)out;
+    code.resize(out);
+
+    for (auto& instr : code)
+        if (instr.dst.type == LABEL)
+            instr.dst.value = newIndex[instr.dst.value];
+}
+
+/* =========================================
+   Liveness for other passes
+========================================= */
+bool liveAfter(const vector<TypedInstruction>& instructions, vector<LiveSet>& after) {
+    after.clear();
+    if (instructions.empty())
+        return true;
+
+    vector<TypedInstruction> code = instructions;
+    DataflowContext ctx(code);
+    if (!buildBlocks(code, ctx.blocks))
+        return false;
+    computeLiveness(ctx);
+
+    static const struct { uint32_t unit; uint16_t flag; } flagUnits[] = {
+        {U_CF, FLAG_CF}, {U_PF, FLAG_PF}, {U_AF, FLAG_AF},
+        {U_ZF, FLAG_ZF}, {U_SF, FLAG_SF}, {U_OF, FLAG_OF}
+    };
+    after.resize(code.size());
+    for (size_t i = 0; i < code.size(); i++) {
+        uint32_t live = ctx.liveAfter[i];
+        after[i].regs = (uint8_t)(live & U_REGS);
+        after[i].flags = 0;
+        for (const auto& f : flagUnits)
+            if (live & f.unit)
+                after[i].flags |= f.flag;
+    }
+    return true;
+}
+
+/* =========================================
+   Main optimizer entry
+========================================= */
+DataflowStats optimizeDataflow(vector<TypedInstruction>& instructions) {
+    DataflowStats stats;
+    if (instructions.empty())
+        return stats;
+
+    DataflowContext ctx(instructions);
+    if (!buildBlocks(instructions, ctx.blocks))
+        return stats;
+    stats.blocks = (int)ctx.blocks.size();
+
+    // Folding frees registers for elimination and elimination frees flags for folding
+    vector<RegisterValues> entry;
+    bool changed = true;
+    while (changed) {
+        computeLiveness(ctx);
+        propagateConstants(ctx, entry);
+        changed = foldConstants(ctx, entry, stats);
+        computeLiveness(ctx);
+        changed |= eliminateDeadStores(ctx, stats);
+    }
+
+    compact(ctx);
+    return stats;
+}
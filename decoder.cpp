@@ -0,0 +1,334 @@
+#include "decoder.h"
+
+using namespace std;
+
+/* =========================================
+   Decode table: first byte x ModR/M reg field -> form row
+   Rows whose encoding has no /digit extension fill all
+   eight slots. On a clash the first row wins, except that
+   fixed one-byte rows (NOP) beat register-in-opcode rows
+   (XCHG AX, AX).
+========================================= */
+constexpr uint16_t NO_ROW = SHAPE_UNKNOWN;
+
+struct DecodeTable {
+    uint16_t row[256][8];
+};
+
+constexpr void claim(DecodeTable& t, int byte, int ext, uint16_t row) {
+    uint16_t& slot = t.row[byte][ext];
+    if (slot == NO_ROW ||
+        (instrForms[row].enc == E_FIXED && instrForms[slot].enc == E_OPREG))
+        slot = row;
+}
+
+constexpr void claimAll(DecodeTable& t, int byte, uint16_t row) {
+    for (int ext = 0; ext < 8; ext++)
+        claim(t, byte, ext, row);
+}
+
+constexpr DecodeTable buildDecodeTable() {
+    DecodeTable t{};
+    for (int b = 0; b < 256; b++)
+        for (int e = 0; e < 8; e++)
+            t.row[b][e] = NO_ROW;
+
+    for (size_t i = 0; i < INSTR_FORM_COUNT; i++) {
+        const InstrForm& f = instrForms[i];
+        uint16_t row = (uint16_t)i;
+
+        switch (f.enc) {
+        case E_RM_EXT:
+            claim(t, f.opcode, f.ext, row);
+            break;
+        case E_OPREG:
+            for (int r = 0; r < 8; r++)
+                claimAll(t, f.opcode + r, row);
+            break;
+        case E_SREG_OP:
+            for (int s = 0; s < 4; s++)
+                claimAll(t, f.opcode + (s << 3), row);
+            break;
+        default:
+            claimAll(t, f.opcode, row);
+            break;
+        }
+    }
+    return t;
+}
+
+static constexpr DecodeTable decodeTable = buildDecodeTable();
+
+/* =========================================
+   Helpers
+========================================= */
+constexpr bool usesModRM(Encoding e) {
+    return e == E_REG_RM || e == E_RM_REG || e == E_RM_EXT;
+}
+
+static bool isByteForm(OperandForm f) {
+    return f == F_R8 || f == F_RM8 || f == F_AL;
+}
+
+constexpr bool isStringOp(Opcode op) {
+    switch (op) {
+    case OP_MOVSB: case OP_MOVSW: case OP_CMPSB: case OP_CMPSW: case OP_SCASB:
+    case OP_SCASW: case OP_LODSB: case OP_LODSW: case OP_STOSB: case OP_STOSW:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static RegisterId regFromField(OperandForm f, int field) {
+    if (f == F_R8 || f == F_RM8)
+        return (RegisterId)(REG_AL + field);
+    if (f == F_SREG)
+        return (RegisterId)(REG_ES + (field & 3));
+    return (RegisterId)(REG_AX + field);
+}
+
+/* =========================================
+   Shape table: row, length and prefix by first byte and
+   reg field, so decodeShape sizes an instruction with
+   lookups instead of walking its operand forms. Lengths
+   leave out the displacement, which the ModR/M byte sizes.
+========================================= */
+enum ShapeFlag : uint8_t {
+    SH_MODRM = 1,       // a ModR/M byte follows the opcode
+    SH_MEM_ONLY = 2,    // r/m must be memory (LEA, LDS, LES)
+    SH_REP_Z = 4,       // F3 prefix
+    SH_REP_NZ = 8       // F2 prefix
+};
+
+struct ShapeEntry {
+    uint16_t row;
+    uint8_t length;
+    uint8_t flags;
+};
+
+struct ShapeTable {
+    ShapeEntry entry[256][8];
+    uint8_t dispLength[256];    // by ModR/M byte
+    uint16_t stringRow[256];    // by first byte: a string instruction's row, or NO_ROW
+};
+
+constexpr int immediateLength(OperandForm f) {
+    return f == F_IMM8 || f == F_SIMM8 || f == F_REL8 ? 1
+         : f == F_IMM16 || f == F_REL16 ? 2
+         : 0;
+}
+
+constexpr ShapeTable buildShapeTable() {
+    ShapeTable t{};
+    for (int b = 0; b < 256; b++) {
+        for (int e = 0; e < 8; e++) {
+            uint16_t row = decodeTable.row[b][e];
+            ShapeEntry& s = t.entry[b][e];
+            s = {row, 1, 0};                // unknown bytes size as one byte of data
+            if (row == NO_ROW)
+                continue;
+            const InstrForm& f = instrForms[row];
+            s.length += (uint8_t)(immediateLength(f.dst) + immediateLength(f.src));
+            if (usesModRM(f.enc)) {
+                s.length++;
+                s.flags |= SH_MODRM;
+            }
+            if (f.enc == E_FIXED && f.ext != NO_EXT)
+                s.length++;                 // AAM/AAD base byte
+            if (f.dst == F_M || f.src == F_M)
+                s.flags |= SH_MEM_ONLY;
+            if (f.op == OP_REP)
+                s.flags |= SH_REP_Z;
+            if (f.op == OP_REPNE)
+                s.flags |= SH_REP_NZ;
+        }
+
+        uint16_t first = decodeTable.row[b][0];
+        t.stringRow[b] = first != NO_ROW && isStringOp(instrForms[first].op) ? first : NO_ROW;
+
+        int mod = b >> 6, rm = b & 7;
+        t.dispLength[b] = (uint8_t)(mod == 1 ? 1 : mod == 2 || (mod == 0 && rm == 6) ? 2 : 0);
+    }
+    return t;
+}
+
+static constexpr ShapeTable shapeTable = buildShapeTable();
+
+/* =========================================
+   Main decode function
+   byte(i) reads the i-th byte of the instruction;
+   ip only places branch targets.
+========================================= */
+template <typename Bytes>
+static bool decode(const Bytes& byte, uint16_t ip, DecodedInsn& out) {
+    int at = 0;
+    auto fetch8 = [&]() -> uint8_t { return byte(at++); };
+    auto fetch16 = [&]() -> uint16_t {
+        uint16_t lo = fetch8();
+        uint16_t hi = fetch8();
+        return lo | (hi << 8);
+    };
+
+    uint8_t opcode = fetch8();
+
+    // Only the prefix right before the string instruction joins: F3 F3 A4 is REP, then REP MOVSB
+    uint8_t repeat = REP_NONE;
+    uint16_t first = decodeTable.row[opcode][0];
+    if (first != NO_ROW && (instrForms[first].op == OP_REP || instrForms[first].op == OP_REPNE)) {
+        uint16_t next = decodeTable.row[byte(at)][0];
+        if (next != NO_ROW && isStringOp(instrForms[next].op)) {
+            repeat = instrForms[first].op == OP_REP ? REP_Z : REP_NZ;
+            opcode = fetch8();
+        }
+    }
+
+    // Peek at the reg field only for bytes whose rows differ by extension
+    int ext = 0;
+    if (decodeTable.row[opcode][0] != decodeTable.row[opcode][1] ||
+        decodeTable.row[opcode][0] != decodeTable.row[opcode][7])
+        ext = (byte(at) >> 3) & 7;
+
+    uint16_t row = decodeTable.row[opcode][ext];
+    if (row == NO_ROW)
+        return false;
+
+    const InstrForm& form = instrForms[row];
+    out = DecodedInsn();
+    out.form = &form;
+    out.opcode = form.op;
+    out.repeat = repeat;
+
+    DecodedOperand* ops[2] = {&out.dst, &out.src};
+    OperandForm forms[2] = {form.dst, form.src};
+
+    // ---- ModR/M ----
+    int mod = 0, reg = 0, rm = 0;
+    if (usesModRM(form.enc)) {
+        uint8_t modrm = fetch8();
+        mod = modrm >> 6;
+        reg = (modrm >> 3) & 7;
+        rm = modrm & 7;
+    }
+
+    int rmOperand = form.enc == E_REG_RM ? 1 : 0;   // which operand sits in r/m
+
+    for (int k = 0; k < 2; k++) {
+        DecodedOperand& o = *ops[k];
+        OperandForm f = forms[k];
+
+        switch (f) {
+        case F_NONE:
+            break;
+
+        case F_AL: o.type = REG; o.value = REG_AL; break;
+        case F_AX: o.type = REG; o.value = REG_AX; break;
+        case F_CL: o.type = REG; o.value = REG_CL; break;
+        case F_DX: o.type = REG; o.value = REG_DX; break;
+        case F_ONE: o.type = IMM; o.value = 1; break;
+
+        case F_R8:
+        case F_R16:
+        case F_SREG:
+            o.type = REG;
+            if (form.enc == E_OPREG)
+                o.value = regFromField(f, opcode - form.opcode);
+            else if (form.enc == E_SREG_OP)
+                o.value = regFromField(f, (opcode - form.opcode) >> 3);
+            else
+                o.value = regFromField(f, k == rmOperand ? rm : reg);
+            break;
+
+        case F_RM8:
+        case F_RM16:
+        case F_M:
+            if (mod == 0b11) {
+                if (f == F_M)
+                    return false;           // LEA needs memory
+                o.type = REG;
+                o.value = regFromField(f, rm);
+                break;
+            }
+            o.type = MEM;
+            if (mod == 0b00 && rm == 0b110) {
+                o.ea = EA_DIRECT;
+                o.value = fetch16();
+            } else {
+                o.ea = (uint8_t)rm;
+                o.value = mod == 0b01 ? (int16_t)(int8_t)fetch8()
+                        : mod == 0b10 ? (int16_t)fetch16()
+                        : 0;
+            }
+            break;
+
+        default:
+            break;                          // immediates are read below
+        }
+    }
+
+    if (form.enc == E_FIXED && form.ext != NO_EXT)
+        fetch8();                           // AAM/AAD base byte
+
+    // ---- Immediates and displacements, in encoding order ----
+    for (int k = 0; k < 2; k++) {
+        DecodedOperand& o = *ops[k];
+        switch (forms[k]) {
+        case F_IMM8:  o.type = IMM; o.value = fetch8(); break;
+        case F_SIMM8: o.type = IMM; o.value = (uint16_t)(int16_t)(int8_t)fetch8(); break;
+        case F_IMM16: o.type = IMM; o.value = fetch16(); break;
+        case F_REL8: {
+            int disp = (int8_t)fetch8();
+            o.type = IMM;
+            o.value = (uint16_t)(ip + at + disp);
+            break;
+        }
+        case F_REL16: {
+            int disp = (int16_t)fetch16();
+            o.type = IMM;
+            o.value = (uint16_t)(ip + at + disp);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    out.width = (isByteForm(form.dst) || isByteForm(form.src)) ? 1 : 2;
+    switch (form.op) {
+    case OP_MOVSB: case OP_CMPSB: case OP_SCASB: case OP_LODSB: case OP_STOSB:
+    case OP_XLAT:
+        out.width = 1;
+        break;
+    default:
+        break;
+    }
+
+    out.length = (uint8_t)at;
+    return true;
+}
+
+bool decodeInstruction(const uint8_t* memory, uint16_t ip, DecodedInsn& out) {
+    return decode([=](int i) { return memory[(uint16_t)(ip + i)]; }, ip, out);
+}
+
+bool decodeBytes(const uint8_t* code, uint16_t ip, DecodedInsn& out) {
+    return decode([=](int i) { return code[i]; }, ip, out);
+}
+
+bool decodeShape(const uint8_t* code, InsnShape& out) {
+    uint8_t first = code[0], next = code[1];
+    const ShapeEntry& e = shapeTable.entry[first][(next >> 3) & 7];
+
+    out.row = e.row;
+    // SH_MODRM is bit 0: the mask keeps the displacement only when there is a ModR/M byte
+    out.length = (uint8_t)(e.length + (shapeTable.dispLength[next] & -(e.flags & SH_MODRM)));
+    out.repeat = REP_NONE;
+    if (e.flags & (SH_REP_Z | SH_REP_NZ) && shapeTable.stringRow[next] != NO_ROW) {
+        out.row = shapeTable.stringRow[next];
+        out.length = 2;
+        out.repeat = e.flags & SH_REP_Z ? REP_Z : REP_NZ;
+    }
+    if (e.flags & SH_MEM_ONLY && next >= 0xC0)
+        out = {NO_ROW, 1, REP_NONE};
+    return out.row != NO_ROW;
+}
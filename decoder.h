@@ -0,0 +1,80 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <cstdint>
+#include "common.h"
+#include "isa.h"
+
+using namespace std;
+
+/* ================= 8086 Instruction Decoder ================= */
+/*
+   The decode table is derived at compile time from instrForms (isa.h),
+   so the decoder recognizes exactly the forms the encoder can emit and
+   both agree on operand layout.
+*/
+
+constexpr uint8_t EA_DIRECT = 0xFF;
+
+// Longest instruction the decoder reads, prefix included
+constexpr int DECODE_MAX_LENGTH = 6;
+
+// r/m memory modes 0-7 (mod != 11)
+enum EffectiveAddress : uint8_t {
+    EA_BX_SI, EA_BX_DI, EA_BP_SI, EA_BP_DI, EA_SI, EA_DI, EA_BP, EA_BX
+};
+
+struct DecodedOperand {
+    OperandType type = NONE;    // REG, MEM or IMM (branch targets are absolute IMM)
+    int value = 0;              // RegisterId | address or displacement | immediate
+    uint8_t ea = EA_DIRECT;     // MEM: EffectiveAddress base, or EA_DIRECT for [disp16]
+};
+
+enum RepeatPrefix : uint8_t {
+    REP_NONE,
+    REP_Z,      // F3: REP, REPE, REPZ
+    REP_NZ      // F2: REPNE, REPNZ
+};
+
+struct DecodedInsn {
+    const InstrForm* form;      // row of instrForms that matched
+    Opcode opcode;
+    DecodedOperand dst;
+    DecodedOperand src;
+    uint8_t width;              // operand size in bytes: 1 or 2
+    uint8_t length;             // instruction size in bytes, prefix included
+    uint8_t repeat;             // RepeatPrefix of a string instruction
+};
+
+/*
+   Decode the instruction at ip in a 64 KB address space (reads wrap at
+   0xFFFF). Returns false for bytes that are not a known form. A REP
+   prefix followed by a string instruction decodes as one instruction
+   with repeat set; before anything else it decodes on its own.
+*/
+bool decodeInstruction(const uint8_t* memory, uint16_t ip, DecodedInsn& out);
+
+/*
+   Same, from a linear buffer with DECODE_MAX_LENGTH readable bytes at
+   code, for an instruction that sits at ip. Nothing wraps.
+*/
+bool decodeBytes(const uint8_t* code, uint16_t ip, DecodedInsn& out);
+
+constexpr uint16_t SHAPE_UNKNOWN = 0xFFFF;
+
+struct InsnShape {
+    uint16_t row;               // index into instrForms, or SHAPE_UNKNOWN
+    uint8_t length;             // prefix included
+    uint8_t repeat;             // RepeatPrefix
+};
+
+/*
+   Only the form, length and prefix of the instruction at code, as
+   decodeBytes would find them, from lookup tables: what a sweep over a
+   large image needs before anything asks for operands. Same buffer
+   requirement as decodeBytes. Returns false for bytes that are not a
+   known form, with out set to SHAPE_UNKNOWN and length 1.
+*/
+bool decodeShape(const uint8_t* code, InsnShape& out);
+
+#endif
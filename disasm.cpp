@@ -0,0 +1,204 @@
+#include "disasm.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+/* =========================================
+   Sweep
+========================================= */
+static void record(const uint8_t* bytes, uint32_t address, DisasmInsn& out) {
+    InsnShape shape;
+    decodeShape(bytes, shape);          // unknown bytes come back as one byte of SHAPE_UNKNOWN
+    out.address = address;
+    out.row = shape.row;
+    out.length = shape.length;
+    out.repeat = shape.repeat;
+    memcpy(out.bytes, bytes, sizeof(out.bytes));
+}
+
+void disassemble(const uint8_t* code, size_t size, uint32_t base, vector<DisasmInsn>& out) {
+    // Compiled 8086 code averages under three bytes an instruction; growing later would copy everything
+    out.reserve(out.size() + size / 2 + 1);
+
+    DisasmInsn insn;
+    size_t at = 0;
+    while (size - at >= sizeof(insn.bytes)) {
+        record(code + at, base + (uint32_t)at, insn);
+        out.push_back(insn);
+        at += insn.length;
+    }
+
+    // The tail sizes from a zero-padded copy; a form cut short by the end is data
+    while (at < size) {
+        uint8_t padded[sizeof(insn.bytes)] = {};
+        memcpy(padded, code + at, size - at);
+        record(padded, base + (uint32_t)at, insn);
+        if (insn.length > size - at) {
+            insn.row = DISASM_DATA;
+            insn.length = 1;
+            insn.repeat = REP_NONE;
+        }
+        out.push_back(insn);
+        at += insn.length;
+    }
+}
+
+/* =========================================
+   Text
+========================================= */
+static const char* const eaNames[] = {
+    "BX+SI", "BX+DI", "BP+SI", "BP+DI", "SI", "DI", "BP", "BX"
+};
+
+// Exactly digits hexadecimal digits, no suffix
+static char* putHex(char* p, unsigned value, int digits) {
+    for (int shift = 4 * (digits - 1); shift >= 0; shift -= 4)
+        *p++ = "0123456789ABCDEF"[value >> shift & 0xF];
+    return p;
+}
+
+// Hexadecimal with an H suffix and a leading 0 before a letter; below 10, plain decimal
+static char* putNumber(char* p, unsigned value, int digits = 1) {
+    if (value < 10 && digits == 1) {
+        *p++ = (char)('0' + value);
+        return p;
+    }
+    while (digits < 8 && value >> 4 * digits)
+        digits++;
+    if ((value >> 4 * (digits - 1) & 0xF) > 9)
+        *p++ = '0';
+    p = putHex(p, value, digits);
+    *p++ = 'H';
+    return p;
+}
+
+static char* putString(char* p, const char* s) {
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static char* putOperand(char* p, const DecodedOperand& o, bool branch) {
+    switch (o.type) {
+    case REG:
+        return putString(p, registerName((RegisterId)o.value));
+    case IMM:
+        return putNumber(p, (uint16_t)o.value, branch ? 4 : 1);
+    case MEM:
+        *p++ = '[';
+        if (o.ea == EA_DIRECT) {
+            p = putNumber(p, (uint16_t)o.value, 4);
+        } else {
+            p = putString(p, eaNames[o.ea]);
+            int disp = (int16_t)o.value;
+            if (disp) {
+                *p++ = disp < 0 ? '-' : '+';
+                p = putNumber(p, (unsigned)(disp < 0 ? -disp : disp));
+            }
+        }
+        *p++ = ']';
+        return p;
+    default:
+        return p;
+    }
+}
+
+size_t formatInstruction(const DisasmInsn& insn, char* text) {
+    char* p = text;
+    DecodedInsn d;
+    if (insn.row == DISASM_DATA || !decodeBytes(insn.bytes, (uint16_t)insn.address, d)) {
+        p = putString(p, "DB ");
+        p = putNumber(p, insn.bytes[0], 2);
+        *p = '\0';
+        return (size_t)(p - text);
+    }
+
+    const InstrForm& form = *d.form;
+    if (d.repeat == REP_NZ) {
+        p = putString(p, "REPNE ");
+    } else if (d.repeat == REP_Z) {
+        // F3 tests ZF only for the comparing instructions
+        bool compares = form.op == OP_CMPSB || form.op == OP_CMPSW || form.op == OP_SCASB || form.op == OP_SCASW;
+        p = putString(p, compares ? "REPE " : "REP ");
+    }
+    p = putString(p, opcodeName(form.op));
+
+    // Nothing else gives the width of MOV [BX], 5 or INC [0100H]
+    bool sized = (d.dst.type == MEM && d.src.type != REG) || (d.src.type == MEM && d.dst.type != REG);
+    bool branch = form.src == F_NONE && (form.dst == F_REL8 || form.dst == F_REL16);
+
+    const DecodedOperand* ops[2] = {&d.dst, &d.src};
+    for (int k = 0; k < 2 && ops[k]->type != NONE; k++) {
+        p = putString(p, k ? ", " : " ");
+        if (sized && ops[k]->type == MEM)
+            p = putString(p, d.width == 1 ? "BYTE PTR " : "WORD PTR ");
+        p = putOperand(p, *ops[k], branch);
+    }
+    *p = '\0';
+    return (size_t)(p - text);
+}
+
+size_t formatLine(const DisasmInsn& insn, char* text) {
+    char* p = putHex(text, insn.address, insn.address > 0xFFFF ? 8 : 4);
+    *p++ = ' ';
+    *p++ = ' ';
+    for (int i = 0; i < DECODE_MAX_LENGTH; i++) {
+        if (i < insn.length) {
+            p = putHex(p, insn.bytes[i], 2);
+        } else {
+            *p++ = ' ';
+            *p++ = ' ';
+        }
+        *p++ = ' ';
+    }
+    *p++ = ' ';
+    return (size_t)(p - text) + formatInstruction(insn, p);
+}
+
+/* =========================================
+   Listing
+========================================= */
+void writeListing(ostream& out, const uint8_t* code, size_t size, const vector<CodeOrigin>& origins,
+                  string_view source) {
+    vector<DisasmInsn> insns;
+    disassemble(code, size, 0, insns);
+
+    vector<size_t> lineStart = {0};
+    for (size_t i = 0; i < source.size(); i++)
+        if (source[i] == '\n')
+            lineStart.push_back(i + 1);
+    if (lineStart.back() == source.size())
+        lineStart.pop_back();
+
+    char buffer[7 + DISASM_LINE_MAX];
+    size_t printed = 0;                 // source lines listed so far
+    auto listThrough = [&](size_t lines) {
+        for (; printed < lines; printed++) {
+            size_t begin = lineStart[printed];
+            size_t end = printed + 1 < lineStart.size() ? lineStart[printed + 1] : source.size();
+            string_view text = source.substr(begin, end - begin);
+            while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+                text.remove_suffix(1);
+            int n = snprintf(buffer, sizeof(buffer), "%5zu  ", printed + 1);
+            out.write(buffer, n);
+            out << text << '\n';
+        }
+    };
+
+    size_t next = 0;                    // first origin not yet reached
+    for (const DisasmInsn& insn : insns) {
+        for (; next < origins.size() && origins[next].address <= insn.address; next++) {
+            uint32_t offset = origins[next].source;
+            if (offset != NO_SOURCE && offset < source.size())
+                listThrough(upper_bound(lineStart.begin(), lineStart.end(), offset) - lineStart.begin());
+        }
+
+        char* p = buffer + formatLine(insn, buffer + 7) + 7;
+        memset(buffer, ' ', 7);
+        *p++ = '\n';
+        out.write(buffer, p - buffer);
+    }
+    listThrough(lineStart.size());
+}
@@ -0,0 +1,77 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "decoder.h"
+
+using namespace std;
+
+/* ================= Disassembler ================= */
+/*
+   Linear sweep over a code image through the emulator's decoder
+   (decoder.h), so it reads exactly the forms the encoder emits. The
+   sweep only sizes each instruction (decodeShape) and keeps its bytes
+   in a 16-byte DisasmInsn; operands are decoded, and text built, when
+   formatInstruction asks for them. A byte that starts no known form
+   becomes a one-byte DB and the sweep carries on after it.
+
+   Output follows the assembler's own syntax: hexadecimal numbers carry
+   an H suffix (0FFH), memory operands are [BX+SI+4] or [0100H], and a
+   memory operand with no register beside it gets BYTE PTR or WORD PTR.
+   Branch targets are offsets in the instruction's 64 KB segment.
+*/
+constexpr uint16_t DISASM_DATA = SHAPE_UNKNOWN;     // row of a byte that is no instruction
+
+struct DisasmInsn {
+    uint32_t address;       // base + offset in the image
+    uint16_t row;           // instrForms index, or DISASM_DATA
+    uint8_t length;         // bytes, prefix included
+    uint8_t repeat;         // RepeatPrefix
+    uint8_t bytes[8];       // the instruction, then whatever followed it (zeros past the image)
+};
+
+static_assert(sizeof(DisasmInsn) == 16, "DisasmInsn should stay compact");
+
+// Longest text formatInstruction writes, terminator included
+constexpr size_t DISASM_TEXT_MAX = 48;
+
+// Append the instructions of code[0, size), loaded at base
+void disassemble(const uint8_t* code, size_t size, uint32_t base, vector<DisasmInsn>& out);
+
+// Write insn as assembler text into text[DISASM_TEXT_MAX]; returns its length
+size_t formatInstruction(const DisasmInsn& insn, char* text);
+
+inline string formatInstruction(const DisasmInsn& insn) {
+    char text[DISASM_TEXT_MAX];
+    size_t length = formatInstruction(insn, text);
+    return string(text, length);
+}
+
+// Longest text formatLine writes, terminator included
+constexpr size_t DISASM_LINE_MAX = 8 + 2 + 3 * DECODE_MAX_LENGTH + 1 + DISASM_TEXT_MAX;
+
+// "0100  B8 28 00            MOV AX, 28H": address, bytes, then formatInstruction
+size_t formatLine(const DisasmInsn& insn, char* text);
+
+/*
+   Listing of an assembled image: every line of source in order, each
+   followed by the instructions it produced, as address, bytes and
+   disassembly. origins maps instruction addresses, in increasing order,
+   to byte offsets in source; an origin covers every instruction up to
+   the next one, and code before the first origin lists ahead of the
+   source.
+*/
+struct CodeOrigin {
+    uint32_t address;
+    uint32_t source;        // offset in source, or NO_SOURCE
+};
+
+void writeListing(ostream& out, const uint8_t* code, size_t size, const vector<CodeOrigin>& origins,
+                  string_view source);
+
+#endif
@@ -0,0 +1,112 @@
+#include "driver.h"
+#include "incremental.h"
+#include "workpool.h"
+#include <cctype>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+using namespace std;
+
+string outputPathFor(const string& input) {
+    size_t dot = input.find_last_of('.');
+    size_t slash = input.find_last_of("/\\");
+    if (dot != string::npos && (slash == string::npos || dot > slash)) {
+        string ext = input.substr(dot);
+        for (char& c : ext)
+            c = (char)tolower((unsigned char)c);
+        if (ext == ".asm")
+            return input.substr(0, dot) + ".bin";
+    }
+    return input + ".bin";
+}
+
+static void assembleOne(const string& input, const CompileOptions& options, FileResult& result) {
+    result.input = input;
+    result.output = outputPathFor(input);
+    try {
+        Compilation unit;
+        assembleFile(unit, input, options);
+
+        ofstream out(result.output, ios::binary);
+        out.write((const char*)unit.machineCode.data(), unit.machineCode.size());
+        if (!out.flush())
+            throw runtime_error("Cannot write " + result.output);
+        result.bytes = unit.machineCode.size();
+        result.cached = unit.cached;
+    } catch (const exception& e) {
+        result.error = e.what();
+    }
+}
+
+/* ================================
+   DRIVER ENTRY
+================================ */
+vector<FileResult> assembleFiles(const vector<string>& inputs, const CompileOptions& options,
+                                 unsigned threads) {
+    vector<FileResult> results(inputs.size());
+    runPool(inputs.size(), poolSize(inputs.size(), threads), [&](unsigned, size_t i) {
+        assembleOne(inputs[i], options, results[i]);
+    });
+    return results;
+}
+
+/* ================================
+   WATCH MODE
+================================ */
+void watchFile(const string& input, const CompileOptions& options, ostream& log) {
+    namespace fs = std::filesystem;
+    const string output = outputPathFor(input);
+    IncrementalAssembler assembler(options.optLevel);
+    fs::file_time_type seen;
+    uintmax_t seenSize = 0;
+    bool first = true;
+
+    for (;; this_thread::sleep_for(chrono::milliseconds(100))) {
+        // Rebuild on any change of time or size; editors may save within one timestamp tick
+        error_code ec;
+        fs::file_time_type modified = fs::last_write_time(input, ec);
+        uintmax_t size = ec ? 0 : fs::file_size(input, ec);
+        if (ec || (!first && modified == seen && size == seenSize))
+            continue;
+        seen = modified;
+        seenSize = size;
+        first = false;
+
+        ifstream fin(input, ios::binary);
+        if (!fin)
+            continue;
+        string text(istreambuf_iterator<char>(fin), (istreambuf_iterator<char>()));
+
+        auto start = chrono::steady_clock::now();
+        try {
+            assembler.update(text);
+        } catch (const exception& e) {
+            log << input << ": " << e.what() << endl;
+            continue;
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        const vector<uint8_t>& code = assembler.machineCode();
+        ofstream out(output, ios::binary);
+        out.write((const char*)code.data(), code.size());
+        if (!out.flush()) {
+            log << "Cannot write " << output << endl;
+            continue;
+        }
+
+        const IncrementalStats& st = assembler.stats();
+        log << input << " -> " << output << " (" << code.size() << " bytes, ";
+        if (st.fullBuild)
+            log << "full build";
+        else
+            log << st.linesParsed << "/" << st.lines << " lines parsed, "
+                << st.instructionsEncoded << "/" << st.instructions << " instructions encoded";
+        log << ", " << ms << " ms)" << endl;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "compilation.h"
+
+using namespace std;
+
+/* ================= Multi-File Driver ================= */
+/*
+   Assembles many independent source files on the work-stealing pool
+   (workpool.h), one Compilation per file, and writes each file's
+   machine code to its output path as a flat binary. A file that fails
+   to assemble or write is reported in its result and does not stop
+   the others.
+*/
+struct FileResult {
+    string input;
+    string output;
+    size_t bytes = 0;       // machine code size
+    bool cached = false;    // came from options.cache
+    string error;           // empty on success
+};
+
+// foo.asm -> foo.bin (any other name just gets .bin appended)
+string outputPathFor(const string& input);
+
+// threads = 0: one per hardware thread
+vector<FileResult> assembleFiles(const vector<string>& inputs, const CompileOptions& options,
+                                 unsigned threads = 0);
+
+/*
+   Watch mode: assemble input to its output path, then poll it for
+   changes and re-assemble each saved version incrementally
+   (incremental.h), logging one line per build. Runs until killed.
+*/
+void watchFile(const string& input, const CompileOptions& options, ostream& log);
+
+#endif
@@ -1,180 +1,1455 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <stdexcept>
 #include <string>
+#include "backend.h"
+#include "decoder.h"
+#include "emulator.h"
+#include "jit.h"
+#include "flags.h"
+#include "timing.h"
+#include "trace.h"
 
 using namespace std;
 
+template <typename T> static inline T rd(const uint8_t* p) { T v; memcpy(&v, p, sizeof v); return v; }
+template <typename T> static inline void wr(uint8_t* p, T v) { memcpy(p, &v, sizeof v); }
+
+/* ================================
+   PRE-DECODED INSTRUCTIONS
+   Each guest instruction is decoded once into a record that
+   names its handler and points straight at its operands
+   (a register slot, a memory byte, or the record's own
+   immediate). Records are cached per IP; K_DECODE marks an
+   empty slot, so the first execution fills it.
+================================ */
+#define HANDLER_LIST(X) \
+    X(DECODE) X(EA) X(INVALID) \
+    X(MOV8) X(MOV16) X(XCHG8) X(XCHG16) X(LEA) \
+    X(ADD8) X(ADD16) X(ADC8) X(ADC16) X(SUB8) X(SUB16) X(SBB8) X(SBB16) \
+    X(CMP8) X(CMP16) X(TEST8) X(TEST16) \
+    X(AND8) X(AND16) X(OR8) X(OR16) X(XOR8) X(XOR16) \
+    X(INC8) X(INC16) X(DEC8) X(DEC16) \
+    X(NOT8) X(NOT16) X(NEG8) X(NEG16) \
+    X(MUL8) X(MUL16) X(IMUL8) X(IMUL16) \
+    X(DIV8) X(DIV16) X(IDIV8) X(IDIV16) \
+    X(SHL8) X(SHL16) X(SHR8) X(SHR16) X(SAR8) X(SAR16) \
+    X(ROL8) X(ROL16) X(ROR8) X(ROR16) X(RCL8) X(RCL16) X(RCR8) X(RCR16) \
+    X(PUSH) X(POP) X(PUSHF) X(POPF) X(LAHF) X(SAHF) \
+    X(CLC) X(STC) X(CMC) X(CLD) X(STD) X(CLI) X(STI) \
+    X(JMP) X(JMP_IND) X(CALL) X(CALL_IND) X(RET) X(RET_N) \
+    X(JO) X(JNO) X(JB) X(JAE) X(JE) X(JNE) X(JBE) X(JA) \
+    X(JS) X(JNS) X(JL) X(JGE) X(JLE) X(JG) \
+    X(LOOP) X(LOOPE) X(LOOPNE) X(JCXZ) X(XLAT) X(NOP) X(HLT) \
+    X(MOVS8) X(MOVS16) X(CMPS8) X(CMPS16) X(STOS8) X(STOS16) \
+    X(LODS8) X(LODS16) X(SCAS8) X(SCAS16) \
+    X(NATIVE)
+
+enum HandlerKind : uint8_t {
+#define X(name) K_##name,
+    HANDLER_LIST(X)
+#undef X
+    K_COUNT
+};
+
+struct DecodedOp {
+    uint8_t* dst;           // operand pointers; null when absent
+    uint8_t* src;
+    uint16_t imm;           // immediate, branch target, RET count or string RepeatPrefix
+    uint16_t next;          // IP of the following instruction
+    uint16_t disp;          // K_EA: displacement added to the base registers
+    uint8_t kind;           // HandlerKind
+    uint8_t body;           // K_EA: handler to run once the address is known
+    uint8_t ea;             // K_EA: EffectiveAddress
+    uint8_t eaOperand;      // K_EA: 0 = dst, 1 = src
+    uint8_t length;
+    bool dstMem;            // writes through dst must check for decoded code
+    uint16_t cycles;        // 8086 clocks (timing.h), charged by EXEC_PROFILE
+    uint8_t takenCycles;
+    uint8_t wordTransfers;
+};
+
+constexpr int MAX_INSN_LENGTH = 6;
+
 /* ================================
-   CPU STATE
+   JIT TIER
+   Taken branches heat their target; at JIT_HOT_THRESHOLD the
+   block there is translated and its record switched to
+   K_NATIVE. blockAt[ip] is a jitBlocks index + 1, 0 if none.
 ================================ */
-struct CPU {
-    uint16_t AX = 0, BX = 0, CX = 0, DX = 0;
-    uint16_t SP = 0, BP = 0, SI = 0, DI = 0;
-    uint16_t IP = 0;
-    bool halted = false;
+enum ExecMode {
+    EXEC_INTERPRET,     // interpreter only
+    EXEC_TIERED,        // interpreter, promoting hot blocks to native code
+    EXEC_STEP,          // reference run for a fixed number of instructions
+    EXEC_PROFILE,       // interpreter counting 8086 cycles per IP
+    EXEC_TRACE          // interpreter recording every step to a TraceWriter
 };
 
+constexpr int MAX_BLOCK_BYTES = JIT_MAX_BLOCK_INSNS * MAX_INSN_LENGTH;
+
 /* ================================
-   MEMORY
+   MACHINE STATE
+   Memory is flat 64 KB; segment registers are kept but not
+   applied. A guard page lets a word access at FFFF stay
+   in bounds. Everything a run touches lives here, so
+   separate machines never share state.
+
+   Every store marks its 256-byte page dirty: relative to
+   the snapshot if there is one, else to all-zero memory.
+   Resets copy back or clear only those pages.
 ================================ */
-static uint8_t memory[65536];
+struct ProfileCounter {
+    uint64_t count;
+    uint64_t cycles;
+};
+
+constexpr int PAGE_SHIFT = 8;
+constexpr int PAGE_SIZE = 1 << PAGE_SHIFT;
+constexpr int PAGE_COUNT = (65536 >> PAGE_SHIFT) + 1;
+
+struct MachineState {
+    CPU cpu;
+    uint8_t memory[PAGE_COUNT * PAGE_SIZE];
+    uint8_t dirty[PAGE_COUNT];
+    uint16_t dirtyPages[PAGE_COUNT];    // the pages marked in dirty, in marking order
+    uint32_t dirtyCount;
+    bool hasSnapshot;
+    CPU snapshotCpu;
+    uint8_t snapshotMemory[PAGE_COUNT * PAGE_SIZE];
+    DecodedOp decodeCache[65536];
+    uint8_t codeMap[65536 + 2];         // decoded records and JIT blocks covering each byte
+    uint32_t codePages[PAGE_COUNT];     // the same counts summed per page
+    vector<uint16_t> decodedIPs;        // slots to clear before the next run
+    uint32_t heat[65536];
+    uint32_t blockAt[65536];
+    vector<JitBlock> jitBlocks;
+    JitCodeBuffer jitCode;
+    bool verifyJit;
+    bool heatUsed;                      // heat must be cleared before the next image
+    vector<ProfileCounter> profile;     // per IP; empty until the first profiled run
+    uint64_t profileCycles;
+    unique_ptr<TraceWriter> trace;      // set by Machine::traceTo
+};
 
 /* ================================
    Helpers
 ================================ */
-static uint16_t& getReg(CPU& cpu, int reg) {
-    switch (reg) {
-        case 0: return cpu.AX;
-        case 1: return cpu.CX;
-        case 2: return cpu.DX;
-        case 3: return cpu.BX;
-        case 4: return cpu.SP;
-        case 5: return cpu.BP;
-        case 6: return cpu.SI;
-        case 7: return cpu.DI;
-        default: throw runtime_error("Invalid register");
+// AL..BH are the low/high halves of AX..BX
+static uint8_t* regPtr(CPU& cpu, int id) {
+    if (id <= REG_DI)
+        return (uint8_t*)&cpu.regs[id];
+    if (id <= REG_BH) {
+        int r = id - REG_AL;
+        return (uint8_t*)&cpu.regs[r & 3] + (r >> 2);
     }
+    return (uint8_t*)&cpu.sregs[id - REG_ES];
 }
 
-static uint8_t fetch8(CPU& cpu) {
-    return memory[cpu.IP++];
+static uint16_t effectiveAddress(const CPU& cpu, uint8_t ea, uint16_t disp) {
+    const uint16_t* r = cpu.regs;
+    switch (ea) {
+    case EA_BX_SI: return r[REG_BX] + r[REG_SI] + disp;
+    case EA_BX_DI: return r[REG_BX] + r[REG_DI] + disp;
+    case EA_BP_SI: return r[REG_BP] + r[REG_SI] + disp;
+    case EA_BP_DI: return r[REG_BP] + r[REG_DI] + disp;
+    case EA_SI:    return r[REG_SI] + disp;
+    case EA_DI:    return r[REG_DI] + disp;
+    case EA_BP:    return r[REG_BP] + disp;
+    default:       return r[REG_BX] + disp;
+    }
 }
 
-static uint16_t fetch16(CPU& cpu) {
-    uint16_t lo = fetch8(cpu);
-    uint16_t hi = fetch8(cpu);
-    return lo | (hi << 8);
+static HandlerKind handlerFor(const DecodedInsn& d) {
+    bool b = d.width == 1;
+    switch (d.opcode) {
+    case OP_MOV:  return b ? K_MOV8  : K_MOV16;
+    case OP_XCHG: return b ? K_XCHG8 : K_XCHG16;
+    case OP_LEA:  return K_LEA;
+    case OP_ADD:  return b ? K_ADD8  : K_ADD16;
+    case OP_ADC:  return b ? K_ADC8  : K_ADC16;
+    case OP_SUB:  return b ? K_SUB8  : K_SUB16;
+    case OP_SBB:  return b ? K_SBB8  : K_SBB16;
+    case OP_CMP:  return b ? K_CMP8  : K_CMP16;
+    case OP_TEST: return b ? K_TEST8 : K_TEST16;
+    case OP_AND:  return b ? K_AND8  : K_AND16;
+    case OP_OR:   return b ? K_OR8   : K_OR16;
+    case OP_XOR:  return b ? K_XOR8  : K_XOR16;
+    case OP_INC:  return b ? K_INC8  : K_INC16;
+    case OP_DEC:  return b ? K_DEC8  : K_DEC16;
+    case OP_NOT:  return b ? K_NOT8  : K_NOT16;
+    case OP_NEG:  return b ? K_NEG8  : K_NEG16;
+    case OP_MUL:  return b ? K_MUL8  : K_MUL16;
+    case OP_IMUL: return b ? K_IMUL8 : K_IMUL16;
+    case OP_DIV:  return b ? K_DIV8  : K_DIV16;
+    case OP_IDIV: return b ? K_IDIV8 : K_IDIV16;
+    case OP_SHL:
+    case OP_SAL:  return b ? K_SHL8  : K_SHL16;
+    case OP_SHR:  return b ? K_SHR8  : K_SHR16;
+    case OP_SAR:  return b ? K_SAR8  : K_SAR16;
+    case OP_ROL:  return b ? K_ROL8  : K_ROL16;
+    case OP_ROR:  return b ? K_ROR8  : K_ROR16;
+    case OP_RCL:  return b ? K_RCL8  : K_RCL16;
+    case OP_RCR:  return b ? K_RCR8  : K_RCR16;
+    case OP_PUSH: return K_PUSH;
+    case OP_POP:  return K_POP;
+    case OP_PUSHF: return K_PUSHF;
+    case OP_POPF: return K_POPF;
+    case OP_LAHF: return K_LAHF;
+    case OP_SAHF: return K_SAHF;
+    case OP_CLC:  return K_CLC;
+    case OP_STC:  return K_STC;
+    case OP_CMC:  return K_CMC;
+    case OP_CLD:  return K_CLD;
+    case OP_STD:  return K_STD;
+    case OP_CLI:  return K_CLI;
+    case OP_STI:  return K_STI;
+    case OP_JO:   return K_JO;
+    case OP_JNO:  return K_JNO;
+    case OP_JB:
+    case OP_JC:   return K_JB;
+    case OP_JAE:
+    case OP_JNC:  return K_JAE;
+    case OP_JE:
+    case OP_JZ:   return K_JE;
+    case OP_JNE:
+    case OP_JNZ:  return K_JNE;
+    case OP_JBE:  return K_JBE;
+    case OP_JA:   return K_JA;
+    case OP_JS:   return K_JS;
+    case OP_JNS:  return K_JNS;
+    case OP_JL:   return K_JL;
+    case OP_JGE:  return K_JGE;
+    case OP_JLE:  return K_JLE;
+    case OP_JG:   return K_JG;
+    case OP_LOOPE:  return K_LOOPE;
+    case OP_LOOPNE: return K_LOOPNE;
+    case OP_JMP:  return d.dst.type == IMM ? K_JMP  : K_JMP_IND;
+    case OP_CALL: return d.dst.type == IMM ? K_CALL : K_CALL_IND;
+    case OP_RET:  return d.dst.type == IMM ? K_RET_N : K_RET;
+    case OP_LOOP: return K_LOOP;
+    case OP_JCXZ: return K_JCXZ;
+    case OP_XLAT: return K_XLAT;
+    case OP_NOP:  return K_NOP;
+    case OP_HLT:  return K_HLT;
+    case OP_MOVSB: return K_MOVS8;
+    case OP_MOVSW: return K_MOVS16;
+    case OP_CMPSB: return K_CMPS8;
+    case OP_CMPSW: return K_CMPS16;
+    case OP_STOSB: return K_STOS8;
+    case OP_STOSW: return K_STOS16;
+    case OP_LODSB: return K_LODS8;
+    case OP_LODSW: return K_LODS16;
+    case OP_SCASB: return K_SCAS8;
+    case OP_SCASW: return K_SCAS16;
+    // Before anything but a string instruction a prefix changes nothing
+    case OP_REP: case OP_REPE: case OP_REPZ: case OP_REPNE: case OP_REPNZ:
+        return K_NOP;
+    default:      return K_INVALID;
+    }
 }
 
-/* ================================
-   EMULATOR CORE
-================================ */
-void runEmulator(const vector<uint8_t>& machineCode) {
-    CPU cpu;
+static void bindOperand(MachineState& m, DecodedOp& op, const DecodedOperand& o, int which) {
+    uint8_t*& slot = which == 0 ? op.dst : op.src;
+    switch (o.type) {
+    case REG:
+        slot = regPtr(m.cpu, o.value);
+        break;
+    case IMM:
+        op.imm = (uint16_t)o.value;
+        slot = (uint8_t*)&op.imm;
+        break;
+    case MEM:
+        if (which == 0)
+            op.dstMem = true;
+        if (o.ea == EA_DIRECT) {
+            slot = m.memory + (uint16_t)o.value;
+        } else {
+            op.body = op.kind;
+            op.kind = K_EA;
+            op.ea = o.ea;
+            op.disp = (uint16_t)o.value;
+            op.eaOperand = (uint8_t)which;
+        }
+        break;
+    default:
+        slot = nullptr;
+        break;
+    }
+}
 
-    // Load code into memory
-    for (size_t i = 0; i < machineCode.size(); i++)
-        memory[i] = machineCode[i];
+static void decodeRecord(MachineState& m, uint16_t ip, DecodedOp& op) {
+    op = DecodedOp();
 
-    cpu.IP = 0;
+    DecodedInsn d;
+    if (!decodeInstruction(m.memory, ip, d)) {
+        op.kind = K_INVALID;
+        op.length = 1;
+        op.next = ip + 1;
+        return;
+    }
 
-    while (!cpu.halted) {
-        uint8_t opcode = fetch8(cpu);
+    // XCHG is symmetric; keep a memory operand on the dst side
+    if (d.opcode == OP_XCHG && d.src.type == MEM)
+        swap(d.dst, d.src);
 
-        switch (opcode) {
+    op.kind = handlerFor(d);
+    op.length = d.length;
+    op.next = ip + d.length;
+    InsnTiming t = instructionTiming(d);
+    op.cycles = t.cycles;
+    op.takenCycles = t.takenCycles;
+    op.wordTransfers = t.wordTransfers;
+    op.imm = d.repeat;                  // string instructions have no operands
+    bindOperand(m, op, d.dst, 0);
+    bindOperand(m, op, d.src, 1);
+}
 
-        /* -------- MOV r16, imm16 -------- */
-        case 0xB8: case 0xB9: case 0xBA: case 0xBB:
-        case 0xBC: case 0xBD: case 0xBE: case 0xBF: {
-            int reg = opcode - 0xB8;
-            getReg(cpu, reg) = fetch16(cpu);
-            break;
-        }
+static void coverCode(MachineState& m, uint16_t start, int length, int delta) {
+    for (int i = 0; i < length; i++) {
+        uint16_t b = start + i;
+        m.codeMap[b] += delta;
+        m.codePages[b >> PAGE_SHIFT] += delta;
+    }
+}
 
-        /* -------- MOV r16, r/m16 -------- */
-        case 0x8B: {
-            uint8_t modrm = fetch8(cpu);
-            int mod = modrm >> 6;
-            int reg = (modrm >> 3) & 7;
-            int rm  = modrm & 7;
-
-            if (mod == 0b11) {
-                getReg(cpu, reg) = getReg(cpu, rm);
-            } else if (mod == 0b00 && rm == 0b110) {
-                uint16_t addr = fetch16(cpu);
-                getReg(cpu, reg) = *(uint16_t*)&memory[addr];
-            }
-            break;
-        }
+static void predecode(MachineState& m, uint16_t ip, DecodedOp& op) {
+    bool listed = op.length != 0;       // decoded before, and still in decodedIPs
+    decodeRecord(m, ip, op);
+    if (!listed)
+        m.decodedIPs.push_back(ip);
+    coverCode(m, ip, op.length, 1);
+}
+
+static void invalidate(MachineState& m, uint16_t ip) {
+    DecodedOp& op = m.decodeCache[ip];
+    op.kind = K_DECODE;
+    coverCode(m, ip, op.length, -1);
+}
+
+static void dropBlock(MachineState& m, uint32_t index) {
+    JitBlock& b = m.jitBlocks[index];
+    m.blockAt[b.start] = 0;
+    m.heat[b.start] = 0;
+    coverCode(m, b.start, b.length, -1);
+    if (m.decodeCache[b.start].kind == K_NATIVE)
+        invalidate(m, b.start);
+    b.entry = nullptr;
+}
 
-        /* -------- MOV r/m16, r16 -------- */
-        case 0x89: {
-            uint8_t modrm = fetch8(cpu);
-            int mod = modrm >> 6;
-            int reg = (modrm >> 3) & 7;
-            int rm  = modrm & 7;
-
-            if (mod == 0b11) {
-                getReg(cpu, rm) = getReg(cpu, reg);
-            } else if (mod == 0b00 && rm == 0b110) {
-                uint16_t addr = fetch16(cpu);
-                *(uint16_t*)&memory[addr] = getReg(cpu, reg);
-            }
-            break;
+static void dropAllBlocks(MachineState& m) {
+    for (uint32_t i = 0; i < m.jitBlocks.size(); i++)
+        if (m.jitBlocks[i].entry)
+            dropBlock(m, i);
+    m.jitBlocks.clear();
+    jitReset(m.jitCode);
+}
+
+static void markDirty(MachineState& m, uint32_t addr, uint32_t n) {
+    for (uint32_t p = addr >> PAGE_SHIFT; p <= (addr + n - 1) >> PAGE_SHIFT; p++) {
+        if (!m.dirty[p]) {
+            m.dirty[p] = 1;
+            m.dirtyPages[m.dirtyCount++] = (uint16_t)p;
         }
+    }
+}
 
-        /* -------- ADD r16, r/m16 -------- */
-        case 0x03: {
-            uint8_t modrm = fetch8(cpu);
-            int mod = modrm >> 6;
-            int reg = (modrm >> 3) & 7;
-            int rm  = modrm & 7;
-
-            if (mod == 0b11) {
-                getReg(cpu, reg) += getReg(cpu, rm);
-            } else if (mod == 0b00 && rm == 0b110) {
-                uint16_t addr = fetch16(cpu);
-                getReg(cpu, reg) += *(uint16_t*)&memory[addr];
-            }
-            break;
+static void clearDirty(MachineState& m) {
+    for (uint32_t i = 0; i < m.dirtyCount; i++)
+        m.dirty[m.dirtyPages[i]] = 0;
+    m.dirtyCount = 0;
+}
+
+// Bytes [addr, addr+n) changed: drop every record and block that covers them
+static void dropCodeAt(MachineState& m, uint16_t addr, int n) {
+    for (int i = 0; i < n; i++) {
+        uint16_t b = addr + i;
+        if (!m.codeMap[b])
+            continue;
+        for (int back = 0; back < MAX_INSN_LENGTH; back++) {
+            uint16_t s = b - back;
+            if (m.decodeCache[s].kind != K_DECODE && back < m.decodeCache[s].length)
+                invalidate(m, s);
+        }
+        if (m.jitBlocks.empty())
+            continue;
+        for (int back = 0; back < MAX_BLOCK_BYTES; back++) {
+            uint16_t s = b - back;
+            if (m.blockAt[s] && back < m.jitBlocks[m.blockAt[s] - 1].length)
+                dropBlock(m, m.blockAt[s] - 1);
         }
+    }
+}
+
+// A guest store hit [addr, addr+n)
+static void noteWrite(MachineState& m, uint16_t addr, int n) {
+    markDirty(m, addr, n);
+    dropCodeAt(m, addr, n);
+}
+
+// Every record and block gives back its codeMap counts, leaving the map all zero
+static void resetDecodeCache(MachineState& m) {
+    dropAllBlocks(m);
+    for (uint16_t ip : m.decodedIPs) {
+        if (m.decodeCache[ip].kind != K_DECODE)
+            invalidate(m, ip);
+        m.decodeCache[ip].length = 0;
+    }
+    m.decodedIPs.clear();
+}
 
-        /* -------- ADD r/m16, r16 -------- */
-        case 0x01: {
-            uint8_t modrm = fetch8(cpu);
-            int mod = modrm >> 6;
-            int reg = (modrm >> 3) & 7;
-            int rm  = modrm & 7;
-
-            if (mod == 0b11) {
-                getReg(cpu, rm) += getReg(cpu, reg);
-            } else if (mod == 0b00 && rm == 0b110) {
-                uint16_t addr = fetch16(cpu);
-                *(uint16_t*)&memory[addr] += getReg(cpu, reg);
-            }
-            break;
+// The block at ip became hot: translate it and enter it from its record
+static void promote(MachineState& m, uint16_t ip) {
+    DecodedOp& op = m.decodeCache[ip];
+    if (op.kind == K_DECODE)
+        predecode(m, ip, op);
+    if (op.kind == K_NATIVE || op.kind == K_INVALID)
+        return;
+
+    JitBlock block;
+    JitCompileResult r = jitCompileBlock(m.jitCode, m.memory, ip, block);
+    if (r == JIT_CODE_FULL) {
+        dropAllBlocks(m);
+        if (op.kind == K_DECODE)
+            predecode(m, ip, op);
+        r = jitCompileBlock(m.jitCode, m.memory, ip, block);
+    }
+    if (r != JIT_OK)
+        return;
+
+    coverCode(m, ip, block.length, 1);
+    m.jitBlocks.push_back(move(block));
+    m.blockAt[ip] = (uint32_t)m.jitBlocks.size();
+    op.kind = K_NATIVE;
+}
+
+[[noreturn]] static void unsupportedAt(const uint8_t* memory, uint16_t ip) {
+    DecodedInsn d;
+    if (!decodeInstruction(memory, ip, d))
+        throw runtime_error("Unknown opcode: " + to_string(memory[ip]) + " at IP " + to_string(ip));
+    throw runtime_error("Emulator does not support " + string(opcodeName(d.opcode)) +
+                        " at IP " + to_string(ip));
+}
+
+/*
+   Rotates change only CF and OF, so the other flags are folded
+   into cpu.flags first. The count is not reduced: the 8086
+   really rotates c times.
+*/
+static void setRotateFlags(CPU& cpu, bool cf, bool of) {
+    uint16_t f = materializeFlags(cpu) & ~(FLAG_CF | FLAG_OF);
+    cpu.flags = f | (cf ? FLAG_CF : 0) | (of ? FLAG_OF : 0);
+}
+
+template <typename T> static T rotateLeft(CPU& cpu, T v, unsigned c) {
+    const unsigned bits = sizeof(T) * 8;
+    T r = (T)((v << (c % bits)) | (v >> ((bits - c % bits) % bits)));
+    bool cf = r & 1;
+    setRotateFlags(cpu, cf, ((r >> (bits - 1)) & 1) != cf);
+    return r;
+}
+
+template <typename T> static T rotateRight(CPU& cpu, T v, unsigned c) {
+    const unsigned bits = sizeof(T) * 8;
+    T r = (T)((v >> (c % bits)) | (v << ((bits - c % bits) % bits)));
+    bool msb = (r >> (bits - 1)) & 1;
+    setRotateFlags(cpu, msb, msb != (bool)((r >> (bits - 2)) & 1));
+    return r;
+}
+
+template <typename T> static T rotateCarryLeft(CPU& cpu, T v, unsigned c) {
+    const unsigned bits = sizeof(T) * 8;
+    bool cf = flagCF(cpu);
+    for (unsigned i = 0; i < c; i++) {
+        bool out = (v >> (bits - 1)) & 1;
+        v = (T)((v << 1) | cf);
+        cf = out;
+    }
+    setRotateFlags(cpu, cf, (bool)((v >> (bits - 1)) & 1) != cf);
+    return v;
+}
+
+template <typename T> static T rotateCarryRight(CPU& cpu, T v, unsigned c) {
+    const unsigned bits = sizeof(T) * 8;
+    bool cf = flagCF(cpu);
+    bool of = false;
+    for (unsigned i = 0; i < c; i++) {
+        of = (bool)((v >> (bits - 1)) & 1) != cf;
+        bool out = v & 1;
+        v = (T)((v >> 1) | ((T)cf << (bits - 1)));
+        cf = out;
+    }
+    setRotateFlags(cpu, cf, of);
+    return v;
+}
+
+[[noreturn]] static void divideError(uint16_t ip) {
+    throw runtime_error("Divide error at IP " + to_string(ip));
+}
+
+/* ================================
+   STRING INSTRUCTIONS
+   Run once, or CX times under a REP prefix, REPE and REPNE
+   also stopping after the first unequal or equal comparison.
+   SI and DI step by the element size, down when DF is set.
+   Each returns the repetitions done.
+
+   A repeat whose elements do not wrap at FFFF runs in bulk:
+   MOVS as one memmove unless the copy overlaps its own
+   source ahead of it, STOS as one fill, LODS as one load of
+   the last element, and CMPS or SCAS with DF clear as a scan
+   eight bytes at a time. The rest step element by element.
+   SI, DI, CX and the flags end the same either way.
+================================ */
+// Whether n >= 1 elements of size bytes from addr stay within 0..FFFF
+static bool withoutWrap(uint16_t addr, uint32_t n, int size, bool down) {
+    uint32_t reach = (n - 1) * size;
+    return down ? addr >= reach : addr + reach <= 0xFFFF;
+}
+
+static inline int lowestSetBit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    for (; !(x & 1); x >>= 1)
+        n++;
+    return n;
+#endif
+}
+
+/*
+   Index of the first element, walking up from a, that compares
+   equal (untilEqual) or unequal to the matching element of b, or to
+   value when b is null; n if there is none. Eight bytes are compared
+   at a time: in x = a ^ b a lane is zero exactly where the elements
+   match, and (x - ONES) & ~x & HIGHS marks the lowest zero lane
+   exactly (borrows only disturb the lanes above it).
+*/
+template <typename T>
+static uint32_t scanUp(const uint8_t* a, const uint8_t* b, T value, uint32_t n, bool untilEqual) {
+    const uint64_t ONES = sizeof(T) == 1 ? 0x0101010101010101ull : 0x0001000100010001ull;
+    const uint64_t HIGHS = ONES << (8 * sizeof(T) - 1);
+    const uint32_t lanes = 8 / sizeof(T);
+
+    if (sizeof(T) == 1 && !b && untilEqual) {
+        const void* hit = memchr(a, (uint8_t)value, n);
+        return hit ? (uint32_t)((const uint8_t*)hit - a) : n;
+    }
+
+    uint64_t pattern = ONES * value;
+    uint32_t i = 0;
+    if (b && !untilEqual)
+        while (i + 64 / sizeof(T) <= n && memcmp(a + i * sizeof(T), b + i * sizeof(T), 64) == 0)
+            i += 64 / sizeof(T);
+    for (; i + lanes <= n; i += lanes) {
+        uint64_t x = rd<uint64_t>(a + i * sizeof(T)) ^ (b ? rd<uint64_t>(b + i * sizeof(T)) : pattern);
+        uint64_t hits = untilEqual ? (x - ONES) & ~x & HIGHS : x;
+        if (hits)
+            return i + lowestSetBit(hits) / (8 * sizeof(T));
+    }
+    for (; i < n; i++) {
+        T x = rd<T>(a + i * sizeof(T));
+        if ((x == (b ? rd<T>(b + i * sizeof(T)) : value)) == untilEqual)
+            return i;
+    }
+    return n;
+}
+
+template <typename T> static uint32_t moveString(MachineState& m, uint8_t repeat) {
+    uint16_t* R = m.cpu.regs;
+    uint8_t* memory = m.memory;
+    bool down = m.cpu.flags & FLAG_DF;
+    int step = down ? -(int)sizeof(T) : (int)sizeof(T);
+    uint32_t n = repeat ? R[REG_CX] : 1;
+    uint16_t si = R[REG_SI], di = R[REG_DI];
+    if (n == 0)
+        return 0;
+
+    uint32_t reach = (n - 1) * sizeof(T), bytes = n * sizeof(T);
+    uint16_t from = down ? si - reach : si, to = down ? di - reach : di;
+    // Stepping reads what it stored when the copy runs into its source ahead of it
+    bool ahead = down ? to < from && from < to + bytes : from < to && to < from + bytes;
+    if (n > 1 && withoutWrap(si, n, sizeof(T), down) && withoutWrap(di, n, sizeof(T), down) && !ahead) {
+        memmove(memory + to, memory + from, bytes);
+    } else {
+        for (uint32_t i = 0; i < n; i++)
+            wr<T>(memory + (uint16_t)(di + i * step), rd<T>(memory + (uint16_t)(si + i * step)));
+    }
+
+    R[REG_SI] = (uint16_t)(si + n * step);
+    R[REG_DI] = (uint16_t)(di + n * step);
+    if (repeat)
+        R[REG_CX] = 0;
+    return n;
+}
+
+template <typename T> static uint32_t storeString(MachineState& m, uint8_t repeat) {
+    uint16_t* R = m.cpu.regs;
+    uint8_t* memory = m.memory;
+    bool down = m.cpu.flags & FLAG_DF;
+    int step = down ? -(int)sizeof(T) : (int)sizeof(T);
+    uint32_t n = repeat ? R[REG_CX] : 1;
+    uint16_t di = R[REG_DI];
+    T value = (T)R[REG_AX];
+    if (n == 0)
+        return 0;
+
+    uint32_t reach = (n - 1) * sizeof(T), bytes = n * sizeof(T);
+    if (n > 1 && withoutWrap(di, n, sizeof(T), down)) {
+        uint8_t* p = memory + (uint16_t)(down ? di - reach : di);
+        wr<T>(p, value);
+        for (uint32_t done = sizeof(T); done < bytes; done *= 2)
+            memcpy(p + done, p, min(done, bytes - done));
+    } else {
+        for (uint32_t i = 0; i < n; i++)
+            wr<T>(memory + (uint16_t)(di + i * step), value);
+    }
+
+    R[REG_DI] = (uint16_t)(di + n * step);
+    if (repeat)
+        R[REG_CX] = 0;
+    return n;
+}
+
+// Loads overwrite one another, so only the last element is read
+template <typename T> static uint32_t loadString(MachineState& m, uint8_t repeat) {
+    uint16_t* R = m.cpu.regs;
+    int step = m.cpu.flags & FLAG_DF ? -(int)sizeof(T) : (int)sizeof(T);
+    uint32_t n = repeat ? R[REG_CX] : 1;
+    uint16_t si = R[REG_SI];
+    if (n == 0)
+        return 0;
+
+    wr<T>(regPtr(m.cpu, REG_AL), rd<T>(m.memory + (uint16_t)(si + (n - 1) * step)));
+    R[REG_SI] = (uint16_t)(si + n * step);
+    if (repeat)
+        R[REG_CX] = 0;
+    return n;
+}
+
+/*
+   CMPS compares [SI] with [DI], SCAS the accumulator with [DI]; the
+   flags are those of the last comparison, taken as a SUB of [DI]
+   from the other. REPE stops on a difference, REPNE on a match
+   (F2 before MOVS, STOS or LODS repeats like F3).
+*/
+template <typename T, bool SCAN> static uint32_t compareString(MachineState& m, uint8_t repeat) {
+    CPU& cpu = m.cpu;
+    uint16_t* R = cpu.regs;
+    const uint8_t* memory = m.memory;
+    bool down = cpu.flags & FLAG_DF;
+    int step = down ? -(int)sizeof(T) : (int)sizeof(T);
+    uint32_t n = repeat ? R[REG_CX] : 1;
+    uint16_t si = R[REG_SI], di = R[REG_DI];
+    T value = (T)R[REG_AX];
+    bool untilEqual = repeat == REP_NZ;
+    if (n == 0)
+        return 0;
+
+    auto left = [&](uint32_t i) { return SCAN ? value : rd<T>(memory + (uint16_t)(si + i * step)); };
+    auto right = [&](uint32_t i) { return rd<T>(memory + (uint16_t)(di + i * step)); };
+
+    uint32_t done;
+    if (repeat && !down && withoutWrap(di, n, sizeof(T), false) &&
+        (SCAN || withoutWrap(si, n, sizeof(T), false))) {
+        done = min(scanUp<T>(memory + di, SCAN ? nullptr : memory + si, value, n, untilEqual) + 1, n);
+    } else {
+        done = 0;
+        while (done < n) {
+            bool equal = left(done) == right(done);
+            done++;
+            if (repeat && equal == untilEqual)
+                break;
         }
+    }
 
-        /* -------- ADD AX, imm16 -------- */
-        case 0x05:
-            cpu.AX += fetch16(cpu);
-            break;
+    T a = left(done - 1), b = right(done - 1);
+    recordFlags(cpu, (uint8_t)(FOP_SUB | (sizeof(T) == 2 ? FOP_WORD : 0)), a, b, (T)(a - b));
+    if (!SCAN)
+        R[REG_SI] = (uint16_t)(si + done * step);
+    R[REG_DI] = (uint16_t)(di + done * step);
+    if (repeat)
+        R[REG_CX] -= (uint16_t)done;
+    return done;
+}
 
-        /* -------- ADD r/m16, imm16 -------- */
-        case 0x81: {
-            uint8_t modrm = fetch8(cpu);
-            int subop = (modrm >> 3) & 7;
-            int rm = modrm & 7;
+template <typename T> static uint32_t compareStrings(MachineState& m, uint8_t repeat) {
+    return compareString<T, false>(m, repeat);
+}
 
-            if (subop != 0)
-                throw runtime_error("Unsupported 0x81 opcode");
+template <typename T> static uint32_t scanString(MachineState& m, uint8_t repeat) {
+    return compareString<T, true>(m, repeat);
+}
 
-            uint16_t imm = fetch16(cpu);
+/*
+   n elements of size bytes were stored from di on: note the span,
+   split where it wraps, and give a trace each element in order.
+*/
+static void stringStored(MachineState& m, uint16_t di, uint32_t n, int size, bool trace) {
+    if (n == 0)
+        return;
+    bool down = m.cpu.flags & FLAG_DF;
+    uint32_t reach = (n - 1) * size, bytes = reach + size;
+    uint16_t low = down ? di - reach : di;
+    if (bytes > 65536)
+        noteWrite(m, 0, 65536 + 1);
+    else if (low + reach <= 0xFFFF)
+        noteWrite(m, low, (int)bytes);
+    else {
+        noteWrite(m, low, 65536 + 1 - low);             // through the guard byte
+        noteWrite(m, 0, (int)(low + bytes - 65536));
+    }
 
-            if ((modrm >> 6) == 0b11) {
-                getReg(cpu, rm) += imm;
-            }
-            break;
+    if (trace) {
+        int step = down ? -size : size;
+        for (uint32_t i = 0; i < n; i++) {
+            uint16_t at = (uint16_t)(di + i * step);
+            m.trace->write(at, m.memory + at, size);
         }
+    }
+}
+
+/* ================================
+   INTERPRETER CORE
+   Handlers are labels; with GCC/Clang each one jumps straight
+   to the next record's handler (computed goto), otherwise
+   control returns to a central switch.
+================================ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH 1
+#endif
 
-        /* -------- HLT -------- */
-        case 0xF4:
-            cpu.halted = true;
-            break;
+template <ExecMode M>
+static uint64_t interpret(MachineState& m, uint64_t budget = 0);
 
-        default:
-            throw runtime_error("Unknown opcode: " + to_string(opcode));
+static void runNative(MachineState& m, uint64_t& executed);
+
+/*
+   EXEC_PROFILE retires each instruction with its clock count: the
+   record's static cycles plus extra, which handlers add to for
+   taken branches, shift counts and odd word addresses.
+*/
+static inline void charge(MachineState& m, const DecodedOp* op, uint32_t& extra) {
+    if (op->wordTransfers) {
+        const uint8_t* p = op->dstMem ? op->dst : op->src;
+        if ((p - m.memory) & 1)
+            extra += 4 * op->wordTransfers;
+    }
+    ProfileCounter& c = m.profile[m.cpu.IP];
+    c.count++;
+    c.cycles += op->cycles + extra;
+    m.profileCycles += op->cycles + extra;
+    extra = 0;
+}
+
+// EXEC_TRACE: the instruction at cpu.IP retired and execution continues at next
+static void traceStep(MachineState& m, const DecodedOp* op, uint16_t next) {
+    CPU& cpu = m.cpu;
+    uint16_t ip = cpu.IP;
+    uint8_t bytes[TRACE_MAX_INSN];
+    for (int i = 0; i < op->length; i++)
+        bytes[i] = m.memory[(uint16_t)(ip + i)];
+    materializeFlags(cpu);
+    cpu.IP = next;
+    m.trace->step(ip, bytes, op->length, cpu);
+    cpu.IP = ip;
+}
+
+/*
+   Every mode but EXEC_INTERPRET and EXEC_TIERED stops after budget
+   instructions (0 = no limit) and decodes a K_NATIVE record into a
+   scratch record, so those runs never enter native code.
+*/
+template <ExecMode M>
+static uint64_t interpret(MachineState& m, uint64_t budget) {
+    CPU& cpu = m.cpu;
+    uint8_t* const memory = m.memory;
+    DecodedOp* const decodeCache = m.decodeCache;
+    uint64_t executed = 0;
+    uint32_t extra = 0;
+    DecodedOp scratch;
+    DecodedOp* op = &decodeCache[cpu.IP];
+    uint16_t* R = cpu.regs;
+    uint8_t& AL = *regPtr(cpu, REG_AL);
+    uint8_t& AH = *regPtr(cpu, REG_AH);
+
+#ifdef THREADED_DISPATCH
+    static void* const handlers[K_COUNT] = {
+#define X(name) &&H_##name,
+        HANDLER_LIST(X)
+#undef X
+    };
+#define DISPATCH() goto *handlers[op->kind]
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+#define STEPPING (M != EXEC_INTERPRET && M != EXEC_TIERED)
+#define ADVANCE(target) do { uint16_t to = (target); \
+                            if (M == EXEC_PROFILE) charge(m, op, extra); \
+                            if (M == EXEC_TRACE) traceStep(m, op, to); \
+                            cpu.IP = to; executed++; \
+                            if (STEPPING && executed == budget) return executed; } while (0)
+#define NEXT() do { ADVANCE(op->next); op = &decodeCache[cpu.IP]; DISPATCH(); } while (0)
+#define HEAT() do { if (M == EXEC_TIERED && ++m.heat[cpu.IP] == JIT_HOT_THRESHOLD) \
+                        promote(m, cpu.IP); } while (0)
+#define JUMP(target) do { if (M == EXEC_PROFILE) extra += op->takenCycles; \
+                         ADVANCE(target); HEAT(); op = &decodeCache[cpu.IP]; DISPATCH(); } while (0)
+#define STORED(addr, n) do { noteWrite(m, (addr), (n)); \
+                            if (M == EXEC_TRACE) m.trace->write((addr), memory + (addr), (n)); } while (0)
+#define WROTE(n) do { if (op->dstMem) STORED((uint16_t)(op->dst - memory), (n)); } while (0)
+#define PUSH16(v) do { R[REG_SP] -= 2; wr<uint16_t>(memory + R[REG_SP], (v)); STORED(R[REG_SP], 2); } while (0)
+#define POP16(v) do { (v) = rd<uint16_t>(memory + R[REG_SP]); R[REG_SP] += 2; } while (0)
+
+/*
+   Handler bodies, generated for both widths. a = dst, b = src, r = result;
+   flag-setting forms only record (kind, a, b, r) for flags.h.
+*/
+#define FOP(kind, T) (uint8_t)((kind) | (sizeof(T) == 2 ? FOP_WORD : 0))
+#define PAIR(M, name, ...) M(name##8, uint8_t, __VA_ARGS__) M(name##16, uint16_t, __VA_ARGS__)
+
+#define ALU(name, T, kind, expr) \
+    H_##name: { T a = rd<T>(op->dst), b = rd<T>(op->src); T r = (T)(expr); \
+                wr<T>(op->dst, r); recordFlags(cpu, FOP(kind, T), a, b, r); WROTE(sizeof(T)); NEXT(); }
+#define COMPARE(name, T, kind, expr) \
+    H_##name: { T a = rd<T>(op->dst), b = rd<T>(op->src); \
+                recordFlags(cpu, FOP(kind, T), a, b, (T)(expr)); NEXT(); }
+#define CARRY_ALU(name, T, kind, expr) \
+    H_##name: { T a = rd<T>(op->dst), b = rd<T>(op->src); unsigned cf = flagCF(cpu); \
+                parkCarry(cpu, cf); T r = (T)(expr); \
+                wr<T>(op->dst, r); recordFlags(cpu, FOP(kind, T), a, b, r); WROTE(sizeof(T)); NEXT(); }
+#define INC_DEC(name, T, kind, expr) \
+    H_##name: { T a = rd<T>(op->dst); parkCarry(cpu, flagCF(cpu)); T r = (T)(expr); \
+                wr<T>(op->dst, r); recordFlags(cpu, FOP(kind, T), a, 1, r); WROTE(sizeof(T)); NEXT(); }
+#define PER_BIT(c) do { if (M == EXEC_PROFILE && op->src != (uint8_t*)&op->imm) extra += 4 * (c); } while (0)
+#define SHIFT(name, T, kind, expr) \
+    H_##name: { T a = rd<T>(op->dst); unsigned c = *op->src; PER_BIT(c); \
+                if (c) { T r = (T)(expr); wr<T>(op->dst, r); recordFlags(cpu, FOP(kind, T), a, c, r); \
+                         WROTE(sizeof(T)); } \
+                NEXT(); }
+#define ROTATE(name, T, fn) \
+    H_##name: { unsigned c = *op->src; PER_BIT(c); \
+                if (c) { wr<T>(op->dst, fn<T>(cpu, rd<T>(op->dst), c)); WROTE(sizeof(T)); } \
+                NEXT(); }
+#define JCC(name, cond) \
+    H_##name: if (cond) JUMP(op->imm); NEXT();
+#define STRING(name, T, fn, stores) \
+    H_##name: { uint16_t di = R[REG_DI]; uint32_t n = fn<T>(m, (uint8_t)op->imm); \
+                if (stores) stringStored(m, di, n, sizeof(T), M == EXEC_TRACE); \
+                if (M == EXEC_PROFILE) extra += op->takenCycles * n; \
+                NEXT(); }
+
+    DISPATCH();
+
+#ifndef THREADED_DISPATCH
+dispatch:
+    switch (op->kind) {
+#define X(name) case K_##name: goto H_##name;
+    HANDLER_LIST(X)
+#undef X
+    default: goto H_INVALID;
+    }
+#endif
+
+H_DECODE:
+    predecode(m, cpu.IP, *op);
+    DISPATCH();
+
+H_EA: {
+    uint8_t* p = memory + effectiveAddress(cpu, op->ea, op->disp);
+    if (op->eaOperand == 0)
+        op->dst = p;
+    else
+        op->src = p;
+#ifdef THREADED_DISPATCH
+    goto *handlers[op->body];
+#else
+    switch (op->body) {
+#define X(name) case K_##name: goto H_##name;
+    HANDLER_LIST(X)
+#undef X
+    default: goto H_INVALID;
+    }
+#endif
+}
+
+H_INVALID:
+    unsupportedAt(memory, cpu.IP);
+
+    /* ---- data movement ---- */
+H_MOV8:
+    *op->dst = *op->src;
+    WROTE(1);
+    NEXT();
+H_MOV16:
+    memcpy(op->dst, op->src, 2);
+    WROTE(2);
+    NEXT();
+
+H_XCHG8: {
+    uint8_t a = *op->dst;
+    *op->dst = *op->src;
+    *op->src = a;
+    WROTE(1);
+    NEXT();
+}
+H_XCHG16: {
+    uint16_t a = rd<uint16_t>(op->dst);
+    wr<uint16_t>(op->dst, rd<uint16_t>(op->src));
+    wr<uint16_t>(op->src, a);
+    WROTE(2);
+    NEXT();
+}
+H_LEA:
+    wr<uint16_t>(op->dst, (uint16_t)(op->src - memory));
+    NEXT();
+
+    /* ---- arithmetic and logic ---- */
+    PAIR(ALU, ADD, FOP_ADD, a + b)
+    PAIR(ALU, SUB, FOP_SUB, a - b)
+    PAIR(ALU, AND, FOP_LOGIC, a & b)
+    PAIR(ALU, OR,  FOP_LOGIC, a | b)
+    PAIR(ALU, XOR, FOP_LOGIC, a ^ b)
+    PAIR(CARRY_ALU, ADC, FOP_ADC, a + b + cf)
+    PAIR(CARRY_ALU, SBB, FOP_SBB, a - b - cf)
+    PAIR(COMPARE, CMP, FOP_SUB, a - b)
+    PAIR(COMPARE, TEST, FOP_LOGIC, a & b)
+    PAIR(INC_DEC, INC, FOP_INC, a + 1)
+    PAIR(INC_DEC, DEC, FOP_DEC, a - 1)
+
+H_NOT8:
+    *op->dst = ~*op->dst;
+    WROTE(1);
+    NEXT();
+H_NOT16:
+    wr<uint16_t>(op->dst, ~rd<uint16_t>(op->dst));
+    WROTE(2);
+    NEXT();
+H_NEG8: {
+    uint8_t b = *op->dst, r = -b;
+    *op->dst = r;
+    recordFlags(cpu, FOP_SUB, 0, b, r);
+    WROTE(1);
+    NEXT();
+}
+H_NEG16: {
+    uint16_t b = rd<uint16_t>(op->dst), r = -b;
+    wr<uint16_t>(op->dst, r);
+    recordFlags(cpu, FOP_SUB | FOP_WORD, 0, b, r);
+    WROTE(2);
+    NEXT();
+}
+
+    /* CF = OF = the upper half carries significant bits */
+H_MUL8:
+    R[REG_AX] = (uint16_t)(AL * *op->dst);
+    recordFlags(cpu, FOP_MUL, AL, AH != 0, AL);
+    NEXT();
+H_MUL16: {
+    uint32_t r = (uint32_t)R[REG_AX] * rd<uint16_t>(op->dst);
+    R[REG_AX] = (uint16_t)r;
+    R[REG_DX] = (uint16_t)(r >> 16);
+    recordFlags(cpu, FOP_MUL | FOP_WORD, R[REG_AX], R[REG_DX] != 0, R[REG_AX]);
+    NEXT();
+}
+H_IMUL8: {
+    int16_t r = (int16_t)((int8_t)AL * (int8_t)*op->dst);
+    R[REG_AX] = (uint16_t)r;
+    recordFlags(cpu, FOP_MUL, AL, r != (int8_t)r, AL);
+    NEXT();
+}
+H_IMUL16: {
+    int32_t r = (int32_t)(int16_t)R[REG_AX] * (int16_t)rd<uint16_t>(op->dst);
+    R[REG_AX] = (uint16_t)r;
+    R[REG_DX] = (uint16_t)((uint32_t)r >> 16);
+    recordFlags(cpu, FOP_MUL | FOP_WORD, R[REG_AX], r != (int16_t)r, R[REG_AX]);
+    NEXT();
+}
+H_DIV8: {
+    uint16_t n = R[REG_AX];
+    uint8_t d = *op->dst;
+    if (d == 0 || n / d > 0xFF)
+        divideError(cpu.IP);
+    AL = (uint8_t)(n / d);
+    AH = (uint8_t)(n % d);
+    NEXT();
+}
+H_DIV16: {
+    uint32_t n = ((uint32_t)R[REG_DX] << 16) | R[REG_AX];
+    uint16_t d = rd<uint16_t>(op->dst);
+    if (d == 0 || n / d > 0xFFFF)
+        divideError(cpu.IP);
+    R[REG_AX] = (uint16_t)(n / d);
+    R[REG_DX] = (uint16_t)(n % d);
+    NEXT();
+}
+H_IDIV8: {
+    int n = (int16_t)R[REG_AX];
+    int d = (int8_t)*op->dst;
+    if (d == 0 || n / d > 127 || n / d < -128)
+        divideError(cpu.IP);
+    AL = (uint8_t)(n / d);
+    AH = (uint8_t)(n % d);
+    NEXT();
+}
+H_IDIV16: {
+    int64_t n = (int32_t)(((uint32_t)R[REG_DX] << 16) | R[REG_AX]);
+    int64_t d = (int16_t)rd<uint16_t>(op->dst);
+    if (d == 0 || n / d > 32767 || n / d < -32768)
+        divideError(cpu.IP);
+    R[REG_AX] = (uint16_t)(n / d);
+    R[REG_DX] = (uint16_t)(n % d);
+    NEXT();
+}
+
+    /* ---- shifts and rotates: the 8086 does not mask the count ---- */
+    SHIFT(SHL8,  uint8_t,  FOP_SHL, c >= 8  ? 0 : a << c)
+    SHIFT(SHL16, uint16_t, FOP_SHL, c >= 16 ? 0 : a << c)
+    SHIFT(SHR8,  uint8_t,  FOP_SHR, c >= 8  ? 0 : a >> c)
+    SHIFT(SHR16, uint16_t, FOP_SHR, c >= 16 ? 0 : a >> c)
+    SHIFT(SAR8,  uint8_t,  FOP_SAR, (int8_t)a >> (c >= 8 ? 7 : c))
+    SHIFT(SAR16, uint16_t, FOP_SAR, (int16_t)a >> (c >= 16 ? 15 : c))
+    PAIR(ROTATE, ROL, rotateLeft)
+    PAIR(ROTATE, ROR, rotateRight)
+    PAIR(ROTATE, RCL, rotateCarryLeft)
+    PAIR(ROTATE, RCR, rotateCarryRight)
+
+    /* ---- flags ---- */
+H_PUSHF:
+    PUSH16(materializeFlags(cpu) | FLAG_RESERVED);
+    NEXT();
+H_POPF: {
+    uint16_t v;
+    POP16(v);
+    cpu.flags = (v & 0x0FD5) | FLAG_RESERVED;
+    cpu.flagOp = FOP_NONE;
+    NEXT();
+}
+H_LAHF:
+    AH = (uint8_t)materializeFlags(cpu);
+    NEXT();
+H_SAHF:
+    cpu.flags = (materializeFlags(cpu) & 0xFF00) | (AH & FLAG_ARITH & 0xFF) | FLAG_RESERVED;
+    NEXT();
+H_CLC:
+    cpu.flags = materializeFlags(cpu) & ~FLAG_CF;
+    NEXT();
+H_STC:
+    cpu.flags = materializeFlags(cpu) | FLAG_CF;
+    NEXT();
+H_CMC:
+    cpu.flags = materializeFlags(cpu) ^ FLAG_CF;
+    NEXT();
+H_CLD:
+    cpu.flags &= ~FLAG_DF;
+    NEXT();
+H_STD:
+    cpu.flags |= FLAG_DF;
+    NEXT();
+H_CLI:
+    cpu.flags &= ~FLAG_IF;
+    NEXT();
+H_STI:
+    cpu.flags |= FLAG_IF;
+    NEXT();
+
+    /* ---- stack and control flow ---- */
+H_PUSH:
+    PUSH16(rd<uint16_t>(op->dst));
+    NEXT();
+H_POP: {
+    uint16_t v;
+    POP16(v);
+    wr<uint16_t>(op->dst, v);
+    WROTE(2);
+    NEXT();
+}
+H_JMP:
+    JUMP(op->imm);
+H_JMP_IND:
+    JUMP(rd<uint16_t>(op->dst));
+H_CALL:
+    PUSH16(op->next);
+    JUMP(op->imm);
+H_CALL_IND: {
+    uint16_t target = rd<uint16_t>(op->dst);
+    PUSH16(op->next);
+    JUMP(target);
+}
+H_RET: {
+    uint16_t target;
+    POP16(target);
+    JUMP(target);
+}
+H_RET_N: {
+    uint16_t target;
+    POP16(target);
+    R[REG_SP] += op->imm;
+    JUMP(target);
+}
+H_LOOP:
+    if (--R[REG_CX] != 0)
+        JUMP(op->imm);
+    NEXT();
+H_LOOPE:
+    if (--R[REG_CX] != 0 && flagZF(cpu))
+        JUMP(op->imm);
+    NEXT();
+H_LOOPNE:
+    if (--R[REG_CX] != 0 && !flagZF(cpu))
+        JUMP(op->imm);
+    NEXT();
+H_JCXZ:
+    if (R[REG_CX] == 0)
+        JUMP(op->imm);
+    NEXT();
+
+    JCC(JO,  flagOF(cpu))
+    JCC(JNO, !flagOF(cpu))
+    JCC(JB,  flagCF(cpu))
+    JCC(JAE, !flagCF(cpu))
+    JCC(JE,  flagZF(cpu))
+    JCC(JNE, !flagZF(cpu))
+    JCC(JBE, flagCF(cpu) || flagZF(cpu))
+    JCC(JA,  !flagCF(cpu) && !flagZF(cpu))
+    JCC(JS,  flagSF(cpu))
+    JCC(JNS, !flagSF(cpu))
+    JCC(JL,  flagSF(cpu) != flagOF(cpu))
+    JCC(JGE, flagSF(cpu) == flagOF(cpu))
+    JCC(JLE, flagZF(cpu) || flagSF(cpu) != flagOF(cpu))
+    JCC(JG,  !flagZF(cpu) && flagSF(cpu) == flagOF(cpu))
+
+H_XLAT:
+    AL = memory[(uint16_t)(R[REG_BX] + AL)];
+    NEXT();
+
+    /* ---- string instructions; imm is the RepeatPrefix ---- */
+    PAIR(STRING, MOVS, moveString, true)
+    PAIR(STRING, STOS, storeString, true)
+    PAIR(STRING, LODS, loadString, false)
+    PAIR(STRING, CMPS, compareStrings, false)
+    PAIR(STRING, SCAS, scanString, false)
+
+H_NOP:
+    NEXT();
+H_HLT:
+    if (M == EXEC_PROFILE)
+        charge(m, op, extra);
+    if (M == EXEC_TRACE)
+        traceStep(m, op, op->next);
+    executed++;
+    cpu.IP = op->next;
+    cpu.halted = true;
+    return executed;
+
+H_NATIVE:
+    if (STEPPING) {
+        decodeRecord(m, cpu.IP, scratch);
+        op = &scratch;
+        DISPATCH();
+    }
+    runNative(m, executed);
+    HEAT();
+    op = &decodeCache[cpu.IP];
+    DISPATCH();
+
+#undef STRING
+#undef JCC
+#undef ROTATE
+#undef SHIFT
+#undef PER_BIT
+#undef INC_DEC
+#undef CARRY_ALU
+#undef COMPARE
+#undef ALU
+#undef PAIR
+#undef FOP
+#undef POP16
+#undef PUSH16
+#undef WROTE
+#undef STORED
+#undef STEPPING
+#undef JUMP
+#undef HEAT
+#undef NEXT
+#undef ADVANCE
+#undef DISPATCH
+}
+
+/* ================================
+   NATIVE BLOCKS
+   In verify mode every block run is repeated by the
+   interpreter from the same starting state, and the two
+   results must agree.
+================================ */
+static string describeState(CPU cpu) {
+    materializeFlags(cpu);
+    string s;
+    for (int r = REG_AX; r <= REG_DI; r++)
+        s += string(registerName((RegisterId)r)) + "=" + to_string(cpu.regs[r]) + " ";
+    return s + "IP=" + to_string(cpu.IP) + " FLAGS=" + to_string(cpu.flags);
+}
+
+static void runNative(MachineState& m, uint64_t& executed) {
+    CPU& cpu = m.cpu;
+    uint8_t* const memory = m.memory;
+    const JitBlock& block = m.jitBlocks[m.blockAt[cpu.IP] - 1];
+    JitContext ctx = {&cpu, memory, m.codeMap, 0, 0};
+    materializeFlags(cpu);     // native code keeps flags materialized
+    for (uint16_t a : block.stores)
+        markDirty(m, a, 2);    // store addresses are fixed, so once per entry is enough
+
+    if (!m.verifyJit) {
+        uint32_t exit = block.entry(&ctx);
+        executed += ctx.executed;
+        if (exit == JIT_EXIT_CODE_WRITE)
+            noteWrite(m, ctx.writeAddr, 2);
+        return;
+    }
+
+    // Native run, remembering what it overwrites
+    uint16_t start = block.start;
+    vector<uint16_t> stores = block.stores;
+    vector<uint16_t> before, native, reference;
+    for (uint16_t a : stores)
+        before.push_back(rd<uint16_t>(memory + a));
+
+    CPU initial = cpu;
+    block.entry(&ctx);
+    CPU nativeState = cpu;
+    for (uint16_t a : stores)
+        native.push_back(rd<uint16_t>(memory + a));
+
+    // Reference run from the same state; it also handles any code writes
+    cpu = initial;
+    for (size_t i = 0; i < stores.size(); i++)
+        wr<uint16_t>(memory + stores[i], before[i]);
+    uint64_t steps = ctx.executed ? interpret<EXEC_STEP>(m, ctx.executed) : 0;
+    for (uint16_t a : stores)
+        reference.push_back(rd<uint16_t>(memory + a));
+
+    bool same = steps == ctx.executed && cpu.IP == nativeState.IP && native == reference &&
+                memcmp(cpu.regs, nativeState.regs, sizeof(cpu.regs)) == 0 &&
+                materializeFlags(cpu) == nativeState.flags;
+    if (!same) {
+        throw runtime_error("JIT mismatch in block at IP " + to_string(start) + " after " +
+                            to_string(ctx.executed) + " instructions\n  native:      " +
+                            describeState(nativeState) + "\n  interpreter: " + describeState(cpu));
+    }
+    executed += ctx.executed;
+}
+
+/* ================================
+   MACHINE
+================================ */
+Machine::Machine() : state(new MachineState()) {}
+
+Machine::~Machine() {}
+
+void Machine::traceTo(const string& path) {
+    endTrace();
+    state->trace.reset(new TraceWriter(path));
+}
+
+void Machine::endTrace() {
+    MachineState& m = *state;
+    if (!m.trace)
+        return;
+    // Drop the writer even if the final flush fails
+    unique_ptr<TraceWriter> trace = move(m.trace);
+    trace->finish();
+}
+
+CPU& Machine::cpu() { return state->cpu; }
+
+const uint8_t* Machine::memory() const { return state->memory; }
+
+void Machine::load(const vector<uint8_t>& image) {
+    MachineState& m = *state;
+    if (image.size() > 65536)
+        throw runtime_error("Program does not fit in 64 KB of memory");
+
+    // Back to all-zero memory: only dirty pages can be non-zero unless a snapshot was loaded
+    if (m.hasSnapshot) {
+        memset(m.memory, 0, sizeof(m.memory));
+        m.hasSnapshot = false;
+    } else {
+        for (uint32_t i = 0; i < m.dirtyCount; i++)
+            memset(m.memory + ((uint32_t)m.dirtyPages[i] << PAGE_SHIFT), 0, PAGE_SIZE);
+    }
+    clearDirty(m);
+
+    // Anything decoded or compiled from a previous image is stale
+    resetDecodeCache(m);
+    if (m.heatUsed) {
+        memset(m.heat, 0, sizeof(m.heat));
+        m.heatUsed = false;
+    }
+
+    m.profile.clear();
+    m.profileCycles = 0;
+
+    m.cpu = CPU();
+    if (!image.empty()) {
+        memcpy(m.memory, image.data(), image.size());
+        markDirty(m, 0, (uint32_t)image.size());
+    }
+}
+
+void Machine::write(uint16_t addr, const uint8_t* data, size_t n) {
+    MachineState& m = *state;
+    if (addr + n > 65536)
+        throw runtime_error("Write past the end of guest memory");
+    if (n == 0)
+        return;
+    memcpy(m.memory + addr, data, n);
+    markDirty(m, addr, (uint32_t)n);
+    dropCodeAt(m, addr, (int)n);
+}
+
+void Machine::snapshot() {
+    MachineState& m = *state;
+    m.snapshotCpu = m.cpu;
+    memcpy(m.snapshotMemory, m.memory, sizeof(m.memory));
+    m.hasSnapshot = true;
+    clearDirty(m);
+}
+
+/*
+   Decoded records and native blocks survive a restore, so code
+   stays hot across runs; only bytes that really change back are
+   invalidated.
+*/
+void Machine::restore() {
+    MachineState& m = *state;
+    if (!m.hasSnapshot)
+        throw runtime_error("No snapshot to restore");
+
+    for (uint32_t i = 0; i < m.dirtyCount; i++) {
+        uint32_t page = m.dirtyPages[i], base = page << PAGE_SHIFT;
+        uint8_t* now = m.memory + base;
+        const uint8_t* then = m.snapshotMemory + base;
+        if (m.codePages[page]) {
+            for (int a = 0; a < PAGE_SIZE; a++)
+                if (now[a] != then[a] && m.codeMap[(uint16_t)(base + a)])
+                    dropCodeAt(m, (uint16_t)(base + a), 1);
         }
+        memcpy(now, then, PAGE_SIZE);
     }
+    clearDirty(m);
+    m.cpu = m.snapshotCpu;
+}
+
+size_t Machine::dirtyPageCount() const {
+    return state->dirtyCount;
+}
+
+Profile Machine::profile() const {
+    const MachineState& m = *state;
+    Profile p;
+    if (m.profile.empty())
+        return p;
+
+    vector<uint64_t> byOpcode(OP_COUNT + 1, 0), countByOpcode(OP_COUNT + 1, 0);
+    for (uint32_t ip = 0; ip < 65536; ip++) {
+        const ProfileCounter& c = m.profile[ip];
+        if (!c.count)
+            continue;
+        DecodedInsn d;
+        int op = decodeInstruction(m.memory, (uint16_t)ip, d) ? d.opcode : OP_COUNT;
+        p.addresses.push_back({(uint16_t)ip, op == OP_COUNT ? "??" : opcodeName((Opcode)op),
+                               c.count, c.cycles});
+        byOpcode[op] += c.cycles;
+        countByOpcode[op] += c.count;
+        p.instructions += c.count;
+        p.cycles += c.cycles;
+    }
+    for (int op = 0; op <= OP_COUNT; op++)
+        if (countByOpcode[op])
+            p.opcodes.push_back({op == OP_COUNT ? "??" : opcodeName((Opcode)op),
+                                 countByOpcode[op], byOpcode[op]});
+
+    auto hotter = [](const auto& a, const auto& b) { return a.cycles > b.cycles; };
+    stable_sort(p.addresses.begin(), p.addresses.end(), hotter);
+    stable_sort(p.opcodes.begin(), p.opcodes.end(), hotter);
+    return p;
+}
+
+RunResult Machine::run(ExecutionTier tier, uint64_t limit) {
+    MachineState& m = *state;
+    if ((tier == TIER_JIT || tier == TIER_JIT_VERIFY) && !jitAvailable())
+        tier = TIER_INTERPRET;
+    m.verifyJit = tier == TIER_JIT_VERIFY;
+
+    RunResult result;
+    if (tier == TIER_TRACE) {
+        if (!m.trace)
+            throw runtime_error("TIER_TRACE run without Machine::traceTo");
+        materializeFlags(m.cpu);
+        m.trace->keyframe(m.cpu);
+        result.executed = interpret<EXEC_TRACE>(m, limit);
+    } else if (tier == TIER_PROFILE) {
+        if (m.profile.empty())
+            m.profile.assign(65536, ProfileCounter());
+        uint64_t start = m.profileCycles;
+        result.executed = interpret<EXEC_PROFILE>(m, limit);
+        result.cycles = m.profileCycles - start;
+    } else if (limit) {
+        // Native blocks can loop indefinitely, so only the stepping interpreter can stop in time
+        result.executed = interpret<EXEC_STEP>(m, limit);
+    } else if (tier == TIER_INTERPRET) {
+        result.executed = interpret<EXEC_INTERPRET>(m);
+    } else {
+        m.heatUsed = true;
+        result.executed = interpret<EXEC_TIERED>(m);
+    }
+    if (limit && !m.cpu.halted)
+        result.error = "Instruction limit of " + to_string(limit) + " reached at IP " +
+                       to_string(m.cpu.IP);
+    materializeFlags(m.cpu);
+    result.cpu = m.cpu;
+    return result;
+}
+
+/* ================================
+   EMULATOR ENTRY
+================================ */
+void runEmulator(const vector<uint8_t>& machineCode, ExecutionTier tier, const string& outputPath) {
+    Machine machine;
+    machine.load(machineCode);
+    if (tier == TIER_TRACE)
+        machine.traceTo(outputPath);
+
+    if ((tier == TIER_JIT || tier == TIER_JIT_VERIFY) && !jitAvailable()) {
+        cout << "JIT not available on this host, interpreting\n";
+        tier = TIER_INTERPRET;
+    }
+    RunResult r = machine.run(tier);
+    machine.endTrace();
 
     /* ================================
        FINAL REGISTER STATE
     ================================ */
     cout << "\nCPU STATE AFTER EXECUTION\n";
-    cout << "AX = " << cpu.AX << endl;
-    cout << "BX = " << cpu.BX << endl;
-    cout << "CX = " << cpu.CX << endl;
-    cout << "DX = " << cpu.DX << endl;
+    cout << "AX = " << r.cpu.regs[REG_AX] << endl;
+    cout << "BX = " << r.cpu.regs[REG_BX] << endl;
+    cout << "CX = " << r.cpu.regs[REG_CX] << endl;
+    cout << "DX = " << r.cpu.regs[REG_DX] << endl;
+    cout << "Instructions executed: " << r.executed << endl;
+
+    if (tier == TIER_PROFILE) {
+        cout << "Cycles: " << r.cycles << endl;
+        Profile profile = machine.profile();
+        printProfile(cout, profile);
+        if (!outputPath.empty()) {
+            ofstream out(outputPath);
+            if (!out)
+                throw runtime_error("Cannot write profile to " + outputPath);
+            writeProfileJson(out, profile);
+        }
+    }
 }
@@ -0,0 +1,137 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "keywords.h"
+#include "profile.h"
+
+using namespace std;
+
+/* ================================
+   FLAGS
+   Arithmetic flags are evaluated lazily: ALU instructions
+   only record what they did (flagOp, operands, result) and
+   flags.h derives individual bits when something reads them.
+   While flagOp is FOP_NONE, flags holds every bit.
+================================ */
+enum FlagBit : uint16_t {
+    FLAG_CF = 0x0001,
+    FLAG_PF = 0x0004,
+    FLAG_AF = 0x0010,
+    FLAG_ZF = 0x0040,
+    FLAG_SF = 0x0080,
+    FLAG_TF = 0x0100,
+    FLAG_IF = 0x0200,
+    FLAG_DF = 0x0400,
+    FLAG_OF = 0x0800,
+    FLAG_ARITH = 0x08D5,
+    FLAG_RESERVED = 0xF002      // read as 1 on the 8086
+};
+
+enum FlagOp : uint8_t {
+    FOP_NONE,       // flags is up to date
+    FOP_ADD,
+    FOP_ADC,        // carry-in parked in flags.CF
+    FOP_SUB,        // also CMP and NEG (0 - x)
+    FOP_SBB,        // borrow-in parked in flags.CF
+    FOP_LOGIC,
+    FOP_INC,        // CF untouched: kept in flags.CF
+    FOP_DEC,
+    FOP_SHL,        // flagB = count
+    FOP_SHR,
+    FOP_SAR,
+    FOP_MUL,        // flagB = CF/OF (upper half significant)
+    FOP_WORD = 0x80 // or'ed in for 16-bit operations
+};
+
+/* ================================
+   CPU STATE
+   Registers are kept in arrays indexed by the 8086 register
+   number, so decoded operands can point straight at them.
+   AL..BH alias the low/high bytes of AX..BX (little-endian host).
+================================ */
+struct CPU {
+    uint16_t regs[8] = {};      // AX CX DX BX SP BP SI DI
+    uint16_t sregs[4] = {};     // ES CS SS DS
+    uint16_t IP = 0;
+    uint16_t flags = FLAG_RESERVED;
+    uint8_t flagOp = FOP_NONE;
+    uint16_t flagA = 0, flagB = 0, flagRes = 0;     // operands and result of flagOp
+    bool halted = false;
+
+    uint16_t& reg(RegisterId r) { return r >= REG_ES ? sregs[r - REG_ES] : regs[r]; }
+};
+
+/* ================================
+   MACHINE
+   One guest: CPU, 64 KB of memory and everything decoded or
+   compiled from them. Machines share no state, so each
+   thread can run its own.
+================================ */
+/*
+   Interpret, also run hot blocks as native code (optionally checked
+   against the interpreter), interpret counting 8086 clock cycles, or
+   interpret recording every step to the trace set by traceTo()
+*/
+enum ExecutionTier { TIER_INTERPRET, TIER_JIT, TIER_JIT_VERIFY, TIER_PROFILE, TIER_TRACE };
+
+struct RunResult {
+    CPU cpu;                // final state, flags materialized
+    uint64_t executed = 0;  // instructions retired
+    uint64_t cycles = 0;    // 8086 clocks, TIER_PROFILE only
+    string error;           // why the program stopped early; empty if it reached HLT
+};
+
+struct MachineState;        // emulator.cpp
+
+class Machine {
+private:
+    unique_ptr<MachineState> state;
+
+public:
+    Machine();
+    ~Machine();
+
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    // Reset CPU and memory (dropping any snapshot) and place image at address 0
+    void load(const vector<uint8_t>& image);
+
+    // Store into guest memory; tracked like a guest store
+    void write(uint16_t addr, const uint8_t* data, size_t n);
+
+    /*
+       snapshot() records the CPU and memory as a baseline; restore()
+       returns to it, copying back only the 256-byte pages written since,
+       so a reset costs about as much as the run's own stores.
+    */
+    void snapshot();
+    void restore();
+    size_t dirtyPageCount() const;
+
+    // Per-address and per-opcode cycles of every TIER_PROFILE run since load()
+    Profile profile() const;
+
+    /*
+       TIER_TRACE runs append to the trace file at path (see trace.h)
+       until endTrace() writes its index, or the Machine is destroyed
+    */
+    void traceTo(const string& path);
+    void endTrace();
+
+    /*
+       Run from the current state until HLT; guest faults throw runtime_error.
+       limit > 0 stops after that many instructions with result.error set;
+       limited runs are interpreted whatever the tier.
+    */
+    RunResult run(ExecutionTier tier = TIER_INTERPRET, uint64_t limit = 0);
+
+    CPU& cpu();
+    const uint8_t* memory() const;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef FLAGS_H
+#define FLAGS_H
+
+#include <cstdint>
+#include "emulator.h"
+
+using namespace std;
+
+/* ================= Lazy Flag Evaluation ================= */
+/*
+   Each getter derives one flag from the last recorded operation, so a
+   Jcc after CMP costs one or two comparisons instead of six flag
+   computations per ALU instruction.
+*/
+
+inline bool lazyWord(const CPU& cpu) { return cpu.flagOp & FOP_WORD; }
+inline uint8_t lazyKind(const CPU& cpu) { return cpu.flagOp & ~FOP_WORD; }
+inline uint32_t lazyMask(const CPU& cpu) { return lazyWord(cpu) ? 0xFFFF : 0xFF; }
+inline uint16_t lazySign(const CPU& cpu) { return lazyWord(cpu) ? 0x8000 : 0x80; }
+
+inline void recordFlags(CPU& cpu, uint8_t op, uint16_t a, uint16_t b, uint16_t res) {
+    cpu.flagOp = op;
+    cpu.flagA = a;
+    cpu.flagB = b;
+    cpu.flagRes = res;
+}
+
+inline bool flagCF(const CPU& cpu) {
+    uint32_t a = cpu.flagA, b = cpu.flagB;
+    uint32_t bits = lazyWord(cpu) ? 16 : 8;
+    switch (lazyKind(cpu)) {
+    case FOP_ADD:   return a + b > lazyMask(cpu);
+    case FOP_ADC:   return a + b + (cpu.flags & FLAG_CF) > lazyMask(cpu);
+    case FOP_SUB:   return a < b;
+    case FOP_SBB:   return a < b + (cpu.flags & FLAG_CF);
+    case FOP_LOGIC: return false;
+    case FOP_SHL:   return b <= bits && ((a >> (bits - b)) & 1);
+    case FOP_SHR:   return b <= bits && ((a >> (b - 1)) & 1);
+    case FOP_SAR: {
+        int32_t s = lazyWord(cpu) ? (int16_t)a : (int8_t)a;
+        return (s >> (b < bits ? b - 1 : bits - 1)) & 1;
+    }
+    case FOP_MUL:   return b;
+    default:        return cpu.flags & FLAG_CF;    // FOP_NONE, INC, DEC
+    }
+}
+
+inline bool flagZF(const CPU& cpu) {
+    return cpu.flagOp == FOP_NONE ? (cpu.flags & FLAG_ZF) : cpu.flagRes == 0;
+}
+
+inline bool flagSF(const CPU& cpu) {
+    return cpu.flagOp == FOP_NONE ? (cpu.flags & FLAG_SF) : (cpu.flagRes & lazySign(cpu));
+}
+
+inline bool flagOF(const CPU& cpu) {
+    uint16_t a = cpu.flagA, b = cpu.flagB, r = cpu.flagRes, s = lazySign(cpu);
+    switch (lazyKind(cpu)) {
+    case FOP_ADD: case FOP_ADC: case FOP_INC:
+        return (a ^ r) & (b ^ r) & s;
+    case FOP_SUB: case FOP_SBB: case FOP_DEC:
+        return (a ^ b) & (a ^ r) & s;
+    case FOP_SHL:   return ((r & s) != 0) != flagCF(cpu);
+    case FOP_SHR:   return a & s;
+    case FOP_LOGIC:
+    case FOP_SAR:   return false;
+    case FOP_MUL:   return b;
+    default:        return cpu.flags & FLAG_OF;
+    }
+}
+
+inline bool flagAF(const CPU& cpu) {
+    switch (lazyKind(cpu)) {
+    case FOP_ADD: case FOP_ADC: case FOP_SUB: case FOP_SBB: case FOP_INC: case FOP_DEC:
+        return (cpu.flagA ^ cpu.flagB ^ cpu.flagRes) & 0x10;
+    case FOP_NONE:
+        return cpu.flags & FLAG_AF;
+    default:
+        return false;
+    }
+}
+
+// Set when the low byte of the result has an even number of 1 bits
+inline bool flagPF(const CPU& cpu) {
+    if (cpu.flagOp == FOP_NONE)
+        return cpu.flags & FLAG_PF;
+    uint8_t x = (uint8_t)cpu.flagRes;
+    x ^= x >> 4;
+    return !((0x6996 >> (x & 0xF)) & 1);
+}
+
+// Fold the lazy record into flags; afterwards flagOp is FOP_NONE
+inline uint16_t materializeFlags(CPU& cpu) {
+    if (cpu.flagOp == FOP_NONE)
+        return cpu.flags;
+    uint16_t f = cpu.flags & ~FLAG_ARITH;
+    if (flagCF(cpu)) f |= FLAG_CF;
+    if (flagPF(cpu)) f |= FLAG_PF;
+    if (flagAF(cpu)) f |= FLAG_AF;
+    if (flagZF(cpu)) f |= FLAG_ZF;
+    if (flagSF(cpu)) f |= FLAG_SF;
+    if (flagOF(cpu)) f |= FLAG_OF;
+    cpu.flags = f;
+    cpu.flagOp = FOP_NONE;
+    return f;
+}
+
+// Update CF alone (INC/DEC, ADC/SBB carry-in) without disturbing the lazy record
+inline void parkCarry(CPU& cpu, bool cf) {
+    cpu.flags = (cpu.flags & ~FLAG_CF) | (cf ? FLAG_CF : 0);
+}
+
+#endif
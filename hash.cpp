@@ -0,0 +1,60 @@
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+/* ================================
+   128-BIT HASH
+   Two 64-bit lanes over 8-byte words (MurmurHash3-style
+   mixing), finished with fmix64.
+================================ */
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDull;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+Hash128 hash128(const void* data, size_t length, uint64_t seed) {
+    const uint64_t C1 = 0x87C37B91114253D5ull, C2 = 0x4CF5AD432745937Full;
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t h1 = seed, h2 = seed ^ 0x9E3779B97F4A7C15ull;
+
+    size_t n = length;
+    while (n >= 16) {
+        uint64_t k1, k2;
+        memcpy(&k1, p, 8);
+        memcpy(&k2, p + 8, 8);
+        h1 ^= rotl64(k1 * C1, 31) * C2;
+        h1 = (rotl64(h1, 27) + h2) * 5 + 0x52DCE729;
+        h2 ^= rotl64(k2 * C2, 33) * C1;
+        h2 = (rotl64(h2, 31) + h1) * 5 + 0x38495AB5;
+        p += 16;
+        n -= 16;
+    }
+    if (n) {
+        uint64_t k1 = 0, k2 = 0;
+        memcpy(&k1, p, min<size_t>(n, 8));
+        if (n > 8)
+            memcpy(&k2, p + 8, n - 8);
+        h1 ^= rotl64(k1 * C1, 31) * C2;
+        h2 ^= rotl64(k2 * C2, 33) * C1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return {h1, h2};
+}
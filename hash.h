@@ -0,0 +1,24 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+/* ================= Content Hashing ================= */
+/*
+   Fast non-cryptographic 128-bit hash for content addressing: the
+   assembly cache (cache.h) and the incremental line cache
+   (incremental.h). Not resistant to deliberate collisions.
+*/
+struct Hash128 {
+    uint64_t hi, lo;
+};
+
+Hash128 hash128(const void* data, size_t length, uint64_t seed = 0);
+
+// Final avalanche step of the hash; also mixes small integers into seeds
+uint64_t fmix64(uint64_t k);
+
+#endif
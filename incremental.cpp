@@ -0,0 +1,456 @@
+#include "incremental.h"
+#include "compilation.h"
+#include "hash.h"
+#include "lexer.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+using namespace std;
+
+IncrementalAssembler::IncrementalAssembler(int optLevel) : optLevel(optLevel) {}
+
+/* ================================
+   Per-line front end
+================================ */
+shared_ptr<const IncrementalAssembler::LineIR> IncrementalAssembler::parseLine(const string& text,
+                                                                              Parser::Section start) {
+    uint64_t key = hash128(text.data(), text.size(), fmix64(start + 1)).lo;
+    auto it = lineCache.find(key);
+    if (it != lineCache.end() && it->second->start == start && it->second->text == text)
+        return it->second;
+
+    auto ir = make_shared<LineIR>();
+    ir->text = text;
+    ir->start = ir->end = start;
+    lastStats.linesParsed++;
+
+    // A throwaway Compilation per line: names are re-interned into ours
+    string scratch = text;      // the lexer upper-cases in place
+    {
+        Lexer first(&scratch[0], &scratch[0] + scratch.size());
+        Token t = first.next();
+        Token next = t.type == END_OF_FILE ? t : first.next();
+        bool label = t.type == IDENTIFIER && next.type == SYMBOL && next.value == ":";
+        if (t.type == END_OF_FILE)
+            ir->lead = LEAD_NONE;
+        else if (t.type == REGISTER || t.type == NUMBER || (t.type == IDENTIFIER && !label) ||
+                 (t.type == SYMBOL && t.value == "["))
+            ir->lead = LEAD_OPERAND;
+        else if (t.type == SYMBOL && t.value == ",")
+            ir->lead = LEAD_COMMA;
+        else
+            ir->lead = LEAD_OTHER;
+    }
+
+    Compilation unit;
+    unit.sem.deferReferences();
+    Lexer lex(&scratch[0], &scratch[0] + scratch.size());
+    Parser parser(lex, unit, start);
+    try {
+        parser.parseProgram();
+        ir->parsed = true;
+    } catch (const runtime_error&) {
+        // Left to the full build, which reports the error or parses it across lines
+    }
+    ir->end = parser.currentSection();
+    ir->trailingOperands = parser.trailingOperands();
+
+    if (ir->parsed) {
+        for (const SymbolEntry& sym : unit.sem.symbols()) {
+            ir->symbols.push_back({names.intern(unit.names.name(sym.name)), sym.isLabel, sym.size, sym.address});
+            if (!sym.isLabel)
+                ir->dataSize += sym.size;
+        }
+        ir->code = move(unit.intermediateCode);
+        for (IC& ic : ir->code) {
+            if (ic.op1.type == SYM)
+                ic.op1.value = names.intern(unit.names.name((SymbolId)ic.op1.value));
+            if (ic.op2.type == SYM)
+                ic.op2.value = names.intern(unit.names.name((SymbolId)ic.op2.value));
+        }
+    }
+
+    lineCache[key] = ir;
+    return ir;
+}
+
+/* ================================
+   Linking
+================================ */
+static bool sameOperand(const TypedOperand& a, const TypedOperand& b) {
+    return a.type == b.type && a.value == b.value && a.size == b.size;
+}
+
+// Replace v[at, at + removed) with with, moving the tail once
+template <typename T>
+static void splice(vector<T>& v, size_t at, size_t removed, const vector<T>& with) {
+    if (with.size() > removed)
+        v.insert(v.begin() + at + removed, with.size() - removed, T());
+    else
+        v.erase(v.begin() + at + with.size(), v.begin() + at + removed);
+    copy(with.begin(), with.end(), v.begin() + at);
+}
+
+/*
+   Bring the last link up to date with an edit: lines [first, first +
+   added) replaced the lines in replaced. Only those lines are resolved
+   and typed; after them, instruction indices and data addresses move
+   as a block. Uses elsewhere are re-typed only when a symbol they name
+   changed in more than its instruction index, and encoded again only
+   when that, or a branch's size or displacement, changed. Without a
+   previous link (or with optLevel > 0) the edit covers every line.
+   False when only a full build can decide.
+*/
+bool IncrementalAssembler::link(size_t first, const vector<Line>& replaced, size_t added) {
+    static const vector<Line> none;
+    bool whole = !linked || optLevel > 0;
+    const vector<Line>& removed = whole ? none : replaced;
+    if (whole) {
+        first = 0;
+        added = lines.size();
+        symbols.assign(names.count(), SymbolState());
+    }
+    linked = false;                 // until this link succeeds
+    linkStamp++;
+    size_t end = first + added;
+
+    // Would the whole text parse an edited line as the end of the instruction before it?
+    int open = -1;
+    for (size_t k = first; k-- > 0;) {
+        if (lines[k].ir->lead != LEAD_NONE) {
+            open = lines[k].ir->trailingOperands;
+            break;
+        }
+    }
+    for (size_t k = first; k < lines.size(); k++) {
+        const LineIR& ir = *lines[k].ir;
+        if (k < end && !ir.parsed)
+            return false;
+        if (ir.lead == LEAD_NONE)
+            continue;
+        if ((open == 0 && ir.lead == LEAD_OPERAND) || (open > 0 && ir.lead == LEAD_COMMA))
+            return false;
+        open = ir.trailingOperands;
+        if (k >= end)
+            break;
+    }
+
+    // Definitions and uses are counted; only the symbols the edit names can become duplicate or undefined
+    symbols.resize(names.count());
+    vector<SymbolId> named;
+    auto tally = [&](const LineIR& ir, int delta) {
+        for (const LineSymbol& sym : ir.symbols) {
+            symbols[sym.name].definitions += delta;
+            named.push_back(sym.name);
+        }
+        for (const IC& ic : ir.code) {
+            for (const TypedOperand* op : {&ic.op1, &ic.op2}) {
+                if (op->type == SYM) {
+                    symbols[op->value].uses += delta;
+                    named.push_back((SymbolId)op->value);
+                }
+            }
+        }
+    };
+    for (const Line& line : removed)
+        tally(*line.ir, -1);
+    for (size_t k = first; k < end; k++)
+        tally(*lines[k].ir, 1);
+    for (SymbolId id : named) {
+        const SymbolState& sym = symbols[id];
+        if (sym.definitions > 1 || (sym.uses > 0 && sym.definitions == 0))
+            return false;
+    }
+
+    // Where the edit starts, and how far it moves what follows
+    size_t codeStart = 0;
+    int dataStart = 0;
+    if (first > 0) {
+        const Line& before = lines[first - 1];
+        codeStart = before.codeStart + before.ir->code.size();
+        dataStart = before.dataStart + before.ir->dataSize;
+    }
+    size_t oldCount = whole ? typed.size() : 0, newCount = 0;
+    int oldData = 0, newData = 0;
+    for (const Line& line : removed) {
+        oldCount += line.ir->code.size();
+        oldData += line.ir->dataSize;
+    }
+    for (size_t k = first; k < end; k++) {
+        newCount += lines[k].ir->code.size();
+        newData += lines[k].ir->dataSize;
+    }
+    size_t count = typed.size() - oldCount + newCount;
+    ptrdiff_t codeShift = (ptrdiff_t)newCount - (ptrdiff_t)oldCount;
+    int dataShift = newData - oldData;
+    ptrdiff_t lineShift = (ptrdiff_t)added - (ptrdiff_t)removed.size();
+
+    bool anyMoved = false;
+    auto setValue = [&](SymbolState& sym, TypedOperand value) {
+        if (!sameOperand(sym.value, value)) {
+            sym.value = value;
+            sym.moved = linkStamp;
+            anyMoved = true;
+        }
+    };
+
+    // Lines and symbols after the edit move as a block
+    if (!whole) {
+        if (codeShift || dataShift) {
+            for (size_t k = end; k < lines.size(); k++) {
+                lines[k].codeStart += codeShift;
+                lines[k].dataStart += dataShift;
+            }
+        }
+        size_t after = first + removed.size();
+        for (SymbolState& sym : symbols) {
+            if (!codeShift && !dataShift && !lineShift)
+                break;
+            if (sym.definitions == 0 || sym.line < after)
+                continue;
+            sym.line += lineShift;
+            TypedOperand value = sym.value;
+            value.value += value.type == LABEL ? (int)codeShift : dataShift;
+            setValue(sym, value);
+        }
+    }
+
+    // The edit's own definitions
+    size_t at = codeStart;
+    int data = dataStart;
+    for (size_t k = first; k < end; k++) {
+        const LineIR& ir = *lines[k].ir;
+        lines[k].codeStart = at;
+        lines[k].dataStart = data;
+        for (const LineSymbol& def : ir.symbols) {
+            SymbolState& sym = symbols[def.name];
+            TypedOperand value;
+            value.type = def.isLabel ? LABEL : MEM;
+            value.value = def.isLabel ? (int)at + def.at : data + def.at;
+            value.size = (uint8_t)def.size;
+            setValue(sym, value);
+            sym.line = k;
+        }
+        at += ir.code.size();
+        data += ir.dataSize;
+    }
+
+    // The edit's instructions, resolved and typed
+    vector<TypedInstruction> editTyped;
+    vector<int> editFixed;
+    vector<SymbolId> editReferences;
+    editTyped.reserve(newCount);
+    editFixed.reserve(newCount);
+    editReferences.reserve(2 * newCount);
+    try {
+        for (size_t k = first; k < end; k++) {
+            for (const IC& parsed : lines[k].ir->code) {
+                IC ic = parsed;
+                for (TypedOperand* op : {&ic.op1, &ic.op2}) {
+                    editReferences.push_back(op->type == SYM ? (SymbolId)op->value : NO_SYMBOL);
+                    if (op->type == SYM)
+                        *op = symbols[op->value].value;
+                }
+                editTyped.push_back(typeInstruction(ic, names));
+                editFixed.push_back(instructionLength(editTyped.back(), codeStart + editTyped.size() - 1));
+            }
+        }
+    } catch (const runtime_error&) {
+        return false;
+    }
+
+    if (optLevel > 0) {
+        // Peephole rewrites across lines: optimize and encode the linked program as a whole
+        try {
+            if (optLevel > 1)
+                optimizeDataflow(editTyped);
+            optimizePeephole(editTyped);
+            generateMachineCode(editTyped, code);
+        } catch (const runtime_error&) {
+            return false;
+        }
+        lastStats.instructionsEncoded = editTyped.size();
+        lastStats.instructions = editTyped.size();
+        return true;
+    }
+
+    splice(typed, codeStart, oldCount, editTyped);
+    splice(fixedLength, codeStart, oldCount, editFixed);
+    splice(references, 2 * codeStart, 2 * oldCount, editReferences);
+
+    // Uses outside the edit of symbols that moved; a branch only needs its label's new index
+    auto outside = [&](size_t i) { return i < codeStart || i >= codeStart + newCount; };
+    vector<pair<size_t, size_t>> changed;
+    if (!whole)
+        changed.push_back({codeStart, codeStart + newCount});
+    vector<size_t> encode;
+    if (anyMoved) {
+        try {
+            for (size_t i = 0; i < count; i++) {
+                SymbolId dst = references[2 * i], src = references[2 * i + 1];
+                bool dstMoved = dst != NO_SYMBOL && symbols[dst].moved == linkStamp;
+                bool srcMoved = src != NO_SYMBOL && symbols[src].moved == linkStamp;
+                if ((!dstMoved && !srcMoved) || !outside(i))
+                    continue;
+
+                TypedInstruction& instr = typed[i];
+                bool indexOnly = fixedLength[i] < 0 && !srcMoved && symbols[dst].value.type == LABEL;
+                if (dstMoved)
+                    instr.dst = symbols[dst].value;
+                if (srcMoved)
+                    instr.src = symbols[src].value;
+                if (indexOnly)
+                    continue;
+                fixedLength[i] = instructionLength(instr, i);
+                changed.push_back({i, i + 1});
+                encode.push_back(i);
+            }
+        } catch (const runtime_error&) {
+            return false;
+        }
+    }
+
+    // Layout: the edit's lengths are new, the rest start from the last link's
+    oldOffset.swap(layout.offset);
+    if (whole || !leastLayout) {
+        leastLayout = layoutCode(typed, fixedLength, layout);
+        for (size_t i = 0; i < count; i++)
+            encode.push_back(i);
+    } else {
+        splice(layout.length, codeStart, oldCount, vector<int>(newCount));
+        splice(layout.branchSize, codeStart, oldCount, vector<uint8_t>(newCount));
+        leastLayout = relayoutCode(typed, fixedLength, changed, layout, encode);
+        for (size_t i = codeStart; i < codeStart + newCount; i++)
+            encode.push_back(i);
+    }
+    sort(encode.begin(), encode.end());
+    encode.erase(unique(encode.begin(), encode.end()), encode.end());
+
+    // Encoded afresh: the edit, re-typed uses and moved branches; between them, runs of the old bytes
+    oldCode.swap(code);
+    code.clear();
+    code.reserve(layout.offset[count]);
+    auto oldIndex = [&](size_t i) { return i < codeStart ? i : i - newCount + oldCount; };
+    auto copyRun = [&](size_t from, size_t to) {
+        if (from < to)
+            code.insert(code.end(), oldCode.data() + oldOffset[oldIndex(from)],
+                        oldCode.data() + oldOffset[oldIndex(to - 1) + 1]);
+    };
+    size_t next = 0;
+    auto copyThrough = [&](size_t stop) {
+        if (next < codeStart && stop > codeStart) {
+            copyRun(next, codeStart);       // an edit that only removed code splits the run
+            next = codeStart;
+        }
+        copyRun(next, stop);
+    };
+    for (size_t i : encode) {
+        copyThrough(i);
+        encodeInstruction(typed, layout, i, code);
+        next = i + 1;
+    }
+    copyThrough(count);
+
+    linked = true;
+    lastStats.instructions = count;
+    lastStats.instructionsEncoded = encode.size();
+    return true;
+}
+
+// The authority on every edit the fast path declines
+void IncrementalAssembler::fullBuild() {
+    linked = false;
+    lastStats.fullBuild = true;
+
+    string source = text();
+    Compilation unit;
+    CompileOptions options;
+    options.optLevel = optLevel;
+    assemble(unit, &source[0], &source[0] + source.size(), options);
+
+    code = move(unit.machineCode);
+    lastStats.instructions = unit.typedInstructions.size();
+    lastStats.instructionsEncoded = unit.typedInstructions.size();
+}
+
+void IncrementalAssembler::rebuild(size_t first, const vector<Line>& replaced, size_t added) {
+    lastStats.lines = lines.size();
+
+    // Keep the line cache to about what the text can use
+    if (lineCache.size() > 2 * lines.size() + 4096) {
+        lineCache.clear();
+        for (const Line& line : lines)
+            lineCache[hash128(line.ir->text.data(), line.ir->text.size(), fmix64(line.ir->start + 1)).lo] = line.ir;
+    }
+
+    if (!link(first, replaced, added))
+        fullBuild();
+}
+
+/* ================================
+   Edits
+================================ */
+void IncrementalAssembler::replaceLines(size_t first, size_t removed, const vector<string>& inserted) {
+    if (first > lines.size() || removed > lines.size() - first)
+        throw runtime_error("Edit past the end of the text");
+    lastStats = IncrementalStats();
+
+    Parser::Section section = first ? lines[first - 1].ir->end : Parser::NO_SECTION;
+    vector<Line> added(inserted.size());
+    for (size_t k = 0; k < inserted.size(); k++) {
+        added[k].ir = parseLine(inserted[k], section);
+        section = added[k].ir->end;
+    }
+
+    // A changed section carries over into the lines after the edit, which join it
+    size_t end = first + removed;
+    for (; end < lines.size() && lines[end].ir->start != section; end++) {
+        Line line;
+        line.ir = parseLine(lines[end].ir->text, section);
+        section = line.ir->end;
+        added.push_back(line);
+    }
+
+    vector<Line> replaced(lines.begin() + first, lines.begin() + end);
+    lines.erase(lines.begin() + first, lines.begin() + end);
+    lines.insert(lines.begin() + first, added.begin(), added.end());
+    rebuild(first, replaced, added.size());
+}
+
+void IncrementalAssembler::update(const string& text) {
+    vector<string_view> now;
+    size_t pos = 0;
+    for (;;) {
+        size_t nl = text.find('\n', pos);
+        if (nl == string::npos) {
+            now.push_back(string_view(text).substr(pos));
+            break;
+        }
+        now.push_back(string_view(text).substr(pos, nl - pos));
+        pos = nl + 1;
+    }
+
+    // Only the differing middle is re-parsed
+    size_t common = min(now.size(), lines.size());
+    size_t prefix = 0;
+    while (prefix < common && now[prefix] == lines[prefix].ir->text)
+        prefix++;
+    size_t suffix = 0;
+    while (suffix < common - prefix &&
+           now[now.size() - 1 - suffix] == lines[lines.size() - 1 - suffix].ir->text)
+        suffix++;
+
+    vector<string> inserted(now.begin() + prefix, now.end() - suffix);
+    replaceLines(prefix, lines.size() - prefix - suffix, inserted);
+}
+
+string IncrementalAssembler::text() const {
+    string s;
+    for (size_t k = 0; k < lines.size(); k++) {
+        if (k)
+            s += '\n';
+        s += lines[k].ir->text;
+    }
+    return s;
+}
@@ -0,0 +1,150 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "backend.h"
+#include "parser.h"
+
+using namespace std;
+
+/* ================= Incremental Assembly ================= */
+/*
+   Keeps one program assembled across edits (editor and watch mode).
+
+   Each source line is lexed and parsed on its own into a LineIR whose
+   symbol references are left unresolved. LineIRs are cached by a hash
+   of the line's text and the section it starts in. An edit re-parses
+   only the lines whose text changed, plus any lines after them whose
+   starting section changed.
+
+   Linking then carries the last link forward rather than redoing it:
+   - the edited lines are resolved and typed; instruction indices and
+     data addresses after them move as a block;
+   - each symbol keeps its definition and value, and counts of both;
+     a use elsewhere is re-typed only when its symbol's value changed
+     in more than instruction index;
+   - relayoutCode re-relaxes only the branches whose spans meet the
+     edit or a branch that changed size;
+   - only the edited lines, re-typed uses and those branches are
+     encoded again. Every other instruction's bytes are copied.
+
+   Some passes over the whole file remain. They are plain array and
+   memory moves: splicing the per-line, per-instruction and layout
+   arrays, shifting the lines and symbols after the edit, scanning
+   for uses of moved symbols, recomputing offsets, and copying the
+   code bytes. At 400k lines an edit that inserts or deletes a line
+   costs about 13 ms, and 7 ms when it keeps the line count; loading
+   the text from nothing takes 600 ms. Linking starts over from every
+   line for the first text, after a fallback (below), and with
+   optLevel > 0.
+
+   The result is byte-for-byte what assemble() produces. When the fast
+   path cannot guarantee that, the edit falls back to a full assemble()
+   of the text, which also throws exactly the error a full build
+   reports. That happens for:
+   - a line that does not parse on its own, or that the parser would
+     join to the line before it (the token stream ignores line breaks:
+     "INC" followed by "AX" parses as INC AX);
+   - a duplicate or undefined symbol;
+   - an instruction with no encoding.
+   With optLevel > 0 the optimizers and code generation run over the
+   whole linked program, since their rewrites cross line boundaries.
+*/
+struct IncrementalStats {
+    size_t lines = 0;
+    size_t linesParsed = 0;             // lexed and parsed by the last edit
+    size_t instructions = 0;
+    size_t instructionsEncoded = 0;     // encoded by the last edit rather than copied
+    bool fullBuild = false;             // the last edit fell back to assemble()
+};
+
+class IncrementalAssembler {
+private:
+    struct LineSymbol {
+        SymbolId name;
+        bool isLabel;
+        int size;
+        int at;                         // instruction index or data address within the line
+    };
+
+    // How a line's first token could continue an instruction left open by the line before it
+    enum Lead : uint8_t { LEAD_NONE, LEAD_OPERAND, LEAD_COMMA, LEAD_OTHER };
+
+    struct LineIR {
+        string text;
+        Parser::Section start, end;
+        bool parsed = false;            // false: the line does not parse on its own
+        Lead lead = LEAD_NONE;          // LEAD_NONE: no tokens at all
+        int trailingOperands = -1;      // see Parser::trailingOperands()
+        vector<LineSymbol> symbols;
+        vector<IC> code;                // references left as SYM
+        int dataSize = 0;
+    };
+
+    struct Line {
+        shared_ptr<const LineIR> ir;
+        size_t codeStart = 0;           // first instruction and data address, as of the last link
+        int dataStart = 0;
+    };
+
+    // A symbol over the lines of the last link
+    struct SymbolState {
+        int definitions = 0;
+        int uses = 0;                   // operands naming it
+        size_t line = 0;                // where it is defined
+        TypedOperand value;
+        uint32_t moved = 0;             // linkStamp of the last link that changed value
+    };
+
+    int optLevel;
+    SymbolInterner names;               // only grows; IDs stay valid in cached LineIRs
+    vector<Line> lines;
+    unordered_map<uint64_t, shared_ptr<const LineIR>> lineCache;
+
+    // The last successful fast link, which the next one edits
+    bool linked = false;
+    vector<TypedInstruction> typed;
+    vector<int> fixedLength;
+    vector<SymbolId> references;        // two per instruction: the symbols dst and src name, or NO_SYMBOL
+    CodeLayout layout;
+    bool leastLayout = false;           // see layoutCode()
+    vector<uint8_t> code;
+    vector<int> oldOffset;              // the link before, while a link copies from it; kept for the buffers
+    vector<uint8_t> oldCode;
+    vector<SymbolState> symbols;
+    uint32_t linkStamp = 0;
+
+    IncrementalStats lastStats;
+
+    shared_ptr<const LineIR> parseLine(const string& text, Parser::Section start);
+    bool link(size_t first, const vector<Line>& replaced, size_t added);
+    void fullBuild();
+    void rebuild(size_t first, const vector<Line>& replaced, size_t added);
+
+public:
+    explicit IncrementalAssembler(int optLevel = 0);
+
+    IncrementalAssembler(const IncrementalAssembler&) = delete;
+    IncrementalAssembler& operator=(const IncrementalAssembler&) = delete;
+
+    /*
+       Both throw runtime_error for a program that does not assemble; the
+       edit is still applied and machineCode() keeps the last good result.
+    */
+    // Replace the whole text; only lines that differ from the current text are re-parsed
+    void update(const string& text);
+    // Replace lines [first, first + removed) with inserted, each given without its '\n'
+    void replaceLines(size_t first, size_t removed, const vector<string>& inserted);
+
+    const vector<uint8_t>& machineCode() const { return code; }
+    const IncrementalStats& stats() const { return lastStats; }
+    size_t lineCount() const { return lines.size(); }
+    string text() const;
+};
+
+#endif
@@ -1,82 +1,51 @@
 #include "backend.h"
+#include "isa.h"
 #include <stdexcept>
 #include <string>
 
 using namespace std;
 
 /* ======================================================
-   Helper: validate MOV instruction
+   Helper: operand shape for diagnostics
 ====================================================== */
-static void validateMOV(const TypedInstruction& instr) {
-    OperandType dst = instr.dst.type;
-    OperandType src = instr.src.type;
-
-    // MOV rules (8086)
-    // REG <- REG | MEM | IMM
-    // MEM <- REG
-    // MEM <- MEM ❌
-    // MEM <- IMM ❌
-
-    if (dst == MEM && src == MEM) {
-        throw runtime_error("Illegal MOV: memory to memory not allowed");
-    }
-
-    if (dst == MEM && src == IMM) {
-        throw runtime_error("Illegal MOV: immediate to memory not allowed");
-    }
-
-    if (dst == NONE || src == NONE) {
-        throw runtime_error("Illegal MOV: missing operand");
+static string describeOperand(const TypedOperand& op) {
+    switch (op.type) {
+    case REG:  return registerName((RegisterId)op.value);
+    case MEM:  return "MEM";
+    case IMM:  return "IMM";
+    case SYM:  return "SYM";
+    case LABEL: return "LABEL";
+    case NONE: break;
     }
+    return "NONE";
 }
 
 /* ======================================================
-   Helper: validate ADD instruction
+   Helper: explain why no form matched
 ====================================================== */
-static void validateADD(const TypedInstruction& instr) {
-    OperandType dst = instr.dst.type;
-    OperandType src = instr.src.type;
+static string rejectReason(const TypedInstruction& instr) {
+    if (formIndex.range[instr.opcode].count == 0)
+        return "Unsupported instruction: " + string(opcodeName(instr.opcode));
 
-    // ADD rules (8086)
-    // REG <- REG | MEM | IMM
-    // MEM <- REG
-    // MEM <- MEM ❌
+    string name = opcodeName(instr.opcode);
 
-    if (dst == MEM && src == MEM) {
-        throw runtime_error("Illegal ADD: memory to memory not allowed");
-    }
+    // 8086 never takes two memory operands
+    if (instr.dst.type == MEM && instr.src.type == MEM)
+        return "Illegal " + name + ": memory to memory not allowed";
 
-    if (dst == NONE || src == NONE) {
-        throw runtime_error("Illegal ADD: missing operand");
-    }
-}
-
-/* ======================================================
-   Helper: validate HLT instruction
-====================================================== */
-static void validateHLT(const TypedInstruction& instr) {
-    if (instr.dst.type != NONE || instr.src.type != NONE) {
-        throw runtime_error("Illegal HLT: operands not allowed");
-    }
+    return "Illegal " + name + ": no form takes (" +
+           describeOperand(instr.dst) + ", " + describeOperand(instr.src) + ")";
 }
 
 /* ======================================================
    Main validation function
+   An instruction is valid when some row of the form
+   table accepts its operand shapes.
 ====================================================== */
 void validateInstructions(const vector<TypedInstruction>& instructions) {
     for (const auto& instr : instructions) {
-
-        if (instr.opcode == "MOV") {
-            validateMOV(instr);
-        }
-        else if (instr.opcode == "ADD") {
-            validateADD(instr);
-        }
-        else if (instr.opcode == "HLT") {
-            validateHLT(instr);
-        }
-        else {
-            throw runtime_error("Unsupported instruction: " + instr.opcode);
+        if (!selectForm(instr)) {
+            throw runtime_error(rejectReason(instr));
         }
     }
 }
@@ -0,0 +1,69 @@
+#include "common.h"
+#include "hash.h"
+#include <cstring>
+
+using namespace std;
+
+/* =========================================
+   Interned symbol names
+   Equal keys mean equal names up to 7 bytes long; only
+   longer names are compared in full.
+========================================= */
+static uint32_t nameHash(string_view name) {
+    return (uint32_t)hash128(name.data(), name.size()).lo;
+}
+
+static uint64_t nameKey(string_view name) {
+    uint64_t key = 0;
+    memcpy(&key, name.data(), name.size() < 7 ? name.size() : 7);
+    return key | (uint64_t)(name.size() < 255 ? name.size() : 255) << 56;
+}
+
+size_t SymbolInterner::probe(string_view name, uint32_t hash, uint64_t key) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& s = slots[i];
+        if (s.id == NO_SYMBOL)
+            return i;
+        if (s.hash == hash && s.key == key && (name.size() <= 7 || names[s.id] == name))
+            return i;
+    }
+}
+
+void SymbolInterner::grow() {
+    vector<Slot> old;
+    old.swap(slots);
+    slots.assign(old.empty() ? 64 : old.size() * 2, Slot{0, NO_SYMBOL, 0});
+
+    size_t mask = slots.size() - 1;
+    for (const Slot& s : old) {
+        if (s.id == NO_SYMBOL)
+            continue;
+        size_t i = s.hash & mask;
+        while (slots[i].id != NO_SYMBOL)
+            i = (i + 1) & mask;
+        slots[i] = s;
+    }
+}
+
+SymbolId SymbolInterner::intern(string_view name) {
+    if (2 * (names.size() + 1) > slots.size())
+        grow();
+
+    uint32_t hash = nameHash(name);
+    uint64_t key = nameKey(name);
+    Slot& slot = slots[probe(name, hash, key)];
+    if (slot.id != NO_SYMBOL)
+        return slot.id;
+
+    SymbolId id = (SymbolId)names.size();
+    names.push_back(text.copy(name));
+    slot = Slot{hash, id, key};
+    return id;
+}
+
+SymbolId SymbolInterner::find(string_view name) const {
+    if (slots.empty())
+        return NO_SYMBOL;
+    return slots[probe(name, nameHash(name), nameKey(name))].id;
+}
@@ -0,0 +1,302 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <cstdint>
+#include <cstddef>
+#include "common.h"
+#include "keywords.h"
+
+using namespace std;
+
+struct TypedInstruction;
+
+/* ================= 8086 Instruction Forms ================= */
+/*
+   One row per encodable (opcode, dst, src) shape. Validation, form
+   selection and encoding are all driven by this table; rows for the same
+   opcode are contiguous and tried in order, so shorter encodings come
+   first.
+*/
+
+enum OperandForm : uint8_t {
+    F_NONE,
+    F_R8,       // AL..BH
+    F_R16,      // AX..DI
+    F_RM8,      // 8-bit register or byte memory
+    F_RM16,     // 16-bit register or word memory
+    F_M,        // memory only (LEA, LDS, LES)
+    F_AL,
+    F_AX,
+    F_CL,
+    F_DX,
+    F_SREG,     // ES, CS, SS, DS
+    F_IMM8,     // 0..FF
+    F_IMM16,
+    F_SIMM8,    // 16-bit immediate that sign-extends from 8 bits
+    F_ONE,      // literal 1 (shift count)
+    F_REL8,     // branch target within -128..127 of the next instruction
+    F_REL16
+};
+
+enum Encoding : uint8_t {
+    E_FIXED,    // opcode [+ fixed second byte in ext]
+    E_REG_RM,   // ModR/M: reg = dst, rm = src
+    E_RM_REG,   // ModR/M: rm = dst, reg = src
+    E_RM_EXT,   // ModR/M: rm = dst, reg = ext; optional immediate
+    E_OPREG,    // opcode + register number; optional immediate
+    E_SREG_OP,  // opcode + (segment register << 3)
+    E_IMM,      // opcode + immediate
+    E_REL       // opcode + displacement to target
+};
+
+constexpr uint8_t NO_EXT = 0xFF;
+
+struct InstrForm {
+    Opcode op;
+    OperandForm dst;
+    OperandForm src;
+    uint8_t opcode;
+    uint8_t ext;        // ModR/M reg-field extension, or second opcode byte for E_FIXED
+    Encoding enc;
+};
+
+#define FORM(op, d, s, code, ext, enc) {OP_##op, F_##d, F_##s, code, ext, E_##enc},
+
+#define FIXED(op, code)          FORM(op, NONE, NONE, code, NO_EXT, FIXED)
+#define FIXED2(op, code, second) FORM(op, NONE, NONE, code, second, FIXED)
+
+/* ADD OR ADC SBB AND SUB XOR CMP share one layout, n = group number */
+#define ALU_FORMS(op, n)                                   \
+    FORM(op, R8,   RM8,   (n) * 8 + 2, NO_EXT, REG_RM)     \
+    FORM(op, R16,  RM16,  (n) * 8 + 3, NO_EXT, REG_RM)     \
+    FORM(op, RM8,  R8,    (n) * 8 + 0, NO_EXT, RM_REG)     \
+    FORM(op, RM16, R16,   (n) * 8 + 1, NO_EXT, RM_REG)     \
+    FORM(op, AL,   IMM8,  (n) * 8 + 4, NO_EXT, IMM)        \
+    FORM(op, AX,   IMM16, (n) * 8 + 5, NO_EXT, IMM)        \
+    FORM(op, RM8,  IMM8,  0x80, n, RM_EXT)                 \
+    FORM(op, RM16, SIMM8, 0x83, n, RM_EXT)                 \
+    FORM(op, RM16, IMM16, 0x81, n, RM_EXT)
+
+/* NOT NEG MUL IMUL DIV IDIV: F6/F7 group */
+#define UNARY_FORMS(op, n)                                 \
+    FORM(op, RM8,  NONE, 0xF6, n, RM_EXT)                  \
+    FORM(op, RM16, NONE, 0xF7, n, RM_EXT)
+
+/* Shifts and rotates: D0-D3 group */
+#define SHIFT_FORMS(op, n)                                 \
+    FORM(op, RM8,  ONE, 0xD0, n, RM_EXT)                   \
+    FORM(op, RM16, ONE, 0xD1, n, RM_EXT)                   \
+    FORM(op, RM8,  CL,  0xD2, n, RM_EXT)                   \
+    FORM(op, RM16, CL,  0xD3, n, RM_EXT)
+
+#define SHORT_BRANCH(op, code) FORM(op, REL8, NONE, code, NO_EXT, REL)
+
+inline constexpr InstrForm instrForms[] = {
+    ALU_FORMS(ADD, 0)
+    ALU_FORMS(OR,  1)
+    ALU_FORMS(ADC, 2)
+    ALU_FORMS(SBB, 3)
+    ALU_FORMS(AND, 4)
+    ALU_FORMS(SUB, 5)
+    ALU_FORMS(XOR, 6)
+    ALU_FORMS(CMP, 7)
+
+    FORM(MOV, R8,   RM8,   0x8A, NO_EXT, REG_RM)
+    FORM(MOV, R16,  RM16,  0x8B, NO_EXT, REG_RM)
+    FORM(MOV, RM8,  R8,    0x88, NO_EXT, RM_REG)
+    FORM(MOV, RM16, R16,   0x89, NO_EXT, RM_REG)
+    FORM(MOV, RM16, SREG,  0x8C, NO_EXT, RM_REG)
+    FORM(MOV, SREG, RM16,  0x8E, NO_EXT, REG_RM)
+    FORM(MOV, R8,   IMM8,  0xB0, NO_EXT, OPREG)
+    FORM(MOV, R16,  IMM16, 0xB8, NO_EXT, OPREG)
+    FORM(MOV, RM8,  IMM8,  0xC6, 0, RM_EXT)
+    FORM(MOV, RM16, IMM16, 0xC7, 0, RM_EXT)
+
+    FORM(XCHG, AX,   R16,  0x90, NO_EXT, OPREG)
+    FORM(XCHG, R16,  AX,   0x90, NO_EXT, OPREG)
+    FORM(XCHG, R8,   RM8,  0x86, NO_EXT, REG_RM)
+    FORM(XCHG, R16,  RM16, 0x87, NO_EXT, REG_RM)
+    FORM(XCHG, RM8,  R8,   0x86, NO_EXT, RM_REG)
+    FORM(XCHG, RM16, R16,  0x87, NO_EXT, RM_REG)
+
+    FORM(TEST, AL,   IMM8,  0xA8, NO_EXT, IMM)
+    FORM(TEST, AX,   IMM16, 0xA9, NO_EXT, IMM)
+    FORM(TEST, R8,   RM8,   0x84, NO_EXT, REG_RM)
+    FORM(TEST, R16,  RM16,  0x85, NO_EXT, REG_RM)
+    FORM(TEST, RM8,  R8,    0x84, NO_EXT, RM_REG)
+    FORM(TEST, RM16, R16,   0x85, NO_EXT, RM_REG)
+    FORM(TEST, RM8,  IMM8,  0xF6, 0, RM_EXT)
+    FORM(TEST, RM16, IMM16, 0xF7, 0, RM_EXT)
+
+    FORM(INC, R16,  NONE, 0x40, NO_EXT, OPREG)
+    FORM(INC, RM8,  NONE, 0xFE, 0, RM_EXT)
+    FORM(INC, RM16, NONE, 0xFF, 0, RM_EXT)
+    FORM(DEC, R16,  NONE, 0x48, NO_EXT, OPREG)
+    FORM(DEC, RM8,  NONE, 0xFE, 1, RM_EXT)
+    FORM(DEC, RM16, NONE, 0xFF, 1, RM_EXT)
+
+    UNARY_FORMS(NOT,  2)
+    UNARY_FORMS(NEG,  3)
+    UNARY_FORMS(MUL,  4)
+    UNARY_FORMS(IMUL, 5)
+    UNARY_FORMS(DIV,  6)
+    UNARY_FORMS(IDIV, 7)
+
+    SHIFT_FORMS(ROL, 0)
+    SHIFT_FORMS(ROR, 1)
+    SHIFT_FORMS(RCL, 2)
+    SHIFT_FORMS(RCR, 3)
+    SHIFT_FORMS(SHL, 4)
+    SHIFT_FORMS(SAL, 4)
+    SHIFT_FORMS(SHR, 5)
+    SHIFT_FORMS(SAR, 7)
+
+    FORM(PUSH, R16,  NONE, 0x50, NO_EXT, OPREG)
+    FORM(PUSH, SREG, NONE, 0x06, NO_EXT, SREG_OP)
+    FORM(PUSH, RM16, NONE, 0xFF, 6, RM_EXT)
+    FORM(POP,  R16,  NONE, 0x58, NO_EXT, OPREG)
+    FORM(POP,  SREG, NONE, 0x07, NO_EXT, SREG_OP)
+    FORM(POP,  RM16, NONE, 0x8F, 0, RM_EXT)
+
+    FORM(LEA, R16, M, 0x8D, NO_EXT, REG_RM)
+    FORM(LDS, R16, M, 0xC5, NO_EXT, REG_RM)
+    FORM(LES, R16, M, 0xC4, NO_EXT, REG_RM)
+
+    FORM(IN,  AL,   IMM8, 0xE4, NO_EXT, IMM)
+    FORM(IN,  AX,   IMM8, 0xE5, NO_EXT, IMM)
+    FORM(IN,  AL,   DX,   0xEC, NO_EXT, FIXED)
+    FORM(IN,  AX,   DX,   0xED, NO_EXT, FIXED)
+    FORM(OUT, IMM8, AL,   0xE6, NO_EXT, IMM)
+    FORM(OUT, IMM8, AX,   0xE7, NO_EXT, IMM)
+    FORM(OUT, DX,   AL,   0xEE, NO_EXT, FIXED)
+    FORM(OUT, DX,   AX,   0xEF, NO_EXT, FIXED)
+
+    FORM(JMP,  REL8,  NONE, 0xEB, NO_EXT, REL)
+    FORM(JMP,  REL16, NONE, 0xE9, NO_EXT, REL)
+    FORM(JMP,  RM16,  NONE, 0xFF, 4, RM_EXT)
+    FORM(CALL, REL16, NONE, 0xE8, NO_EXT, REL)
+    FORM(CALL, RM16,  NONE, 0xFF, 2, RM_EXT)
+    FORM(RET,  NONE,  NONE, 0xC3, NO_EXT, FIXED)
+    FORM(RET,  IMM16, NONE, 0xC2, NO_EXT, IMM)
+
+    SHORT_BRANCH(JO,  0x70)
+    SHORT_BRANCH(JNO, 0x71)
+    SHORT_BRANCH(JB,  0x72)
+    SHORT_BRANCH(JC,  0x72)
+    SHORT_BRANCH(JAE, 0x73)
+    SHORT_BRANCH(JNC, 0x73)
+    SHORT_BRANCH(JE,  0x74)
+    SHORT_BRANCH(JZ,  0x74)
+    SHORT_BRANCH(JNE, 0x75)
+    SHORT_BRANCH(JNZ, 0x75)
+    SHORT_BRANCH(JBE, 0x76)
+    SHORT_BRANCH(JA,  0x77)
+    SHORT_BRANCH(JS,  0x78)
+    SHORT_BRANCH(JNS, 0x79)
+    SHORT_BRANCH(JL,  0x7C)
+    SHORT_BRANCH(JGE, 0x7D)
+    SHORT_BRANCH(JLE, 0x7E)
+    SHORT_BRANCH(JG,  0x7F)
+    SHORT_BRANCH(LOOPNE, 0xE0)
+    SHORT_BRANCH(LOOPE,  0xE1)
+    SHORT_BRANCH(LOOP,   0xE2)
+    SHORT_BRANCH(JCXZ,   0xE3)
+
+    FIXED(DAA, 0x27)
+    FIXED(DAS, 0x2F)
+    FIXED(AAA, 0x37)
+    FIXED(AAS, 0x3F)
+    FIXED2(AAM, 0xD4, 0x0A)
+    FIXED2(AAD, 0xD5, 0x0A)
+    FIXED(XLAT, 0xD7)
+    FIXED(LAHF, 0x9F)
+    FIXED(SAHF, 0x9E)
+    FIXED(PUSHF, 0x9C)
+    FIXED(POPF, 0x9D)
+    FIXED(HLT,  0xF4)
+    FIXED(NOP,  0x90)
+    FIXED(WAIT, 0x9B)
+    FIXED(LOCK, 0xF0)
+    FIXED(CLC,  0xF8)
+    FIXED(STC,  0xF9)
+    FIXED(CMC,  0xF5)
+    FIXED(CLD,  0xFC)
+    FIXED(STD,  0xFD)
+    FIXED(CLI,  0xFA)
+    FIXED(STI,  0xFB)
+    FIXED(MOVSB, 0xA4)
+    FIXED(MOVSW, 0xA5)
+    FIXED(CMPSB, 0xA6)
+    FIXED(CMPSW, 0xA7)
+    FIXED(STOSB, 0xAA)
+    FIXED(STOSW, 0xAB)
+    FIXED(LODSB, 0xAC)
+    FIXED(LODSW, 0xAD)
+    FIXED(SCASB, 0xAE)
+    FIXED(SCASW, 0xAF)
+
+    /* String prefixes: REP MOVSB assembles as two instructions, F3 A4 */
+    FIXED(REP,   0xF3)
+    FIXED(REPE,  0xF3)
+    FIXED(REPZ,  0xF3)
+    FIXED(REPNE, 0xF2)
+    FIXED(REPNZ, 0xF2)
+};
+
+#undef FORM
+#undef FIXED
+#undef FIXED2
+#undef ALU_FORMS
+#undef UNARY_FORMS
+#undef SHIFT_FORMS
+#undef SHORT_BRANCH
+
+constexpr size_t INSTR_FORM_COUNT = sizeof(instrForms) / sizeof(instrForms[0]);
+
+/* ================= Opcode -> Form Range ================= */
+
+struct FormRange {
+    uint16_t first;
+    uint16_t count;
+};
+
+struct FormIndex {
+    FormRange range[OP_COUNT];
+    bool contiguous;
+};
+
+constexpr FormIndex buildFormIndex() {
+    FormIndex index{};
+    index.contiguous = true;
+
+    for (size_t i = 0; i < INSTR_FORM_COUNT; i++) {
+        FormRange& r = index.range[instrForms[i].op];
+        if (r.count == 0)
+            r.first = (uint16_t)i;
+        else if (r.first + r.count != i)
+            index.contiguous = false;
+        r.count++;
+    }
+    return index;
+}
+
+inline constexpr FormIndex formIndex = buildFormIndex();
+
+static_assert(formIndex.contiguous, "instrForms rows for one opcode must be adjacent");
+
+/* ================= Form Selection / Encoding ================= */
+
+/*
+   First form whose operand shapes fit, or nullptr. With address < 0 only
+   shapes are checked (validation); otherwise branch displacements must
+   also fit the form (code generation).
+*/
+const InstrForm* selectForm(const TypedInstruction& instr, int address = -1);
+
+// Encoded size in bytes of instr using form
+int formLength(const InstrForm& form, const TypedInstruction& instr);
+
+// Append the encoding of instr using form; address is where it starts
+void encodeForm(const InstrForm& form, const TypedInstruction& instr, int address, vector<uint8_t>& out);
+
+#endif
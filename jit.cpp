@@ -0,0 +1,598 @@
+#include "jit.h"
+#include "decoder.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64 1
+#endif
+
+#ifdef JIT_X64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+using namespace std;
+
+#ifndef JIT_X64
+
+/* ================================
+   No x86-64 host: interpreter only
+================================ */
+bool jitAvailable() { return false; }
+
+JitCodeBuffer::~JitCodeBuffer() {}
+
+JitCompileResult jitCompileBlock(JitCodeBuffer&, const uint8_t*, uint16_t, JitBlock&) {
+    return JIT_UNSUPPORTED;
+}
+
+void jitReset(JitCodeBuffer&) {}
+
+#else
+
+/* ================================
+   Executable code buffer
+   One region per JitCodeBuffer, filled linearly and
+   released all at once.
+================================ */
+constexpr size_t JIT_CODE_CAPACITY = 8 << 20;
+
+static uint8_t* mapCode() {
+#ifdef _WIN32
+    void* p = VirtualAlloc(nullptr, JIT_CODE_CAPACITY, MEM_COMMIT | MEM_RESERVE,
+                           PAGE_EXECUTE_READWRITE);
+    return (uint8_t*)p;
+#else
+    void* p = mmap(nullptr, JIT_CODE_CAPACITY, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? nullptr : (uint8_t*)p;
+#endif
+}
+
+static void unmapCode(uint8_t* p) {
+#ifdef _WIN32
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, JIT_CODE_CAPACITY);
+#endif
+}
+
+static bool allocateCodeBuffer(JitCodeBuffer& code) {
+    if (!code.base) {
+        code.base = mapCode();
+        code.used = 0;
+    }
+    return code.base != nullptr;
+}
+
+JitCodeBuffer::~JitCodeBuffer() {
+    if (base)
+        unmapCode(base);
+}
+
+// Probed once: some hosts refuse writable+executable mappings
+bool jitAvailable() {
+    static const bool available = [] {
+        uint8_t* p = mapCode();
+        if (p)
+            unmapCode(p);
+        return p != nullptr;
+    }();
+    return available;
+}
+
+void jitReset(JitCodeBuffer& code) {
+    code.used = 0;
+}
+
+/* ================================
+   x86-64 emitter
+================================ */
+enum HostReg : uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Guest register n (AX..DI) lives in host r(8+n)
+static HostReg hostReg(int guest) {
+    return (HostReg)(R8 + guest);
+}
+
+// A 16-bit operand: a host register or [rsi + guest address]
+struct Loc {
+    bool mem;
+    HostReg reg;
+    uint16_t addr;
+};
+
+struct X64Emitter {
+    vector<uint8_t> code;
+
+    size_t here() const { return code.size(); }
+    void b(uint8_t v) { code.push_back(v); }
+    void w(uint16_t v) { b(v & 0xFF); b(v >> 8); }
+    void d(uint32_t v) { w(v & 0xFFFF); w(v >> 16); }
+    void patch32(size_t at, uint32_t v) { memcpy(&code[at], &v, 4); }
+
+    static uint8_t modrm(int mod, int reg, int rm) {
+        return (uint8_t)((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // 16-bit op: 66 [REX] opcode ModR/M [disp32]; reg is a host register or /digit
+    void op16(uint8_t opcode, int reg, const Loc& rm) {
+        b(0x66);
+        uint8_t rex = 0x40 | ((reg & 8) ? 4 : 0) | (!rm.mem && (rm.reg & 8) ? 1 : 0);
+        if (rex != 0x40)
+            b(rex);
+        b(opcode);
+        if (rm.mem) {
+            b(modrm(2, reg, RSI));
+            d(rm.addr);
+        } else {
+            b(modrm(3, reg, rm.reg));
+        }
+    }
+
+    // mov r64, [base + disp8]
+    void load64(HostReg dst, HostReg base, uint8_t disp) {
+        b(0x48 | ((dst & 8) ? 4 : 0));
+        b(0x8B);
+        b(modrm(1, dst, base));
+        b(disp);
+    }
+
+    // mov r16 <-> [base + disp8], r16 in r8w..r15w
+    void loadGuest(HostReg dst, HostReg base, uint8_t disp) {
+        b(0x66); b(0x44); b(0x8B); b(modrm(1, dst, base)); b(disp);
+    }
+    void storeGuest(HostReg src, HostReg base, uint8_t disp) {
+        b(0x66); b(0x44); b(0x89); b(modrm(1, src, base)); b(disp);
+    }
+
+    void push(HostReg r) { if (r & 8) b(0x41); b(0x50 + (r & 7)); }
+    void pop(HostReg r)  { if (r & 8) b(0x41); b(0x58 + (r & 7)); }
+
+    // jmp/jcc rel32 to a later address; returns the field to patch
+    size_t jmp32() { b(0xE9); d(0); return here() - 4; }
+    size_t jcc32(uint8_t cc) { b(0x0F); b(0x80 | cc); d(0); return here() - 4; }
+    void bind(size_t field, size_t target) { patch32(field, (uint32_t)(target - (field + 4))); }
+    void jmpBack(size_t target) { b(0xE9); d((uint32_t)(target - (here() + 4))); }
+
+    // add qword [rdi + disp32], imm32
+    void addExecuted(uint32_t n) {
+        if (!n)
+            return;
+        b(0x48); b(0x81); b(modrm(2, 0, RDI));
+        d(offsetof(JitContext, executed));
+        d(n);
+    }
+};
+
+constexpr uint8_t CC_E = 0x4, CC_NE = 0x5;
+
+/* ================================
+   Guest flags
+   Only flags some exit can observe are stored back: a
+   backward pass over the block marks which instructions'
+   flag results are live.
+================================ */
+struct JitFlagEffect {
+    uint16_t writes;    // guest flags the instruction defines
+    uint16_t host;      // of those, bits the host computes identically (others become 0)
+    uint16_t reads;
+};
+
+static JitFlagEffect jitFlagEffect(const DecodedInsn& d) {
+    const uint16_t logic = FLAG_ARITH & ~FLAG_AF;     // AF is left 0 by the interpreter
+    switch (d.opcode) {
+    case OP_ADD: case OP_SUB: case OP_CMP: case OP_NEG:
+        return {FLAG_ARITH, FLAG_ARITH, 0};
+    case OP_ADC: case OP_SBB:
+        return {FLAG_ARITH, FLAG_ARITH, FLAG_CF};
+    case OP_AND: case OP_OR: case OP_XOR: case OP_TEST:
+    case OP_SHL: case OP_SAL: case OP_SHR: case OP_SAR:
+        return {FLAG_ARITH, logic, 0};
+    case OP_INC: case OP_DEC:
+        return {FLAG_ARITH & ~FLAG_CF, FLAG_ARITH & ~FLAG_CF, 0};
+    case OP_ROL: case OP_ROR:
+        return {FLAG_CF | FLAG_OF, FLAG_CF | FLAG_OF, 0};
+    default:
+        return {0, 0, 0};
+    }
+}
+
+// An instruction that may leave the block right after it
+static bool storesToMemory(const DecodedInsn& d) {
+    if (d.opcode == OP_CMP || d.opcode == OP_TEST)
+        return false;
+    return (d.dst.type == MEM) || (d.opcode == OP_XCHG && d.src.type == MEM);
+}
+
+/* ================================
+   Block translation
+================================ */
+struct PendingExit {
+    size_t field;           // jcc/jmp rel32 to patch
+    uint16_t ip;
+    uint32_t executed;
+    JitExit reason;
+    uint16_t writeAddr;
+};
+
+struct BlockTranslator {
+    X64Emitter x;
+    uint16_t start;
+    size_t loopTop = 0;
+    vector<PendingExit> exits;
+    vector<uint16_t> stores;
+
+    static bool loc(const DecodedOperand& o, Loc& out) {
+        if (o.type == REG && o.value <= REG_DI) {
+            out = {false, hostReg(o.value), 0};
+            return true;
+        }
+        if (o.type == MEM && o.ea == EA_DIRECT) {
+            out = {true, RAX, (uint16_t)o.value};
+            return true;
+        }
+        return false;
+    }
+
+    void prologue() {
+        static const HostReg saved[] = {RBX, RBP, R12, R13, R14, R15};
+        for (HostReg r : saved)
+            x.push(r);
+#ifdef _WIN32
+        x.push(RDI);
+        x.push(RSI);
+        x.b(0x48); x.b(0x89); x.b(X64Emitter::modrm(3, RCX, RDI));   // mov rdi, rcx
+#endif
+        x.load64(RSI, RDI, offsetof(JitContext, memory));
+        x.load64(RBX, RDI, offsetof(JitContext, codeMap));
+        x.load64(RDX, RDI, offsetof(JitContext, cpu));
+        for (int n = 0; n < 8; n++)
+            x.loadGuest(hostReg(n), RDX, (uint8_t)(offsetof(CPU, regs) + 2 * n));
+        loopTop = x.here();
+    }
+
+    // Write back guest registers, restore host registers, return eax
+    void epilogue() {
+        x.load64(RDX, RDI, offsetof(JitContext, cpu));
+        for (int n = 0; n < 8; n++)
+            x.storeGuest(hostReg(n), RDX, (uint8_t)(offsetof(CPU, regs) + 2 * n));
+#ifdef _WIN32
+        x.pop(RSI);
+        x.pop(RDI);
+#endif
+        static const HostReg saved[] = {R15, R14, R13, R12, RBP, RBX};
+        for (HostReg r : saved)
+            x.pop(r);
+        x.b(0xC3);
+    }
+
+    // Exit stub body: account, set IP, pick the reason, jump to the epilogue
+    size_t exitStub(const PendingExit& e) {
+        x.addExecuted(e.executed);
+        if (e.reason == JIT_EXIT_CODE_WRITE) {
+            x.b(0x66); x.b(0xC7); x.b(X64Emitter::modrm(2, 0, RDI));   // mov word [rdi+d32], imm16
+            x.d(offsetof(JitContext, writeAddr));
+            x.w(e.writeAddr);
+        }
+        x.load64(RDX, RDI, offsetof(JitContext, cpu));
+        x.b(0x66); x.b(0xC7); x.b(X64Emitter::modrm(2, 0, RDX));       // mov word [rdx+d32], imm16
+        x.d(offsetof(CPU, IP));
+        x.w(e.ip);
+        x.b(0xB8); x.d(e.reason);                                      // mov eax, reason
+        return x.jmp32();
+    }
+
+    void exitTo(uint16_t ip, uint32_t executed) {
+        exits.push_back({x.jmp32(), ip, executed, JIT_EXIT_BRANCH, 0});
+    }
+
+    // Branch to target: loop natively when it is the block start
+    void branchTo(uint16_t target, uint32_t executed) {
+        if (target == start) {
+            x.addExecuted(executed);
+            x.jmpBack(loopTop);
+        } else {
+            exitTo(target, executed);
+        }
+    }
+
+    // After a store to guest memory: leave if it hit decoded code
+    void checkStore(uint16_t addr, uint16_t next, uint32_t executed) {
+        stores.push_back(addr);
+        x.b(0x66); x.b(0x83); x.b(X64Emitter::modrm(2, 7, RBX));       // cmp word [rbx+d32], 0
+        x.d(addr);
+        x.b(0);
+        exits.push_back({x.jcc32(CC_NE), next, executed, JIT_EXIT_CODE_WRITE, addr});
+    }
+
+    // Guest FLAGS are kept materialized in cpu->flags while a block runs
+    void loadGuestFlags() {
+        x.b(0x0F); x.b(0xB7); x.b(X64Emitter::modrm(2, RAX, RDX));      // movzx eax, word [rdx+d32]
+        x.d(offsetof(CPU, flags));
+        x.b(0x25); x.d(FLAG_ARITH);                                    // and eax, arith flags
+        x.b(0x50);                                                     // push rax
+        x.b(0x9D);                                                     // popfq
+    }
+
+    // Copy the host flags the guest op defines into cpu->flags (bits outside host are cleared)
+    void storeGuestFlags(uint16_t writes, uint16_t host) {
+        x.b(0x9C);                                                     // pushfq
+        x.b(0x58);                                                     // pop rax
+        x.b(0x25); x.d(host);                                          // and eax, host
+        x.b(0x0F); x.b(0xB7); x.b(X64Emitter::modrm(2, RCX, RDX));      // movzx ecx, word [rdx+d32]
+        x.d(offsetof(CPU, flags));
+        x.b(0x81); x.b(X64Emitter::modrm(3, 4, RCX)); x.d((uint16_t)~writes);  // and ecx, ~writes
+        x.b(0x09); x.b(X64Emitter::modrm(3, RAX, RCX));                 // or ecx, eax
+        x.b(0x66); x.b(0x89); x.b(X64Emitter::modrm(2, RCX, RDX));      // mov [rdx+d32], cx
+        x.d(offsetof(CPU, flags));
+    }
+
+    /*
+       Straight-line instruction; false when it cannot be translated.
+       Only word operations on AX..DI, direct memory and immediates.
+       recordFlags: some exit can observe the flags this instruction sets.
+    */
+    bool translate(const DecodedInsn& d, uint16_t next, uint32_t executed, bool recordFlags) {
+        if (d.width != 2)
+            return false;
+
+        Loc dst = {}, src = {};
+        bool hasDst = loc(d.dst, dst);
+        bool hasSrc = loc(d.src, src);
+        bool srcImm = d.src.type == IMM;
+        bool srcNone = d.src.type == NONE;
+        bool stores = hasDst && dst.mem;
+
+        static const struct { Opcode op; uint8_t group; } alu[] = {
+            {OP_ADD, 0}, {OP_OR, 1}, {OP_ADC, 2}, {OP_SBB, 3},
+            {OP_AND, 4}, {OP_SUB, 5}, {OP_XOR, 6}, {OP_CMP, 7}
+        };
+
+        switch (d.opcode) {
+        case OP_NOP:
+            return true;
+
+        case OP_MOV:
+            if (!hasDst)
+                return false;
+            if (srcImm) {
+                if (dst.mem) {
+                    x.op16(0xC7, 0, dst);
+                } else {
+                    x.b(0x66); x.b(0x41); x.b(0xB8 + (dst.reg & 7));
+                }
+                x.w((uint16_t)d.src.value);
+            } else if (hasSrc && !src.mem) {
+                x.op16(0x89, src.reg, dst);
+            } else if (hasSrc && !dst.mem) {
+                x.op16(0x8B, dst.reg, src);
+            } else {
+                return false;
+            }
+            break;
+
+        case OP_ADD: case OP_OR: case OP_ADC: case OP_SBB:
+        case OP_AND: case OP_SUB: case OP_XOR: case OP_CMP: {
+            if (!hasDst || (!srcImm && !hasSrc) || (hasSrc && src.mem && dst.mem))
+                return false;
+            uint8_t group = 0;
+            for (auto& a : alu)
+                if (a.op == d.opcode)
+                    group = a.group;
+            if (d.opcode == OP_ADC || d.opcode == OP_SBB)
+                loadGuestFlags();                                      // carry in
+            if (srcImm) {
+                x.op16(0x81, group, dst);
+                x.w((uint16_t)d.src.value);
+            } else if (!src.mem) {
+                x.op16(group * 8 + 1, src.reg, dst);
+            } else {
+                x.op16(group * 8 + 3, dst.reg, src);
+            }
+            stores = stores && d.opcode != OP_CMP;
+            break;
+        }
+
+        case OP_TEST:
+            if (!hasDst || (!srcImm && !hasSrc) || (hasSrc && src.mem && dst.mem))
+                return false;
+            if (srcImm) {
+                x.op16(0xF7, 0, dst);
+                x.w((uint16_t)d.src.value);
+            } else if (!src.mem) {
+                x.op16(0x85, src.reg, dst);
+            } else {
+                x.op16(0x85, dst.reg, src);
+            }
+            stores = false;
+            break;
+
+        case OP_INC: case OP_DEC:
+            if (!hasDst || !srcNone)
+                return false;
+            x.op16(0xFF, d.opcode == OP_INC ? 0 : 1, dst);
+            break;
+
+        case OP_NOT: case OP_NEG:
+            if (!hasDst || !srcNone)
+                return false;
+            x.op16(0xF7, d.opcode == OP_NOT ? 2 : 3, dst);
+            break;
+
+        case OP_SHL: case OP_SAL: case OP_SHR: case OP_SAR: case OP_ROL: case OP_ROR: {
+            // the host masks CL counts, the 8086 does not: shift-by-one only
+            if (!hasDst || !srcImm)
+                return false;
+            uint8_t ext = d.opcode == OP_ROL ? 0 : d.opcode == OP_ROR ? 1
+                        : d.opcode == OP_SHR ? 5 : d.opcode == OP_SAR ? 7 : 4;
+            x.op16(0xD1, ext, dst);
+            break;
+        }
+
+        case OP_XCHG:
+            if (!hasDst || !hasSrc)
+                return false;
+            if (!src.mem)
+                x.op16(0x87, src.reg, dst);
+            else if (!dst.mem)
+                x.op16(0x87, dst.reg, src);
+            else
+                return false;
+            if (src.mem)
+                checkStore(src.addr, next, executed);
+            break;
+
+        default:
+            return false;
+        }
+
+        if (recordFlags) {
+            JitFlagEffect e = jitFlagEffect(d);
+            if (e.writes)
+                storeGuestFlags(e.writes, e.host);
+        }
+        if (stores)
+            checkStore(dst.addr, next, executed);
+        return true;
+    }
+
+    // Control transfer that ends the block; false when not handled here
+    bool translateBranch(const DecodedInsn& d, uint16_t next, uint32_t executed) {
+        uint16_t target = (uint16_t)d.dst.value;
+        if (d.dst.type != IMM)
+            return false;
+
+        // Jcc: 8086 and x86-64 share the condition encoding in 70-7F
+        if (d.form->enc == E_REL && d.form->opcode >= 0x70 && d.form->opcode <= 0x7F) {
+            loadGuestFlags();
+            exits.push_back({x.jcc32((d.form->opcode & 0xF) ^ 1), next, executed, JIT_EXIT_BRANCH, 0});
+            branchTo(target, executed);
+            return true;
+        }
+
+        switch (d.opcode) {
+        case OP_JMP:
+            branchTo(target, executed);
+            return true;
+
+        case OP_LOOP: {
+            // dec cx (host flags are not guest flags); jz falls out of the loop
+            x.op16(0xFF, 1, Loc{false, hostReg(REG_CX), 0});
+            exits.push_back({x.jcc32(CC_E), next, executed, JIT_EXIT_BRANCH, 0});
+            branchTo(target, executed);
+            return true;
+        }
+
+        case OP_JCXZ: {
+            x.b(0x66); x.b(0x41); x.b(0x83); x.b(X64Emitter::modrm(3, 7, R9)); x.b(0);   // cmp r9w, 0
+            exits.push_back({x.jcc32(CC_NE), next, executed, JIT_EXIT_BRANCH, 0});
+            branchTo(target, executed);
+            return true;
+        }
+
+        default:
+            return false;
+        }
+    }
+
+    void finish() {
+        vector<size_t> toEpilogue;
+        for (const PendingExit& e : exits) {
+            x.bind(e.field, x.here());
+            toEpilogue.push_back(exitStub(e));
+        }
+        size_t epi = x.here();
+        for (size_t f : toEpilogue)
+            x.bind(f, epi);
+        epilogue();
+    }
+};
+
+JitCompileResult jitCompileBlock(JitCodeBuffer& code, const uint8_t* memory, uint16_t ip, JitBlock& out) {
+    if (!allocateCodeBuffer(code))
+        return JIT_UNSUPPORTED;
+
+    // Pass 1: find the block extent with a throwaway translation
+    vector<DecodedInsn> insns;
+    bool ended = false;
+    {
+        BlockTranslator probe;
+        probe.start = ip;
+        uint16_t at = ip;
+        while (insns.size() < (size_t)JIT_MAX_BLOCK_INSNS) {
+            DecodedInsn d;
+            if (!decodeInstruction(memory, at, d))
+                break;
+            uint16_t next = at + d.length;
+            if (probe.translateBranch(d, next, 0)) {
+                insns.push_back(d);
+                ended = true;
+                break;
+            }
+            if (!probe.translate(d, next, 0, false))
+                break;
+            insns.push_back(d);
+            at = next;
+        }
+    }
+    if (insns.empty())
+        return JIT_UNSUPPORTED;
+
+    // Pass 2: flag liveness; every exit observes all arithmetic flags
+    size_t n = insns.size();
+    vector<bool> record(n);
+    uint16_t live = FLAG_ARITH;
+    for (size_t i = n; i-- > 0;) {
+        if (storesToMemory(insns[i]))
+            live = FLAG_ARITH;
+        JitFlagEffect e = jitFlagEffect(insns[i]);
+        record[i] = (e.writes & live) != 0;
+        live = (live & ~e.writes) | e.reads;
+    }
+
+    // Pass 3: emit
+    BlockTranslator t;
+    t.start = ip;
+    t.prologue();
+
+    uint16_t at = ip;
+    for (size_t i = 0; i < n; i++) {
+        uint16_t next = at + insns[i].length;
+        if (ended && i == n - 1)
+            t.translateBranch(insns[i], next, (uint32_t)n);
+        else
+            t.translate(insns[i], next, (uint32_t)(i + 1), record[i]);
+        at = next;
+    }
+
+    // Fell off the end: resume the interpreter at the first untranslated instruction
+    if (!ended)
+        t.exitTo(at, (uint32_t)n);
+    t.finish();
+
+    if (code.used + t.x.code.size() > JIT_CODE_CAPACITY)
+        return JIT_CODE_FULL;
+
+    uint8_t* entry = code.base + code.used;
+    memcpy(entry, t.x.code.data(), t.x.code.size());
+    code.used += (t.x.code.size() + 15) & ~(size_t)15;
+#ifdef _WIN32
+    FlushInstructionCache(GetCurrentProcess(), entry, t.x.code.size());
+
+#endif
+
+    out.entry = (JitEntry)(void*)entry;
+    out.start = ip;
+    out.length = (uint16_t)(at - ip);
+    out.stores = move(t.stores);
+    return JIT_OK;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "emulator.h"
+
+using namespace std;
+
+/* ================= Dynamic Binary Translation ================= */
+/*
+   Hot guest basic blocks are translated to x86-64 host code. Inside a
+   block guest AX..DI live in host r8w..r15w, and guest flags stay
+   materialized in cpu.flags: after each instruction whose flags an exit
+   can observe, the host flags are copied there. A block writes the
+   registers back and returns to the interpreter at its first control
+   transfer, at HLT, at anything it cannot translate, and after any
+   store that lands on decoded code. A block that branches back to its
+   own start (JMP, Jcc, LOOP, JCXZ) iterates natively.
+
+   Each Machine owns its JitCodeBuffer, so machines on different threads
+   compile and run blocks independently. On other hosts jitAvailable()
+   is false and the emulator stays in the interpreter.
+*/
+
+constexpr uint32_t JIT_HOT_THRESHOLD = 50;     // taken branches into an IP before it is compiled
+constexpr int JIT_MAX_BLOCK_INSNS = 64;
+
+enum JitExit : uint32_t {
+    JIT_EXIT_BRANCH,        // cpu.IP holds the next guest instruction
+    JIT_EXIT_CODE_WRITE     // same, and writeAddr (2 bytes) hit decoded code
+};
+
+// Passed to every block; field offsets are baked into the generated code
+struct JitContext {
+    CPU* cpu;
+    uint8_t* memory;
+    const uint8_t* codeMap;     // non-zero where decoded code lives
+    uint64_t executed;          // guest instructions retired, added to by blocks
+    uint16_t writeAddr;
+};
+
+typedef uint32_t (*JitEntry)(JitContext* ctx);
+
+struct JitBlock {
+    JitEntry entry;
+    uint16_t start;
+    uint16_t length;                // guest bytes covered
+    vector<uint16_t> stores;        // direct addresses the block may write
+};
+
+enum JitCompileResult {
+    JIT_OK,
+    JIT_UNSUPPORTED,        // not even the first instruction can be translated
+    JIT_CODE_FULL           // call jitReset() and retry
+};
+
+// Executable memory for translated blocks, mapped on first use
+struct JitCodeBuffer {
+    uint8_t* base = nullptr;
+    size_t used = 0;
+
+    JitCodeBuffer() = default;
+    ~JitCodeBuffer();
+
+    JitCodeBuffer(const JitCodeBuffer&) = delete;
+    JitCodeBuffer& operator=(const JitCodeBuffer&) = delete;
+};
+
+bool jitAvailable();
+
+// Translate the block starting at ip into code
+JitCompileResult jitCompileBlock(JitCodeBuffer& code, const uint8_t* memory, uint16_t ip, JitBlock& out);
+
+// Release every block translated into code at once
+void jitReset(JitCodeBuffer& code);
+
+#endif
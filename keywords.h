@@ -0,0 +1,234 @@
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include "common.h"
+
+using namespace std;
+
+/* ================= Keyword Tables ================= */
+/*
+   Each list is the single source of truth for its keyword class: the enum,
+   the printable names and the perfect-hash classifier below are all
+   generated from it. New opcodes go at the end: superoptimizer cache
+   files (superopt.h) store opcode numbers.
+*/
+
+#define OPCODE_LIST(X)                                                        \
+    X(ADD) X(ADC) X(SUB) X(SBB) X(INC) X(DEC) X(MUL) X(IMUL) X(DIV) X(IDIV)  \
+    X(NEG) X(CMP) X(DAA) X(DAS) X(AAA) X(AAS) X(AAM) X(AAD)                   \
+    X(MOV) X(XCHG) X(XLAT) X(PUSH) X(POP) X(IN) X(OUT) X(LEA) X(LDS) X(LES)   \
+    X(LAHF) X(SAHF) X(PUSHF) X(POPF) X(HLT) X(NOP) X(WAIT) X(ESC) X(LOCK)     \
+    X(CLC) X(STC) X(CMC) X(CLD) X(STD) X(CLI) X(STI)                          \
+    X(MOVSB) X(MOVSW) X(CMPSB) X(CMPSW) X(SCASB) X(SCASW)                     \
+    X(LODSB) X(LODSW) X(STOSB) X(STOSW)                                       \
+    X(JMP) X(CALL) X(RET)                                                     \
+    X(JE) X(JZ) X(JNE) X(JNZ) X(JA) X(JAE) X(JB) X(JBE)                       \
+    X(JG) X(JGE) X(JL) X(JLE) X(JC) X(JNC) X(JO) X(JNO) X(JS) X(JNS)          \
+    X(LOOP) X(LOOPE) X(LOOPNE) X(JCXZ)                                        \
+    X(SHL) X(SAL) X(SHR) X(SAR) X(ROL) X(ROR) X(RCL) X(RCR)                   \
+    X(AND) X(OR) X(XOR) X(NOT) X(TEST)                                        \
+    X(REP) X(REPE) X(REPZ) X(REPNE) X(REPNZ)
+
+// 8086 encoding order: (id & 7) is the reg field for the 16- and 8-bit
+// groups, (id - REG_ES) is the segment register number
+#define REGISTER_LIST(X)                                       \
+    X(AX) X(CX) X(DX) X(BX) X(SP) X(BP) X(SI) X(DI)            \
+    X(AL) X(CL) X(DL) X(BL) X(AH) X(CH) X(DH) X(BH)            \
+    X(ES) X(CS) X(SS) X(DS)                                    \
+    X(IP) X(FLAGS)
+
+#define DIRECTIVE_LIST(X)                                                  \
+    X(DATA, ".DATA") X(CODE, ".CODE") X(STACK, ".STACK")                   \
+    X(DB, "DB") X(DW, "DW") X(DD, "DD") X(DQ, "DQ") X(DT, "DT")            \
+    X(ORG, "ORG") X(END, "END") X(ASSUME, "ASSUME")                        \
+    X(PROC, "PROC") X(ENDP, "ENDP") X(PUBLIC, "PUBLIC") X(EXTRN, "EXTRN")  \
+    X(LABEL, "LABEL") X(MACRO, "MACRO") X(ENDM, "ENDM")
+
+enum Opcode : uint8_t
+{
+#define X(name) OP_##name,
+    OPCODE_LIST(X)
+#undef X
+    OP_COUNT
+};
+
+enum RegisterId : uint8_t
+{
+#define X(name) REG_##name,
+    REGISTER_LIST(X)
+#undef X
+    REG_COUNT
+};
+
+enum DirectiveId : uint8_t
+{
+#define X(name, text) DIR_##name,
+    DIRECTIVE_LIST(X)
+#undef X
+    DIR_COUNT
+};
+
+inline constexpr const char *opcodeNames[] = {
+#define X(name) #name,
+    OPCODE_LIST(X)
+#undef X
+};
+
+inline constexpr const char *registerNames[] = {
+#define X(name) #name,
+    REGISTER_LIST(X)
+#undef X
+};
+
+inline constexpr const char *directiveNames[] = {
+#define X(name, text) text,
+    DIRECTIVE_LIST(X)
+#undef X
+};
+
+inline const char *opcodeName(Opcode op) { return opcodeNames[op]; }
+inline const char *registerName(RegisterId r) { return registerNames[r]; }
+
+/* ================= Perfect-Hash Classifier ================= */
+
+struct Keyword
+{
+    const char *name;
+    uint8_t length;
+    TokenType type;
+    uint8_t id;
+};
+
+constexpr uint8_t constLength(const char *s)
+{
+    uint8_t n = 0;
+    while (s[n])
+        n++;
+    return n;
+}
+
+inline constexpr Keyword keywordList[] = {
+#define X(name) {#name, constLength(#name), INSTRUCTION, OP_##name},
+    OPCODE_LIST(X)
+#undef X
+#define X(name) {#name, constLength(#name), REGISTER, REG_##name},
+    REGISTER_LIST(X)
+#undef X
+#define X(name, text) {text, constLength(text), DIRECTIVE, DIR_##name},
+    DIRECTIVE_LIST(X)
+#undef X
+};
+
+constexpr size_t KEYWORD_COUNT = sizeof(keywordList) / sizeof(keywordList[0]);
+constexpr size_t MAX_KEYWORD_LENGTH = 6;
+constexpr unsigned KEYWORD_SLOT_BITS = 11;
+constexpr size_t KEYWORD_SLOTS = size_t(1) << KEYWORD_SLOT_BITS;
+constexpr uint8_t NO_KEYWORD = 0xFF;
+
+static_assert(KEYWORD_COUNT < NO_KEYWORD, "keyword index must fit in a byte");
+
+constexpr char asciiUpper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? char(c - ('a' - 'A')) : c;
+}
+
+constexpr uint32_t keywordHashStep(uint32_t h, char c)
+{
+    return (h ^ (uint8_t)c) * 0x01000193u; // FNV-1a
+}
+
+constexpr uint32_t keywordSlot(uint32_t h)
+{
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    return h >> (32 - KEYWORD_SLOT_BITS);
+}
+
+constexpr uint32_t keywordHash(const char *s, size_t n, uint32_t seed)
+{
+    uint32_t h = seed;
+    for (size_t i = 0; i < n; i++)
+        h = keywordHashStep(h, asciiUpper(s[i]));
+    return keywordSlot(h);
+}
+
+/* Search, at compile time, for a seed that maps every keyword to its own slot */
+constexpr uint32_t findKeywordSeed()
+{
+    for (uint32_t seed = 0x811C9DC5u;; seed++)
+    {
+        bool used[KEYWORD_SLOTS] = {};
+        bool collision = false;
+
+        for (size_t k = 0; k < KEYWORD_COUNT && !collision; k++)
+        {
+            uint32_t slot = keywordHash(keywordList[k].name, keywordList[k].length, seed);
+            collision = used[slot];
+            used[slot] = true;
+        }
+
+        if (!collision)
+            return seed;
+    }
+}
+
+struct KeywordSlots
+{
+    uint8_t index[KEYWORD_SLOTS];
+};
+
+constexpr KeywordSlots buildKeywordSlots(uint32_t seed)
+{
+    KeywordSlots slots{};
+    for (size_t i = 0; i < KEYWORD_SLOTS; i++)
+        slots.index[i] = NO_KEYWORD;
+    for (size_t k = 0; k < KEYWORD_COUNT; k++)
+        slots.index[keywordHash(keywordList[k].name, keywordList[k].length, seed)] = (uint8_t)k;
+    return slots;
+}
+
+inline constexpr uint32_t keywordSeed = findKeywordSeed();
+inline constexpr KeywordSlots keywordSlots = buildKeywordSlots(keywordSeed);
+
+struct KeywordInfo
+{
+    TokenType type; // IDENTIFIER when the word is not a keyword
+    uint8_t id;     // Opcode, RegisterId or DirectiveId
+};
+
+/*
+   Case-insensitive, allocation-free: upper-cases into a small stack buffer
+   while hashing, then confirms the single candidate slot.
+*/
+inline KeywordInfo classifyKeyword(string_view word)
+{
+    size_t n = word.size();
+    if (n == 0 || n > MAX_KEYWORD_LENGTH)
+        return {IDENTIFIER, 0};
+
+    char up[MAX_KEYWORD_LENGTH];
+    uint32_t h = keywordSeed;
+    for (size_t i = 0; i < n; i++)
+    {
+        up[i] = asciiUpper(word[i]);
+        h = keywordHashStep(h, up[i]);
+    }
+
+    uint8_t k = keywordSlots.index[keywordSlot(h)];
+    if (k == NO_KEYWORD)
+        return {IDENTIFIER, 0};
+
+    const Keyword &kw = keywordList[k];
+    if (kw.length != n)
+        return {IDENTIFIER, 0};
+    for (size_t i = 0; i < n; i++)
+        if (kw.name[i] != up[i])
+            return {IDENTIFIER, 0};
+
+    return {kw.type, kw.id};
+}
+
+#endif
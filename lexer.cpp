@@ -1,32 +1,24 @@
 #include "common.h"
+#include "keywords.h"
+#include "lexer.h"
+#include "source_map.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <deque>
 #include <set>
 #include <cctype>
+#include <cstdint>
 #include <string>
 using namespace std;
 
-set<string> instruction = {
-    "ADD", "ADC", "SUB", "SBB", "INC", "DEC", "MUL", "IMUL", "DIV", "IDIV", "NEG", "CMP", "DAA", "DAS", "AAA", "AAS", "AAM", "AAD", "MOV", "XCHG", "XLAT", "PUSH", "POP", "IN", "OUT", "LEA", "LDS", "LES", "LAHF", "SAHF", "HLT", "NOP", "WAIT", "ESC", "LOCK", "CLC", "STC", "CMC", "CLD", "STD", "CLI", "STI", "MOVSB", "MOVSW", "CMPSB", "CMPSW", "SCASB", "SCASW", "LODSB", "LODSW", "STOSB", "STOSW", "JMP", "CALL", "RET", "JE", "JZ", "JNE", "JNZ", "JA", "JAE", "JB", "JBE", "JG", "JGE", "JL", "JLE", "JC", "JNC", "JO", "JNO", "JS", "JNS", "LOOP", "LOOPE", "LOOPNE", "JCXZ", "SHL", "SAL", "SHR", "SAR", "ROL", "ROR", "RCL", "RCR", "AND", "OR", "XOR", "NOT", "TEST"};
-
-set<string> registers = {
-    "CS", "DS", "ES", "SS", "IP", "FLAGS", "SP", "BP", "SI", "DI", "AL", "AH", "BL", "BH", "CL", "CH", "DL", "DH", "AX", "BX", "CX", "DX"
-
-};
-
-set<string> directives = {
-    ".DATA", ".CODE", ".STACK", "DB", "DW", "DD", "DQ", "DT", "ORG", "END", "ASSUME", "PROC", "ENDP", "PUBLIC", "EXTRN", "LABEL", "MACRO", "ENDM"
-
-};
-
 set<char> singleSymbols = {
     '+', '-', '*', '/', '%', '=', '<', '>',
     ',', ':', '(', ')', '[', ']',
     '.', '$', '@', '?', '#', '!',
     '&', '|', '^', '\'', '"', '~'};
 
-set<string> multiSymbols = {
+set<string, less<>> multiSymbols = {
     "==", "!=", "<=", ">=", "<<", ">>"};
 
 // helper function
@@ -45,11 +37,28 @@ bool isNumber(const string &s)
   return false;
 }
 
+// Owned text for tokens produced by the line-based lexer.
+// Token values point in here until the next lexer() call.
+static deque<string> lexemePool;
+
+static string_view intern(const string &s)
+{
+  lexemePool.push_back(s);
+  return lexemePool.back();
+}
+
+static Token wordToken(string_view word)
+{
+  KeywordInfo kw = classifyKeyword(word);
+  return {kw.type, word, kw.id};
+}
+
 // lexer function
 vector<Token> lexer(const string &filename)
 {
   ifstream fin(filename);
   vector<Token> tokens;
+  lexemePool.clear();
 
   if (!fin)
   {
@@ -84,15 +93,7 @@ vector<Token> lexer(const string &filename)
           word += line[i++];
 
         word = toUpper(word);
-
-        if (instruction.count(word))
-          tokens.push_back({INSTRUCTION, word});
-        else if (registers.count(word))
-          tokens.push_back({REGISTER, word});
-        else if (directives.count(word))
-          tokens.push_back({DIRECTIVE, word});
-        else
-          tokens.push_back({IDENTIFIER, word});
+        tokens.push_back(wordToken(intern(word)));
 
         continue;
       }
@@ -103,7 +104,7 @@ vector<Token> lexer(const string &filename)
         string num;
         while (i < n && isalnum(line[i]))
           num += line[i++];
-        tokens.push_back({NUMBER, num});
+        tokens.push_back({NUMBER, intern(toUpper(num))});
         continue;
       }
 
@@ -113,7 +114,7 @@ vector<Token> lexer(const string &filename)
         string two = line.substr(i, 2);
         if (multiSymbols.count(two))
         {
-          tokens.push_back({SYMBOL, two});
+          tokens.push_back({SYMBOL, intern(two)});
           i += 2;
           continue;
         }
@@ -121,10 +122,7 @@ vector<Token> lexer(const string &filename)
 
       // singleSymbols
       if (singleSymbols.count(line[i]))
-      {
-        tokens.push_back({SYMBOL, string(1, line[i])});
-        i++;
-      }
+        tokens.push_back({SYMBOL, intern(string(1, line[i]))});
       i++;
     }
   }
@@ -133,81 +131,136 @@ vector<Token> lexer(const string &filename)
   return tokens;
 }
 
-// Symbol table code
+/* ================= Memory-mapped lexer ================= */
 
-enum SymbolType
+enum CharClass : uint8_t
 {
-  VAR,
-  LABEL,
-  PROC
+  CC_OTHER,
+  CC_SPACE,
+  CC_WORD_START, // letter, '_' or '.'
+  CC_DIGIT,
+  CC_SYMBOL
 };
 
-string symbolTypeToString(SymbolType t)
+struct CharTable
 {
-  switch (t)
+  uint8_t cls[256];
+
+  CharTable() : cls()
   {
-  case VAR:
-    return "VARIABLE";
-  case LABEL:
-    return "LABEL";
-  case PROC:
-    return "PROCEDURE";
+    for (int c = 0; c < 256; c++)
+    {
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f')
+        cls[c] = CC_SPACE;
+      else if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '.')
+        cls[c] = CC_WORD_START;
+      else if (c >= '0' && c <= '9')
+        cls[c] = CC_DIGIT;
+      else if (singleSymbols.count((char)c))
+        cls[c] = CC_SYMBOL;
+    }
   }
-  return "UNKNOWN";
+};
+
+static const CharTable &charTable()
+{
+  static const CharTable table;
+  return table;
 }
 
-struct Symbol
+static inline bool isWordChar(uint8_t cls)
 {
-  string name;
-  SymbolType type;
-  int address;
-  int size;
-};
-// function of symbol table
-vector<Symbol> buildSymbolTable(const vector<Token> &tokens)
+  return cls == CC_WORD_START || cls == CC_DIGIT;
+}
+
+Lexer::Lexer(char *begin, char *end) : begin(begin), p(begin), end(end) {}
+
+Lexer::Lexer(SourceMap &source) : begin(source.data()), p(source.data()), end(source.data() + source.size()) {}
+
+/*
+   Same token stream as lexer(), but scans the buffer directly.
+   Nothing on this path allocates.
+*/
+Token Lexer::next()
 {
-  vector<Symbol> table;
-  int LC = 0; // Location Counter
+  const uint8_t *cls = charTable().cls;
 
-  for (size_t i = 0; i < tokens.size(); i++)
+  while (p < end)
   {
-    // LABEL → identifier :
-    if (tokens[i].type == IDENTIFIER &&
-        i + 1 < tokens.size() &&
-        tokens[i + 1].value == ":")
+    uint8_t c = (uint8_t)*p;
+    uint8_t k = cls[c];
+
+    if (k == CC_SPACE)
     {
-      table.push_back({tokens[i].value, LABEL, LC, 0});
+      p++;
+      continue;
     }
 
-    // VARIABLE → identifier DB/DW/DD
-    if (tokens[i].type == IDENTIFIER &&
-        i + 1 < tokens.size() &&
-        tokens[i + 1].type == DIRECTIVE)
+    // comment runs to end of line
+    if (c == ';')
     {
-      int size = 0;
+      while (p < end && *p != '\n')
+        p++;
+      continue;
+    }
 
-      if (tokens[i + 1].value == "DB")
-        size = 1;
-      else if (tokens[i + 1].value == "DW")
-        size = 2;
-      else if (tokens[i + 1].value == "DD")
-        size = 4;
+    // identifier / keyword
+    if (k == CC_WORD_START)
+    {
+      char *start = p;
+      while (p < end && isWordChar(cls[(uint8_t)*p]))
+      {
+        if (*p >= 'a' && *p <= 'z')
+          *p -= 'a' - 'A';
+        p++;
+      }
 
-      if (size > 0)
+      return wordToken(string_view(start, p - start));
+    }
+
+    // number
+    if (k == CC_DIGIT)
+    {
+      char *start = p;
+      while (p < end && isWordChar(cls[(uint8_t)*p]) && *p != '_' && *p != '.')
       {
-        table.push_back({tokens[i].value, VAR, LC, size});
-        LC += size;
+        if (*p >= 'a' && *p <= 'z')
+          *p -= 'a' - 'A';
+        p++;
       }
+      return {NUMBER, string_view(start, p - start)};
     }
 
-    // PROC
-    if (tokens[i].type == IDENTIFIER &&
-        i + 1 < tokens.size() &&
-        tokens[i + 1].value == "PROC")
+    // multi-character symbol first (never spans a line break)
+    if (p + 1 < end && p[1] != '\n' && p[1] != '\r')
     {
-      table.push_back({tokens[i].value, PROC, LC, 0});
+      string_view two(p, 2);
+      if (multiSymbols.count(two))
+      {
+        p += 2;
+        return {SYMBOL, two};
+      }
     }
+
+    char *sym = p++;
+    if (k == CC_SYMBOL)
+      return {SYMBOL, string_view(sym, 1)};
   }
 
-  return table;
+  return {END_OF_FILE, string_view()};
+}
+
+/* Whole-file token vector from the mapped source (benchmarks, tools) */
+vector<Token> lexerMapped(SourceMap &source)
+{
+  vector<Token> tokens;
+  Lexer lex(source);
+
+  // Rough guess: one token every 4 bytes of source
+  tokens.reserve(source.size() / 4);
+
+  for (Token t = lex.next(); t.type != END_OF_FILE; t = lex.next())
+    tokens.push_back(t);
+
+  return tokens;
 }
@@ -0,0 +1,32 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "common.h"
+
+using namespace std;
+
+/* ================= Streaming Lexer ================= */
+/*
+   Pulls one token at a time from an in-memory source buffer (a SourceMap
+   or a file read into a string). Words are upper-cased in place and every
+   token is a view into the buffer, which must outlive the tokens.
+   Returns END_OF_FILE once the buffer is exhausted.
+*/
+class Lexer
+{
+private:
+  char *begin;
+  char *p;
+  char *end;
+
+public:
+  Lexer(char *begin, char *end);
+  explicit Lexer(SourceMap &source);
+
+  Token next();
+
+  // Offset of a token's text from the start of the buffer
+  uint32_t offsetOf(const Token &token) const { return (uint32_t)(token.value.data() - begin); }
+};
+
+#endif
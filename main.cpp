@@ -1,61 +1,216 @@
 #include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
 #include "common.h"
-#include "parser.h"
-#include "semantic.h"
+#include "compilation.h"
+#include "driver.h"
+#include "cache.h"
 #include "backend.h"
+#include "stats.h"
 
-extern vector<IC> intermediateCode;
-
-int main()
+int main(int argc, char *argv[])
 {
-    vector<Token> tokens = lexer("test.asm");
+    /*
+       usage: compiler [--mmap] [-O0|-O1|-O2] [--superopt[=size|cycles] [--superopt-cache=FILE]]
+                       [--cache=DIR [--cache-size=MB]] [--stats[=out.json]]
+                       [--listing=out.lst] [--jit|--jit-verify|--profile[=out.json]|--trace=out.t86]
+                       [file.asm]
+              compiler [--mmap] [-O0|-O1|-O2] [--superopt[=size|cycles] [--superopt-cache=FILE]]
+                       [--cache=DIR [--cache-size=MB]] [-jN] file.asm...
+              compiler [-O0|-O1|-O2] --watch file.asm
+
+       One file is assembled with a full listing and then run. Several
+       files (or -jN) are assembled in parallel, each to its own .bin.
+       --cache reuses earlier results for unchanged sources (cache.h).
+       --superopt replaces short register sequences with the cheapest
+       proven equivalent, by size unless =cycles (superopt.h); results
+       carry over between runs in --superopt-cache.
+       --stats reports what each assembler stage cost (stats.h), also
+       as JSON when given a file.
+       --listing writes the source with the address, bytes and
+       disassembly of what each line assembled to (disasm.h); it
+       assembles afresh, without --cache.
+       --watch re-assembles the file to its .bin on every save, touching
+       only what the edit changed (incremental.h).
+    */
+    vector<string> files;
+    string outputPath;
+    CompileOptions options;
+    ExecutionTier tier = TIER_INTERPRET;
+    unsigned jobs = 0;
+    bool batch = false;
+    bool watch = false;
+    string cacheDir;
+    uint64_t cacheBytes = CACHE_DEFAULT_BYTES;
+    bool stats = false;
+    string statsPath;
+    string superoptPath;
+    string listingPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--mmap")
+            options.useMappedLexer = true;
+        else if (arg == "--jit")
+            tier = TIER_JIT;
+        else if (arg == "--jit-verify")
+            tier = TIER_JIT_VERIFY;
+        else if (arg == "--profile")
+            tier = TIER_PROFILE;
+        else if (arg.compare(0, 10, "--profile=") == 0)
+        {
+            tier = TIER_PROFILE;
+            outputPath = arg.substr(10);
+        }
+        else if (arg.compare(0, 8, "--trace=") == 0)
+        {
+            tier = TIER_TRACE;
+            outputPath = arg.substr(8);
+        }
+        else if (arg == "--stats")
+            stats = true;
+        else if (arg.compare(0, 8, "--stats=") == 0)
+        {
+            stats = true;
+            statsPath = arg.substr(8);
+        }
+        else if (arg == "--superopt" || arg == "--superopt=size")
+            options.superopt = SUPEROPT_SIZE;
+        else if (arg == "--superopt=cycles")
+            options.superopt = SUPEROPT_CYCLES;
+        else if (arg.compare(0, 17, "--superopt-cache=") == 0)
+            superoptPath = arg.substr(17);
+        else if (arg.compare(0, 10, "--listing=") == 0)
+            listingPath = arg.substr(10);
+        else if (arg == "--watch")
+            watch = true;
+        else if (arg.compare(0, 8, "--cache=") == 0)
+            cacheDir = arg.substr(8);
+        else if (arg.compare(0, 13, "--cache-size=") == 0)
+            cacheBytes = strtoull(arg.c_str() + 13, nullptr, 10) << 20;
+        else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && isdigit(arg[2]))
+            options.optLevel = arg[2] - '0';
+        else if (arg.size() > 2 && arg[0] == '-' && arg[1] == 'j' && isdigit(arg[2]))
+        {
+            jobs = (unsigned)atoi(arg.c_str() + 2);
+            batch = true;
+        }
+        else
+            files.push_back(arg);
+    }
 
-    Parser parser(tokens);
-    parser.parseProgram();
+    if (files.empty())
+        files.push_back("test.asm");
 
-    cout << "\nINTERMEDIATE CODE\n";
-    for (auto &ic : intermediateCode)
+    if (watch)
     {
-        cout << "(" << ic.opcode << ", "
-             << ic.op1 << ", "
-             << ic.op2 << ")\n";
+        if (files.size() != 1)
+        {
+            cout << "--watch takes exactly one file\n";
+            return 1;
+        }
+        if (options.superopt != SUPEROPT_OFF)
+        {
+            cout << "--superopt does not apply to --watch\n";
+            return 1;
+        }
+        watchFile(files[0], options, cout);
     }
 
-    SemanticAnalyzer sem(tokens);
-    sem.analyze();
-    sem.printSymbolTable();
-    sem.resolveIC(intermediateCode);
+    unique_ptr<AssemblyCache> cache;
+    if (!cacheDir.empty())
+    {
+        try
+        {
+            cache.reset(new AssemblyCache(cacheDir, cacheBytes));
+            options.cache = cache.get();
+        }
+        catch (const runtime_error &e)
+        {
+            cout << e.what() << ", continuing without it\n";
+        }
+    }
 
-    cout << "\nRESOLVED INTERMEDIATE CODE\n";
-    for (auto &ic : resolvedIC)
+    SuperoptCache superoptCache;
+    if (!superoptPath.empty())
     {
-        cout << "(" << ic.opcode << ", "
-             << ic.op1 << ", "
-             << ic.op2 << ")\n";
+        if (!superoptCache.load(superoptPath))
+            cout << "Cannot read " << superoptPath << ", continuing with an empty superoptimizer cache\n";
+        options.superoptCache = &superoptCache;
     }
 
-    generateTypedInstructions(resolvedIC);
+    if (batch || files.size() > 1)
+    {
+        vector<FileResult> results = assembleFiles(files, options, jobs);
+        if (!superoptPath.empty() && !superoptCache.save(superoptPath))
+            cout << "Cannot write the superoptimizer cache to " << superoptPath << endl;
 
-    cout << "\nTYPED INSTRUCTIONS\n";
-    for (auto& ti : typedInstructions) {
-        cout << ti.opcode
-             << " | dst(type=" << ti.dst.type << ", val=" << ti.dst.value << ")"
-             << " | src(type=" << ti.src.type << ", val=" << ti.src.value << ")\n";
+        int failed = 0;
+        for (auto &r : results)
+        {
+            if (r.error.empty())
+                cout << r.input << " -> " << r.output << " (" << r.bytes << " bytes"
+                     << (r.cached ? ", cached" : "") << ")\n";
+            else
+            {
+                cout << r.input << ": " << r.error << "\n";
+                failed++;
+            }
+        }
+        cout << results.size() - failed << " assembled, " << failed << " failed\n";
+        return failed ? 1 : 0;
     }
 
-    validateInstructions(typedInstructions);
-    cout << "\nInstruction validation passed.\n";
+    StageRecorder recorder;
+    if (stats)
+        options.stats = &recorder;
 
-    generateMachineCode(typedInstructions);
+    // A cached result keeps only the bytes, not the instructions a listing traces back to lines
+    if (!listingPath.empty())
+        options.cache = nullptr;
 
-    cout << "\nMACHINE CODE\n";
-    for (auto b : machineCode) {
-        printf("%02X ", b);
+    Compilation unit;
+    try
+    {
+        assembleFile(unit, files[0], options, &cout);
+    }
+    catch (const runtime_error &e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+    if (!superoptPath.empty() && !superoptCache.save(superoptPath))
+        cout << "Cannot write the superoptimizer cache to " << superoptPath << endl;
+
+    if (stats)
+    {
+        printStageStats(cout, recorder);
+        if (!statsPath.empty())
+        {
+            ofstream out(statsPath);
+            writeStageStatsJson(out, recorder, files[0]);
+            if (!out.flush())
+                cout << "Cannot write stage statistics to " << statsPath << endl;
+        }
     }
-    cout << endl;
 
-    runEmulator(machineCode);
+    if (!listingPath.empty())
+    {
+        // Read again: the lexer upper-cased the text it assembled
+        ifstream in(files[0], ios::binary);
+        string source((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        ofstream out(listingPath);
+        writeListing(out, unit, source);
+        if (!out.flush())
+            cout << "Cannot write the listing to " << listingPath << endl;
+    }
 
+    runEmulator(unit.machineCode, tier, outputPath);
 
     return 0;
 }
@@ -2,79 +2,55 @@
 #include "common.h"
 #include <vector>
 #include <string>
-#include <cctype>
 #include <stdexcept>
 
 using namespace std;
 
-/* =========================================
-   Global Typed Instruction List
-========================================= */
-vector<TypedInstruction> typedInstructions;
-
 /* =========================================
    Helper Functions
 ========================================= */
 
-// Check if string is a number
-static bool isNumber(const string& s) {
-    if (s.empty()) return false;
-    for (char c : s)
-        if (!isdigit(c)) return false;
-    return true;
-}
-
-// Parse operand string into TypedOperand
-TypedOperand parseOperand(const string& op) {
-    TypedOperand result;
-    result.type = NONE;
-    result.value = 0;
-
-    if (op.empty())
-        return result;
-
-    // Register operand
-    if (registerCode.count(op)) {
-        result.type = REG;
-        result.value = registerCode[op];
-        return result;
+// Check an IR operand is something the backend can encode
+static TypedOperand typeOperand(const SymbolInterner& names, const TypedOperand& op) {
+    switch (op.type) {
+    case NONE:
+    case MEM:
+    case IMM:
+    case LABEL:
+        return op;
+
+    case REG:
+        // IP and FLAGS cannot be named as operands
+        if (op.value > REG_DS)
+            throw runtime_error("Unsupported register: " + string(registerName((RegisterId)op.value)));
+        return op;
+
+    case SYM:
+        throw runtime_error("Unresolved symbol: " + string(names.name((SymbolId)op.value)));
     }
 
-    // Memory operand: [number]
-    if (op.front() == '[' && op.back() == ']') {
-        string addr = op.substr(1, op.size() - 2);
-        if (!isNumber(addr)) {
-            throw runtime_error("Invalid memory address: " + op);
-        }
-        result.type = MEM;
-        result.value = stoi(addr);
-        return result;
-    }
-
-    // Immediate operand
-    if (isNumber(op)) {
-        result.type = IMM;
-        result.value = stoi(op);
-        return result;
-    }
-
-    throw runtime_error("Unknown operand type: " + op);
+    throw runtime_error("Unknown operand type");
 }
 
 /* =========================================
    Main Typing Function
 ========================================= */
 
-void generateTypedInstructions(const vector<IC>& resolvedIC) {
-    typedInstructions.clear();
+TypedInstruction typeInstruction(const IC& ic, const SymbolInterner& names) {
+    TypedInstruction ti;
+    ti.opcode = ic.opcode;
+    ti.source = ic.source;
 
-    for (const auto& ic : resolvedIC) {
-        TypedInstruction ti;
-        ti.opcode = ic.opcode;
+    ti.dst = typeOperand(names, ic.op1);
+    ti.src = typeOperand(names, ic.op2);
+    return ti;
+}
 
-        ti.dst = parseOperand(ic.op1);
-        ti.src = parseOperand(ic.op2);
+void generateTypedInstructions(const vector<IC>& resolvedIC, const SymbolInterner& names,
+                               vector<TypedInstruction>& out) {
+    out.clear();
+    out.reserve(resolvedIC.size());
 
-        typedInstructions.push_back(ti);
-    }
+    for (const auto& ic : resolvedIC)
+        out.push_back(typeInstruction(ic, names));
 }
@@ -1,49 +1,68 @@
 #include "parser.h"
 #include "common.h"
+#include "compilation.h"
+#include "isa.h"
+#include "keywords.h"
+#include "lexer.h"
 #include <stdexcept>
-#include <iostream>
 
 using namespace std;
 
-// Global intermediate code vector
-vector<IC> intermediateCode;
-
 /* Constructor */
-Parser::Parser(const vector<Token> &t) : tokens(t), pos(0), inCodeSection(false) {}
+Parser::Parser(Lexer &lexer, Compilation &unit, Section start)
+    : lexer(lexer), unit(unit), hasFollowing(false), section(start), openOperands(-1)
+{
+    current = lexer.next();
+}
 
 /* Utility methods */
 
 bool Parser::isAtEnd()
 {
-    return pos >= tokens.size();
+    return current.type == END_OF_FILE;
 }
 
-Token Parser::peek()
+const Token &Parser::peek()
 {
-    if (isAtEnd())
-        return Token{END_OF_FILE, ""};
-    return tokens[pos];
+    return current;
+}
+
+/* Second token of lookahead; the lexer drops line breaks, so only this tells "L1:" from an operand */
+const Token &Parser::peekNext()
+{
+    if (!hasFollowing && !isAtEnd())
+    {
+        following = lexer.next();
+        hasFollowing = true;
+    }
+    return hasFollowing ? following : current;
 }
 
-Token Parser::advance()
+const Token &Parser::advance()
 {
-    if (!isAtEnd())
-        pos++;
-    return tokens[pos - 1];
+    previous = current;
+    if (hasFollowing)
+    {
+        current = following;
+        hasFollowing = false;
+    }
+    else if (!isAtEnd())
+        current = lexer.next();
+    return previous;
 }
 
-bool Parser::check(TokenType type, const string &value)
+bool Parser::check(TokenType type, string_view value)
 {
     if (isAtEnd())
         return false;
-    if (tokens[pos].type != type)
+    if (current.type != type)
         return false;
-    if (!value.empty() && tokens[pos].value != value)
+    if (!value.empty() && current.value != value)
         return false;
     return true;
 }
 
-bool Parser::match(TokenType type, const string &value)
+bool Parser::match(TokenType type, string_view value)
 {
     if (check(type, value))
     {
@@ -53,30 +72,61 @@ bool Parser::match(TokenType type, const string &value)
     return false;
 }
 
+/* Keyword tokens are compared by ID, never by text */
+bool Parser::checkKeyword(TokenType type, uint8_t id)
+{
+    if (isAtEnd())
+        return false;
+    return current.type == type && current.id == id;
+}
+
+bool Parser::matchKeyword(TokenType type, uint8_t id)
+{
+    if (checkKeyword(type, id))
+    {
+        advance();
+        return true;
+    }
+    return false;
+}
+
 /* Parsing logic */
 
 void Parser::parseProgram()
 {
-    cout << "Parsing started...\n";
-
     while (!isAtEnd())
     {
-        if (match(DIRECTIVE, ".CODE"))
+        openOperands = -1;
+
+        if (matchKeyword(DIRECTIVE, DIR_CODE))
         {
-            inCodeSection = true;
+            section = CODE_SECTION;
             continue;
         }
 
-        if (match(DIRECTIVE, ".DATA"))
+        if (matchKeyword(DIRECTIVE, DIR_DATA))
         {
-            inCodeSection = false;
+            section = DATA_SECTION;
             continue;
         }
 
-        if (inCodeSection && check(INSTRUCTION))
+        if (section == CODE_SECTION && check(INSTRUCTION))
         {
             Instruction instr = parseInstruction();
             generateIC(instr);
+            openOperands = instr.operandCount;
+            continue;
+        }
+
+        if (section == CODE_SECTION && check(IDENTIFIER))
+        {
+            parseLabel();
+            continue;
+        }
+
+        if (section == DATA_SECTION && check(IDENTIFIER))
+        {
+            parseDataDefinition();
             continue;
         }
 
@@ -85,63 +135,174 @@ void Parser::parseProgram()
     }
 }
 
+/* Data definition: IDENTIFIER DB|DW|DD NUMBER */
+void Parser::parseDataDefinition()
+{
+    SymbolId name = unit.names.intern(advance().value);
+
+    int size = 0;
+    if (matchKeyword(DIRECTIVE, DIR_DB))
+        size = 1;
+    else if (matchKeyword(DIRECTIVE, DIR_DW))
+        size = 2;
+    else if (matchKeyword(DIRECTIVE, DIR_DD))
+        size = 4;
+    else
+        throw runtime_error("Semantic error: Expected DB, DW or DD after " + string(unit.names.name(name)));
+
+    if (!match(NUMBER))
+    {
+        throw runtime_error("Semantic error: Expected NUMBER after " + string(previous.value) + " for " + string(unit.names.name(name)));
+    }
+    // initial value is not stored yet
+
+    unit.sem.defineVariable(name, size);
+}
+
+/* Label definition: IDENTIFIER ':' marks the next instruction */
+void Parser::parseLabel()
+{
+    SymbolId name = unit.names.intern(advance().value);
+
+    if (!match(SYMBOL, ":"))
+    {
+        throw runtime_error("Expected ':' after label " + string(unit.names.name(name)));
+    }
+
+    unit.sem.defineLabel(name, unit.intermediateCode.size());
+}
+
+/* False for an opcode whose every form is operandless (HLT, CLC) */
+static bool takesOperand(Opcode op)
+{
+    FormRange r = formIndex.range[op];
+    if (r.count == 0)
+        return true;
+    for (int i = r.first; i < r.first + r.count; i++)
+        if (instrForms[i].dst != F_NONE)
+            return true;
+    return false;
+}
+
 /* Parse a full instruction (opcode + operands) */
 Instruction Parser::parseInstruction()
 {
     Instruction instr;
-    instr.opcode = advance().value; // consume opcode
+    instr.opcode = (Opcode)advance().id; // consume opcode
+    instr.source = lexer.offsetOf(previous);
 
-    // Check if next token can start an operand
-    if (!isAtEnd() && (peek().type == REGISTER || peek().type == NUMBER || peek().type == IDENTIFIER || (peek().type == SYMBOL && peek().value == "[")))
+    // Check if next token can start an operand. An identifier is the label
+    // of the next line instead when a ':' follows it, or when the opcode has
+    // no form that takes an operand (HLT, then a line "L1:")
+    bool operand = peek().type == REGISTER || peek().type == NUMBER || (peek().type == SYMBOL && peek().value == "[");
+    if (peek().type == IDENTIFIER)
     {
-        instr.operands = parseOperandList();
+        const Token &next = peekNext();
+        operand = takesOperand(instr.opcode) && !(next.type == SYMBOL && next.value == ":");
+    }
+    if (!isAtEnd() && operand)
+    {
+        parseOperandList(instr);
     }
 
     return instr;
 }
 
 /* Parse comma-separated operand list */
-vector<Operand> Parser::parseOperandList()
+void Parser::parseOperandList(Instruction &instr)
 {
-    vector<Operand> operands;
-
-    operands.push_back(parseOperand());
+    do
+    {
+        TypedOperand op = parseOperand();
+        if (instr.operandCount < 2)
+            instr.operands[instr.operandCount] = op;
+        instr.operandCount++;
+    } while (match(SYMBOL, ","));
+}
 
-    while (match(SYMBOL, ","))
+/* Numeric literal: decimal, or hexadecimal with an H suffix (0FFH) */
+static int parseNumber(string_view text)
+{
+    int base = 10;
+    if (text.size() > 1 && text.back() == 'H')
     {
-        operands.push_back(parseOperand());
+        base = 16;
+        text.remove_suffix(1);
     }
 
-    return operands;
+    long value = 0;
+    for (char c : text)
+    {
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (base == 16 && c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            throw runtime_error("Invalid number: " + string(text));
+
+        value = value * base + digit;
+        if (value > 0xFFFF)
+            throw runtime_error("Number out of range: " + string(text));
+    }
+    return (int)value;
 }
 
 /* Parse a single operand */
-Operand Parser::parseOperand()
+TypedOperand Parser::parseOperand()
 {
-    Operand op;
+    TypedOperand op;
 
     // Simple operand types
-    if (match(REGISTER) || match(NUMBER) || match(IDENTIFIER))
+    if (match(REGISTER))
+    {
+        op.type = REG;
+        op.value = previous.id;
+        return op;
+    }
+
+    if (match(NUMBER))
     {
-        op.value = tokens[pos - 1].value;
+        op.type = IMM;
+        op.value = parseNumber(previous.value);
         return op;
     }
 
-    // Memory operand: [REGISTER] or [IDENTIFIER]
+    // A bare variable name addresses memory, same as [name]
+    if (match(IDENTIFIER))
+    {
+        op.type = SYM;
+        op.value = unit.names.intern(previous.value);
+        return op;
+    }
+
+    // Memory operand: [IDENTIFIER] or [NUMBER]
     if (match(SYMBOL, "["))
     {
-        if (!(match(REGISTER) || match(IDENTIFIER)))
+        if (match(IDENTIFIER))
         {
-            throw runtime_error("Invalid memory operand: expected REGISTER or IDENTIFIER after '['");
+            op.type = SYM;
+            op.value = unit.names.intern(previous.value);
+        }
+        else if (match(NUMBER))
+        {
+            op.type = MEM;
+            op.value = parseNumber(previous.value);
+        }
+        else if (match(REGISTER))
+        {
+            throw runtime_error("Unsupported memory operand: [" + string(previous.value) + "]");
+        }
+        else
+        {
+            throw runtime_error("Invalid memory operand: expected IDENTIFIER or NUMBER after '['");
         }
-        string inner = tokens[pos - 1].value;
 
         if (!match(SYMBOL, "]"))
         {
             throw runtime_error("Missing closing ']' in memory operand");
         }
 
-        op.value = "[" + inner + "]";
         return op;
     }
 
@@ -153,7 +314,13 @@ void Parser::generateIC(const Instruction &instr)
 {
     IC ic;
     ic.opcode = instr.opcode;
-    ic.op1 = instr.operands.size() > 0 ? instr.operands[0].value : "";
-    ic.op2 = instr.operands.size() > 1 ? instr.operands[1].value : "";
-    intermediateCode.push_back(ic);
+    ic.source = instr.source;
+    if (instr.operandCount > 0)
+        ic.op1 = instr.operands[0];
+    if (instr.operandCount > 1)
+        ic.op2 = instr.operands[1];
+    unit.intermediateCode.push_back(ic);
+
+    // Patch known symbols now, remember forward references
+    unit.sem.resolveIC(unit.intermediateCode, unit.intermediateCode.size() - 1);
 }
@@ -7,28 +7,59 @@
 
 using namespace std;
 
+class Lexer;
+struct Compilation;
+
+/*
+   Single streaming front-end pass: pulls tokens from the lexer, defines
+   data symbols, emits IC into the compilation and hands symbol
+   references to its semantic analyzer, which resolves them or records
+   them for back-patching.
+*/
 class Parser
 {
+public:
+  enum Section : uint8_t
+  {
+    NO_SECTION,
+    DATA_SECTION,
+    CODE_SECTION
+  };
+
 private:
-  vector<Token> tokens;
-  int pos;
-  bool inCodeSection;
+  Lexer &lexer;
+  Compilation &unit;
+  Token current;   // lookahead
+  Token following; // the token after current, once peekNext has read it
+  bool hasFollowing;
+  Token previous;  // last consumed token
+  Section section;
+  int openOperands; // operands of an instruction that ended the input, -1 otherwise
 
 public:
-  Parser(const vector<Token> &t);
+  // A fragment of a program (incremental.h) starts in the section the text before it left
+  Parser(Lexer &lexer, Compilation &unit, Section start = NO_SECTION);
   void parseProgram();
 
+  Section currentSection() const { return section; }
+  // A fragment ending in an instruction would take operands (or more of them) from what follows
+  int trailingOperands() const { return openOperands; }
+
 private:
   bool isAtEnd();
-  Token peek();
-  Token advance();
-  bool check(TokenType type, const string &value = "");
-  bool match(TokenType type, const string &value = "");
+  const Token &peek();
+  const Token &peekNext();
+  const Token &advance();
+  bool check(TokenType type, string_view value = {});
+  bool match(TokenType type, string_view value = {});
+  bool checkKeyword(TokenType type, uint8_t id);
+  bool matchKeyword(TokenType type, uint8_t id);
 
-  void parseLine();
+  void parseDataDefinition();
+  void parseLabel();
   Instruction parseInstruction();
-  vector<Operand> parseOperandList();
-  Operand parseOperand();
+  void parseOperandList(Instruction &instr);
+  TypedOperand parseOperand();
 
   void generateIC(const Instruction &instr);
 };
@@ -0,0 +1,319 @@
+#include "backend.h"
+#include "isa.h"
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+/* =========================================
+   Flag effects
+   Only the six arithmetic flags matter here.
+========================================= */
+enum FlagBits : uint8_t {
+    FL_CF = 1 << 0,
+    FL_PF = 1 << 1,
+    FL_AF = 1 << 2,
+    FL_ZF = 1 << 3,
+    FL_SF = 1 << 4,
+    FL_OF = 1 << 5,
+    FL_ALL = 0x3F
+};
+
+struct FlagEffect {
+    uint8_t reads;
+    uint8_t writes;     // includes flags left undefined
+    bool leavesBlock;   // control does not simply fall through
+};
+
+static FlagEffect flagEffect(const TypedInstruction& instr) {
+    switch (instr.opcode) {
+    case OP_ADD: case OP_SUB: case OP_CMP: case OP_NEG:
+    case OP_AND: case OP_OR:  case OP_XOR: case OP_TEST:
+    case OP_MUL: case OP_IMUL: case OP_DIV: case OP_IDIV:
+        return {0, FL_ALL, false};
+    case OP_ADC: case OP_SBB:
+        return {FL_CF, FL_ALL, false};
+    case OP_INC: case OP_DEC:
+        return {0, FL_ALL & ~FL_CF, false};
+    case OP_SHL: case OP_SAL: case OP_SHR: case OP_SAR:
+        // a CL count of zero leaves every flag untouched
+        return {0, (uint8_t)(instr.src.type == IMM ? FL_ALL : 0), false};
+    case OP_ROL: case OP_ROR:
+        return {0, (uint8_t)(instr.src.type == IMM ? (FL_CF | FL_OF) : 0), false};
+    case OP_RCL: case OP_RCR:
+        return {FL_CF, (uint8_t)(instr.src.type == IMM ? (FL_CF | FL_OF) : 0), false};
+    case OP_DAA: case OP_DAS: case OP_AAA: case OP_AAS:
+        return {FL_CF | FL_AF, FL_ALL, false};
+    case OP_AAM: case OP_AAD:
+        return {0, FL_ALL, false};
+    case OP_CLC: case OP_STC:
+        return {0, FL_CF, false};
+    case OP_CMC:
+        return {FL_CF, FL_CF, false};
+    case OP_SAHF:
+        return {0, FL_ALL & ~FL_OF, false};
+    case OP_LAHF: case OP_PUSHF:
+        return {FL_ALL, 0, false};
+    case OP_POPF:
+        return {0, FL_ALL, false};
+    case OP_CMPSB: case OP_CMPSW: case OP_SCASB: case OP_SCASW:
+        return {0, FL_ALL, false};
+    case OP_REP: case OP_REPE: case OP_REPZ: case OP_REPNE: case OP_REPNZ:
+        return {FL_ALL, 0, false};  // the string instruction after it may not run
+    case OP_HLT:
+        return {0, FL_ALL, true};   // nothing runs afterwards
+    case OP_JMP: case OP_CALL: case OP_RET:
+    case OP_LOOP: case OP_JCXZ:
+        return {FL_ALL, 0, true};   // successor unknown here: assume live
+    case OP_LOOPE: case OP_LOOPNE:
+    case OP_JE: case OP_JZ: case OP_JNE: case OP_JNZ: case OP_JA: case OP_JAE:
+    case OP_JB: case OP_JBE: case OP_JG: case OP_JGE: case OP_JL: case OP_JLE:
+    case OP_JC: case OP_JNC: case OP_JO: case OP_JNO: case OP_JS: case OP_JNS:
+        return {FL_ALL, 0, true};
+    default:
+        return {0, 0, false};
+    }
+}
+
+static bool isBranchOpcode(Opcode op) {
+    FormRange r = formIndex.range[op];
+    for (int i = r.first; i < r.first + r.count; i++)
+        if (instrForms[i].dst == F_REL8 || instrForms[i].dst == F_REL16)
+            return true;
+    return false;
+}
+
+/* =========================================
+   Rule engine
+   Instructions are deleted by marking them dead;
+   the stream is compacted (and label targets
+   remapped) once a pass makes no more changes.
+========================================= */
+struct PeepholeContext {
+    vector<TypedInstruction>& code;
+    vector<bool> dead;
+    vector<bool> isTarget;      // some LABEL operand points here
+    int bytesSaved;
+
+    explicit PeepholeContext(vector<TypedInstruction>& c)
+        : code(c), dead(c.size(), false), isTarget(c.size() + 1, false), bytesSaved(0) {
+        for (const auto& instr : code)
+            if (instr.dst.type == LABEL)
+                isTarget[instr.dst.value] = true;
+    }
+
+    size_t next(size_t i) const {
+        for (i++; i < code.size() && dead[i]; i++) {}
+        return i;
+    }
+
+    // True when none of the flags in mask is read before being overwritten
+    bool flagsDeadAfter(size_t i, uint8_t mask) const {
+        const int window = 32;
+        int seen = 0;
+        for (size_t j = next(i); j < code.size() && seen < window; j = next(j), seen++) {
+            FlagEffect e = flagEffect(code[j]);
+            if (e.reads & mask)
+                return false;
+            mask &= ~e.writes;
+            if (mask == 0)
+                return true;
+            if (e.leavesBlock)
+                return code[j].opcode == OP_HLT;
+        }
+        return false;
+    }
+
+    void remove(size_t i) {
+        bytesSaved += instructionLength(code[i]);
+        dead[i] = true;
+    }
+
+    // Replace when the new form is encodable and strictly shorter
+    bool replace(size_t i, const TypedInstruction& with) {
+        if (!selectForm(with))
+            return false;
+        int saved = instructionLength(code[i]) - instructionLength(with);
+        if (saved <= 0)
+            return false;
+        bytesSaved += saved;
+        code[i] = with;
+        return true;
+    }
+
+    static int instructionLength(const TypedInstruction& instr) {
+        const InstrForm* form = selectForm(instr);
+        return form ? formLength(*form, instr) : 0;
+    }
+};
+
+static bool sameOperand(const TypedOperand& a, const TypedOperand& b) {
+    return a.type == b.type && a.value == b.value;
+}
+
+static bool isGeneralReg(const TypedOperand& o) {
+    return o.type == REG && o.value <= REG_BH;
+}
+
+/* ---------- MOV r, r  ->  (nothing) ---------- */
+static bool ruleMovSelf(PeepholeContext& ctx, size_t i) {
+    const TypedInstruction& in = ctx.code[i];
+    if (in.opcode != OP_MOV || in.dst.type != REG || !sameOperand(in.dst, in.src))
+        return false;
+    ctx.remove(i);
+    return true;
+}
+
+/* ---------- MOV r16, 0  ->  XOR r16, r16 ---------- */
+static bool ruleZeroToXor(PeepholeContext& ctx, size_t i) {
+    const TypedInstruction& in = ctx.code[i];
+    if (in.opcode != OP_MOV || !isGeneralReg(in.dst) || in.src.type != IMM || in.src.value != 0)
+        return false;
+    if (!ctx.flagsDeadAfter(i, FL_ALL))
+        return false;
+
+    TypedInstruction x = in;
+    x.opcode = OP_XOR;
+    x.src = in.dst;
+    return ctx.replace(i, x);
+}
+
+/* ---------- ADD/SUB x, +-1  ->  INC/DEC x ---------- */
+static bool ruleIncDec(PeepholeContext& ctx, size_t i) {
+    const TypedInstruction& in = ctx.code[i];
+    if ((in.opcode != OP_ADD && in.opcode != OP_SUB) || in.src.type != IMM)
+        return false;
+
+    bool up;
+    uint8_t differs;                    // flags INC/DEC would compute differently
+    if (in.src.value == 1) {
+        up = in.opcode == OP_ADD;
+        differs = FL_CF;
+    } else if (in.src.value == 0xFFFF) {
+        up = in.opcode == OP_SUB;
+        differs = FL_CF | FL_AF;
+    } else {
+        return false;
+    }
+
+    if (!ctx.flagsDeadAfter(i, differs))
+        return false;
+
+    TypedInstruction x = in;
+    x.opcode = up ? OP_INC : OP_DEC;
+    x.src = TypedOperand();
+    return ctx.replace(i, x);
+}
+
+/* ---------- ADD/SUB/OR/XOR x, 0  ->  (nothing) ---------- */
+static bool ruleArithIdentity(PeepholeContext& ctx, size_t i) {
+    const TypedInstruction& in = ctx.code[i];
+    bool identity = (in.opcode == OP_ADD || in.opcode == OP_SUB ||
+                     in.opcode == OP_OR || in.opcode == OP_XOR) &&
+                    in.src.type == IMM && in.src.value == 0;
+    if (!identity || !ctx.flagsDeadAfter(i, FL_ALL))
+        return false;
+    ctx.remove(i);
+    return true;
+}
+
+/*
+   Second MOV of a pair that leaves memory and register equal:
+     MOV [m], r ; MOV r, [m]     (reload of a store)
+     MOV r, [m] ; MOV [m], r     (store of a load)
+     MOV a, b   ; MOV a, b       (duplicate)
+   The second instruction must not be a branch target.
+*/
+static bool ruleRedundantMove(PeepholeContext& ctx, size_t i) {
+    size_t j = ctx.next(i);
+    if (j >= ctx.code.size() || ctx.isTarget[j])
+        return false;
+
+    const TypedInstruction& a = ctx.code[i];
+    const TypedInstruction& b = ctx.code[j];
+    if (a.opcode != OP_MOV || b.opcode != OP_MOV)
+        return false;
+
+    bool swapped = sameOperand(a.dst, b.src) && sameOperand(a.src, b.dst) &&
+                   ((a.dst.type == MEM && isGeneralReg(a.src)) ||
+                    (a.src.type == MEM && isGeneralReg(a.dst)));
+    bool duplicate = sameOperand(a.dst, b.dst) && sameOperand(a.src, b.src) &&
+                     !sameOperand(a.dst, a.src);
+
+    if (!swapped && !duplicate)
+        return false;
+
+    ctx.remove(j);
+    return true;
+}
+
+struct PeepholeRule {
+    const char* name;
+    bool (*apply)(PeepholeContext& ctx, size_t i);
+};
+
+static const PeepholeRule peepholeRules[] = {
+    {"mov-self",        ruleMovSelf},
+    {"redundant-move",  ruleRedundantMove},
+    {"arith-identity",  ruleArithIdentity},
+    {"zero-to-xor",     ruleZeroToXor},
+    {"inc-dec",         ruleIncDec},
+};
+
+/* =========================================
+   Compact live instructions, remap labels
+========================================= */
+static void compact(PeepholeContext& ctx) {
+    vector<TypedInstruction>& code = ctx.code;
+    vector<int> newIndex(code.size() + 1);
+
+    size_t out = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        newIndex[i] = (int)out;     // a deleted target falls through to the next live one
+        if (!ctx.dead[i])
+            code[out++] = code[i];
+    }
+    newIndex[code.size()] = (int)out;
+    code.resize(out);
+
+    for (auto& instr : code)
+        if (instr.dst.type == LABEL)
+            instr.dst.value = newIndex[instr.dst.value];
+}
+
+/* =========================================
+   Main optimizer entry
+========================================= */
+PeepholeStats optimizePeephole(vector<TypedInstruction>& instructions) {
+    PeepholeStats stats;
+    for (const auto& rule : peepholeRules)
+        stats.rules.push_back({rule.name, 0});
+
+    // Numeric branch targets pin the code layout
+    for (const auto& instr : instructions)
+        if (instr.dst.type == IMM && isBranchOpcode(instr.opcode))
+            return stats;
+
+    PeepholeContext ctx(instructions);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < instructions.size(); i = ctx.next(i)) {
+            if (ctx.dead[i])
+                continue;
+            for (size_t r = 0; r < stats.rules.size(); r++) {
+                if (peepholeRules[r].apply(ctx, i)) {
+                    stats.rules[r].hits++;
+                    changed = true;
+                    if (ctx.dead[i])
+                        break;
+                }
+            }
+        }
+    }
+
+    compact(ctx);
+    stats.bytesSaved = ctx.bytesSaved;
+    return stats;
+}
@@ -0,0 +1,50 @@
+#include "profile.h"
+#include <cstdio>
+
+using namespace std;
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+void printProfile(ostream& out, const Profile& profile, size_t top) {
+    char line[96];
+
+    out << "\nHOT SPOTS (" << profile.cycles << " cycles, " << profile.instructions
+        << " instructions)\n";
+    out << "    IP  INSTR        COUNT        CYCLES      %\n";
+    for (size_t i = 0; i < profile.addresses.size() && i < top; i++) {
+        const AddressProfile& a = profile.addresses[i];
+        snprintf(line, sizeof line, "  %04X  %-6s %12llu  %12llu  %5.1f\n", a.ip, a.mnemonic,
+                 (unsigned long long)a.count, (unsigned long long)a.cycles,
+                 percent(a.cycles, profile.cycles));
+        out << line;
+    }
+
+    out << "\nCYCLES BY OPCODE\n";
+    out << "  INSTR        COUNT        CYCLES      %   AVG\n";
+    for (size_t i = 0; i < profile.opcodes.size() && i < top; i++) {
+        const OpcodeProfile& o = profile.opcodes[i];
+        snprintf(line, sizeof line, "  %-6s %12llu  %12llu  %5.1f %5.1f\n", o.mnemonic,
+                 (unsigned long long)o.count, (unsigned long long)o.cycles,
+                 percent(o.cycles, profile.cycles), o.count ? (double)o.cycles / o.count : 0.0);
+        out << line;
+    }
+}
+
+void writeProfileJson(ostream& out, const Profile& profile) {
+    out << "{\n  \"instructions\": " << profile.instructions << ",\n  \"cycles\": "
+        << profile.cycles << ",\n  \"addresses\": [";
+    for (size_t i = 0; i < profile.addresses.size(); i++) {
+        const AddressProfile& a = profile.addresses[i];
+        out << (i ? ",\n" : "\n") << "    {\"ip\": " << a.ip << ", \"mnemonic\": \"" << a.mnemonic
+            << "\", \"count\": " << a.count << ", \"cycles\": " << a.cycles << "}";
+    }
+    out << "\n  ],\n  \"opcodes\": [";
+    for (size_t i = 0; i < profile.opcodes.size(); i++) {
+        const OpcodeProfile& o = profile.opcodes[i];
+        out << (i ? ",\n" : "\n") << "    {\"mnemonic\": \"" << o.mnemonic << "\", \"count\": "
+            << o.count << ", \"cycles\": " << o.cycles << "}";
+    }
+    out << "\n  ]\n}\n";
+}
@@ -0,0 +1,41 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+using namespace std;
+
+/* ================= Hot-Spot Profile ================= */
+/*
+   Collected by TIER_PROFILE runs (see Machine::profile). Both lists are
+   sorted by cycles, hottest first. mnemonic is decoded from memory when
+   the profile is built; "??" if the bytes there no longer decode.
+*/
+struct AddressProfile {
+    uint16_t ip;
+    const char* mnemonic;
+    uint64_t count;
+    uint64_t cycles;
+};
+
+struct OpcodeProfile {
+    const char* mnemonic;
+    uint64_t count;
+    uint64_t cycles;
+};
+
+struct Profile {
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    vector<AddressProfile> addresses;
+    vector<OpcodeProfile> opcodes;
+};
+
+// Sorted hot-spot tables, top rows of each
+void printProfile(ostream& out, const Profile& profile, size_t top = 20);
+
+void writeProfileJson(ostream& out, const Profile& profile);
+
+#endif
@@ -1,146 +1,112 @@
 #include "semantic.h"
-#include <iostream>
-#include <map>
+#include "keywords.h"
+#include <ostream>
 #include <stdexcept>
 
 using namespace std;
 
 /* ================================
-   Symbol Table Entry
+   Constructor
 ================================ */
-struct Symbol {
-    string name;
-    int address;
-    int size;   // in bytes
-};
+SemanticAnalyzer::SemanticAnalyzer(const SymbolInterner& names)
+    : names(names), dataOffset(0), deferAll(false) {}
 
 /* ================================
-   Global Tables
+   Add Symbol to Table
 ================================ */
-map<string, Symbol> symbolTable;
-vector<IC> resolvedIC;
+void SemanticAnalyzer::addSymbol(SymbolId name, bool isLabel, int address, int size) {
+    if (name >= resolved.size())
+        resolved.resize(name + 1);
 
-/* ================================
-   Constructor
-================================ */
-SemanticAnalyzer::SemanticAnalyzer(const vector<Token>& t)
-    : tokens(t), pos(0), dataOffset(0) {}
+    TypedOperand& op = resolved[name];
+    if (op.type != NONE) {
+        throw runtime_error("Semantic error: Duplicate symbol " + string(names.name(name)));
+    }
 
-/* ================================
-   Utility Functions
-================================ */
-bool SemanticAnalyzer::isAtEnd() {
-    return pos >= tokens.size();
-}
+    SymbolEntry sym;
+    sym.name = name;
+    sym.isLabel = isLabel;
+    sym.address = address;
+    sym.size = size;
 
-Token SemanticAnalyzer::peek() {
-    if (isAtEnd())
-        return Token{END_OF_FILE, ""};
-    return tokens[pos];
+    op.type = isLabel ? LABEL : MEM;
+    op.value = address;
+    op.size = (uint8_t)size;
+    symbolTable.push_back(sym);
 }
 
-Token SemanticAnalyzer::advance() {
-    if (!isAtEnd())
-        pos++;
-    return tokens[pos - 1];
+void SemanticAnalyzer::defineVariable(SymbolId name, int size) {
+    addSymbol(name, false, dataOffset, size);
+    dataOffset += size;
 }
 
-/* ================================
-   Main Semantic Analysis
-================================ */
-void SemanticAnalyzer::analyze() {
-    while (!isAtEnd()) {
-        if (peek().type == DIRECTIVE && peek().value == ".DATA") {
-            advance();               // consume .DATA
-            processDataSection();
-        } else {
-            advance();
-        }
-    }
+// Code addresses are only known after branch relaxation,
+// so a label records the instruction it precedes
+void SemanticAnalyzer::defineLabel(SymbolId name, size_t instructionIndex) {
+    addSymbol(name, true, (int)instructionIndex, 0);
 }
 
 /* ================================
-   Process .DATA Section
+   Resolve Intermediate Code
+   Symbol references are patched in place: variables
+   become direct memory operands, labels become
+   instruction-index targets.
 ================================ */
-void SemanticAnalyzer::processDataSection() {
-    while (!isAtEnd()) {
-
-        // Stop when CODE section begins
-        if (peek().type == DIRECTIVE && peek().value == ".CODE")
-            return;
-
-        // Expect: IDENTIFIER DB NUMBER
-        if (peek().type == IDENTIFIER) {
-            string name = advance().value;
-
-            if (!(peek().type == DIRECTIVE && peek().value == "DB")) {
-                throw runtime_error("Semantic error: Expected DB after " + name);
-            }
-            advance(); // consume DB
-
-            if (peek().type != NUMBER) {
-                throw runtime_error("Semantic error: Expected NUMBER after DB for " + name);
-            }
-            advance(); // consume value (not stored yet)
-
-            addSymbol(name, 1);
-        } else {
-            advance();
-        }
-    }
-}
+bool SemanticAnalyzer::resolveOperand(TypedOperand& op) {
+    if (op.type != SYM)
+        return true;
 
-/* ================================
-   Add Symbol to Table
-================================ */
-void SemanticAnalyzer::addSymbol(const string& name, int size) {
-    if (symbolTable.count(name)) {
-        throw runtime_error("Semantic error: Duplicate symbol " + name);
-    }
+    SymbolId name = (SymbolId)op.value;
+    if (name >= resolved.size() || resolved[name].type == NONE)
+        return false;
 
-    Symbol sym;
-    sym.name = name;
-    sym.address = dataOffset;
-    sym.size = size;
+    op = resolved[name];
+    return true;
+}
 
-    symbolTable[name] = sym;
-    dataOffset += size;
+void SemanticAnalyzer::resolveIC(vector<IC>& intermediateCode, size_t index) {
+    if (deferAll)
+        return;
+    IC& ic = intermediateCode[index];
+
+    if (!resolveOperand(ic.op1))
+        fixups.push_back({index, 1});
+    if (!resolveOperand(ic.op2))
+        fixups.push_back({index, 2});
 }
 
 /* ================================
-   Resolve Intermediate Code
+   Back-patch Forward References
 ================================ */
-void SemanticAnalyzer::resolveIC(const vector<IC>& intermediateCode) {
-    resolvedIC.clear();
-
-    for (const auto& ic : intermediateCode) {
-        IC resolved = ic;
+void SemanticAnalyzer::backpatch(vector<IC>& intermediateCode) {
+    for (const auto& fix : fixups) {
+        IC& ic = intermediateCode[fix.ic];
+        TypedOperand& op = fix.operand == 1 ? ic.op1 : ic.op2;
 
-        // Resolve operand 1
-        if (symbolTable.count(ic.op1)) {
-            resolved.op1 = "[" + to_string(symbolTable[ic.op1].address) + "]";
+        if (!resolveOperand(op)) {
+            throw runtime_error("Semantic error: Undefined symbol " + string(names.name((SymbolId)op.value)));
         }
-
-        // Resolve operand 2
-        if (symbolTable.count(ic.op2)) {
-            resolved.op2 = "[" + to_string(symbolTable[ic.op2].address) + "]";
-        }
-
-        resolvedIC.push_back(resolved);
     }
+    fixups.clear();
 }
 
 /* ================================
    Debug Output
 ================================ */
-void SemanticAnalyzer::printSymbolTable() {
-    cout << "\nSYMBOL TABLE\n";
-    cout << "-----------------------------\n";
-    for (auto& entry : symbolTable) {
-        cout << entry.second.name
-             << " -> address: "
-             << entry.second.address
-             << ", size: "
-             << entry.second.size << endl;
+void SemanticAnalyzer::printSymbolTable(ostream& out) const {
+    out << "\nSYMBOL TABLE\n";
+    out << "-----------------------------\n";
+    for (auto& sym : symbolTable) {
+        if (sym.isLabel) {
+            out << names.name(sym.name)
+                << " -> label at instruction: "
+                << sym.address << endl;
+            continue;
+        }
+        out << names.name(sym.name)
+            << " -> address: "
+            << sym.address
+            << ", size: "
+            << sym.size << endl;
     }
 }
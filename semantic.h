@@ -2,29 +2,52 @@
 #define SEMANTIC_H
 
 #include "common.h"
+#include <ostream>
 #include <vector>
 
+struct SymbolEntry {
+    SymbolId name;
+    bool isLabel;
+    int address;   // data address, or instruction index for a label
+    int size;      // in bytes
+};
+
+/*
+   Owns the symbol table. The parser defines symbols and hands over each
+   IC as it is emitted; references to symbols that are already defined are
+   patched immediately, forward references are recorded and patched by
+   backpatch() once the whole program has been seen.
+*/
 class SemanticAnalyzer {
 private:
-    std::vector<Token> tokens;
-    int pos;
-    int dataOffset;
+    struct Fixup {
+        size_t ic;        // index into the IC vector
+        uint8_t operand;  // 1 = op1, 2 = op2
+    };
 
-    bool isAtEnd();
-    Token peek();
-    Token advance();
+    const SymbolInterner& names;
+    int dataOffset;
+    bool deferAll;
+    std::vector<Fixup> fixups;
+    std::vector<SymbolEntry> symbolTable;   // in definition order
+    std::vector<TypedOperand> resolved;     // SymbolId -> the operand it becomes, NONE if undefined
 
-    void processDataSection();
-    void addSymbol(const std::string& name, int size);
+    void addSymbol(SymbolId name, bool isLabel, int address, int size);
+    bool resolveOperand(TypedOperand& op);
 
 public:
-    SemanticAnalyzer(const std::vector<Token>& tokens);
+    explicit SemanticAnalyzer(const SymbolInterner& names);
 
-    void analyze();
-    void resolveIC(const std::vector<IC>& intermediateCode);
-    void printSymbolTable();
-};
+    // Leave every reference as SYM, for callers that resolve across fragments (incremental.h)
+    void deferReferences() { deferAll = true; }
+
+    void defineVariable(SymbolId name, int size);
+    void defineLabel(SymbolId name, size_t instructionIndex);
+    void resolveIC(std::vector<IC>& intermediateCode, size_t index);
+    void backpatch(std::vector<IC>& intermediateCode);
+    void printSymbolTable(std::ostream& out) const;
 
-extern std::vector<IC> resolvedIC;
+    const std::vector<SymbolEntry>& symbols() const { return symbolTable; }
+};
 
 #endif
@@ -0,0 +1,139 @@
+#include "source_map.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/* =========================================
+   Constructor / Destructor
+========================================= */
+#ifdef _WIN32
+SourceMap::SourceMap() : base(nullptr), length(0), fileHandle(nullptr), mappingHandle(nullptr) {}
+#else
+SourceMap::SourceMap() : base(nullptr), length(0) {}
+#endif
+
+SourceMap::~SourceMap()
+{
+    close();
+}
+
+/* =========================================
+   Map file (private, copy-on-write)
+========================================= */
+#ifdef _WIN32
+
+bool SourceMap::open(const string &filename)
+{
+    close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // Empty file: nothing to map
+    if (fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    base = static_cast<char *>(view);
+    length = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void SourceMap::close()
+{
+    if (base)
+        UnmapViewOfFile(base);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+
+    base = nullptr;
+    length = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+#else
+
+bool SourceMap::open(const string &filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // Empty file: nothing to map
+    if (st.st_size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps its own reference
+
+    if (p == MAP_FAILED)
+        return false;
+
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    base = static_cast<char *>(p);
+    length = st.st_size;
+    return true;
+}
+
+void SourceMap::close()
+{
+    if (base)
+        munmap(base, length);
+
+    base = nullptr;
+    length = 0;
+}
+
+#endif
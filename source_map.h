@@ -0,0 +1,45 @@
+#ifndef SOURCE_MAP_H
+#define SOURCE_MAP_H
+
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+/* ================= Memory-Mapped Source File ================= */
+/*
+   Maps a source file once, copy-on-write. The mapped lexer upper-cases
+   keywords and identifiers in place, so only pages that actually contain
+   lower-case text are ever copied; the file on disk is never modified.
+   Tokens produced from a SourceMap point into this buffer and stay valid
+   for as long as the SourceMap is alive.
+*/
+class SourceMap
+{
+private:
+    char *base;
+    size_t length;
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#endif
+
+public:
+    SourceMap();
+    ~SourceMap();
+
+    SourceMap(const SourceMap &) = delete;
+    SourceMap &operator=(const SourceMap &) = delete;
+
+    bool open(const string &filename);
+    void close();
+
+    char *data() { return base; }
+    const char *data() const { return base; }
+    size_t size() const { return length; }
+
+    // Byte offset of a token inside the mapped buffer
+    size_t offsetOf(const char *p) const { return p - base; }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+using namespace std;
+
+#ifndef NO_STAGE_STATS
+
+/* ================================
+   HEAP ACCOUNTING
+   Every allocation goes through here; only one made on a thread with
+   a live StageTimer is counted. Freed blocks are sized by the C
+   runtime, so allocations made before the stage still balance out.
+================================ */
+static thread_local StageStats* measuring = nullptr;
+static thread_local int64_t liveBytes = 0;
+
+static size_t blockSize(void* p) {
+#ifdef _WIN32
+    return _msize(p);
+#else
+    return malloc_usable_size(p);
+#endif
+}
+
+static void* allocate(size_t n) {
+    void* p = malloc(n ? n : 1);
+    if (!p)
+        throw bad_alloc();
+    if (measuring) {
+        measuring->allocations++;
+        liveBytes += blockSize(p);
+        if (liveBytes > (int64_t)measuring->peakBytes)
+            measuring->peakBytes = (uint64_t)liveBytes;
+    }
+    return p;
+}
+
+static void release(void* p) noexcept {
+    if (!p)
+        return;
+    if (measuring)
+        liveBytes -= blockSize(p);
+    free(p);
+}
+
+void* operator new(size_t n) { return allocate(n); }
+void* operator new[](size_t n) { return allocate(n); }
+
+void* operator new(size_t n, const nothrow_t&) noexcept {
+    try {
+        return allocate(n);
+    } catch (const bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t n, const nothrow_t& tag) noexcept { return operator new(n, tag); }
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { release(p); }
+
+/* ================================
+   STAGE TIMER
+================================ */
+StageTimer::StageTimer(StageRecorder* recorder, const char* name, const char* unit) : recorder(recorder) {
+    if (!recorder)
+        return;
+    stage.name = name;
+    stage.unit = unit;
+    measuring = &stage;
+    liveBytes = 0;
+    start = chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer() {
+    if (!recorder)
+        return;
+    stage.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    measuring = nullptr;
+    recorder->stages.push_back(stage);
+}
+
+#endif
+
+/* ================================
+   OUTPUT
+================================ */
+void printStageStats(ostream& out, const StageRecorder& stats) {
+    if (!STAGE_STATS_ENABLED) {
+        out << "\nStage statistics are not compiled in (NO_STAGE_STATS)\n";
+        return;
+    }
+
+    char line[112];
+    double ms = 0;
+    uint64_t allocations = 0, peak = 0;
+
+    out << "\nSTAGE STATISTICS\n";
+    out << "  STAGE        TIME ms         ITEMS  UNIT           ALLOCS     PEAK KB\n";
+    for (const StageStats& s : stats.stages) {
+        snprintf(line, sizeof line, "  %-9s %10.3f  %12llu  %-12s %8llu  %10.1f\n", s.name, s.ms,
+                 (unsigned long long)s.items, s.unit, (unsigned long long)s.allocations,
+                 s.peakBytes / 1024.0);
+        out << line;
+        ms += s.ms;
+        allocations += s.allocations;
+        peak = max(peak, s.peakBytes);
+    }
+    snprintf(line, sizeof line, "  %-9s %10.3f  %12s  %-12s %8llu  %10.1f\n", "total", ms, "", "",
+             (unsigned long long)allocations, peak / 1024.0);
+    out << line;
+}
+
+static void writeJsonString(ostream& out, const string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if ((unsigned char)c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof esc, "\\u%04x", c);
+            out << esc;
+        } else
+            out << c;
+    }
+    out << '"';
+}
+
+void writeStageStatsJson(ostream& out, const StageRecorder& stats, const string& source) {
+    double ms = 0;
+    uint64_t allocations = 0, peak = 0;
+
+    out << "{\n  \"source\": ";
+    writeJsonString(out, source);
+    out << ",\n  \"stages\": [";
+    for (size_t i = 0; i < stats.stages.size(); i++) {
+        const StageStats& s = stats.stages[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << s.name << "\", \"ms\": " << s.ms
+            << ", \"items\": " << s.items << ", \"unit\": \"" << s.unit << "\", \"allocations\": "
+            << s.allocations << ", \"peakBytes\": " << s.peakBytes << "}";
+        ms += s.ms;
+        allocations += s.allocations;
+        peak = max(peak, s.peakBytes);
+    }
+    out << "\n  ],\n  \"totalMs\": " << ms << ",\n  \"allocations\": " << allocations
+        << ",\n  \"peakBytes\": " << peak << "\n}\n";
+}
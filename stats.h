@@ -0,0 +1,83 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* ================= Stage Statistics ================= */
+/*
+   Per-stage cost of one assembly (--stats): wall time, the items the
+   stage worked through, and the heap it used. Memory is counted by
+   replacement operator new/delete, only on the thread running a stage
+   and only while a StageTimer is live:
+     allocations - calls to operator new,
+     peakBytes   - most heap bytes live at once above the stage's start.
+
+   Building with NO_STAGE_STATS compiles all of it out: StageTimer is
+   empty, operator new is left alone and the lexing pass is skipped.
+   Without it, an assembly that is not recorded pays one null check per
+   stage and one thread-local test per allocation.
+*/
+#ifdef NO_STAGE_STATS
+constexpr bool STAGE_STATS_ENABLED = false;
+#else
+constexpr bool STAGE_STATS_ENABLED = true;
+#endif
+
+struct StageStats {
+    const char* name = "";
+    const char* unit = "";          // what items counts
+    uint64_t items = 0;
+    double ms = 0;
+    uint64_t allocations = 0;
+    uint64_t peakBytes = 0;
+};
+
+struct StageRecorder {
+    vector<StageStats> stages;      // in the order they ran
+};
+
+#ifndef NO_STAGE_STATS
+
+/*
+   Times and measures one stage from construction to destruction, then
+   appends it to the recorder. A null recorder records nothing. Stages
+   must not nest.
+*/
+class StageTimer {
+private:
+    StageRecorder* recorder;
+    StageStats stage;
+    chrono::steady_clock::time_point start;
+
+public:
+    StageTimer(StageRecorder* recorder, const char* name, const char* unit);
+    ~StageTimer();
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void count(uint64_t items) { stage.items = items; }
+};
+
+#else
+
+class StageTimer {
+public:
+    StageTimer(StageRecorder*, const char*, const char*) {}
+    void count(uint64_t) {}
+};
+
+#endif
+
+// Stage table with totals
+void printStageStats(ostream& out, const StageRecorder& stats);
+
+void writeStageStatsJson(ostream& out, const StageRecorder& stats, const string& source);
+
+#endif
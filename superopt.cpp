@@ -0,0 +1,1115 @@
+#include "superopt.h"
+#include "bdd.h"
+#include "decoder.h"
+#include "emulator.h"
+#include "isa.h"
+#include "timing.h"
+#include "workpool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+
+using namespace std;
+
+/* =========================================
+   Eligible instructions
+========================================= */
+static bool isReg16(const TypedOperand& o) {
+    return o.type == REG && o.value <= REG_DI;
+}
+
+static bool isReg8(const TypedOperand& o) {
+    return o.type == REG && o.value >= REG_AL && o.value <= REG_BH;
+}
+
+static bool plainRegister(const TypedOperand& o) {
+    return (isReg16(o) && o.value != REG_SP) || isReg8(o);
+}
+
+// Word register holding o
+static int wordOf(const TypedOperand& o) {
+    return isReg16(o) ? o.value : (o.value - REG_AL) & 3;
+}
+
+static bool isBinary(Opcode op) {
+    switch (op) {
+    case OP_MOV: case OP_XCHG: case OP_ADD: case OP_ADC: case OP_SUB: case OP_SBB:
+    case OP_AND: case OP_OR: case OP_XOR: case OP_CMP: case OP_TEST:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool isUnary(Opcode op) {
+    return op == OP_INC || op == OP_DEC || op == OP_NEG || op == OP_NOT;
+}
+
+static bool isShift(Opcode op) {
+    switch (op) {
+    case OP_SHL: case OP_SAL: case OP_SHR: case OP_SAR:
+    case OP_ROL: case OP_ROR: case OP_RCL: case OP_RCR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool isCarryOp(Opcode op) {
+    return op == OP_CLC || op == OP_STC || op == OP_CMC;
+}
+
+bool superoptEligible(const TypedInstruction& in) {
+    const TypedOperand& d = in.dst;
+    const TypedOperand& s = in.src;
+    bool shape;
+    if (isBinary(in.opcode))
+        shape = plainRegister(d) && (plainRegister(s) || (s.type == IMM && in.opcode != OP_XCHG));
+    else if (isUnary(in.opcode))
+        shape = plainRegister(d) && s.type == NONE;
+    else if (isShift(in.opcode))
+        shape = plainRegister(d) && s.type == IMM && s.value == 1;
+    else if (isCarryOp(in.opcode))
+        shape = d.type == NONE && s.type == NONE;
+    else
+        shape = false;
+    return shape && selectForm(in);
+}
+
+// What an eligible instruction may change, for pruning candidates
+static LiveSet writesOf(const TypedInstruction& in) {
+    LiveSet w = {0, 0};
+    if (in.dst.type == REG && in.opcode != OP_CMP && in.opcode != OP_TEST)
+        w.regs |= (uint8_t)(1 << wordOf(in.dst));
+    if (in.opcode == OP_XCHG)
+        w.regs |= (uint8_t)(1 << wordOf(in.src));
+
+    switch (in.opcode) {
+    case OP_MOV: case OP_XCHG: case OP_NOT:
+        break;
+    case OP_INC: case OP_DEC:
+        w.flags = FLAG_ARITH & ~FLAG_CF;
+        break;
+    case OP_ROL: case OP_ROR: case OP_RCL: case OP_RCR:
+        w.flags = FLAG_CF | FLAG_OF;
+        break;
+    case OP_CLC: case OP_STC: case OP_CMC:
+        w.flags = FLAG_CF;
+        break;
+    default:
+        w.flags = FLAG_ARITH;
+        break;
+    }
+    return w;
+}
+
+// What an eligible instruction depends on; a byte destination counts as read, since the other half survives
+static LiveSet readsOf(const TypedInstruction& in) {
+    LiveSet r = {0, 0};
+    if (in.src.type == REG)
+        r.regs |= (uint8_t)(1 << wordOf(in.src));
+    if (in.dst.type == REG && (in.opcode != OP_MOV || isReg8(in.dst)))
+        r.regs |= (uint8_t)(1 << wordOf(in.dst));
+
+    switch (in.opcode) {
+    case OP_ADC: case OP_SBB: case OP_RCL: case OP_RCR: case OP_CMC:
+        r.flags = FLAG_CF;
+        break;
+    default:
+        break;
+    }
+    return r;
+}
+
+static bool sameInstruction(const TypedInstruction& a, const TypedInstruction& b) {
+    return a.opcode == b.opcode && a.dst.type == b.dst.type && a.dst.value == b.dst.value &&
+           a.src.type == b.src.type && a.src.value == b.src.value;
+}
+
+static bool sameSequence(const vector<TypedInstruction>& a, const vector<TypedInstruction>& b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (!sameInstruction(a[i], b[i]))
+            return false;
+    return true;
+}
+
+/* =========================================
+   Cost: encoded bytes and clocks
+========================================= */
+struct Encoded {
+    uint8_t code[8];
+    uint8_t length;
+    uint16_t cycles;
+};
+
+// memory: a 64 KB scratch space for the decoder
+static Encoded encode(const TypedInstruction& in, vector<uint8_t>& memory) {
+    Encoded e;
+    vector<uint8_t> bytes;
+    encodeForm(*selectForm(in), in, 0, bytes);
+    memcpy(memory.data(), bytes.data(), bytes.size());
+    memcpy(e.code, bytes.data(), bytes.size());
+    e.length = (uint8_t)bytes.size();
+
+    DecodedInsn d;
+    decodeInstruction(memory.data(), 0, d);
+    e.cycles = instructionTiming(d).cycles;
+    return e;
+}
+
+static int64_t costOf(int bytes, int cycles, SuperoptGoal goal) {
+    return goal == SUPEROPT_SIZE ? (int64_t)bytes << 16 | cycles : (int64_t)cycles << 16 | bytes;
+}
+
+static void measure(const vector<TypedInstruction>& seq, vector<uint8_t>& memory, int& bytes, int& cycles) {
+    bytes = cycles = 0;
+    for (const TypedInstruction& in : seq) {
+        Encoded e = encode(in, memory);
+        bytes += e.length;
+        cycles += e.cycles;
+    }
+}
+
+/* =========================================
+   Testing on the emulator
+========================================= */
+constexpr uint16_t TEST_CODE_AT = 0x100;
+constexpr uint32_t TEST_SEED = 8086;
+
+class Tester {
+private:
+    Machine machine;
+
+public:
+    Tester() { machine.load(vector<uint8_t>()); }
+
+    // Run code (then HLT) from state; false if the emulator faults
+    bool run(const uint8_t* code, size_t length, const CPU& from, CPU& to) {
+        uint8_t buffer[SUPEROPT_LENGTH * 8 + SUPEROPT_WINDOW * 8 + 1];
+        memcpy(buffer, code, length);
+        buffer[length] = 0xF4;
+        try {
+            machine.write(TEST_CODE_AT, buffer, length + 1);
+            machine.cpu() = from;
+            machine.cpu().IP = TEST_CODE_AT;
+            to = machine.run().cpu;
+            return true;
+        } catch (const exception&) {
+            return false;
+        }
+    }
+};
+
+// Edge values first, so the first tests reject most wrong candidates
+static vector<CPU> testStates() {
+    static const uint16_t edges[] = {0x0000, 0xFFFF, 0x8000, 0x7FFF, 0x0001, 0x00FF, 0xFF00, 0x0080};
+    mt19937 rng(TEST_SEED);
+    vector<CPU> states(SUPEROPT_TESTS);
+    for (size_t t = 0; t < states.size(); t++) {
+        CPU& cpu = states[t];
+        for (int r = 0; r < 8; r++)
+            cpu.regs[r] = t < 8 ? edges[(t + r) % 8] : (uint16_t)rng();
+        cpu.flags = FLAG_RESERVED | (uint16_t)(rng() & FLAG_ARITH);
+        cpu.flagOp = FOP_NONE;
+    }
+    return states;
+}
+
+static bool sameLive(const CPU& a, const CPU& b, LiveSet live) {
+    for (int r = 0; r < 8; r++)
+        if ((live.regs & (1 << r)) && a.regs[r] != b.regs[r])
+            return false;
+    return ((a.flags ^ b.flags) & live.flags) == 0;
+}
+
+/* =========================================
+   Symbolic execution
+   Every register bit and flag of the input
+   state is a BDD variable; bit i of all the
+   registers are adjacent in the order, which
+   keeps adders linear in size. Flags follow
+   flags.h exactly.
+========================================= */
+enum SymbolicFlag { S_CF, S_PF, S_AF, S_ZF, S_SF, S_OF, S_FLAG_COUNT };
+
+static const uint16_t symbolicFlagBits[S_FLAG_COUNT] = {
+    FLAG_CF, FLAG_PF, FLAG_AF, FLAG_ZF, FLAG_SF, FLAG_OF
+};
+
+class SymbolicCPU {
+private:
+    BddManager& m;
+
+    void read(const TypedOperand& o, int n, Bdd* v) const;
+    void write(const TypedOperand& o, int n, const Bdd* v);
+    Bdd add(const Bdd* a, const Bdd* b, Bdd carry, int n, Bdd* r);
+    void resultFlags(const Bdd* r, int n);
+
+public:
+    Bdd reg[8][16];
+    Bdd flag[S_FLAG_COUNT];
+
+    explicit SymbolicCPU(BddManager& m);
+    void execute(const TypedInstruction& in);
+};
+
+SymbolicCPU::SymbolicCPU(BddManager& m) : m(m) {
+    for (int f = 0; f < S_FLAG_COUNT; f++)
+        flag[f] = m.variable(f);
+    for (int b = 0; b < 16; b++)
+        for (int r = 0; r < 8; r++)
+            reg[r][b] = m.variable(S_FLAG_COUNT + b * 8 + r);
+}
+
+void SymbolicCPU::read(const TypedOperand& o, int n, Bdd* v) const {
+    if (o.type == IMM) {
+        for (int i = 0; i < n; i++)
+            v[i] = (o.value >> i) & 1 ? BDD_TRUE : BDD_FALSE;
+    } else if (isReg16(o)) {
+        copy(reg[o.value], reg[o.value] + 16, v);
+    } else {
+        int k = o.value - REG_AL;
+        const Bdd* from = reg[k & 3] + (k & 4 ? 8 : 0);
+        copy(from, from + 8, v);
+    }
+}
+
+void SymbolicCPU::write(const TypedOperand& o, int n, const Bdd* v) {
+    if (isReg16(o)) {
+        copy(v, v + n, reg[o.value]);
+    } else {
+        int k = o.value - REG_AL;
+        copy(v, v + 8, reg[k & 3] + (k & 4 ? 8 : 0));
+    }
+}
+
+// r = a + b + carry over n bits; returns the carry out
+Bdd SymbolicCPU::add(const Bdd* a, const Bdd* b, Bdd carry, int n, Bdd* r) {
+    for (int i = 0; i < n; i++) {
+        Bdd half = m.differ(a[i], b[i]);
+        r[i] = m.differ(half, carry);
+        carry = m.ite(half, carry, a[i]);
+    }
+    return carry;
+}
+
+void SymbolicCPU::resultFlags(const Bdd* r, int n) {
+    Bdd parity = BDD_FALSE, any = BDD_FALSE;
+    for (int i = 0; i < 8; i++)
+        parity = m.differ(parity, r[i]);
+    for (int i = 0; i < n; i++)
+        any = m.either(any, r[i]);
+    flag[S_PF] = m.negate(parity);
+    flag[S_ZF] = m.negate(any);
+    flag[S_SF] = r[n - 1];
+}
+
+void SymbolicCPU::execute(const TypedInstruction& in) {
+    const int n = isReg8(in.dst) ? 8 : 16, top = n - 1;
+    Bdd a[16], b[16], r[16];
+
+    switch (in.opcode) {
+    case OP_CLC:
+        flag[S_CF] = BDD_FALSE;
+        return;
+    case OP_STC:
+        flag[S_CF] = BDD_TRUE;
+        return;
+    case OP_CMC:
+        flag[S_CF] = m.negate(flag[S_CF]);
+        return;
+    case OP_MOV:
+        read(in.src, n, b);
+        write(in.dst, n, b);
+        return;
+    case OP_XCHG:
+        read(in.dst, n, a);
+        read(in.src, n, b);
+        write(in.dst, n, b);
+        write(in.src, n, a);
+        return;
+    case OP_NOT:
+        read(in.dst, n, a);
+        for (int i = 0; i < n; i++)
+            r[i] = m.negate(a[i]);
+        write(in.dst, n, r);
+        return;
+    default:
+        break;
+    }
+
+    read(in.dst, n, a);
+    if (in.opcode == OP_INC || in.opcode == OP_DEC) {
+        TypedOperand one;
+        one.type = IMM;
+        one.value = 1;
+        read(one, n, b);
+    } else if (in.src.type != NONE) {
+        read(in.src, n, b);
+    }
+
+    auto addOverflow = [&](const Bdd* x, const Bdd* y) {
+        return m.both(m.differ(x[top], r[top]), m.differ(y[top], r[top]));
+    };
+    auto subOverflow = [&](const Bdd* x, const Bdd* y) {
+        return m.both(m.differ(x[top], y[top]), m.differ(x[top], r[top]));
+    };
+    auto adjust = [&](const Bdd* x, const Bdd* y) {
+        return m.differ(m.differ(x[4], y[4]), r[4]);
+    };
+
+    bool store = true;
+    switch (in.opcode) {
+    case OP_ADD: case OP_ADC: case OP_INC: {
+        Bdd carry = add(a, b, in.opcode == OP_ADC ? flag[S_CF] : BDD_FALSE, n, r);
+        if (in.opcode != OP_INC)
+            flag[S_CF] = carry;
+        flag[S_OF] = addOverflow(a, b);
+        flag[S_AF] = adjust(a, b);
+        resultFlags(r, n);
+        break;
+    }
+    case OP_SUB: case OP_SBB: case OP_CMP: case OP_DEC: {
+        // a - b - borrow = a + ~b + !borrow; the borrow out is the inverted carry
+        Bdd nb[16];
+        for (int i = 0; i < n; i++)
+            nb[i] = m.negate(b[i]);
+        Bdd carry = add(a, nb, in.opcode == OP_SBB ? m.negate(flag[S_CF]) : BDD_TRUE, n, r);
+        if (in.opcode != OP_DEC)
+            flag[S_CF] = m.negate(carry);
+        flag[S_OF] = subOverflow(a, b);
+        flag[S_AF] = adjust(a, b);
+        resultFlags(r, n);
+        store = in.opcode != OP_CMP;
+        break;
+    }
+    case OP_NEG: {
+        // 0 - a
+        Bdd zero[16], na[16];
+        for (int i = 0; i < n; i++) {
+            zero[i] = BDD_FALSE;
+            na[i] = m.negate(a[i]);
+        }
+        flag[S_CF] = m.negate(add(zero, na, BDD_TRUE, n, r));
+        flag[S_OF] = subOverflow(zero, a);
+        flag[S_AF] = adjust(zero, a);
+        resultFlags(r, n);
+        break;
+    }
+    case OP_AND: case OP_OR: case OP_XOR: case OP_TEST:
+        for (int i = 0; i < n; i++)
+            r[i] = in.opcode == OP_OR ? m.either(a[i], b[i]) :
+                   in.opcode == OP_XOR ? m.differ(a[i], b[i]) : m.both(a[i], b[i]);
+        flag[S_CF] = flag[S_OF] = flag[S_AF] = BDD_FALSE;
+        resultFlags(r, n);
+        store = in.opcode != OP_TEST;
+        break;
+
+    // Shifts and rotates by 1
+    case OP_SHL: case OP_SAL:
+        r[0] = BDD_FALSE;
+        for (int i = 1; i < n; i++)
+            r[i] = a[i - 1];
+        flag[S_CF] = a[top];
+        flag[S_OF] = m.differ(r[top], a[top]);
+        flag[S_AF] = BDD_FALSE;
+        resultFlags(r, n);
+        break;
+    case OP_SHR: case OP_SAR:
+        for (int i = 0; i < top; i++)
+            r[i] = a[i + 1];
+        r[top] = in.opcode == OP_SAR ? a[top] : BDD_FALSE;
+        flag[S_CF] = a[0];
+        flag[S_OF] = in.opcode == OP_SAR ? BDD_FALSE : a[top];
+        flag[S_AF] = BDD_FALSE;
+        resultFlags(r, n);
+        break;
+    case OP_ROL:
+        r[0] = a[top];
+        for (int i = 1; i < n; i++)
+            r[i] = a[i - 1];
+        flag[S_CF] = r[0];
+        flag[S_OF] = m.differ(r[top], r[0]);
+        break;
+    case OP_ROR:
+        for (int i = 0; i < top; i++)
+            r[i] = a[i + 1];
+        r[top] = a[0];
+        flag[S_CF] = r[top];
+        flag[S_OF] = m.differ(r[top], r[top - 1]);
+        break;
+    case OP_RCL:
+        r[0] = flag[S_CF];
+        for (int i = 1; i < n; i++)
+            r[i] = a[i - 1];
+        flag[S_CF] = a[top];
+        flag[S_OF] = m.differ(r[top], a[top]);
+        break;
+    case OP_RCR:
+        flag[S_OF] = m.differ(a[top], flag[S_CF]);
+        for (int i = 0; i < top; i++)
+            r[i] = a[i + 1];
+        r[top] = flag[S_CF];
+        flag[S_CF] = a[0];
+        break;
+    default:
+        store = false;
+        break;
+    }
+    if (store)
+        write(in.dst, n, r);
+}
+
+// True when both sequences agree on live for every input state
+static bool provenEqual(BddManager& m, const vector<TypedInstruction>& x,
+                        const vector<TypedInstruction>& y, LiveSet live) {
+    m.clear();
+    SymbolicCPU a(m), b(m);
+    for (const TypedInstruction& in : x)
+        a.execute(in);
+    for (const TypedInstruction& in : y)
+        b.execute(in);
+    if (m.overflowed())
+        return false;
+
+    for (int r = 0; r < 8; r++)
+        if (live.regs & (1 << r))
+            for (int i = 0; i < 16; i++)
+                if (a.reg[r][i] != b.reg[r][i])
+                    return false;
+    for (int f = 0; f < S_FLAG_COUNT; f++)
+        if ((live.flags & symbolicFlagBits[f]) && a.flag[f] != b.flag[f])
+            return false;
+    return true;
+}
+
+/* =========================================
+   Candidate instructions
+========================================= */
+struct Choice {
+    TypedInstruction instr;
+    Encoded encoded;
+    int64_t cost;
+    LiveSet writes;
+    LiveSet reads;
+    uint8_t kills;      // words written whole
+};
+
+/*
+   Whether a candidate with choice b straight after choice a can be
+   skipped: either b overwrites everything a wrote without reading it,
+   so b alone does the same, or the two are independent and the other
+   order comes earlier in the enumeration
+*/
+static bool redundantPair(const vector<Choice>& choices, uint32_t a, uint32_t b) {
+    const Choice& x = choices[a];
+    const Choice& y = choices[b];
+    bool hidden = !(x.writes.regs & ~(y.kills & ~y.reads.regs)) &&
+                  !(x.writes.flags & ~(y.writes.flags & ~y.reads.flags));
+    if (hidden)
+        return true;
+
+    bool independent = !(x.writes.regs & (y.reads.regs | y.writes.regs)) &&
+                       !(x.writes.flags & (y.reads.flags | y.writes.flags)) &&
+                       !(y.writes.regs & x.reads.regs) && !(y.writes.flags & x.reads.flags);
+    return independent && b < a;
+}
+
+static TypedOperand registerOperand(int id) {
+    TypedOperand o;
+    o.type = REG;
+    o.value = id;
+    return o;
+}
+
+static TypedOperand immediateOperand(int value) {
+    TypedOperand o;
+    o.type = IMM;
+    o.value = value;
+    return o;
+}
+
+/*
+   Every eligible instruction over the window's registers and the given
+   immediates, cheapest first
+*/
+static vector<Choice> buildChoices(const vector<TypedInstruction>& window, const vector<uint16_t>& constants,
+                                   SuperoptGoal goal, vector<uint8_t>& memory) {
+    bool usesWord[8] = {}, asBytes[8] = {}, usesBytes = false;
+    vector<uint16_t> words = {0, 1, 0xFFFF};
+    for (const TypedInstruction& in : window) {
+        for (const TypedOperand* o : {&in.dst, &in.src}) {
+            if (o->type == REG)
+                usesWord[wordOf(*o)] = true;
+            if (isReg8(*o))
+                usesBytes = asBytes[wordOf(*o)] = true;
+            if (o->type == IMM)
+                words.push_back((uint16_t)o->value);
+        }
+    }
+    words.insert(words.end(), constants.begin(), constants.end());
+    sort(words.begin(), words.end());
+    words.erase(unique(words.begin(), words.end()), words.end());
+
+    vector<uint16_t> bytes = {0xFF};
+    for (uint16_t w : words) {
+        bytes.push_back(w & 0xFF);
+        bytes.push_back(w >> 8);
+    }
+    sort(bytes.begin(), bytes.end());
+    bytes.erase(unique(bytes.begin(), bytes.end()), bytes.end());
+
+    vector<TypedOperand> regs16, regs8;
+    for (int r = 0; r < 8; r++) {
+        if (!usesWord[r])
+            continue;
+        regs16.push_back(registerOperand(r));
+        // Only these keep their halves whatever register they stand for (canonicalRegisters)
+        if (asBytes[r] || (usesBytes && r == REG_AX)) {
+            regs8.push_back(registerOperand(REG_AL + r));
+            regs8.push_back(registerOperand(REG_AH + r));
+        }
+    }
+
+    vector<TypedInstruction> all;
+    auto emit = [&](Opcode op, const TypedOperand& d, const TypedOperand& s) {
+        TypedInstruction in = {op, d, s};
+        if (superoptEligible(in))
+            all.push_back(in);
+    };
+
+    static const Opcode binary[] = {OP_MOV, OP_ADD, OP_ADC, OP_SUB, OP_SBB, OP_AND,
+                                    OP_OR, OP_XOR, OP_CMP, OP_TEST, OP_XCHG};
+    static const Opcode unary[] = {OP_INC, OP_DEC, OP_NEG, OP_NOT};
+    static const Opcode shifts[] = {OP_SHL, OP_SHR, OP_SAR, OP_ROL, OP_ROR, OP_RCL, OP_RCR};
+
+    for (int width = 0; width < 2; width++) {
+        const vector<TypedOperand>& regs = width ? regs8 : regs16;
+        const vector<uint16_t>& imms = width ? bytes : words;
+        for (Opcode op : binary) {
+            for (const TypedOperand& d : regs) {
+                for (const TypedOperand& s : regs) {
+                    bool same = s.value == d.value;
+                    if ((op == OP_MOV && same) || (op == OP_XCHG && s.value <= d.value))
+                        continue;
+                    emit(op, d, s);
+                }
+                for (uint16_t v : imms)
+                    emit(op, d, immediateOperand(v));
+            }
+        }
+        for (const TypedOperand& d : regs) {
+            for (Opcode op : unary)
+                emit(op, d, TypedOperand());
+            for (Opcode op : shifts)
+                emit(op, d, immediateOperand(1));
+        }
+    }
+    for (Opcode op : {OP_CLC, OP_STC, OP_CMC})
+        emit(op, TypedOperand(), TypedOperand());
+
+    vector<Choice> choices;
+    for (const TypedInstruction& in : all) {
+        Choice c;
+        c.instr = in;
+        c.encoded = encode(in, memory);
+        c.cost = costOf(c.encoded.length, c.encoded.cycles, goal);
+        c.writes = writesOf(in);
+        c.reads = readsOf(in);
+        c.kills = isReg8(in.dst) ? 0 : c.writes.regs;
+        choices.push_back(c);
+    }
+    stable_sort(choices.begin(), choices.end(),
+                [](const Choice& a, const Choice& b) { return a.cost < b.cost; });
+    return choices;
+}
+
+/* =========================================
+   Search
+========================================= */
+struct SearchBest {
+    int64_t cost;
+    vector<uint32_t> picks;     // into choices; empty: no candidate yet
+
+    // Cheaper, or as cheap and earlier in enumeration order
+    bool beatenBy(int64_t c, const vector<uint32_t>& p) const {
+        if (c != cost)
+            return c < cost;
+        if (p.size() != picks.size())
+            return p.size() < picks.size();
+        return p < picks;
+    }
+};
+
+struct SearchWorker {
+    Tester tester;
+    unique_ptr<BddManager> bdd;     // made on the first proof; most searches need none
+
+    BddManager& prover() {
+        if (!bdd)
+            bdd.reset(new BddManager());
+        return *bdd;
+    }
+};
+
+// The calling thread is pool worker 0; its Machine outlives the search
+static SearchWorker& threadWorker() {
+    thread_local SearchWorker worker;
+    return worker;
+}
+
+struct SearchCounts {
+    uint64_t candidates = 0;
+    uint64_t proofs = 0;
+};
+
+// Smaller searches stay on the calling thread rather than building a Machine per worker
+constexpr uint64_t PARALLEL_SPACE = 1 << 16;
+
+bool superoptimizeWindow(const vector<TypedInstruction>& window, LiveSet liveOut, SuperoptGoal goal,
+                         vector<TypedInstruction>& best, SuperoptStats& stats, unsigned threads) {
+    best.clear();
+    vector<uint8_t> memory(65536);
+
+    // What the window does from each test state
+    vector<CPU> states = testStates();
+    vector<CPU> expected(states.size());
+    vector<uint8_t> windowCode;
+    int windowBytes = 0, windowCycles = 0;
+    for (const TypedInstruction& in : window) {
+        Encoded e = encode(in, memory);
+        windowCode.insert(windowCode.end(), e.code, e.code + e.length);
+        windowBytes += e.length;
+        windowCycles += e.cycles;
+    }
+    int64_t windowCost = costOf(windowBytes, windowCycles, goal);
+
+    SearchWorker& caller = threadWorker();
+    for (size_t t = 0; t < states.size(); t++)
+        if (!caller.tester.run(windowCode.data(), windowCode.size(), states[t], expected[t]))
+            return false;
+
+    // Nothing live changes: the window can go
+    bool noEffect = true;
+    for (size_t t = 0; t < states.size() && noEffect; t++)
+        noEffect = sameLive(states[t], expected[t], liveOut);
+    if (noEffect && provenEqual(caller.prover(), window, vector<TypedInstruction>(), liveOut)) {
+        stats.proofs++;
+        return true;
+    }
+
+    // Whatever live the window visibly changes, a candidate must write
+    LiveSet changed = {0, 0};
+    for (size_t t = 0; t < states.size(); t++) {
+        for (int r = 0; r < 8; r++)
+            if (states[t].regs[r] != expected[t].regs[r])
+                changed.regs |= (uint8_t)(1 << r);
+        changed.flags |= states[t].flags ^ expected[t].flags;
+    }
+    changed.regs &= liveOut.regs;
+    changed.flags &= liveOut.flags;
+
+    // Live registers the window always leaves the same are worth having as immediates
+    vector<uint16_t> constants;
+    for (int r = 0; r < 8; r++) {
+        if (!(liveOut.regs & (1 << r)))
+            continue;
+        bool same = true;
+        for (size_t t = 1; t < expected.size() && same; t++)
+            same = expected[t].regs[r] == expected[0].regs[r];
+        if (same)
+            constants.push_back(expected[0].regs[r]);
+    }
+    vector<Choice> choices = buildChoices(window, constants, goal, memory);
+    if (choices.empty())
+        return false;
+
+    // Each length is searched only if it fits the budget by itself
+    int maxLength = min(SUPEROPT_LENGTH, (int)window.size() + 1);
+    bool searchLength[SUPEROPT_LENGTH + 1] = {};
+    uint64_t space = 1, searched = 0;
+    for (int len = 1; len <= maxLength; len++) {
+        space *= choices.size();
+        searchLength[len] = space <= SUPEROPT_BUDGET;
+        if (searchLength[len])
+            searched += space;
+    }
+
+    // Candidates must be strictly cheaper than the window
+    SearchBest found = {windowCost - 1, vector<uint32_t>()};
+    atomic<int64_t> limit(windowCost - 1);
+    mutex foundLock;
+
+    unsigned workers = searched < PARALLEL_SPACE ? 1 : poolSize(choices.size(), threads);
+    vector<unique_ptr<SearchWorker>> pool(workers);
+    vector<SearchCounts> counts(workers);
+
+    runPool(choices.size(), workers, [&](unsigned w, size_t first) {
+        if (w > 0 && !pool[w])
+            pool[w].reset(new SearchWorker());
+        SearchWorker& k = w > 0 ? *pool[w] : caller;
+        SearchCounts& n = counts[w];
+
+        vector<uint32_t> picks(1, (uint32_t)first);
+        uint8_t code[SUPEROPT_LENGTH * 8];
+        size_t codeLength = 0;
+
+        auto test = [&](int64_t cost) {
+            // The last instruction must change something live, or a shorter candidate does the same
+            const LiveSet& last = choices[picks.back()].writes;
+            if (!(last.regs & liveOut.regs) && !(last.flags & liveOut.flags))
+                return;
+            LiveSet written = {0, 0};
+            for (uint32_t p : picks) {
+                written.regs |= choices[p].writes.regs;
+                written.flags |= choices[p].writes.flags;
+            }
+            if ((changed.regs & ~written.regs) || (changed.flags & ~written.flags))
+                return;
+
+            n.candidates++;
+            CPU out;
+            for (size_t t = 0; t < states.size(); t++)
+                if (!k.tester.run(code, codeLength, states[t], out) || !sameLive(out, expected[t], liveOut))
+                    return;
+
+            vector<TypedInstruction> seq;
+            for (uint32_t p : picks)
+                seq.push_back(choices[p].instr);
+            n.proofs++;
+            if (!provenEqual(k.prover(), window, seq, liveOut))
+                return;
+
+            lock_guard<mutex> guard(foundLock);
+            if (found.picks.empty() ? cost <= found.cost : found.beatenBy(cost, picks)) {
+                found.cost = cost;
+                found.picks = picks;
+                limit.store(cost);
+            }
+        };
+
+        // Extend picks to length instructions, cheapest choices first
+        function<void(int, int64_t)> extend = [&](int length, int64_t cost) {
+            if ((int)picks.size() == length) {
+                test(cost);
+                return;
+            }
+            for (uint32_t c = 0; c < choices.size(); c++) {
+                int64_t total = cost + choices[c].cost;
+                if (total > limit.load())
+                    break;
+                if (redundantPair(choices, picks.back(), c))
+                    continue;
+                const Encoded& e = choices[c].encoded;
+                memcpy(code + codeLength, e.code, e.length);
+                codeLength += e.length;
+                picks.push_back(c);
+                extend(length, total);
+                picks.pop_back();
+                codeLength -= e.length;
+            }
+        };
+
+        const Choice& head = choices[first];
+        memcpy(code, head.encoded.code, head.encoded.length);
+        codeLength = head.encoded.length;
+        for (int len = 1; len <= maxLength; len++)
+            if (searchLength[len] && head.cost <= limit.load())
+                extend(len, head.cost);
+    });
+
+    for (const SearchCounts& n : counts) {
+        stats.candidates += n.candidates;
+        stats.proofs += n.proofs;
+    }
+    if (found.picks.empty())
+        return false;
+    for (uint32_t p : found.picks)
+        best.push_back(choices[p].instr);
+    return true;
+}
+
+/* =========================================
+   Canonical windows
+========================================= */
+struct Renaming {
+    int8_t to[8];       // window register -> canonical, -1 if unused
+    int8_t from[8];     // canonical -> window register
+};
+
+// AX keeps its short forms; registers used as bytes need one of CX, DX, BX
+static Renaming canonicalRegisters(const vector<TypedInstruction>& window) {
+    vector<int> order;
+    bool used[8] = {}, asByte[8] = {};
+    for (const TypedInstruction& in : window) {
+        for (const TypedOperand* o : {&in.dst, &in.src}) {
+            if (o->type != REG)
+                continue;
+            int w = wordOf(*o);
+            if (!used[w]) {
+                used[w] = true;
+                order.push_back(w);
+            }
+            if (isReg8(*o))
+                asByte[w] = true;
+        }
+    }
+
+    Renaming r;
+    fill(r.to, r.to + 8, -1);
+    fill(r.from, r.from + 8, -1);
+    bool taken[8] = {};
+    auto assign = [&](int w, int c) {
+        r.to[w] = (int8_t)c;
+        r.from[c] = (int8_t)w;
+        taken[c] = true;
+    };
+    if (used[REG_AX])
+        assign(REG_AX, REG_AX);
+
+    static const int byteRegisters[] = {REG_CX, REG_DX, REG_BX};
+    static const int otherRegisters[] = {REG_CX, REG_DX, REG_BX, REG_BP, REG_SI, REG_DI};
+    for (int w : order) {
+        if (w == REG_AX || !asByte[w])
+            continue;
+        for (int c : byteRegisters) {
+            if (!taken[c]) {
+                assign(w, c);
+                break;
+            }
+        }
+    }
+    for (int w : order) {
+        if (w == REG_AX || asByte[w])
+            continue;
+        for (int c : otherRegisters) {
+            if (!taken[c]) {
+                assign(w, c);
+                break;
+            }
+        }
+    }
+    return r;
+}
+
+static TypedOperand renameOperand(const TypedOperand& o, const int8_t* map) {
+    TypedOperand r = o;
+    if (isReg16(o)) {
+        r.value = map[o.value];
+    } else if (isReg8(o)) {
+        int k = o.value - REG_AL;
+        r.value = REG_AL + map[k & 3] + (k & 4);
+    }
+    return r;
+}
+
+static vector<TypedInstruction> renameAll(const vector<TypedInstruction>& seq, const int8_t* map) {
+    vector<TypedInstruction> out;
+    for (const TypedInstruction& in : seq)
+        out.push_back({in.opcode, renameOperand(in.dst, map), renameOperand(in.src, map)});
+    return out;
+}
+
+static LiveSet renameLive(LiveSet live, const int8_t* map) {
+    LiveSet r = {0, live.flags};
+    for (int w = 0; w < 8; w++)
+        if (map[w] >= 0 && (live.regs & (1 << w)))
+            r.regs |= (uint8_t)(1 << map[w]);
+    return r;
+}
+
+/* =========================================
+   Cache
+   key:   goal/live regs/live flags/window
+   entry: key, a tab, the best sequence
+   Instructions are opcode,type,value,type,value
+   joined by semicolons.
+========================================= */
+static string formatSequence(const vector<TypedInstruction>& seq) {
+    string s;
+    for (const TypedInstruction& in : seq) {
+        if (!s.empty())
+            s += ';';
+        s += to_string(in.opcode) + ',' + to_string(in.dst.type) + ',' + to_string(in.dst.value) + ',' +
+             to_string(in.src.type) + ',' + to_string(in.src.value);
+    }
+    return s;
+}
+
+static bool parseSequence(const string& text, vector<TypedInstruction>& seq) {
+    seq.clear();
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ';')) {
+        int op, dt, dv, st, sv;
+        char c1, c2, c3, c4;
+        stringstream fields(item);
+        if (!(fields >> op >> c1 >> dt >> c2 >> dv >> c3 >> st >> c4 >> sv))
+            return false;
+        if (op < 0 || op >= OP_COUNT || dt < REG || dt > NONE || st < REG || st > NONE)
+            return false;
+        TypedInstruction instr = {(Opcode)op, TypedOperand(), TypedOperand()};
+        instr.dst.type = (OperandType)dt;
+        instr.dst.value = dv;
+        instr.src.type = (OperandType)st;
+        instr.src.value = sv;
+        if (!superoptEligible(instr))
+            return false;
+        seq.push_back(instr);
+    }
+    return true;
+}
+
+static string windowKey(const vector<TypedInstruction>& canonical, LiveSet live, SuperoptGoal goal) {
+    return to_string(goal) + '/' + to_string(live.regs) + '/' + to_string(live.flags) + '/' +
+           formatSequence(canonical);
+}
+
+bool SuperoptCache::lookup(const string& key, vector<TypedInstruction>& best) const {
+    lock_guard<mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return false;
+    best = it->second;
+    return true;
+}
+
+void SuperoptCache::store(const string& key, const vector<TypedInstruction>& best) {
+    lock_guard<mutex> guard(lock);
+    entries[key] = best;
+}
+
+size_t SuperoptCache::size() const {
+    lock_guard<mutex> guard(lock);
+    return entries.size();
+}
+
+bool SuperoptCache::load(const string& path) {
+    ifstream in(path);
+    if (!in)
+        return true;
+    string line;
+    vector<TypedInstruction> seq;
+    lock_guard<mutex> guard(lock);
+    while (getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab != string::npos && parseSequence(line.substr(tab + 1), seq))
+            entries[line.substr(0, tab)] = seq;
+    }
+    return !in.bad();
+}
+
+bool SuperoptCache::save(const string& path) const {
+    vector<string> lines;
+    {
+        lock_guard<mutex> guard(lock);
+        for (const auto& e : entries)
+            lines.push_back(e.first + '\t' + formatSequence(e.second));
+    }
+    // Sorted, so a cache kept under version control diffs cleanly
+    sort(lines.begin(), lines.end());
+
+    ofstream out(path, ios::trunc);
+    for (const string& line : lines)
+        out << line << '\n';
+    return (bool)out.flush();
+}
+
+/* =========================================
+   Whole program
+========================================= */
+// The window's cheapest equivalent, from the cache when it has been seen
+static vector<TypedInstruction> bestFor(const vector<TypedInstruction>& window, LiveSet live, SuperoptGoal goal,
+                                        SuperoptCache& cache, SuperoptStats& stats, unsigned threads) {
+    Renaming names = canonicalRegisters(window);
+    vector<TypedInstruction> canonical = renameAll(window, names.to);
+    LiveSet canonicalLive = renameLive(live, names.to);
+    string key = windowKey(canonical, canonicalLive, goal);
+
+    stats.windows++;
+    vector<TypedInstruction> best;
+    if (cache.lookup(key, best)) {
+        stats.cacheHits++;
+    } else {
+        if (!superoptimizeWindow(canonical, canonicalLive, goal, best, stats, threads))
+            best = canonical;
+        cache.store(key, best);
+    }
+    return renameAll(best, names.from);
+}
+
+SuperoptStats superoptimize(vector<TypedInstruction>& instructions, SuperoptGoal goal,
+                            SuperoptCache* cache, unsigned threads) {
+    SuperoptStats stats;
+    vector<LiveSet> live;
+    if (goal == SUPEROPT_OFF || !liveAfter(instructions, live))
+        return stats;
+
+    SuperoptCache local;
+    if (!cache)
+        cache = &local;
+
+    size_t n = instructions.size();
+    vector<bool> isTarget(n + 1, false);
+    for (const TypedInstruction& instr : instructions)
+        if (instr.dst.type == LABEL)
+            isTarget[instr.dst.value] = true;
+
+    vector<uint8_t> memory(65536);
+    vector<TypedInstruction> out;
+    vector<int> newIndex(n + 1);
+    out.reserve(n);
+
+    size_t i = 0;
+    while (i < n) {
+        // Longest window first; only its first instruction may be a branch target
+        size_t end = i;
+        while (end < n && end - i < (size_t)SUPEROPT_WINDOW && superoptEligible(instructions[end]) &&
+               (end == i || !isTarget[end]))
+            end++;
+
+        size_t taken = 0;
+        for (size_t len = end - i; len > 0 && !taken; len--) {
+            vector<TypedInstruction> window(instructions.begin() + i, instructions.begin() + i + len);
+            vector<TypedInstruction> best = bestFor(window, live[i + len - 1], goal, *cache, stats, threads);
+            if (sameSequence(best, window))
+                continue;
+
+            int fromBytes, fromCycles, toBytes, toCycles;
+            measure(window, memory, fromBytes, fromCycles);
+            measure(best, memory, toBytes, toCycles);
+            stats.bytesSaved += fromBytes - toBytes;
+            stats.cyclesSaved += fromCycles - toCycles;
+            stats.replacements.push_back({i, window, best});
+
+            for (size_t k = i; k < i + len; k++)
+                newIndex[k] = (int)out.size();
+            // The whole replacement lists under the window's first line
+            for (TypedInstruction instr : best) {
+                instr.source = instructions[i].source;
+                out.push_back(instr);
+            }
+            taken = len;
+        }
+        if (!taken) {
+            newIndex[i] = (int)out.size();
+            out.push_back(instructions[i]);
+            taken = 1;
+        }
+        i += taken;
+    }
+    newIndex[n] = (int)out.size();
+
+    for (TypedInstruction& instr : out)
+        if (instr.dst.type == LABEL)
+            instr.dst.value = newIndex[instr.dst.value];
+    instructions.swap(out);
+    return stats;
+}
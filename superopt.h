@@ -0,0 +1,106 @@
+#ifndef SUPEROPT_H
+#define SUPEROPT_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "backend.h"
+
+using namespace std;
+
+/* ================= Superoptimizer ================= */
+/*
+   Brute-force search for the cheapest sequence equivalent to a short
+   straight-line window of register code (--superopt).
+
+   A window is up to SUPEROPT_WINDOW consecutive instructions inside one
+   basic block, each a MOV, XCHG, ALU operation, INC/DEC/NEG/NOT, shift
+   or rotate by 1, or CLC/STC/CMC on registers and immediates (SP
+   excluded). Candidates are every sequence of up to SUPEROPT_LENGTH
+   such instructions over the window's registers, its immediates, 0, 1,
+   all ones and any constant the window leaves in a live register,
+   cheapest first.
+
+   Equivalence only covers what is live after the window (liveAfter,
+   backend.h): those registers and flags must match, anything else may
+   differ. A candidate is run on the emulator from SUPEROPT_TESTS
+   register states, each compared with the window's own result, and one
+   that passes them all is then proven equal for every input by building
+   both as binary decision diagrams over the input bits (bdd.h).
+
+   Each search spreads the candidates across the work pool by their
+   first instruction. The cheapest proven candidate wins, ties going to
+   the earliest in enumeration order, so the result does not depend on
+   the thread count.
+*/
+enum SuperoptGoal : uint8_t {
+    SUPEROPT_OFF,
+    SUPEROPT_SIZE,      // fewest bytes, then fewest cycles
+    SUPEROPT_CYCLES     // fewest cycles, then fewest bytes
+};
+
+constexpr int SUPEROPT_WINDOW = 4;
+constexpr int SUPEROPT_LENGTH = 3;
+constexpr int SUPEROPT_TESTS = 32;
+
+// A longer length is skipped when it alone would enumerate more candidates than this
+constexpr uint64_t SUPEROPT_BUDGET = 4000000;
+
+struct SuperoptReplacement {
+    size_t index;                       // first instruction of the window, before any replacement
+    vector<TypedInstruction> from, to;
+};
+
+struct SuperoptStats {
+    int windows = 0;                    // looked up, whether searched or cached
+    int cacheHits = 0;
+    uint64_t candidates = 0;            // run on the emulator
+    uint64_t proofs = 0;                // passed every test, checked symbolically
+    int bytesSaved = 0;
+    int cyclesSaved = 0;                // one pass through the code
+    vector<SuperoptReplacement> replacements;
+};
+
+/*
+   Search results by canonical window: registers renamed in order of
+   first use (AX kept, for its short forms), with the live registers,
+   live flags and goal. An entry holds the best sequence found, or the
+   window itself when nothing is cheaper. Safe to share between threads.
+*/
+class SuperoptCache {
+private:
+    mutable mutex lock;
+    unordered_map<string, vector<TypedInstruction>> entries;
+
+public:
+    bool lookup(const string& key, vector<TypedInstruction>& best) const;
+    void store(const string& key, const vector<TypedInstruction>& best);
+    size_t size() const;
+
+    // One entry per line; a missing file loads as empty
+    bool load(const string& path);
+    bool save(const string& path) const;
+};
+
+// Whether instr may appear in a window
+bool superoptEligible(const TypedInstruction& instr);
+
+/*
+   Cheapest equivalent of window given what is live after it. Returns
+   false, leaving best empty, when nothing cheaper exists.
+   threads = 0: one per hardware thread.
+*/
+bool superoptimizeWindow(const vector<TypedInstruction>& window, LiveSet liveOut, SuperoptGoal goal,
+                         vector<TypedInstruction>& best, SuperoptStats& stats, unsigned threads = 0);
+
+/*
+   Replace windows throughout a validated program, longest window first
+   at each position, and remap label targets. Without a cache, results
+   are still shared within this program.
+*/
+SuperoptStats superoptimize(vector<TypedInstruction>& instructions, SuperoptGoal goal,
+                            SuperoptCache* cache = nullptr, unsigned threads = 0);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+   Heap allocations of the parse stage must not grow with the program.
+   The parser appends its IR to vectors that double, so calls to
+   operator new should grow with the log of the instruction count. The
+   test assembles two generated programs, one 16 times the size of the
+   other, under a StageRecorder. It fails if parsing the large one took
+   more than a few allocations per doubling over the small one.
+
+   build: g++ -std=c++17 -O2 -pthread -I. tests/alloc_test.cpp lexer.cpp parser.cpp semantic.cpp interner.cpp arena.cpp operand_typer.cpp instruction_validator.cpp peephole.cpp dataflow.cpp superopt.cpp bdd.cpp workpool.cpp codegen.cpp compilation.cpp cache.cpp hash.cpp source_map.cpp stats.cpp emulator.cpp decoder.cpp jit.cpp timing.cpp profile.cpp trace.cpp disasm.cpp -o alloc_test
+   usage: alloc_test
+*/
+#include "compilation.h"
+#include "stats.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+static const int SMALL = 2000;
+static const int LARGE = 32000;
+static const int DOUBLINGS = 4;             // log2(LARGE / SMALL)
+static const uint64_t PER_DOUBLING = 10;    // currently 5 or 6
+
+// Data, labels, branches and plain instructions, count instructions in all
+static string generate(int count)
+{
+    string source = ".DATA\n";
+    for (int i = 0; i < count / 50 + 1; i++)
+        source += "V" + to_string(i) + " DW " + to_string(i) + "\n";
+    source += ".CODE\n";
+    for (int i = 0; i < count - 1; i++)
+    {
+        if (i % 10 == 0)
+            source += "L" + to_string(i) + ":\n";
+        switch (i % 5)
+        {
+        case 0: source += "MOV AX, V" + to_string(i / 50) + "\n"; break;
+        case 1: source += "ADD AX, 3\n"; break;
+        case 2: source += "JNE L" + to_string(i / 10 * 10) + "\n"; break;
+        case 3: source += "MOV CX, BX\n"; break;
+        default: source += "INC DX\n"; break;
+        }
+    }
+    source += "HLT\n";
+    return source;
+}
+
+// Allocations of the parse stage assembling count instructions
+static uint64_t parseAllocations(int count)
+{
+    string source = generate(count);
+    Compilation unit;
+    StageRecorder recorder;
+    CompileOptions options;
+    options.stats = &recorder;
+    assemble(unit, &source[0], &source[0] + source.size(), options);
+
+    for (const StageStats &stage : recorder.stages)
+    {
+        if (strcmp(stage.name, "parse") == 0)
+        {
+            if (stage.items != (uint64_t)count)
+                throw runtime_error("parse stage counted " + to_string(stage.items) + " instructions");
+            return stage.allocations;
+        }
+    }
+    throw runtime_error("no parse stage recorded");
+}
+
+int main()
+{
+    if (!STAGE_STATS_ENABLED)
+    {
+        printf("skipped: built with NO_STAGE_STATS\n");
+        return 0;
+    }
+
+    try
+    {
+        uint64_t small = parseAllocations(SMALL);
+        uint64_t large = parseAllocations(LARGE);
+        printf("parse allocations: %llu for %d instructions, %llu for %d\n",
+               (unsigned long long)small, SMALL, (unsigned long long)large, LARGE);
+        if (large > small + PER_DOUBLING * DOUBLINGS)
+        {
+            printf("FAIL: more than %llu allocations per doubling\n", (unsigned long long)PER_DOUBLING);
+            return 1;
+        }
+    }
+    catch (const exception &e)
+    {
+        printf("FAIL: %s\n", e.what());
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include "timing.h"
+
+using namespace std;
+
+/*
+   [disp]            6
+   [base] or [index] 5     + displacement: 9
+   [BP+DI], [BX+SI]  7     + displacement: 11
+   [BP+SI], [BX+DI]  8     + displacement: 12
+   The decoder keeps only the displacement value, so a zero
+   displacement counts as none except for [BP], which always has one.
+*/
+int eaCycles(const DecodedOperand& o) {
+    if (o.type != MEM)
+        return 0;
+    if (o.ea == EA_DIRECT)
+        return 6;
+
+    bool disp = o.value != 0 || o.ea == EA_BP;
+    switch (o.ea) {
+    case EA_BP_DI:
+    case EA_BX_SI: return disp ? 11 : 7;
+    case EA_BP_SI:
+    case EA_BX_DI: return disp ? 12 : 8;
+    default:       return disp ? 9 : 5;
+    }
+}
+
+static bool isAccumulator(OperandForm f) {
+    return f == F_AL || f == F_AX;
+}
+
+// A REP string instruction: 9 clocks, plus takenCycles per repetition
+static void stringTiming(InsnTiming& t, const DecodedInsn& d, int once, int repeated) {
+    t.cycles = d.repeat ? 9 : once;
+    t.takenCycles = d.repeat ? repeated : 0;
+}
+
+InsnTiming instructionTiming(const DecodedInsn& d) {
+    bool memDst = d.dst.type == MEM, memSrc = d.src.type == MEM;
+    bool mem = memDst || memSrc;
+    bool imm = d.src.type == IMM;
+    bool word = d.width == 2;
+    int ea = eaCycles(memDst ? d.dst : d.src);
+
+    // Word memory operands; read-modify-write forms transfer twice
+    auto transfers = [&](int n) { return (uint8_t)(mem && word ? n : 0); };
+
+    InsnTiming t = {0, 0, 0};
+    switch (d.opcode) {
+    case OP_MOV:
+        if (d.dst.type == REG && d.src.type == REG)
+            t.cycles = 2;
+        else if (memDst)
+            t.cycles = (imm ? 10 : 9) + ea;
+        else if (memSrc)
+            t.cycles = 8 + ea;
+        else
+            t.cycles = 4;
+        t.wordTransfers = transfers(1);
+        break;
+
+    case OP_ADD:
+    case OP_ADC:
+    case OP_SUB:
+    case OP_SBB:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+        if (memDst)
+            t.cycles = (imm ? 17 : 16) + ea;
+        else if (memSrc)
+            t.cycles = 9 + ea;
+        else
+            t.cycles = imm ? 4 : 3;
+        t.wordTransfers = transfers(memDst ? 2 : 1);
+        break;
+
+    case OP_CMP:
+        if (memDst)
+            t.cycles = (imm ? 10 : 9) + ea;
+        else if (memSrc)
+            t.cycles = 9 + ea;
+        else
+            t.cycles = imm ? 4 : 3;
+        t.wordTransfers = transfers(1);
+        break;
+
+    case OP_TEST:
+        if (mem)
+            t.cycles = (imm ? 11 : 9) + ea;
+        else if (imm)
+            t.cycles = isAccumulator(d.form->dst) ? 4 : 5;
+        else
+            t.cycles = 3;
+        t.wordTransfers = transfers(1);
+        break;
+
+    case OP_XCHG:
+        if (mem)
+            t.cycles = 17 + ea;
+        else
+            t.cycles = isAccumulator(d.form->dst) || isAccumulator(d.form->src) ? 3 : 4;
+        t.wordTransfers = transfers(2);
+        break;
+
+    case OP_LEA:
+        t.cycles = 2 + ea;
+        break;
+    case OP_LDS:
+    case OP_LES:
+        t.cycles = 16 + ea;
+        t.wordTransfers = 2;
+        break;
+
+    case OP_INC:
+    case OP_DEC:
+        if (mem)
+            t.cycles = 15 + ea;
+        else
+            t.cycles = d.form->enc == E_OPREG ? 2 : 3;
+        t.wordTransfers = transfers(2);
+        break;
+
+    case OP_NOT:
+    case OP_NEG:
+        t.cycles = mem ? 16 + ea : 3;
+        t.wordTransfers = transfers(2);
+        break;
+
+    case OP_MUL:
+        t.cycles = word ? (mem ? 132 + ea : 126) : (mem ? 80 + ea : 74);
+        t.wordTransfers = transfers(1);
+        break;
+    case OP_IMUL:
+        t.cycles = word ? (mem ? 147 + ea : 141) : (mem ? 95 + ea : 89);
+        t.wordTransfers = transfers(1);
+        break;
+    case OP_DIV:
+        t.cycles = word ? (mem ? 159 + ea : 153) : (mem ? 91 + ea : 85);
+        t.wordTransfers = transfers(1);
+        break;
+    case OP_IDIV:
+        t.cycles = word ? (mem ? 181 + ea : 175) : (mem ? 113 + ea : 107);
+        t.wordTransfers = transfers(1);
+        break;
+
+    // By 1: the listed time. By CL: the base time plus 4 per bit, added at run time.
+    case OP_ROL:
+    case OP_ROR:
+    case OP_RCL:
+    case OP_RCR:
+    case OP_SHL:
+    case OP_SAL:
+    case OP_SHR:
+    case OP_SAR:
+        if (d.form->src == F_CL)
+            t.cycles = mem ? 20 + ea : 8;
+        else
+            t.cycles = mem ? 15 + ea : 2;
+        t.wordTransfers = transfers(2);
+        break;
+
+    case OP_PUSH:
+        t.cycles = mem ? 16 + ea : d.dst.type == REG && d.dst.value >= REG_ES ? 10 : 11;
+        t.wordTransfers = transfers(1);
+        break;
+    case OP_POP:
+        t.cycles = mem ? 17 + ea : 8;
+        t.wordTransfers = transfers(1);
+        break;
+    case OP_PUSHF: t.cycles = 10; break;
+    case OP_POPF:  t.cycles = 8; break;
+    case OP_LAHF:
+    case OP_SAHF:  t.cycles = 4; break;
+
+    case OP_JMP:
+        t.cycles = mem ? 18 + ea : d.dst.type == REG ? 11 : 15;
+        t.wordTransfers = transfers(1);
+        break;
+    case OP_CALL:
+        t.cycles = mem ? 21 + ea : d.dst.type == REG ? 16 : 19;
+        t.wordTransfers = transfers(1);
+        break;
+    case OP_RET:
+        t.cycles = d.dst.type == IMM ? 12 : 8;
+        break;
+
+    case OP_JO:  case OP_JNO: case OP_JB:  case OP_JC:  case OP_JAE: case OP_JNC:
+    case OP_JE:  case OP_JZ:  case OP_JNE: case OP_JNZ: case OP_JBE: case OP_JA:
+    case OP_JS:  case OP_JNS: case OP_JL:  case OP_JGE: case OP_JLE: case OP_JG:
+        t.cycles = 4;
+        t.takenCycles = 12;
+        break;
+    case OP_LOOP:   t.cycles = 5; t.takenCycles = 12; break;
+    case OP_LOOPE:  t.cycles = 6; t.takenCycles = 12; break;
+    case OP_LOOPNE: t.cycles = 5; t.takenCycles = 14; break;
+    case OP_JCXZ:   t.cycles = 6; t.takenCycles = 12; break;
+
+    case OP_IN:
+    case OP_OUT:
+        t.cycles = d.form->enc == E_FIXED ? 8 : 10;
+        break;
+
+    case OP_DAA:
+    case OP_DAS:
+    case OP_AAA:
+    case OP_AAS:  t.cycles = 4; break;
+    case OP_AAM:  t.cycles = 83; break;
+    case OP_AAD:  t.cycles = 60; break;
+    case OP_XLAT: t.cycles = 11; break;
+
+    case OP_MOVSB:
+    case OP_MOVSW: stringTiming(t, d, 18, 17); break;
+    case OP_CMPSB:
+    case OP_CMPSW: stringTiming(t, d, 22, 22); break;
+    case OP_STOSB:
+    case OP_STOSW: stringTiming(t, d, 11, 10); break;
+    case OP_LODSB:
+    case OP_LODSW: stringTiming(t, d, 12, 13); break;
+    case OP_SCASB:
+    case OP_SCASW: stringTiming(t, d, 15, 15); break;
+
+    case OP_NOP:
+    case OP_WAIT: t.cycles = 3; break;
+    default:      t.cycles = 2; break;      // HLT, LOCK, lone REP prefixes and the flag instructions
+    }
+    return t;
+}
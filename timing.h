@@ -0,0 +1,32 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cstdint>
+#include "decoder.h"
+
+using namespace std;
+
+/* ================= 8086 Instruction Timing ================= */
+/*
+   Clock counts from the 8086 data sheet. cycles includes the
+   effective-address calculation of a memory operand; the emulator adds
+   the parts that depend on run-time values:
+     - takenCycles when a conditional branch or loop is taken, or
+       for each repetition of a REP string instruction,
+     - 4 per bit for shifts and rotates by CL,
+     - 4 per word transfer (wordTransfers) at an odd address.
+   MUL, IMUL, DIV and IDIV take a data-dependent time on the 8086; they
+   are charged the midpoint of the documented range.
+*/
+struct InsnTiming {
+    uint16_t cycles;
+    uint8_t takenCycles;
+    uint8_t wordTransfers;      // memory word reads + writes through the r/m operand
+};
+
+// Clocks to form the address of a memory operand (0 for anything else)
+int eaCycles(const DecodedOperand& o);
+
+InsnTiming instructionTiming(const DecodedInsn& d);
+
+#endif
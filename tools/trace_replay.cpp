@@ -0,0 +1,86 @@
+/*
+   Replays a trace written by `compiler --trace=FILE`: prints the CPU
+   state after step N (through the keyframe index, so any N is cheap)
+   and then the next `count` steps one per line.
+
+   build: g++ -std=c++17 -O2 -I. tools/trace_replay.cpp trace.cpp decoder.cpp disasm.cpp -pthread -o trace_replay
+   usage: trace_replay file.t86 [step [count]]
+*/
+#include "trace.h"
+#include "disasm.h"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+static void printState(const CPU& cpu)
+{
+    printf("AX=%04X BX=%04X CX=%04X DX=%04X SP=%04X BP=%04X SI=%04X DI=%04X IP=%04X FLAGS=%04X\n",
+           cpu.regs[REG_AX], cpu.regs[REG_BX], cpu.regs[REG_CX], cpu.regs[REG_DX],
+           cpu.regs[REG_SP], cpu.regs[REG_BP], cpu.regs[REG_SI], cpu.regs[REG_DI],
+           cpu.IP, cpu.flags);
+}
+
+/* One line per step: number, address, bytes, instruction, stores, registers after */
+static void printStep(const TraceReader& trace, vector<DisasmInsn>& scratch)
+{
+    printf("%10llu  %04X  ", (unsigned long long)trace.step(), trace.ip());
+    for (int i = 0; i < TRACE_MAX_INSN; i++)
+    {
+        if (i < trace.length())
+            printf("%02X ", trace.bytes()[i]);
+        else
+            printf("   ");
+    }
+
+    scratch.clear();
+    disassemble(trace.bytes(), trace.length(), trace.ip(), scratch);
+    printf("%-24s", scratch.size() == 1 ? formatInstruction(scratch[0]).c_str() : "??");
+
+    for (const TraceWrite& w : trace.writes())
+    {
+        if (w.length == 2)
+            printf(" [%04X]=%04X", w.addr, w.bytes[0] | w.bytes[1] << 8);
+        else
+            printf(" [%04X]=%02X", w.addr, w.bytes[0]);
+    }
+    printf("  ");
+    printState(trace.cpu());
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: trace_replay file.t86 [step [count]]\n");
+        return 1;
+    }
+
+    try
+    {
+        // Holds per-address tables, too large for the stack
+        unique_ptr<TraceReader> trace(new TraceReader(argv[1]));
+        vector<DisasmInsn> scratch;
+
+        printf("%llu steps\n", (unsigned long long)trace->steps());
+        uint64_t at = argc > 2 ? strtoull(argv[2], nullptr, 10) : trace->steps();
+        uint64_t count = argc > 3 ? strtoull(argv[3], nullptr, 10) : 0;
+        if (at > trace->steps())
+            at = trace->steps();
+
+        trace->seek(at);
+        printf("after step %llu: ", (unsigned long long)at);
+        printState(trace->cpu());
+
+        for (uint64_t i = 0; i < count && trace->next(); i++)
+            printStep(*trace, scratch);
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
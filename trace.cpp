@@ -0,0 +1,379 @@
+#include "trace.h"
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+enum TraceTag : uint8_t {
+    TAG_KEYFRAME = 0x00,
+    TAG_END = 0x07,
+    TAG_LENGTH = 0x07,
+    TAG_JUMP = 0x08,
+    TAG_BYTES = 0x10,
+    TAG_REGS = 0x20,
+    TAG_WRITES = 0x40
+};
+
+static const char TRACE_MAGIC[4] = {'T', '8', '6', 'T'};
+static const char TRACE_END_MAGIC[4] = {'T', '8', '6', 'E'};
+constexpr uint8_t TRACE_VERSION = 1;
+constexpr int TRACE_REGS = 13;      // AX..DI, ES..DS, FLAGS
+constexpr int FOOTER_SIZE = 8 + 8 + 4;
+
+static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+static uint16_t traceReg(const CPU& cpu, int r) {
+    return r < 8 ? cpu.regs[r] : r < 12 ? cpu.sregs[r - 8] : cpu.flags;
+}
+
+static void setTraceReg(CPU& cpu, int r, uint16_t v) {
+    if (r < 8)
+        cpu.regs[r] = v;
+    else if (r < 12)
+        cpu.sregs[r - 8] = v;
+    else
+        cpu.flags = v;
+}
+
+/* ================================
+   WRITER
+================================ */
+TraceWriter::TraceWriter(const string& path)
+    : path(path), filling(0), pending(false), done(false), failed(false),
+      lastIP(0), lastWrite(0), steps(0), offset(0), writeCount(0) {
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+        throw runtime_error("Cannot open trace file " + path);
+    memset(last, 0, sizeof(last));
+    memset(knownLength, 0, sizeof(knownLength));
+    blocks[0].reserve(TRACE_BLOCK_SIZE + 64);
+    blocks[1].reserve(TRACE_BLOCK_SIZE + 64);
+
+    for (char c : TRACE_MAGIC)
+        put((uint8_t)c);
+    put(TRACE_VERSION);
+
+    writer = thread(&TraceWriter::writerLoop, this);
+}
+
+TraceWriter::~TraceWriter() {
+    try {
+        finish();
+    } catch (...) {
+    }
+}
+
+void TraceWriter::writerLoop() {
+    unique_lock<mutex> g(lock);
+    for (;;) {
+        ready.wait(g, [this] { return pending || done; });
+        if (!pending)
+            return;
+
+        // The filling side never touches the pending block, so write it unlocked
+        vector<uint8_t>& block = blocks[filling ^ 1];
+        g.unlock();
+        bool ok = fwrite(block.data(), 1, block.size(), file) == block.size();
+        block.clear();
+        g.lock();
+
+        failed = failed || !ok;
+        pending = false;
+        ready.notify_all();
+    }
+}
+
+// Hand the full block to the writer thread; waits only if it is still busy with the last one
+void TraceWriter::flushBlock() {
+    unique_lock<mutex> g(lock);
+    ready.wait(g, [this] { return !pending; });
+    if (failed)
+        throw runtime_error("Error writing trace file " + path);
+    filling ^= 1;
+    pending = true;
+    ready.notify_all();
+}
+
+inline void TraceWriter::put(uint8_t b) {
+    blocks[filling].push_back(b);
+    offset++;
+}
+
+void TraceWriter::putVarint(uint64_t v) {
+    while (v >= 0x80) {
+        put((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    put((uint8_t)v);
+}
+
+void TraceWriter::keyframe(const CPU& cpu) {
+    keyframes.push_back({steps, offset});
+    put(TAG_KEYFRAME);
+    putVarint(steps);
+    for (int r = 0; r < TRACE_REGS; r++) {
+        last[r] = traceReg(cpu, r);
+        put((uint8_t)last[r]);
+        put((uint8_t)(last[r] >> 8));
+    }
+    lastIP = cpu.IP;
+    put((uint8_t)lastIP);
+    put((uint8_t)(lastIP >> 8));
+    lastWrite = 0;
+    memset(knownLength, 0, sizeof(knownLength));
+}
+
+void TraceWriter::write(uint16_t addr, const uint8_t* data, int n) {
+    uint64_t v = zigzag((int16_t)(addr - lastWrite)) << 1 | (n == 2);
+    while (v >= 0x80) {
+        writes.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    writes.push_back((uint8_t)v);
+    writes.insert(writes.end(), data, data + n);
+    lastWrite = addr;
+    writeCount++;
+}
+
+void TraceWriter::step(uint16_t ip, const uint8_t* bytes, int length, const CPU& cpu) {
+    uint8_t tag = (uint8_t)length;
+    uint16_t sequential = ip + length;
+    if (cpu.IP != sequential)
+        tag |= TAG_JUMP;
+    if (knownLength[ip] != length || memcmp(known[ip], bytes, length) != 0) {
+        tag |= TAG_BYTES;
+        memcpy(known[ip], bytes, length);
+        knownLength[ip] = (uint8_t)length;
+    }
+    uint32_t mask = 0;
+    for (int r = 0; r < TRACE_REGS; r++)
+        if (traceReg(cpu, r) != last[r])
+            mask |= 1u << r;
+    if (mask)
+        tag |= TAG_REGS;
+    if (writeCount)
+        tag |= TAG_WRITES;
+
+    put(tag);
+    if (tag & TAG_JUMP)
+        putVarint(zigzag((int16_t)(cpu.IP - sequential)));
+    if (tag & TAG_BYTES)
+        for (int i = 0; i < length; i++)
+            put(bytes[i]);
+    if (mask) {
+        putVarint(mask);
+        for (int r = 0; r < TRACE_REGS; r++) {
+            if (mask & (1u << r)) {
+                uint16_t v = traceReg(cpu, r);
+                putVarint(zigzag((int16_t)(v - last[r])));
+                last[r] = v;
+            }
+        }
+    }
+    if (writeCount) {
+        putVarint(writeCount);
+        for (uint8_t b : writes)
+            put(b);
+        writes.clear();
+        writeCount = 0;
+    }
+    lastIP = cpu.IP;
+    steps++;
+
+    if (steps % TRACE_KEYFRAME_INTERVAL == 0)
+        keyframe(cpu);
+    if (blocks[filling].size() >= TRACE_BLOCK_SIZE)
+        flushBlock();
+}
+
+void TraceWriter::finish() {
+    if (!file)
+        return;
+
+    put(TAG_END);
+    uint64_t indexOffset = offset;
+    putVarint(keyframes.size());
+    for (auto& k : keyframes) {
+        putVarint(k.first);
+        putVarint(k.second);
+    }
+    for (int i = 0; i < 8; i++)
+        put((uint8_t)(indexOffset >> (8 * i)));
+    for (int i = 0; i < 8; i++)
+        put((uint8_t)(steps >> (8 * i)));
+    for (char c : TRACE_END_MAGIC)
+        put((uint8_t)c);
+
+    // Hand over the last block and stop the thread, even after a write error
+    {
+        unique_lock<mutex> g(lock);
+        ready.wait(g, [this] { return !pending; });
+        filling ^= 1;
+        pending = true;
+        done = true;
+        ready.notify_all();
+    }
+    writer.join();
+
+    bool ok = !failed && fclose(file) == 0;
+    file = nullptr;
+    if (!ok)
+        throw runtime_error("Error writing trace file " + path);
+}
+
+/* ================================
+   READER
+================================ */
+TraceReader::TraceReader(const string& path)
+    : in(path, ios::binary), buffer(TRACE_BLOCK_SIZE), pos(0), end(0), total(0),
+      current(0), stepIP(0), stepLength(0), lastWrite(0) {
+    if (!in)
+        throw runtime_error("Cannot open trace file " + path);
+
+    char magic[5];
+    in.read(magic, 5);
+    if (!in || memcmp(magic, TRACE_MAGIC, 4) != 0 || (uint8_t)magic[4] != TRACE_VERSION)
+        throw runtime_error(path + " is not a trace file");
+
+    // Footer: index offset, step count, end magic
+    uint8_t footer[FOOTER_SIZE];
+    in.seekg(-FOOTER_SIZE, ios::end);
+    in.read((char*)footer, FOOTER_SIZE);
+    if (!in || memcmp(footer + 16, TRACE_END_MAGIC, 4) != 0)
+        throw runtime_error(path + " is truncated (no trace footer)");
+    uint64_t indexOffset = 0;
+    for (int i = 7; i >= 0; i--) {
+        indexOffset = indexOffset << 8 | footer[i];
+        total = total << 8 | footer[8 + i];
+    }
+
+    seekOffset(indexOffset);
+    uint64_t count = getVarint();
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t step = getVarint();
+        keyframes.push_back({step, getVarint()});
+    }
+    if (keyframes.empty())
+        throw runtime_error(path + " has no keyframes");
+
+    memset(stepBytes, 0, sizeof(stepBytes));
+    seek(0);
+}
+
+void TraceReader::seekOffset(uint64_t offset) {
+    in.clear();
+    in.seekg((streamoff)offset);
+    pos = end = 0;
+}
+
+bool TraceReader::fill() {
+    in.read((char*)buffer.data(), buffer.size());
+    pos = 0;
+    end = (size_t)in.gcount();
+    return end > 0;
+}
+
+uint8_t TraceReader::get() {
+    if (pos == end && !fill())
+        throw runtime_error("Trace ends in the middle of a record");
+    return buffer[pos++];
+}
+
+uint64_t TraceReader::getVarint() {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t b = get();
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+}
+
+void TraceReader::readKeyframe() {
+    current = getVarint();
+    for (int r = 0; r < TRACE_REGS; r++) {
+        uint16_t lo = get();
+        setTraceReg(state, r, (uint16_t)(lo | get() << 8));
+    }
+    uint16_t lo = get();
+    state.IP = (uint16_t)(lo | get() << 8);
+    lastWrite = 0;
+    memset(knownLength, 0, sizeof(knownLength));
+}
+
+void TraceReader::seek(uint64_t step) {
+    if (step > total)
+        throw runtime_error("Trace has only " + to_string(total) + " steps");
+
+    // Last keyframe at or before step
+    size_t k = 0;
+    while (k + 1 < keyframes.size() && keyframes[k + 1].first <= step)
+        k++;
+    seekOffset(keyframes[k].second);
+    if (get() != TAG_KEYFRAME)
+        throw runtime_error("Trace index does not point at a keyframe");
+    readKeyframe();
+    stepWrites.clear();
+    stepLength = 0;
+
+    while (current < step)
+        next();
+}
+
+bool TraceReader::next() {
+    for (;;) {
+        if (current == total)
+            return false;
+
+        uint8_t tag = get();
+        if (tag == TAG_KEYFRAME) {
+            readKeyframe();
+            continue;
+        }
+        if (tag == TAG_END)
+            return false;
+
+        int length = tag & TAG_LENGTH;
+        uint16_t ip = state.IP, sequential = ip + length;
+        state.IP = sequential;
+        if (tag & TAG_JUMP)
+            state.IP = (uint16_t)(sequential + unzigzag(getVarint()));
+
+        if (tag & TAG_BYTES) {
+            for (int i = 0; i < length; i++)
+                known[ip][i] = get();
+            knownLength[ip] = (uint8_t)length;
+        } else if (knownLength[ip] != length) {
+            throw runtime_error("Trace refers to unrecorded bytes at IP " + to_string(ip));
+        }
+        memcpy(stepBytes, known[ip], length);
+        stepIP = ip;
+        stepLength = (uint8_t)length;
+
+        if (tag & TAG_REGS) {
+            uint64_t mask = getVarint();
+            for (int r = 0; r < TRACE_REGS; r++)
+                if (mask & (1u << r))
+                    setTraceReg(state, r, (uint16_t)(traceReg(state, r) + unzigzag(getVarint())));
+        }
+
+        stepWrites.clear();
+        if (tag & TAG_WRITES) {
+            uint64_t n = getVarint();
+            for (uint64_t i = 0; i < n; i++) {
+                uint64_t v = getVarint();
+                TraceWrite w;
+                w.addr = (uint16_t)(lastWrite + unzigzag(v >> 1));
+                w.length = (v & 1) ? 2 : 1;
+                for (int b = 0; b < w.length; b++)
+                    w.bytes[b] = get();
+                lastWrite = w.addr;
+                stepWrites.push_back(w);
+            }
+        }
+
+        current++;
+        return true;
+    }
+}
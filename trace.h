@@ -0,0 +1,151 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "emulator.h"
+
+using namespace std;
+
+/* ================= Execution Trace ================= */
+/*
+   Binary trace of a guest run, one record per retired instruction:
+
+     tag      bits 0-2 length (1..6), bit 3 IP jumped, bit 4 bytes follow,
+              bit 5 registers changed, bit 6 memory written
+     [jump]   zigzag varint: IP after - (IP + length)
+     [bytes]  the instruction; omitted when identical to the last
+              execution at this IP since the previous keyframe
+     [regs]   varint mask (AX..DI, ES..DS, FLAGS), then a zigzag varint
+              delta for each register in the mask
+     [writes] varint count, then per write: zigzag varint address delta
+              from the previous write << 1 | word, and the bytes
+
+   Records carry the state after the instruction, so the IP of a record
+   is the IP after the one before it. Every TRACE_KEYFRAME_INTERVAL steps,
+   and at the start of each run, a keyframe (tag 0) holds the full CPU
+   state and resets all delta bases; the footer indexes keyframes by step
+   so a reader can seek without scanning from the start.
+
+   The whole file is streamed: the writer fills one block while a
+   background thread writes the other, and the reader reads in blocks.
+*/
+
+constexpr uint64_t TRACE_KEYFRAME_INTERVAL = 1 << 20;
+constexpr size_t TRACE_BLOCK_SIZE = 1 << 20;
+constexpr int TRACE_MAX_INSN = 6;              // longest 8086 instruction the assembler emits
+
+class TraceWriter {
+private:
+    FILE* file;
+    string path;
+
+    // Double buffering: the emulator fills blocks[filling]; the thread writes the other
+    vector<uint8_t> blocks[2];
+    int filling;
+    bool pending;               // the other block is waiting for / being written
+    bool done;
+    bool failed;
+    mutex lock;
+    condition_variable ready;
+    thread writer;
+
+    // Delta bases, reset at each keyframe
+    uint16_t last[13];          // AX..DI, ES..DS, FLAGS
+    uint16_t lastIP;
+    uint16_t lastWrite;
+    uint8_t known[65536][TRACE_MAX_INSN];
+    uint8_t knownLength[65536];
+
+    uint64_t steps;
+    uint64_t offset;            // file offset of the next byte emitted
+    vector<pair<uint64_t, uint64_t>> keyframes;    // (step, offset)
+    vector<uint8_t> writes;     // this step's encoded memory writes
+    uint32_t writeCount;
+
+    void put(uint8_t b);
+    void putVarint(uint64_t v);
+    void flushBlock();
+    void writerLoop();
+
+public:
+    explicit TraceWriter(const string& path);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Full state record; starts a run and resets the delta bases
+    void keyframe(const CPU& cpu);
+
+    // A store made by the instruction being executed
+    void write(uint16_t addr, const uint8_t* data, int n);
+
+    // The instruction at ip retired, leaving cpu (flags materialized)
+    void step(uint16_t ip, const uint8_t* bytes, int length, const CPU& cpu);
+
+    // Write the index and footer and wait for the writer thread
+    void finish();
+};
+
+struct TraceWrite {
+    uint16_t addr;
+    uint8_t length;
+    uint8_t bytes[2];
+};
+
+/*
+   Replays a trace file. next() steps forward one record; seek(n) jumps
+   to the state after n steps (0 = the first keyframe) through the
+   keyframe index. cpu() is the reconstructed state after the current
+   step; ip(), bytes() and writes() describe the instruction itself.
+*/
+class TraceReader {
+private:
+    ifstream in;
+    vector<uint8_t> buffer;
+    size_t pos, end;
+
+    vector<pair<uint64_t, uint64_t>> keyframes;
+    uint64_t total;
+
+    CPU state;
+    uint64_t current;
+    uint16_t stepIP;
+    uint8_t stepLength;
+    uint8_t stepBytes[TRACE_MAX_INSN];
+    vector<TraceWrite> stepWrites;
+
+    uint16_t lastWrite;
+    uint8_t known[65536][TRACE_MAX_INSN];
+    uint8_t knownLength[65536];
+
+    bool fill();
+    uint8_t get();
+    uint64_t getVarint();
+    void seekOffset(uint64_t offset);
+    void readKeyframe();
+
+public:
+    explicit TraceReader(const string& path);
+
+    uint64_t steps() const { return total; }
+    uint64_t step() const { return current; }
+
+    bool next();
+    void seek(uint64_t step);
+
+    const CPU& cpu() const { return state; }
+    uint16_t ip() const { return stepIP; }
+    int length() const { return stepLength; }
+    const uint8_t* bytes() const { return stepBytes; }
+    const vector<TraceWrite>& writes() const { return stepWrites; }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "workpool.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/* ================================
+   WORK SHARDS
+   [next, end) is what a worker still has to run. The owner
+   takes from the front; thieves cut from the back.
+================================ */
+struct Shard {
+    mutex lock;
+    size_t next = 0, end = 0;
+};
+
+static bool takeOwn(Shard& own, size_t& index) {
+    lock_guard<mutex> g(own.lock);
+    if (own.next == own.end)
+        return false;
+    index = own.next++;
+    return true;
+}
+
+// Move the back half of the first non-empty shard after self into self
+static bool steal(vector<unique_ptr<Shard>>& shards, size_t self) {
+    size_t n = shards.size();
+    for (size_t k = 1; k < n; k++) {
+        Shard& victim = *shards[(self + k) % n];
+        size_t from, to;
+        {
+            lock_guard<mutex> g(victim.lock);
+            size_t left = victim.end - victim.next;
+            if (left == 0)
+                continue;
+            to = victim.end;
+            from = to - (left + 1) / 2;
+            victim.end = from;
+        }
+        Shard& own = *shards[self];
+        lock_guard<mutex> g(own.lock);
+        own.next = from;
+        own.end = to;
+        return true;
+    }
+    return false;
+}
+
+static void worker(vector<unique_ptr<Shard>>& shards, unsigned self,
+                   const function<void(unsigned, size_t)>& run) {
+    size_t i;
+    for (;;) {
+        if (!takeOwn(*shards[self], i)) {
+            if (!steal(shards, self))
+                return;
+            continue;
+        }
+        run(self, i);
+    }
+}
+
+/* ================================
+   POOL ENTRY
+================================ */
+unsigned poolSize(size_t count, unsigned threads) {
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    if (threads > count)
+        threads = (unsigned)max<size_t>(count, 1);
+    return threads;
+}
+
+void runPool(size_t count, unsigned workers, const function<void(unsigned worker, size_t job)>& run) {
+    if (count == 0)
+        return;
+
+    vector<unique_ptr<Shard>> shards;
+    for (unsigned t = 0; t < workers; t++) {
+        shards.emplace_back(new Shard());
+        shards[t]->next = count * t / workers;
+        shards[t]->end = count * (t + 1) / workers;
+    }
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < workers; t++)
+        pool.emplace_back(worker, ref(shards), t, cref(run));
+    worker(shards, 0, run);
+    for (auto& th : pool)
+        th.join();
+}
@@ -0,0 +1,24 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <cstddef>
+#include <functional>
+
+using namespace std;
+
+/* ================= Work-Stealing Pool ================= */
+/*
+   Runs jobs 0..count-1 on a pool of worker threads. The jobs are dealt
+   out as one contiguous shard per worker; a worker that finishes its
+   shard steals the back half of another worker's remaining range. The
+   calling thread is worker 0.
+
+   run(worker, job) is called once per job; worker (0..workers-1) lets
+   callers keep per-thread state such as a Machine. run must not throw.
+*/
+// threads = 0: one per hardware thread, never more than count
+unsigned poolSize(size_t count, unsigned threads);
+
+void runPool(size_t count, unsigned workers, const function<void(unsigned worker, size_t job)>& run);
+
+#endif